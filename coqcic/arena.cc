@@ -0,0 +1,164 @@
+#include "coqcic/arena.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace coqcic {
+
+namespace {
+
+thread_local constr_arena* current_arena = nullptr;
+
+}  // namespace
+
+class constr_arena::region {
+public:
+	~region();
+
+	explicit
+	region(std::size_t block_size) noexcept;
+
+	region(const region& other) = delete;
+	region& operator=(const region& other) = delete;
+
+	void*
+	allocate(std::size_t size, std::size_t align);
+
+	inline
+	std::size_t
+	bytes_allocated() const noexcept { return bytes_allocated_; }
+
+	inline
+	std::size_t
+	blocks() const noexcept { return blocks_.size(); }
+
+	// Reference counting follows constr_refcount: atomic unless built
+	// with COQCIC_NONATOMIC_REFCOUNT.
+	inline
+	void
+	acquire() noexcept {
+#ifdef COQCIC_NONATOMIC_REFCOUNT
+		refs_.store(refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#else
+		refs_.fetch_add(1, std::memory_order_relaxed);
+#endif
+	}
+
+	// Returns true if this was the last reference.
+	inline
+	bool
+	release() noexcept {
+#ifdef COQCIC_NONATOMIC_REFCOUNT
+		std::size_t refs = refs_.load(std::memory_order_relaxed) - 1;
+		refs_.store(refs, std::memory_order_relaxed);
+		return refs == 0;
+#else
+		return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+#endif
+	}
+
+private:
+	std::size_t block_size_;
+	std::vector<std::unique_ptr<char[]>> blocks_;
+	char* current_ = nullptr;
+	std::size_t remaining_ = 0;
+	std::size_t bytes_allocated_ = 0;
+	std::atomic<std::size_t> refs_ = 1;
+};
+
+/**
+	\class constr_arena
+	\brief Region allocator for term constructions.
+	\headerfile coqcic/arena.h <coqcic/arena.h>
+
+	Usage:
+
+	\code
+		constr_arena arena;
+		std::vector<sfb_t> sfbs;
+		{
+			constr_arena::scope s(arena);
+			// all nodes built here are allocated from the arena
+			sfbs = import_library(...);
+		}
+	\endcode
+*/
+
+constr_arena::~constr_arena() {
+	release(region_);
+}
+
+constr_arena::constr_arena(std::size_t block_size) : region_(new region(block_size)) {
+}
+
+std::size_t
+constr_arena::bytes_allocated() const noexcept {
+	return region_->bytes_allocated();
+}
+
+std::size_t
+constr_arena::blocks() const noexcept {
+	return region_->blocks();
+}
+
+std::pair<void*, constr_arena::region*>
+constr_arena::allocate(std::size_t size, std::size_t align) {
+	void* memory = region_->allocate(size, align);
+	region_->acquire();
+	return {memory, region_};
+}
+
+void
+constr_arena::release(region* storage) noexcept {
+	if (storage->release()) {
+		delete storage;
+	}
+}
+
+constr_arena*
+constr_arena::current() noexcept {
+	return current_arena;
+}
+
+constr_arena::region::~region() {
+}
+
+constr_arena::region::region(std::size_t block_size) noexcept : block_size_(block_size) {
+}
+
+void*
+constr_arena::region::allocate(std::size_t size, std::size_t align) {
+	std::size_t padding = (align - reinterpret_cast<std::uintptr_t>(current_) % align) % align;
+	if (padding + size > remaining_) {
+		// Oversized requests get a block of their own, so that the
+		// remainder of the current block is not wasted.
+		if (size > block_size_ / 4) {
+			blocks_.emplace_back(new char[size + align]);
+			char* base = blocks_.back().get();
+			std::size_t offset = (align - reinterpret_cast<std::uintptr_t>(base) % align) % align;
+			bytes_allocated_ += size;
+			return base + offset;
+		}
+		blocks_.emplace_back(new char[block_size_]);
+		current_ = blocks_.back().get();
+		remaining_ = block_size_;
+		padding = (align - reinterpret_cast<std::uintptr_t>(current_) % align) % align;
+	}
+	char* result = current_ + padding;
+	current_ = result + size;
+	remaining_ -= padding + size;
+	bytes_allocated_ += size;
+	return result;
+}
+
+constr_arena::scope::~scope() {
+	current_arena = previous_;
+}
+
+constr_arena::scope::scope(constr_arena& arena) noexcept : previous_(current_arena) {
+	current_arena = &arena;
+}
+
+}  // namespace coqcic
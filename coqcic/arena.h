@@ -0,0 +1,127 @@
+#ifndef COQCIC_ARENA_H
+#define COQCIC_ARENA_H
+
+#include <cstddef>
+#include <utility>
+
+namespace coqcic {
+
+/**
+	\brief Region allocator for term constructions
+
+	While an arena is installed for the current thread (see
+	\ref constr_arena::scope), all \ref builder functions allocate
+	new term nodes from the arena instead of the general heap. Memory
+	is handed out from large contiguous blocks by bumping a pointer,
+	and it is never returned to the arena individually: destroying a
+	node runs its destructor, but its storage is released only
+	together with all other storage of the arena.
+
+	Each node keeps the backing storage alive, so it is safe to let
+	terms allocated from an arena outlive the \ref constr_arena object
+	itself: the blocks are freed in one step when both the arena and
+	the last node allocated from it have been destroyed.
+
+	This is intended for bulk operations such as importing a whole
+	library via \ref constr_from_sexpr, where a large number of small
+	nodes is created at once and dropped together later.
+
+	Arenas are not synchronized, each thread needs to install its
+	own arena. Nodes allocated from an arena may however be used and
+	released from any thread (unless the library is built with
+	non-atomic reference counts, see \ref constr_refcount, which
+	also applies to references to the arena storage).
+*/
+class constr_arena {
+public:
+	class scope;
+
+	// Storage backing an arena, shared by the arena and all nodes
+	// allocated from it.
+	class region;
+
+	static constexpr std::size_t default_block_size = 256 * 1024;
+
+	~constr_arena();
+
+	explicit
+	constr_arena(std::size_t block_size = default_block_size);
+
+	constr_arena(const constr_arena& other) = delete;
+	constr_arena& operator=(const constr_arena& other) = delete;
+
+	/**
+		\brief Number of bytes handed out by this arena
+	*/
+	std::size_t
+	bytes_allocated() const noexcept;
+
+	/**
+		\brief Number of blocks obtained from the heap by this arena
+	*/
+	std::size_t
+	blocks() const noexcept;
+
+	/**
+		\brief Allocate memory from this arena
+
+		\returns
+			Memory of the given size and alignment, and a
+			reference to the storage it was drawn from. The
+			memory remains valid until the reference is given up
+			via \ref release.
+	*/
+	std::pair<void*, region*>
+	allocate(std::size_t size, std::size_t align);
+
+	/**
+		\brief Give up a reference to arena storage
+
+		The storage is freed when the arena object has been destroyed
+		and all references obtained from \ref allocate are released.
+	*/
+	static
+	void
+	release(region* storage) noexcept;
+
+	/**
+		\brief Arena installed for the current thread
+
+		\returns
+			Arena installed by innermost active \ref scope of the
+			current thread, or nullptr if none.
+	*/
+	static
+	constr_arena*
+	current() noexcept;
+
+private:
+	// Holds a reference itself.
+	region* region_;
+};
+
+/**
+	\brief Installs an arena for the current thread
+
+	While an object of this class is alive, \ref builder functions
+	called on the current thread allocate all terms from the given
+	arena. Scopes may be nested, the previously installed arena is
+	restored when the scope ends.
+*/
+class constr_arena::scope {
+public:
+	~scope();
+
+	explicit
+	scope(constr_arena& arena) noexcept;
+
+	scope(const scope& other) = delete;
+	scope& operator=(const scope& other) = delete;
+
+private:
+	constr_arena* previous_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_ARENA_H
@@ -0,0 +1,49 @@
+#include "coqcic/arena.h"
+
+#include "gtest/gtest.h"
+
+#include "coqcic/constr.h"
+#include "coqcic/hashcons.h"
+
+namespace coqcic {
+
+TEST(arena_test, allocate_nodes) {
+	using namespace builder;
+
+	constr_t a;
+	{
+		constr_arena arena(1024);
+		{
+			constr_arena::scope s(arena);
+			a = product({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+		}
+		EXPECT_LT(0u, arena.bytes_allocated());
+		EXPECT_EQ(1u, arena.blocks());
+
+		// Outside of the scope, nodes are allocated from the heap.
+		std::size_t before = arena.bytes_allocated();
+		auto b = product({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+		EXPECT_EQ(before, arena.bytes_allocated());
+		EXPECT_EQ(a, b);
+	}
+
+	// Nodes remain valid after the arena object is gone.
+	EXPECT_EQ("nat", a.as_product()->args()[0].type.as_global()->name());
+	a = constr_t();
+}
+
+TEST(arena_test, with_hashcons) {
+	using namespace builder;
+
+	constr_arena arena;
+	constr_hashcons table;
+	constr_arena::scope as(arena);
+	constr_hashcons::scope hs(table);
+
+	auto a = apply(global("S"), {global("O")});
+	auto b = apply(global("S"), {global("O")});
+	EXPECT_EQ(a.repr(), b.repr());
+	EXPECT_LT(0u, arena.bytes_allocated());
+}
+
+}  // namespace coqcic
@@ -0,0 +1,64 @@
+#include "coqcic/check_cache.h"
+
+namespace coqcic {
+
+double
+check_cache::statistics::hit_rate() const noexcept {
+	std::size_t hits = closed_hits + open_hits;
+	std::size_t lookups = hits + misses;
+	return lookups ? static_cast<double>(hits) / lookups : 0.0;
+}
+
+std::size_t
+check_cache::open_key_hash::operator()(const open_key& key) const noexcept {
+	std::size_t seed = std::hash<const void*>()(key.node);
+	hash_combine(seed, std::hash<const void*>()(key.locals));
+	return seed;
+}
+
+check_cache::~check_cache() {
+}
+
+check_cache::check_cache() {
+}
+
+constr_t
+check_cache::check(const constr_t& term, const type_context_t& ctx) {
+	const constr_base* node = term.repr().get();
+	if (term.loose_bound() == 0) {
+		auto i = closed_.find(node);
+		if (i != closed_.end()) {
+			++stats_.closed_hits;
+			return i->second.type;
+		}
+		++stats_.misses;
+		auto type = node->check(ctx);
+		closed_.emplace(node, closed_entry{term, type});
+		return type;
+	} else {
+		open_key key{node, ctx.locals.identity()};
+		auto i = open_.find(key);
+		if (i != open_.end()) {
+			++stats_.open_hits;
+			return i->second.type;
+		}
+		++stats_.misses;
+		auto type = node->check(ctx);
+		open_.emplace(key, open_entry{term, ctx.locals, type});
+		return type;
+	}
+}
+
+std::size_t
+check_cache::size() const noexcept {
+	return closed_.size() + open_.size();
+}
+
+void
+check_cache::clear() noexcept {
+	closed_.clear();
+	open_.clear();
+	stats_ = statistics();
+}
+
+}  // namespace coqcic
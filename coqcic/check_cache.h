@@ -0,0 +1,140 @@
+#ifndef COQCIC_CHECK_CACHE_H
+#define COQCIC_CHECK_CACHE_H
+
+#include <cstddef>
+#include <unordered_map>
+
+#include "coqcic/constr.h"
+
+namespace coqcic {
+
+/**
+	\brief Memoizes results of type checking
+
+	While a cache is set in the \ref type_context_t::cache "context"
+	passed to \ref constr_t::check, the type of every subterm checked is
+	recorded, and checking the same term node again yields the recorded
+	type instead of recomputing it.
+
+	Terms without loose de Bruijn indices are typed independently of the
+	local variables of the context, their types are shared across all
+	contexts. All other terms are keyed by the identity of the stack of
+	local variables: only checks within the very same (not merely an
+	equal) context state hit. Shared subterms of hash-consed terms (see
+	\ref constr_hashcons) benefit most, as equal subterms are then also
+	identical nodes.
+
+	The cache assumes that the resolution of globals does not change
+	while it is in use; it must be cleared otherwise. It holds strong
+	references to all nodes and context states recorded, until cleared or
+	destroyed. Caches are not synchronized, concurrent checks must use
+	separate caches.
+*/
+class check_cache {
+public:
+	/**
+		\brief Counts of cache lookups
+	*/
+	struct statistics {
+		/**
+			\brief Lookups of terms without loose indices that hit
+		*/
+		std::size_t closed_hits = 0;
+
+		/**
+			\brief Lookups of terms with loose indices that hit
+		*/
+		std::size_t open_hits = 0;
+
+		/**
+			\brief Lookups that missed (and computed the type)
+		*/
+		std::size_t misses = 0;
+
+		/**
+			\brief Fraction of lookups that hit, zero without lookups
+		*/
+		double
+		hit_rate() const noexcept;
+	};
+
+	~check_cache();
+
+	check_cache();
+
+	check_cache(const check_cache& other) = delete;
+	check_cache& operator=(const check_cache& other) = delete;
+
+	/**
+		\brief Type of term, computed at most once per context
+
+		\param term
+			Term to be checked.
+
+		\param ctx
+			Typing context (its \ref type_context_t::cache "cache"
+			is expected to point to this object).
+
+		\returns
+			Expression representing type of term.
+	*/
+	constr_t
+	check(const constr_t& term, const type_context_t& ctx);
+
+	/**
+		\brief Lookup counts since construction or last \ref clear
+	*/
+	inline const statistics&
+	stats() const noexcept {
+		return stats_;
+	}
+
+	/**
+		\brief Number of types recorded
+	*/
+	std::size_t
+	size() const noexcept;
+
+	/**
+		\brief Drop all recorded types and reset statistics
+	*/
+	void
+	clear() noexcept;
+
+private:
+	struct open_key {
+		const constr_base* node;
+		const void* locals;
+
+		inline bool
+		operator==(const open_key& other) const noexcept {
+			return node == other.node && locals == other.locals;
+		}
+	};
+
+	struct open_key_hash {
+		std::size_t
+		operator()(const open_key& key) const noexcept;
+	};
+
+	// The term and locals are retained so that the addresses in the keys
+	// are not reused for different objects.
+	struct open_entry {
+		constr_t term;
+		type_context_t::local_stack locals;
+		constr_t type;
+	};
+
+	struct closed_entry {
+		constr_t term;
+		constr_t type;
+	};
+
+	std::unordered_map<const constr_base*, closed_entry> closed_;
+	std::unordered_map<open_key, open_entry, open_key_hash> open_;
+	statistics stats_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_CHECK_CACHE_H
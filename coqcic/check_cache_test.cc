@@ -0,0 +1,80 @@
+#include "coqcic/check_cache.h"
+
+#include "gtest/gtest.h"
+
+namespace coqcic {
+
+namespace {
+
+constr_t
+lookup_global(const std::string& name) {
+	using namespace builder;
+	if (name == "nat") {
+		return builtin_set();
+	} else if (name == "list") {
+		return product({{{}, builtin_set()}}, builtin_set());
+	} else {
+		throw std::runtime_error("Unbound constr_global");
+	}
+}
+
+}  // namespace
+
+TEST(check_cache_test, closed_terms) {
+	using namespace builder;
+	std::size_t lookups = 0;
+	type_context_t ctx;
+	ctx.global_types = [&lookups](const std::string& name) {
+		++lookups;
+		return lookup_global(name);
+	};
+
+	auto nat_list = apply(global("list"), {global("nat")});
+	auto fn_type = product({{{}, nat_list}, {{}, nat_list}}, nat_list);
+	auto expected = fn_type.check(ctx);
+	std::size_t uncached_lookups = lookups;
+
+	check_cache cache;
+	ctx.cache = &cache;
+	lookups = 0;
+	EXPECT_EQ(expected, fn_type.check(ctx));
+	EXPECT_LT(lookups, uncached_lookups);
+	EXPECT_EQ(2u, cache.stats().closed_hits);
+	EXPECT_EQ(0u, cache.stats().open_hits);
+
+	// Closed terms hit in any context.
+	auto inner = ctx.push_local("x", global("nat"));
+	EXPECT_EQ(expected, fn_type.check(inner));
+	EXPECT_EQ(3u, cache.stats().closed_hits);
+	EXPECT_EQ(3.0 / (3.0 + cache.stats().misses), cache.stats().hit_rate());
+
+	cache.clear();
+	EXPECT_EQ(0u, cache.size());
+	EXPECT_EQ(0.0, cache.stats().hit_rate());
+}
+
+TEST(check_cache_test, open_terms) {
+	using namespace builder;
+	type_context_t ctx;
+	ctx.global_types = lookup_global;
+	check_cache cache;
+	ctx.cache = &cache;
+
+	auto var = local("x", 0);
+	auto inner = ctx.push_local("x", global("nat"));
+	EXPECT_EQ(global("nat"), var.check(inner));
+	EXPECT_EQ(global("nat"), var.check(inner));
+	EXPECT_EQ(1u, cache.stats().open_hits);
+
+	// An equal, but distinct context state misses.
+	auto other = ctx.push_local("x", global("nat"));
+	EXPECT_EQ(global("nat"), var.check(other));
+	EXPECT_EQ(1u, cache.stats().open_hits);
+	EXPECT_EQ(2u, cache.stats().misses);
+
+	// Arguments of lambdas are in the context of the body.
+	auto id = lambda({{"x", global("nat")}}, local("x", 0));
+	EXPECT_EQ(product({{"x", global("nat")}}, global("nat")), id.check(ctx));
+}
+
+}  // namespace coqcic
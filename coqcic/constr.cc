@@ -1,39 +1,404 @@
 #include "coqcic/constr.h"
 
+#include <algorithm>
+#include <mutex>
+#include <new>
 #include <stdexcept>
+#include <tuple>
 
+#include "coqcic/arena.h"
+#include "coqcic/check_cache.h"
+#include "coqcic/global_env.h"
+#include "coqcic/hashcons.h"
+#include "coqcic/reduce.h"
 #include "coqcic/simpl.h"
+#include "coqcic/visitor.h"
 
 #include <iostream>
 
 namespace coqcic {
 
+namespace {
+
+inline std::size_t
+hash_value(std::size_t seed, std::size_t value) noexcept {
+	hash_combine(seed, value);
+	return seed;
+}
+
+template<typename ChildHash>
+std::size_t
+hash_args(std::size_t seed, const std::vector<formal_arg_t>& args, const ChildHash& child_hash) {
+	hash_combine(seed, args.size());
+	for (const auto& arg : args) {
+		hash_combine(seed, child_hash(arg.type));
+	}
+	return seed;
+}
+
+template<typename ChildHash>
+std::size_t
+hash_let(const constr_t& value, const constr_t& type, const constr_t& body, const ChildHash& child_hash) {
+	std::size_t seed = constr_kind_let;
+	hash_combine(seed, child_hash(value));
+	hash_combine(seed, child_hash(type));
+	hash_combine(seed, child_hash(body));
+	return seed;
+}
+
+template<typename ChildHash>
+std::size_t
+hash_apply(const constr_t& fn, const std::vector<constr_t>& args, const ChildHash& child_hash) {
+	std::size_t seed = constr_kind_apply;
+	hash_combine(seed, child_hash(fn));
+	for (const auto& arg : args) {
+		hash_combine(seed, child_hash(arg));
+	}
+	return seed;
+}
+
+template<typename ChildHash>
+std::size_t
+hash_cast(const constr_t& term, constr_cast::kind_type kind, const constr_t& typeterm, const ChildHash& child_hash) {
+	std::size_t seed = constr_kind_cast;
+	hash_combine(seed, child_hash(term));
+	hash_combine(seed, kind);
+	hash_combine(seed, child_hash(typeterm));
+	return seed;
+}
+
+template<typename ChildHash>
+std::size_t
+hash_match(const constr_t& casetype, const constr_t& arg, const std::vector<match_branch_t>& branches, const ChildHash& child_hash) {
+	std::size_t seed = constr_kind_match;
+	hash_combine(seed, child_hash(casetype));
+	hash_combine(seed, child_hash(arg));
+	for (const auto& branch : branches) {
+		hash_combine(seed, std::hash<std::string>()(branch.constructor));
+		hash_combine(seed, branch.nargs);
+		hash_combine(seed, child_hash(branch.expr));
+	}
+	return seed;
+}
+
+template<typename ChildHash>
+std::size_t
+hash_fix(std::size_t index, const fix_group_t& group, const ChildHash& child_hash) {
+	std::size_t seed = constr_kind_fix;
+	hash_combine(seed, index);
+	for (const auto& fn : group.functions) {
+		hash_combine(seed, hash_args(child_hash(fn.restype), fn.args, child_hash));
+		hash_combine(seed, child_hash(fn.body));
+	}
+	return seed;
+}
+
+// Loose bound of a term as seen from outside of "n" binders.
+inline std::size_t
+unbind(std::size_t bound, std::size_t n) noexcept {
+	return bound > n ? bound - n : 0;
+}
+
+// Loose bound of product / lambda: each argument type is in scope of
+// the preceding arguments, the body in scope of all of them.
+std::size_t
+bound_binders(const std::vector<formal_arg_t>& args, const constr_t& body) noexcept {
+	std::size_t bound = unbind(body.loose_bound(), args.size());
+	for (std::size_t n = 0; n < args.size(); ++n) {
+		bound = std::max(bound, unbind(args[n].type.loose_bound(), n));
+	}
+	return bound;
+}
+
+std::size_t
+bound_let(const constr_t& value, const constr_t& type, const constr_t& body) noexcept {
+	return std::max({value.loose_bound(), type.loose_bound(), unbind(body.loose_bound(), 1)});
+}
+
+std::size_t
+bound_apply(const constr_t& fn, const std::vector<constr_t>& args) noexcept {
+	std::size_t bound = fn.loose_bound();
+	for (const auto& arg : args) {
+		bound = std::max(bound, arg.loose_bound());
+	}
+	return bound;
+}
+
+std::size_t
+bound_match(const constr_t& casetype, const constr_t& arg, const std::vector<match_branch_t>& branches) noexcept {
+	std::size_t bound = std::max(casetype.loose_bound(), arg.loose_bound());
+	for (const auto& branch : branches) {
+		bound = std::max(bound, branch.expr.loose_bound());
+	}
+	return bound;
+}
+
+// All functions of the group are in scope of each function, arguments as
+// for bound_binders.
+std::size_t
+bound_fix(const fix_group_t& group) noexcept {
+	std::size_t bound = 0;
+	std::size_t nfunctions = group.functions.size();
+	for (const auto& fn : group.functions) {
+		for (std::size_t n = 0; n < fn.args.size(); ++n) {
+			bound = std::max(bound, unbind(fn.args[n].type.loose_bound(), nfunctions + n));
+		}
+		bound = std::max(bound, unbind(fn.restype.loose_bound(), nfunctions + fn.args.size()));
+		bound = std::max(bound, unbind(fn.body.loose_bound(), nfunctions + fn.args.size()));
+	}
+	return bound;
+}
+
+// Hash of a node of any kind but constr_kind_shifted, obtaining hashes of
+// its children through "child_hash".
+template<typename ChildHash>
+std::size_t
+hash_node(const constr_base& node, const ChildHash& child_hash) {
+	switch (node.constr_kind()) {
+		case constr_kind_local: {
+			return hash_value(constr_kind_local, static_cast<const constr_local&>(node).index());
+		}
+		case constr_kind_global: {
+			const auto& global = static_cast<const constr_global&>(node);
+			return hash_value(constr_kind_global, global.symbol());
+		}
+		case constr_kind_builtin: {
+			const auto& builtin = static_cast<const constr_builtin&>(node);
+			return hash_value(constr_kind_builtin, std::hash<std::string>()(builtin.name()));
+		}
+		case constr_kind_product: {
+			const auto& product = static_cast<const constr_product&>(node);
+			return hash_args(
+				hash_value(constr_kind_product, child_hash(product.restype())), product.args(), child_hash);
+		}
+		case constr_kind_lambda: {
+			const auto& lambda = static_cast<const constr_lambda&>(node);
+			return hash_args(
+				hash_value(constr_kind_lambda, child_hash(lambda.body())), lambda.args(), child_hash);
+		}
+		case constr_kind_let: {
+			const auto& let = static_cast<const constr_let&>(node);
+			return hash_let(let.value(), let.type(), let.body(), child_hash);
+		}
+		case constr_kind_apply: {
+			const auto& apply = static_cast<const constr_apply&>(node);
+			return hash_apply(apply.fn(), apply.args(), child_hash);
+		}
+		case constr_kind_cast: {
+			const auto& cast = static_cast<const constr_cast&>(node);
+			return hash_cast(cast.term(), cast.kind(), cast.typeterm(), child_hash);
+		}
+		case constr_kind_match: {
+			const auto& match = static_cast<const constr_match&>(node);
+			return hash_match(match.casetype(), match.arg(), match.branches(), child_hash);
+		}
+		case constr_kind_fix: {
+			const auto& fix = static_cast<const constr_fix&>(node);
+			return hash_fix(fix.index(), *fix.group(), child_hash);
+		}
+		default: {
+			std::terminate();
+		}
+	}
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+// constr_release_queue
+
+// Destroying a node releases its children, which may destroy them in
+// turn: for deeply nested terms, this recursion overflows the stack.
+// Nodes therefore release the children they hold the last reference to
+// explicitly, recursing only up to a bounded depth. Deeper children are
+// handed over into a per-thread queue, which the outermost destructor
+// drains in a loop.
+class constr_release_queue {
+public:
+	// Releases "term" if this is the last reference to it.
+	static inline void
+	release(constr_t& term) {
+		if (!term.repr_ || term.repr_.use_count() != 1) {
+			return;
+		}
+		if (depth < max_depth || finished) {
+			++depth;
+			term.repr_.reset();
+			--depth;
+		} else {
+			auto& terms = queue();
+			terms.emplace_back();
+			terms.back().swap(term);
+			++pending;
+		}
+	}
+
+	// Releases all queued terms, unless called by a nested destructor
+	// or already done by an enclosing one.
+	static inline void
+	drain() {
+		if (depth != 0 || pending == 0 || draining) {
+			return;
+		}
+		auto& terms = queue();
+		draining = true;
+		while (!terms.empty()) {
+			constr_t term;
+			term.swap(terms.back());
+			terms.pop_back();
+			--pending;
+		}
+		draining = false;
+	}
+
+private:
+	static constexpr std::size_t max_depth = 256;
+
+	struct state {
+		~state() {
+			finished = true;
+		}
+
+		std::vector<constr_t> terms;
+	};
+
+	static inline std::vector<constr_t>&
+	queue() {
+		static thread_local state q;
+		return q.terms;
+	}
+
+	// Plain flags and counters, which unlike the queue itself are
+	// accessed without a guard for dynamic initialization.
+	static thread_local std::size_t depth;
+	static thread_local std::size_t pending;
+	static thread_local bool draining;
+	// Set once the queue of this thread is destroyed, terms released
+	// afterwards (e.g. by destructors of static objects) are released
+	// recursively.
+	static thread_local bool finished;
+};
+
+thread_local std::size_t constr_release_queue::depth = 0;
+thread_local std::size_t constr_release_queue::pending = 0;
+thread_local bool constr_release_queue::draining = false;
+thread_local bool constr_release_queue::finished = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// constr_shifted
+
+// Deferred shift of a term, see constr_t::shift. The shifted term is
+// constructed one level deep on first inspection: the shift
+// implementations of the node kinds shift their children through
+// constr_t::shift, which yields deferred shifts again.
+class constr_shifted final : public constr_base {
+public:
+	~constr_shifted() override {
+		constr_release_queue::release(term_);
+		constr_release_queue::release(forced_);
+		constr_release_queue::drain();
+	}
+
+	// Requires term.loose_bound() > limit, i.e. the shift affects the
+	// term. Lower loose indices than the largest one may remain below
+	// "limit", hence the resulting bound is not exact for negative "dir".
+	constr_shifted(constr_t term, std::size_t limit, int dir) noexcept
+		: constr_base(
+			constr_kind_shifted,
+			std::max<std::ptrdiff_t>(limit, std::ptrdiff_t(term.loose_bound()) + dir)),
+		term_(std::move(term)), limit_(limit), dir_(dir)
+	{
+	}
+
+	void
+	format(std::string& out) const override {
+		forced()->format(out);
+	}
+
+	bool
+	operator==(const constr_base& other) const noexcept override {
+		return *forced() == other;
+	}
+
+	constr_t
+	check(const type_context_t& ctx) const override {
+		return forced()->check(ctx);
+	}
+
+	// Outermost node of the shifted term, constructed on first call.
+	const constr_base*
+	forced() const noexcept {
+		std::call_once(once_, [this] {
+			forced_ = term_.node()->shift(limit_, dir_);
+		});
+		return forced_.repr_.get();
+	}
+
+	inline
+	const constr_t&
+	term() const noexcept { return term_; }
+
+	inline
+	std::size_t
+	limit() const noexcept { return limit_; }
+
+	inline
+	int
+	dir() const noexcept { return dir_; }
+
+private:
+	constr_t term_;
+	std::size_t limit_;
+	int dir_;
+
+	mutable std::once_flag once_;
+	mutable constr_t forced_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // constr
 
 void
 constr_t::format(std::string& out) const {
-	repr_->format(out);
+	node()->format(out);
 }
 
 bool
 constr_t::operator==(const constr_t& other) const {
-	return repr_ == other.repr_ || *repr_ == *other.repr_;
+	if (repr_ == other.repr_) {
+		return true;
+	}
+	const constr_base* left = node();
+	const constr_base* right = other.node();
+	if (left == right) {
+		return true;
+	}
+	// Hashes are only compared if already known: computing them would
+	// resolve all deferred shifts in both terms.
+	std::size_t left_hash = left->cached_hash();
+	std::size_t right_hash = right->cached_hash();
+	if (left_hash && right_hash && left_hash != right_hash) {
+		return false;
+	}
+	return *left == *right;
 }
 
 constr_t
 constr_t::check(const type_context_t& ctx) const {
-	return repr_->check(ctx);
+	if (ctx.cache) {
+		return ctx.cache->check(*this, ctx);
+	}
+	return node()->check(ctx);
 }
 
 constr_t
 constr_t::simpl() const {
-	return repr_->simpl();
+	return node()->simpl();
 }
 
-constr_t
-constr_t::shift(std::size_t limit, int dir) const {
-	return repr_->shift(limit, dir);
+const constr_base*
+constr_t::resolve_shifted(const constr_base& shifted) noexcept {
+	return static_cast<const constr_shifted&>(shifted).forced();
 }
 
 std::string
@@ -47,41 +412,39 @@ constr_t::debug_string() const {
 ////////////////////////////////////////////////////////////////////////////////
 // free functions on constr
 
-static void
-collect_external_references(const constr_t& obj, std::size_t depth, std::vector<std::size_t> refs) {
-	if (auto local = obj.as_local()) {
-		if (local->index() >= depth) {
-			refs.push_back(local->index() - depth);
-		}
-	} else if (auto product = obj.as_product()) {
-		for (const auto& arg : product->args()) {
-			collect_external_references(arg.type, depth, refs);
-			++depth;
-		}
-		collect_external_references(product->restype(), depth , refs);
-	} else if (auto lambda = obj.as_lambda()) {
-		for (const auto& arg : product->args()) {
-			collect_external_references(arg.type, depth, refs);
-			++depth;
+namespace {
+
+// Collects indices of locals bound outside the term visited, skipping
+// subterms without such locals.
+class external_references_visitor final : public query_visitor {
+public:
+	void
+	push_local(const std::string* name, const constr_t* type, const constr_t* value) override {
+		++depth;
+	}
+
+	void
+	pop_local() override {
+		--depth;
+	}
+
+	query_action
+	visit(const constr_t& term) override {
+		if (term.loose_bound() <= depth) {
+			// No local refers to anything outside.
+			return query_action::skip;
 		}
-		collect_external_references(lambda->body(), depth + 1, refs);
-	} else if (auto let = obj.as_let()) {
-		collect_external_references(let->value(), depth, refs);
-		collect_external_references(let->type(), depth, refs);
-		collect_external_references(let->body(), depth + 1, refs);
-	} else if (auto fix = obj.as_fix()) {
-		depth += fix->group()->functions.size();
-		for (const auto& fn : fix->group()->functions) {
-			std::size_t current_depth = depth;
-			for (const auto& arg : fn.args) {
-				collect_external_references(arg.type, current_depth, refs);
-				current_depth += 1;
-			}
-			collect_external_references(fn.restype, current_depth, refs);
-			collect_external_references(fn.body, current_depth, refs);
+		if (auto local = term.as_local()) {
+			refs.push_back(local->index() - depth);
 		}
+		return query_action::descend;
 	}
-}
+
+	std::size_t depth = 0;
+	std::vector<std::size_t> refs;
+};
+
+}  // namespace
 
 /**
 	\brief Collects unbound de Bruijn indices.
@@ -111,8 +474,9 @@ collect_external_references(const constr_t& obj, std::size_t depth, std::vector<
 */
 std::vector<std::size_t>
 collect_external_references(const constr_t& obj) {
-	std::vector<std::size_t> refs;
-	collect_external_references(obj, 0, refs);
+	external_references_visitor visitor;
+	visit_query(obj, visitor);
+	std::vector<std::size_t> refs = std::move(visitor.refs);
 
 	std::sort(refs.begin(), refs.end());
 	refs.erase(std::unique(refs.begin(), refs.end()), refs.end());
@@ -121,6 +485,21 @@ collect_external_references(const constr_t& obj) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// fix_function_t
+
+std::optional<std::size_t>
+fix_function_t::structural_arg() const {
+	if (auto match = body.as_match()) {
+		if (auto local = match->arg().as_local()) {
+			if (local->index() < args.size()) {
+				return args.size() - 1 - local->index();
+			}
+		}
+	}
+	return std::nullopt;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // fix_group_t
 
@@ -177,6 +556,49 @@ type_context_t::push_local(std::string name, constr_t type) const {
 	return new_ctx;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// constr_refcount
+
+void
+constr_refcount::acquire(const constr_base* node) noexcept {
+#ifdef COQCIC_NONATOMIC_REFCOUNT
+	node->refs_.store(node->refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#else
+	node->refs_.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+void
+constr_refcount::release(const constr_base* node) noexcept {
+#ifdef COQCIC_NONATOMIC_REFCOUNT
+	std::size_t refs = node->refs_.load(std::memory_order_relaxed) - 1;
+	node->refs_.store(refs, std::memory_order_relaxed);
+	if (refs != 0) {
+		return;
+	}
+#else
+	if (node->refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return;
+	}
+#endif
+	if (auto storage = node->storage_) {
+		node->~constr_base();
+		constr_arena::release(storage);
+	} else {
+		delete node;
+	}
+}
+
+std::size_t
+constr_refcount::use_count(const constr_base* node) noexcept {
+	return node->refs_.load(std::memory_order_relaxed);
+}
+
+void
+constr_refcount::attach(const constr_base* node, constr_arena::region* storage) noexcept {
+	const_cast<constr_base*>(node)->storage_ = storage;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // constr_base
 
@@ -203,6 +625,63 @@ constr_base::shift(std::size_t limit, int dir) const {
 	return constr_t(shared_from_this());
 }
 
+std::size_t
+constr_base::compute_hash() const {
+	// Nodes whose hash is computed once the hashes of all their children
+	// are known, post-order on an explicit stack: terms above deferred
+	// shifts may be arbitrarily deep. The flag marks nodes whose
+	// children have been pushed already.
+	std::vector<std::pair<const constr_base*, bool>> stack{{this, false}};
+	std::size_t hash = 0;
+	while (!stack.empty()) {
+		auto& top = stack.back();
+		const constr_base* node = top.first;
+		if (!top.second) {
+			top.second = true;
+			auto push = [&stack](const constr_base* child) {
+				if (child && child->cached_hash() == 0) {
+					stack.emplace_back(child, false);
+				}
+			};
+			if (node->kind_ == constr_kind_shifted) {
+				push(static_cast<const constr_shifted&>(*node).forced());
+			} else {
+				hash_node(*node, [&push](const constr_t& child) {
+					push(child.repr().get());
+					return std::size_t(0);
+				});
+			}
+			continue;
+		}
+		stack.pop_back();
+		// Children whose hash is zero are recomputed, by a loop of
+		// their own.
+		if (node->kind_ == constr_kind_shifted) {
+			hash = static_cast<const constr_shifted&>(*node).forced()->hash();
+		} else {
+			hash = hash_node(*node, [](const constr_t& child) { return child.hash(); });
+		}
+		node->hash_.store(hash, std::memory_order_relaxed);
+	}
+	return hash;
+}
+
+void
+constr_base::init_hash() const noexcept {
+	if (kind_ == constr_kind_shifted) {
+		return;
+	}
+	bool complete = true;
+	std::size_t hash = hash_node(*this, [&complete](const constr_t& child) {
+		std::size_t hash = child.repr() ? child.repr()->hash_.load(std::memory_order_relaxed) : 0;
+		complete = complete && hash != 0;
+		return hash;
+	});
+	if (complete) {
+		hash_.store(hash, std::memory_order_relaxed);
+	}
+}
+
 std::string
 constr_base::repr() const {
 	std::string result;
@@ -210,6 +689,12 @@ constr_base::repr() const {
 	return result;
 }
 
+symbol_table&
+constr_symbols() {
+	static symbol_table table;
+	return table;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // constr_local
 
@@ -233,20 +718,30 @@ constr_local::~constr_local() {
 constr_local::constr_local(
 	std::string name,
 	std::size_t index
-) : name_(std::move(name)),
+) : constr_base(constr_kind_local, index + 1),
 	index_(std::move(index)) {
+	std::tie(symbol_, name_) = constr_symbols().intern_with_name(name);
+}
+
+constr_local::constr_local(
+	symbol_table::id_type symbol,
+	std::size_t index
+) : constr_base(constr_kind_local, index + 1),
+	name_(&constr_symbols().name(symbol)),
+	symbol_(symbol),
+	index_(index) {
 }
 
 void
 constr_local::format(std::string& out) const {
-	out += name_ + "," + std::to_string(index_);
+	out += *name_ + "," + std::to_string(index_);
 }
 
 bool
 constr_local::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_local = dynamic_cast<const constr_local*>(&other)) {
+	} else if (auto other_local = other.constr_kind() == constr_kind_local ? static_cast<const constr_local*>(&other) : nullptr) {
 		return index_ == other_local->index_;
 	} else {
 		return false;
@@ -261,7 +756,7 @@ constr_local::check(const type_context_t& ctx) const {
 constr_t
 constr_local::shift(std::size_t limit, int dir) const {
 	if (index_ >= limit) {
-		return constr_t(std::make_shared<constr_local>(name_, index_ + dir));
+		return builder::local(symbol_, index_ + dir);
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -283,20 +778,30 @@ constr_local::shift(std::size_t limit, int dir) const {
 constr_global::~constr_global() {
 }
 
-constr_global::constr_global(std::string name) : name_(std::move(name)) {
+constr_global::constr_global(
+	std::string name
+) : constr_base(constr_kind_global, 0) {
+	std::tie(symbol_, name_) = constr_symbols().intern_with_name(name);
+}
+
+constr_global::constr_global(
+	symbol_table::id_type symbol
+) : constr_base(constr_kind_global, 0),
+	name_(&constr_symbols().name(symbol)),
+	symbol_(symbol) {
 }
 
 void
 constr_global::format(std::string& out) const {
-	out += name_;
+	out += *name_;
 }
 
 bool
 constr_global::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_global = dynamic_cast<const constr_global*>(&other)) {
-		return name_ == other_global->name_;
+	} else if (auto other_global = other.constr_kind() == constr_kind_global ? static_cast<const constr_global*>(&other) : nullptr) {
+		return symbol_ == other_global->symbol_;
 	} else {
 		return false;
 	}
@@ -304,7 +809,14 @@ constr_global::operator==(const constr_base& other) const noexcept {
 
 constr_t
 constr_global::check(const type_context_t& ctx) const {
-	return ctx.global_types(name_);
+	if (ctx.globals) {
+		auto id = ctx.globals->find(symbol_);
+		if (!id) {
+			throw std::runtime_error("unresolved global: " + *name_);
+		}
+		return ctx.globals->type(*id);
+	}
+	return ctx.global_types(*name_);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -325,7 +837,8 @@ constr_builtin::~constr_builtin() {
 constr_builtin::constr_builtin(
 	std::string name,
 	std::function<constr_t(const constr_base&)> check
-) : name_(std::move(name)),
+) : constr_base(constr_kind_builtin, 0),
+	name_(std::move(name)),
 	check_(std::move(check)) {
 }
 
@@ -336,7 +849,13 @@ constr_builtin::format(std::string& out) const {
 
 bool
 constr_builtin::operator==(const constr_base& other) const noexcept {
-	return this == &other;
+	if (this == &other) {
+		return true;
+	} else if (other.constr_kind() == constr_kind_builtin) {
+		return name_ == static_cast<const constr_builtin&>(other).name_;
+	} else {
+		return false;
+	}
 }
 
 constr_t
@@ -344,40 +863,68 @@ constr_builtin::check(const type_context_t& ctx) const {
 	return check_(*this);
 }
 
-std::shared_ptr<const constr_base>
-constr_builtin::get_set() {
-	static const std::shared_ptr<const constr_base> singleton = std::make_shared<constr_builtin>(
-		"Set",
-		[](const constr_base&) { return constr_t(get_type()); }
-	);
+namespace {
+
+// Builtin sorts are singletons. Without atomic reference counts, nodes
+// cannot be shared between threads, so each thread gets its own instance.
+template<typename Init>
+const constr_ptr<const constr_base>&
+builtin_singleton(Init init) {
+	// Hash eagerly like make_constr does, such that nodes built on
+	// builtins know their hash at construction.
+	auto make = [&init] {
+		auto node = init();
+		node->init_hash();
+		return node;
+	};
+#ifdef COQCIC_NONATOMIC_REFCOUNT
+	static thread_local const constr_ptr<const constr_base> singleton = make();
+#else
+	static const constr_ptr<const constr_base> singleton = make();
+#endif
 	return singleton;
 }
 
-std::shared_ptr<const constr_base>
+}  // namespace
+
+constr_ptr<const constr_base>
+constr_builtin::get_set() {
+	return builtin_singleton([] {
+		return make_constr_ptr<constr_builtin>(
+			"Set",
+			[](const constr_base&) { return constr_t(get_type()); }
+		);
+	});
+}
+
+constr_ptr<const constr_base>
 constr_builtin::get_prop() {
-	static const std::shared_ptr<const constr_base> singleton = std::make_shared<constr_builtin>(
-		"Prop",
-		[](const constr_base&) { return constr_t(get_type()); }
-	);
-	return singleton;
+	return builtin_singleton([] {
+		return make_constr_ptr<constr_builtin>(
+			"Prop",
+			[](const constr_base&) { return constr_t(get_type()); }
+		);
+	});
 }
 
-std::shared_ptr<const constr_base>
+constr_ptr<const constr_base>
 constr_builtin::get_sprop() {
-	static const std::shared_ptr<const constr_base> singleton = std::make_shared<constr_builtin>(
-		"SProp",
-		[](const constr_base&) { return constr_t(get_type()); }
-	);
-	return singleton;
+	return builtin_singleton([] {
+		return make_constr_ptr<constr_builtin>(
+			"SProp",
+			[](const constr_base&) { return constr_t(get_type()); }
+		);
+	});
 }
 
-std::shared_ptr<const constr_base>
+constr_ptr<const constr_base>
 constr_builtin::get_type() {
-	static const std::shared_ptr<const constr_base> singleton = std::make_shared<constr_builtin>(
-		"Type",
-		[](const constr_base&) { return constr_t(get_type()); }
-	);
-	return singleton;
+	return builtin_singleton([] {
+		return make_constr_ptr<constr_builtin>(
+			"Type",
+			[](const constr_base&) { return constr_t(get_type()); }
+		);
+	});
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -394,12 +941,18 @@ constr_builtin::get_type() {
 */
 
 constr_product::~constr_product() {
+	for (auto& arg : args_) {
+		constr_release_queue::release(arg.type);
+	}
+	constr_release_queue::release(restype_);
+	constr_release_queue::drain();
 }
 
 constr_product::constr_product(
 	std::vector<formal_arg_t> args,
 	constr_t restype
-) : args_(std::move(args)), restype_(std::move(restype)) {
+) : constr_base(constr_kind_product, bound_binders(args, restype)),
+	args_(std::move(args)), restype_(std::move(restype)) {
 }
 
 void
@@ -421,7 +974,7 @@ bool
 constr_product::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_product = dynamic_cast<const constr_product*>(&other)) {
+	} else if (auto other_product = other.constr_kind() == constr_kind_product ? static_cast<const constr_product*>(&other) : nullptr) {
 		return args_ == other_product->args_ && restype_ == other_product->restype_;
 	} else {
 		return false;
@@ -467,7 +1020,7 @@ constr_product::shift(std::size_t limit, int dir) const {
 	change = change || restype.repr() != restype_.repr();
 
 	if (change) {
-		return constr_t(std::make_shared<constr_product>(std::move(args), std::move(restype)));
+		return builder::product(std::move(args), std::move(restype));
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -487,12 +1040,18 @@ constr_product::shift(std::size_t limit, int dir) const {
 
 
 constr_lambda::~constr_lambda() {
+	for (auto& arg : args_) {
+		constr_release_queue::release(arg.type);
+	}
+	constr_release_queue::release(body_);
+	constr_release_queue::drain();
 }
 
 constr_lambda::constr_lambda(
 	std::vector<formal_arg_t> args,
 	constr_t body
-) : args_(std::move(args)), body_(std::move(body)) {
+) : constr_base(constr_kind_lambda, bound_binders(args, body)),
+	args_(std::move(args)), body_(std::move(body)) {
 }
 
 void
@@ -514,7 +1073,7 @@ bool
 constr_lambda::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_lambda = dynamic_cast<const constr_lambda*>(&other)) {
+	} else if (auto other_lambda = other.constr_kind() == constr_kind_lambda ? static_cast<const constr_lambda*>(&other) : nullptr) {
 		return args_ == other_lambda->args_ && body_ == other_lambda->body_;
 	} else {
 		return false;
@@ -525,10 +1084,10 @@ constr_t
 constr_lambda::check(const type_context_t& ctx) const {
 	type_context_t new_ctx = ctx;
 	for (const auto& arg : args_) {
-		type_context_t new_ctx = ctx.push_local(arg.name ? *arg.name : "_", arg.type);
+		new_ctx = new_ctx.push_local(arg.name ? *arg.name : "_", arg.type);
 	}
 	auto restype = body_.check(new_ctx);
-	return constr_t(std::make_shared<constr_product>(args(), std::move(restype)));
+	return builder::product(args(), std::move(restype));
 }
 
 constr_t
@@ -547,7 +1106,7 @@ constr_lambda::shift(std::size_t limit, int dir) const {
 	change = change || body.repr() != body_.repr();
 
 	if (change) {
-		return constr_t(std::make_shared<constr_lambda>(std::move(args), std::move(body)));
+		return builder::lambda(std::move(args), std::move(body));
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -566,6 +1125,10 @@ constr_lambda::shift(std::size_t limit, int dir) const {
 */
 
 constr_let::~constr_let() {
+	constr_release_queue::release(value_);
+	constr_release_queue::release(type_);
+	constr_release_queue::release(body_);
+	constr_release_queue::drain();
 }
 
 constr_let::constr_let(
@@ -573,7 +1136,8 @@ constr_let::constr_let(
 	constr_t value,
 	constr_t type,
 	constr_t body
-) : varname_(std::move(varname)),
+) : constr_base(constr_kind_let, bound_let(value, type, body)),
+	varname_(std::move(varname)),
 	value_(std::move(value)),
 	type_(std::move(type)),
 	body_(std::move(body)) {
@@ -600,7 +1164,7 @@ bool
 constr_let::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_let = dynamic_cast<const constr_let*>(&other)) {
+	} else if (auto other_let = other.constr_kind() == constr_kind_let ? static_cast<const constr_let*>(&other) : nullptr) {
 		return value_ == other_let->value_ && type_ == other_let->type_ && body_ == other_let->body_;
 	} else {
 		return false;
@@ -619,7 +1183,7 @@ constr_let::shift(std::size_t limit, int dir) const {
 	auto type = type_.shift(limit, dir);
 	auto body = body_.shift(limit + 1, dir);
 	if (value.repr() != value_.repr() || type.repr() != type_.repr() || body.repr() != body_.repr()) {
-		return constr_t(std::make_shared<constr_let>(varname_, std::move(value), std::move(type), std::move(body)));
+		return builder::let(varname_, std::move(value), std::move(type), std::move(body));
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -638,12 +1202,18 @@ constr_let::shift(std::size_t limit, int dir) const {
 */
 
 constr_apply::~constr_apply() {
+	constr_release_queue::release(fn_);
+	for (auto& arg : args_) {
+		constr_release_queue::release(arg);
+	}
+	constr_release_queue::drain();
 }
 
 constr_apply::constr_apply(
 	constr_t fn,
 	std::vector<constr_t> args
-) : fn_(std::move(fn)) , args_(std::move(args)) {
+) : constr_base(constr_kind_apply, bound_apply(fn, args)),
+	fn_(std::move(fn)) , args_(std::move(args)) {
 }
 
 void
@@ -661,7 +1231,7 @@ bool
 constr_apply::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_apply = dynamic_cast<const constr_apply*>(&other)) {
+	} else if (auto other_apply = other.constr_kind() == constr_kind_apply ? static_cast<const constr_apply*>(&other) : nullptr) {
 		return fn_ == other_apply->fn_ && args_ == other_apply->args_;
 	} else {
 		return false;
@@ -701,25 +1271,7 @@ constr_apply::check(const type_context_t& ctx) const {
 
 constr_t
 constr_apply::simpl() const {
-	if (auto fnlambda = dynamic_cast<const constr_lambda*>(fn_.repr().get())) {
-		std::size_t nsubst = std::min(args().size(), fnlambda->args().size());
-		std::vector<formal_arg_t> residual_formal_args(fnlambda->args().begin() + nsubst, fnlambda->args().end());
-		constr_t resfn =
-			residual_formal_args.empty() ?
-			fnlambda->body() : builder::lambda(std::move(residual_formal_args), fnlambda->body());
-
-		std::vector<constr_t> subst;
-		for (std::size_t n = 0; n < nsubst; ++n) {
-			subst.push_back(args()[nsubst - n - 1]);
-		}
-		constr_t res = local_subst(resfn, 0, subst);
-		if (nsubst != args().size()) {
-			res = builder::apply(std::move(res), {args().begin() + nsubst, args().end()});
-		}
-		return res.simpl();
-	} else {
-		return constr_t(shared_from_this());
-	}
+	return whnf(constr_t(shared_from_this()), reduce_beta);
 }
 
 constr_t
@@ -736,7 +1288,7 @@ constr_apply::shift(std::size_t limit, int dir) const {
 	}
 
 	if (change) {
-		return constr_t(std::make_shared<constr_apply>(std::move(fn), std::move(args)));
+		return builder::apply(std::move(fn), std::move(args));
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -755,13 +1307,17 @@ constr_apply::shift(std::size_t limit, int dir) const {
 
 
 constr_cast::~constr_cast() {
+	constr_release_queue::release(term_);
+	constr_release_queue::release(typeterm_);
+	constr_release_queue::drain();
 }
 
 constr_cast::constr_cast(
 	constr_t term,
 	kind_type kind,
 	constr_t typeterm
-) : term_(std::move(term)), kind_(kind), typeterm_(std::move(typeterm)) {
+) : constr_base(constr_kind_cast, std::max(term.loose_bound(), typeterm.loose_bound())),
+	term_(std::move(term)), kind_(kind), typeterm_(std::move(typeterm)) {
 }
 
 void
@@ -796,7 +1352,7 @@ bool
 constr_cast::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_cast = dynamic_cast<const constr_cast*>(&other)) {
+	} else if (auto other_cast = other.constr_kind() == constr_kind_cast ? static_cast<const constr_cast*>(&other) : nullptr) {
 		return term_ == other_cast->term_ && kind_ == other_cast->kind_ && typeterm_ == other_cast->typeterm_;
 	} else {
 		return false;
@@ -813,7 +1369,7 @@ constr_cast::shift(std::size_t limit, int dir) const {
 	auto term = term_.shift(limit, dir);
 	auto typeterm = typeterm_.shift(limit, dir);
 	if (term.repr() != term_.repr() || typeterm.repr() != typeterm_.repr()) {
-		return constr_t(std::make_shared<constr_cast>(std::move(term), kind_, std::move(typeterm)));
+		return builder::cast(std::move(term), kind_, std::move(typeterm));
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -833,13 +1389,20 @@ constr_cast::shift(std::size_t limit, int dir) const {
 */
 
 constr_match::~constr_match() {
+	constr_release_queue::release(casetype_);
+	constr_release_queue::release(arg_);
+	for (auto& branch : branches_) {
+		constr_release_queue::release(branch.expr);
+	}
+	constr_release_queue::drain();
 }
 
 constr_match::constr_match(
 	constr_t casetype,
 	constr_t arg,
 	std::vector<match_branch_t> branches
-) : casetype_(std::move(casetype)), arg_(std::move(arg)), branches_(std::move(branches)) {
+) : constr_base(constr_kind_match, bound_match(casetype, arg, branches)),
+	casetype_(std::move(casetype)), arg_(std::move(arg)), branches_(std::move(branches)) {
 }
 
 void
@@ -863,7 +1426,7 @@ bool
 constr_match::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_match = dynamic_cast<const constr_match*>(&other)) {
+	} else if (auto other_match = other.constr_kind() == constr_kind_match ? static_cast<const constr_match*>(&other) : nullptr) {
 		return casetype_ == other_match->casetype_ && arg_ == other_match->arg_ && branches_ == other_match->branches_;
 	} else {
 		return false;
@@ -893,7 +1456,7 @@ constr_match::shift(std::size_t limit, int dir) const {
 	}
 
 	if (diff) {
-		return constr_t(std::make_shared<constr_match>(std::move(casetype), std::move(arg), std::move(branches)));
+		return builder::match(std::move(casetype), std::move(arg), std::move(branches));
 	} else {
 		return constr_t(shared_from_this());
 	}
@@ -916,7 +1479,8 @@ constr_fix::~constr_fix() {
 constr_fix::constr_fix(
 	std::size_t index,
 	std::shared_ptr<const fix_group_t> group
-) : index_(index), group_(std::move(group)) {
+) : constr_base(constr_kind_fix, bound_fix(*group)),
+	index_(index), group_(std::move(group)) {
 }
 
 void
@@ -951,7 +1515,7 @@ bool
 constr_fix::operator==(const constr_base& other) const noexcept {
 	if (this == &other) {
 		return true;
-	} else if (auto other_fix = dynamic_cast<const constr_fix*>(&other)) {
+	} else if (auto other_fix = other.constr_kind() == constr_kind_fix ? static_cast<const constr_fix*>(&other) : nullptr) {
 		return group_ == other_fix->group_ && index_ == other_fix->index_;
 	} else {
 		return false;
@@ -979,30 +1543,111 @@ constr_fix::shift(std::size_t limit, int dir) const {
 			new_fn.args.push_back({arg.name, new_arg});
 		}
 		new_fn.restype = fn.restype.shift(limit + add_index, dir);
-		changed = changed || (new_fn.restype != fn.restype);
+		changed = changed || (new_fn.restype.repr() != fn.restype.repr());
 		new_fn.body = fn.body.shift(limit + add_index, dir);
-		changed = changed || (new_fn.body != fn.body);
+		changed = changed || (new_fn.body.repr() != fn.body.repr());
 		new_group.functions.push_back(std::move(new_fn));
 	}
 
 	if (changed) {
-		std::shared_ptr<const fix_group_t> group = std::make_shared<fix_group_t>(std::move(new_group));
-		return constr_t(std::make_shared<constr_fix>(index_, std::move(group)));
+		return builder::fix(index_, std::make_shared<fix_group_t>(std::move(new_group)));
 	} else {
 		return constr_t(shared_from_this());
 	}
 }
 
+namespace {
+
+// Constructs a new node, allocating it from the arena installed for the
+// current thread (if any) and interning it in the hash-consing table
+// installed for the current thread (if any).
+template<typename T, typename... Args>
+inline constr_t
+make_constr(Args&&... args) {
+	constr_ptr<const constr_base> node;
+	if (auto arena = constr_arena::current()) {
+		auto [memory, storage] = arena->allocate(sizeof(T), alignof(T));
+		T* raw;
+		try {
+			raw = new (memory) T(std::forward<Args>(args)...);
+		} catch (...) {
+			constr_arena::release(storage);
+			throw;
+		}
+		constr_refcount::attach(raw, storage);
+		node = constr_ptr<const constr_base>(raw);
+	} else {
+		node = make_constr_ptr<T>(std::forward<Args>(args)...);
+	}
+	node->init_hash();
+	if (auto table = constr_hashcons::current()) {
+		return constr_t(table->intern(std::move(node)));
+	} else {
+		return constr_t(std::move(node));
+	}
+}
+
+}  // namespace
+
+constr_t
+constr_t::shift(std::size_t limit, int dir) const {
+	if (dir == 0 || loose_bound() <= limit) {
+		return *this;
+	}
+	if (constr_hashcons::current()) {
+		// Interned nodes must not refer to deferred shifts, whose
+		// hash is only known after resolving them completely.
+		return node()->shift(limit, dir);
+	}
+
+	switch (repr_->constr_kind()) {
+		case constr_kind_local:
+		case constr_kind_global:
+		case constr_kind_builtin: {
+			return repr_->shift(limit, dir);
+		}
+		case constr_kind_shifted: {
+			// Shifting indices >= l1 by d1 and then indices >= l2 by d2
+			// is the same as shifting indices >= l1 by d1 + d2 if
+			// l1 <= l2 <= l1 + d1: the second shift then affects
+			// exactly the indices affected by the first one.
+			const auto& inner = static_cast<const constr_shifted&>(*repr_);
+			if (
+				inner.limit() <= limit &&
+				std::ptrdiff_t(limit) <= std::ptrdiff_t(inner.limit()) + inner.dir()) {
+				if (inner.dir() + dir == 0) {
+					return inner.term();
+				}
+				return make_constr<constr_shifted>(inner.term(), inner.limit(), inner.dir() + dir);
+			}
+			return make_constr<constr_shifted>(*this, limit, dir);
+		}
+		default: {
+			return make_constr<constr_shifted>(*this, limit, dir);
+		}
+	}
+}
+
 namespace builder {
 
 constr_t
 local(std::string name, std::size_t index) {
-	return constr_t(std::make_shared<constr_local>(std::move(name), std::move(index)));
+	return make_constr<constr_local>(std::move(name), std::move(index));
+}
+
+constr_t
+local(symbol_table::id_type symbol, std::size_t index) {
+	return make_constr<constr_local>(symbol, index);
 }
 
 constr_t
 global(std::string name) {
-	return constr_t(std::make_shared<constr_global>(std::move(name)));
+	return make_constr<constr_global>(std::move(name));
+}
+
+constr_t
+global(symbol_table::id_type symbol) {
+	return make_constr<constr_global>(symbol);
 }
 
 constr_t
@@ -1027,12 +1672,12 @@ builtin_type() {
 
 constr_t
 product(std::vector<formal_arg_t> args, constr_t restype) {
-	return constr_t(std::make_shared<constr_product>(std::move(args), std::move(restype)));
+	return make_constr<constr_product>(std::move(args), std::move(restype));
 }
 
 constr_t
 lambda(std::vector<formal_arg_t> args, constr_t body) {
-	return constr_t(std::make_shared<constr_lambda>(std::move(args), std::move(body)));
+	return make_constr<constr_lambda>(std::move(args), std::move(body));
 }
 
 constr_t
@@ -1042,28 +1687,31 @@ let(
 	constr_t type,
 	constr_t body
 ) {
-	return constr_t(std::make_shared<constr_let>(std::move(varname), std::move(value), std::move(type), std::move(body)));
+	return make_constr<constr_let>(std::move(varname), std::move(value), std::move(type), std::move(body));
 }
 
 constr_t
 apply(constr_t fn, std::vector<constr_t> args) {
-	return constr_t(std::make_shared<constr_apply>(std::move(fn), std::move(args)));
+	return make_constr<constr_apply>(std::move(fn), std::move(args));
 }
 
 constr_t
 cast(constr_t term, constr_cast::kind_type kind, constr_t typeterm) {
-	return constr_t(std::make_shared<constr_cast>(std::move(term), kind, std::move(typeterm)));
+	return make_constr<constr_cast>(std::move(term), kind, std::move(typeterm));
 }
 
 
 constr_t
 match(constr_t restype, constr_t arg, std::vector<match_branch_t> branches) {
-	return constr_t(std::make_shared<constr_match>(std::move(restype), std::move(arg), std::move(branches)));
+	return make_constr<constr_match>(std::move(restype), std::move(arg), std::move(branches));
 }
 
 constr_t
 fix(std::size_t index, std::shared_ptr<const fix_group_t> group) {
-	return constr_t(std::make_shared<constr_fix>(index, std::move(group)));
+	if (auto table = constr_hashcons::current()) {
+		group = table->intern_group(std::move(group));
+	}
+	return make_constr<constr_fix>(index, std::move(group));
 }
 
 }  // builder
@@ -1,18 +1,192 @@
 #ifndef COQCIC_CONSTR_H
 #define COQCIC_CONSTR_H
 
+#include <atomic>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
-#include "coqcic/lazy_stack.h"
+#include "coqcic/arena.h"
+#include "coqcic/skew_list.h"
+#include "coqcic/symbol_table.h"
 
 namespace coqcic {
 
+class constr_base;
+
+/**
+	\brief Reference counting of term representation nodes
+
+	Maintains the reference count embedded in each \ref constr_base
+	node on behalf of \ref constr_ptr, and destroys nodes when their
+	last reference is released.
+
+	By default counts are maintained atomically, such that terms can
+	be shared between threads. If the library is configured with
+	--enable-nonatomic-refcount (defining COQCIC_NONATOMIC_REFCOUNT),
+	they are maintained with plain arithmetic instead. This makes
+	copying terms considerably cheaper, but terms must then not be
+	shared between threads. The choice is made in the implementation
+	of these functions only: node layout and interface are the same
+	in either case, and code using the library is built the same way.
+*/
+class constr_refcount {
+public:
+	static
+	void
+	acquire(const constr_base* node) noexcept;
+
+	static
+	void
+	release(const constr_base* node) noexcept;
+
+	static
+	std::size_t
+	use_count(const constr_base* node) noexcept;
+
+	/**
+		\brief Record arena storage backing a node
+
+		Hands a reference to arena storage (see
+		\ref constr_arena::allocate) over to a newly allocated node.
+		The reference is given up when the node is destroyed, after
+		running its destructor.
+	*/
+	static
+	void
+	attach(const constr_base* node, constr_arena::region* storage) noexcept;
+};
+
+/**
+	\brief Owning pointer to term representation nodes
+
+	Reference counted pointer to \ref constr_base nodes, using the
+	count embedded in the node, see \ref constr_refcount. Since the
+	count is part of the node, a new owning pointer can be made from
+	any plain pointer to a node that is owned by some other pointer.
+*/
+template<typename T>
+class constr_ptr {
+public:
+	using element_type = T;
+
+	inline
+	~constr_ptr() {
+		if (ptr_) {
+			constr_refcount::release(ptr_);
+		}
+	}
+
+	constexpr
+	constr_ptr() noexcept = default;
+
+	constexpr
+	constr_ptr(std::nullptr_t) noexcept {}
+
+	// Takes a new reference to "ptr".
+	inline explicit
+	constr_ptr(T* ptr) noexcept : ptr_(ptr) {
+		if (ptr_) {
+			constr_refcount::acquire(ptr_);
+		}
+	}
+
+	inline
+	constr_ptr(const constr_ptr& other) noexcept : constr_ptr(other.ptr_) {}
+
+	inline
+	constr_ptr(constr_ptr&& other) noexcept : ptr_(other.ptr_) {
+		other.ptr_ = nullptr;
+	}
+
+	template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+	inline
+	constr_ptr(const constr_ptr<U>& other) noexcept : constr_ptr(other.ptr_) {}
+
+	template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+	inline
+	constr_ptr(constr_ptr<U>&& other) noexcept : ptr_(other.ptr_) {
+		other.ptr_ = nullptr;
+	}
+
+	inline
+	constr_ptr&
+	operator=(const constr_ptr& other) noexcept {
+		constr_ptr(other).swap(*this);
+		return *this;
+	}
+
+	inline
+	constr_ptr&
+	operator=(constr_ptr&& other) noexcept {
+		constr_ptr(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	inline
+	void
+	reset() noexcept {
+		constr_ptr().swap(*this);
+	}
+
+	inline
+	void
+	swap(constr_ptr& other) noexcept {
+		std::swap(ptr_, other.ptr_);
+	}
+
+	inline
+	T*
+	get() const noexcept { return ptr_; }
+
+	inline
+	T&
+	operator*() const noexcept { return *ptr_; }
+
+	inline
+	T*
+	operator->() const noexcept { return ptr_; }
+
+	inline explicit
+	operator bool() const noexcept { return ptr_ != nullptr; }
+
+	inline
+	std::size_t
+	use_count() const noexcept {
+		return ptr_ ? constr_refcount::use_count(ptr_) : 0;
+	}
+
+	template<typename U>
+	inline
+	bool
+	operator==(const constr_ptr<U>& other) const noexcept { return ptr_ == other.ptr_; }
+
+	template<typename U>
+	inline
+	bool
+	operator!=(const constr_ptr<U>& other) const noexcept { return ptr_ != other.ptr_; }
+
+private:
+	T* ptr_ = nullptr;
+
+	template<typename U>
+	friend class constr_ptr;
+};
+
+template<typename T, typename... Args>
+inline
+constr_ptr<T>
+make_constr_ptr(Args&&... args) {
+	return constr_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
 // Abstract base representation class for CIC constrs.
 class constr_base;
 
@@ -29,6 +203,30 @@ class constr_match;
 class constr_fix;
 
 class type_context_t;
+class check_cache;
+class global_env;
+
+/**
+	\brief Kind of a term construction
+
+	Identifies the representation subclass of \ref constr_base,
+	see \ref constr_t::visit.
+*/
+enum constr_kind_t {
+	constr_kind_local,
+	constr_kind_global,
+	constr_kind_builtin,
+	constr_kind_product,
+	constr_kind_lambda,
+	constr_kind_let,
+	constr_kind_apply,
+	constr_kind_cast,
+	constr_kind_match,
+	constr_kind_fix,
+	// Internal: deferred shift of another term, see \ref constr_t::shift.
+	// Never reported by \ref constr_t::constr_kind.
+	constr_kind_shifted
+};
 
 /**
 	\brief A coqcic term construction
@@ -44,12 +242,19 @@ public:
 	explicit
 	inline
 	constr_t(
-		std::shared_ptr<const constr_base> repr
+		constr_ptr<const constr_base> repr
 	) noexcept : repr_(std::move(repr)) {
 	}
 
 	constr_t() noexcept = default;
 
+	constr_t(const constr_t& other) noexcept = default;
+
+	/**
+		\brief Move constr, leaving the source empty
+	*/
+	constr_t(constr_t&& other) noexcept = default;
+
 	/**
 		\brief Assign constr
 	*/
@@ -104,6 +309,38 @@ public:
 	inline
 	bool operator!=(const constr_t& other) const { return ! (*this == other); }
 
+	/**
+		\brief Structural hash of term
+		\returns
+			Hash value
+
+		Returns a hash value that is consistent with \ref operator==,
+		i.e. terms comparing equal have the same hash value (names
+		of local variables do not contribute to the hash). The hash
+		value is computed once when the term is constructed, so this
+		is a constant-time operation. Terms built over deferred
+		shifts (see \ref shift) compute it on first use instead.
+	*/
+	inline std::size_t hash() const;
+
+	/**
+		\brief Bound of loose de Bruijn indices
+		\returns
+			Number greater than all loose indices
+
+		Returns a number greater than the de Bruijn indices of all
+		locals that are not bound within the term itself (as viewed
+		from the root), zero if there are none (i.e. the term is
+		closed). The bound is computed when the term is constructed,
+		so this is a constant-time operation. It is exact except for
+		terms with deferred shifts (see \ref shift), where it may be
+		larger.
+
+		Shifts and substitutions of indices at or above the bound
+		leave the term unchanged.
+	*/
+	inline std::size_t loose_bound() const noexcept;
+
 	/**
 		\brief Checks type of constr
 		\param ctx
@@ -126,7 +363,10 @@ public:
 		\returns
 			Simplified term.
 
-		Resolves apply / lambda pairs to produce a simplified term.
+		Resolves apply / lambda pairs at the head to produce a
+		simplified term, i.e. computes the weak head normal form
+		with respect to beta reduction. See \ref whnf and \ref nf
+		for further reductions.
 	*/
 	constr_t
 	simpl() const;
@@ -167,6 +407,16 @@ public:
 		The latter operation does not cause a change because '1 inside
 		the lambda abstraction refers to the zeroe'th unbound variable
 		for the term as a whole.
+
+		The shift is performed lazily: the result is a node that
+		records the pending shift, and the outermost node of the
+		shifted term is only constructed when the result is first
+		inspected (e.g. through \ref as_product or \ref visit). Its
+		children are again pending shifts, such that only the parts
+		of a term actually inspected are ever rebuilt. Shifting a
+		pending shift again composes both into a single pending
+		shift where possible. While a \ref constr_hashcons table is
+		installed, shifts are performed eagerly instead.
 	*/
 	constr_t
 	shift(std::size_t limit, int dir) const;
@@ -184,18 +434,29 @@ public:
 
 	/**
 		\brief Access the underlying representation object
+
+		This may be a node of internal kind \ref constr_kind_shifted
+		representing a deferred shift, use the accessors of this
+		class to inspect the term.
 	*/
 	const
-	std::shared_ptr<const constr_base>&
+	constr_ptr<const constr_base>&
 	repr() const noexcept {
 		return repr_;
 	}
 
-	std::shared_ptr<const constr_base>
+	constr_ptr<const constr_base>
 	extract_repr() && noexcept {
 		return std::move(repr_);
 	}
 
+	/**
+		\brief Kind of construction represented
+
+		Must not be called on default-constructed object.
+	*/
+	inline constr_kind_t constr_kind() const noexcept;
+
 	/**
 		\brief Return \ref constr_local or nullptr
 
@@ -329,7 +590,15 @@ public:
 	visit(Visitor&& vis) const;
 
 private:
-	std::shared_ptr<const constr_base> repr_;
+	friend class constr_shifted;
+	friend class constr_release_queue;
+
+	// Representation node with deferred shift (if any) resolved.
+	inline const constr_base* node() const noexcept;
+
+	static const constr_base* resolve_shifted(const constr_base& shifted) noexcept;
+
+	constr_ptr<const constr_base> repr_;
 };
 
 /**
@@ -442,6 +711,19 @@ struct fix_function_t {
 	operator==(const fix_function_t& other) const noexcept {
 		return name == other.name && args == other.args && restype == other.restype && body == other.body;
 	}
+
+	/**
+		\brief Structural argument of this function
+
+		\returns
+			Position of the formal argument the body directly
+			matches on, or nullopt if the body is not a match on
+			one of the formal arguments. Reduction unfolds the
+			function only when this argument is a constructor
+			application.
+	*/
+	std::optional<std::size_t>
+	structural_arg() const;
 };
 
 /**
@@ -499,6 +781,11 @@ collect_external_references(const constr_t& obj);
 	\brief Context for type checking operations.
 
 	Context for type checking operation on constr objects.
+
+	Contexts are persistent: \ref push_local leaves the context unmodified
+	and creates a new one in O(1), sharing the locals of the original
+	context as well as its resolver of globals. Looking up a local is
+	O(log n) in the number of locals.
 */
 class type_context_t {
 public:
@@ -525,15 +812,69 @@ public:
 		constr_t type;
 	};
 
+	/**
+		\brief Persistent stack of local variables.
+	*/
+	using local_stack = skew_list<local_entry>;
+
+	/**
+		\brief Resolver of global types, shared by reference.
+
+		Holds a function object mapping names of globals to their
+		types. Copies refer to the same function object.
+	*/
+	class global_types_fn {
+	public:
+		global_types_fn() noexcept = default;
+
+		template<
+			typename Fn,
+			typename = std::enable_if_t<!std::is_same_v<std::decay_t<Fn>, global_types_fn>>>
+		inline
+		global_types_fn(Fn fn)
+			: fn_(std::make_shared<const std::function<constr_t(const std::string&)>>(std::move(fn)))
+		{
+		}
+
+		inline constr_t
+		operator()(const std::string& name) const {
+			return (*fn_)(name);
+		}
+
+		inline explicit
+		operator bool() const noexcept {
+			return fn_ && *fn_;
+		}
+
+	private:
+		std::shared_ptr<const std::function<constr_t(const std::string&)>> fn_;
+	};
+
 	/**
 		\brief Stack of local variables.
 	*/
-	lazy_stack<local_entry> locals;
+	local_stack locals;
 
 	/**
 		\brief Map constr_global name to its type.
 	*/
-	std::function<constr_t(const std::string&)> global_types;
+	global_types_fn global_types;
+
+	/**
+		\brief Table of globals, used instead of global_types if set.
+
+		Not owned, must outlive all checks using this context (and
+		contexts derived from it).
+	*/
+	const global_env* globals = nullptr;
+
+	/**
+		\brief Memoizes types of checked subterms, if set.
+
+		Not owned, must outlive all checks using this context (and
+		contexts derived from it).
+	*/
+	check_cache* cache = nullptr;
 };
 
 /**
@@ -543,7 +884,7 @@ public:
 	constructs. Generally, avoid interacting with this directly
 	instead of the wrapper \ref constr_t.
 */
-class constr_base : public std::enable_shared_from_this<constr_base> {
+class constr_base {
 public:
 	virtual
 	~constr_base();
@@ -570,8 +911,94 @@ public:
 
 	std::string
 	repr() const;
+
+	/**
+		\brief Structural hash of this term, see \ref constr_t::hash
+	*/
+	inline
+	std::size_t
+	hash() const {
+		std::size_t hash = hash_.load(std::memory_order_relaxed);
+		return hash ? hash : compute_hash();
+	}
+
+	/**
+		\brief Structural hash if already computed, zero otherwise
+	*/
+	inline
+	std::size_t
+	cached_hash() const noexcept {
+		return hash_.load(std::memory_order_relaxed);
+	}
+
+	/**
+		\brief Kind of construction, determines the subclass
+	*/
+	inline
+	constr_kind_t
+	constr_kind() const noexcept { return kind_; }
+
+	/**
+		\brief Bound of loose de Bruijn indices, see \ref constr_t::loose_bound
+	*/
+	inline
+	std::size_t
+	loose_bound() const noexcept { return loose_bound_; }
+
+	/**
+		\brief Precompute hash if hashes of all children are known
+
+		Called when constructing a node. Nodes with children whose
+		hash is not known yet (deferred shifts, see
+		\ref constr_t::shift) compute their hash on first use
+		instead, such that constructing them does not require
+		resolving their children.
+	*/
+	void
+	init_hash() const noexcept;
+
+	/**
+		\brief New owning pointer to this node
+	*/
+	inline
+	constr_ptr<const constr_base>
+	shared_from_this() const noexcept {
+		return constr_ptr<const constr_base>(this);
+	}
+
+protected:
+	inline
+	constr_base(constr_kind_t kind, std::size_t loose_bound) noexcept
+		: hash_(0), kind_(kind), loose_bound_(loose_bound) {}
+
+private:
+	// Computes the hash from the children and caches it, along with
+	// those of all descendants not known yet.
+	std::size_t
+	compute_hash() const;
+
+	mutable std::atomic<std::size_t> hash_;
+	constr_kind_t kind_;
+	std::size_t loose_bound_;
+
+	// Maintained by constr_refcount.
+	mutable std::atomic<std::size_t> refs_ = 0;
+	constr_arena::region* storage_ = nullptr;
+
+	friend class constr_refcount;
 };
 
+/**
+	\brief Table interning names of globals and local variables
+
+	\ref constr_global and \ref constr_local nodes refer to their
+	name by its id in this process-wide table, instead of holding a
+	copy of the name. Equal names are thereby stored only once, and
+	compare as integers. Names are never removed from the table.
+*/
+symbol_table&
+constr_symbols();
+
 /**
 	\brief Reference to local variable
 
@@ -586,6 +1013,13 @@ public:
 		std::string name,
 		std::size_t index);
 
+	/**
+		\brief Local named by the given id in \ref constr_symbols
+	*/
+	constr_local(
+		symbol_table::id_type symbol,
+		std::size_t index);
+
 	void
 	format(std::string& out) const override;
 
@@ -600,14 +1034,22 @@ public:
 
 	inline
 	const std::string&
-	name() const noexcept { return name_; }
+	name() const noexcept { return *name_; }
+
+	/**
+		\brief Id of name in \ref constr_symbols
+	*/
+	inline
+	symbol_table::id_type
+	symbol() const noexcept { return symbol_; }
 
 	inline
 	std::size_t
 	index() const noexcept { return index_; }
 
 private:
-	std::string name_;
+	const std::string* name_;
+	symbol_table::id_type symbol_;
 	std::size_t index_;
 };
 
@@ -622,6 +1064,13 @@ public:
 	constr_global(
 		std::string name);
 
+	/**
+		\brief Global named by the given id in \ref constr_symbols
+	*/
+	explicit
+	constr_global(
+		symbol_table::id_type symbol);
+
 	void
 	format(std::string& out) const override;
 
@@ -633,10 +1082,18 @@ public:
 
 	inline
 	const std::string&
-	name() const noexcept { return name_; }
+	name() const noexcept { return *name_; }
+
+	/**
+		\brief Id of name in \ref constr_symbols
+	*/
+	inline
+	symbol_table::id_type
+	symbol() const noexcept { return symbol_; }
 
 private:
-	std::string name_;
+	const std::string* name_;
+	symbol_table::id_type symbol_;
 };
 
 /**
@@ -665,19 +1122,19 @@ public:
 	name() const noexcept { return name_; }
 
 	static
-	std::shared_ptr<const constr_base>
+	constr_ptr<const constr_base>
 	get_set();
 
 	static
-	std::shared_ptr<const constr_base>
+	constr_ptr<const constr_base>
 	get_prop();
 
 	static
-	std::shared_ptr<const constr_base>
+	constr_ptr<const constr_base>
 	get_sprop();
 
 	static
-	std::shared_ptr<const constr_base>
+	constr_ptr<const constr_base>
 	get_type();
 
 private:
@@ -982,42 +1439,61 @@ private:
 ////////////////////////////////////////////////////////////////////////////////
 // constr_t implementations
 
-const constr_local* constr_t::as_local() const noexcept { return dynamic_cast<const constr_local*>(repr_.get()); }
-const constr_global* constr_t::as_global() const noexcept { return dynamic_cast<const constr_global*>(repr_.get()); }
-const constr_builtin* constr_t::as_builtin() const noexcept { return dynamic_cast<const constr_builtin*>(repr_.get()); }
-const constr_product* constr_t::as_product() const noexcept { return dynamic_cast<const constr_product*>(repr_.get()); }
-const constr_lambda* constr_t::as_lambda() const noexcept { return dynamic_cast<const constr_lambda*>(repr_.get()); }
-const constr_let* constr_t::as_let() const noexcept { return dynamic_cast<const constr_let*>(repr_.get()); }
-const constr_apply* constr_t::as_apply() const noexcept { return dynamic_cast<const constr_apply*>(repr_.get()); }
-const constr_cast* constr_t::as_cast() const noexcept { return dynamic_cast<const constr_cast*>(repr_.get()); }
-const constr_match* constr_t::as_match() const noexcept { return dynamic_cast<const constr_match*>(repr_.get()); }
-const constr_fix* constr_t::as_fix() const noexcept { return dynamic_cast<const constr_fix*>(repr_.get()); }
+const constr_local* constr_t::as_local() const noexcept { return repr_ && node()->constr_kind() == constr_kind_local ? static_cast<const constr_local*>(node()) : nullptr; }
+const constr_global* constr_t::as_global() const noexcept { return repr_ && node()->constr_kind() == constr_kind_global ? static_cast<const constr_global*>(node()) : nullptr; }
+const constr_builtin* constr_t::as_builtin() const noexcept { return repr_ && node()->constr_kind() == constr_kind_builtin ? static_cast<const constr_builtin*>(node()) : nullptr; }
+const constr_product* constr_t::as_product() const noexcept { return repr_ && node()->constr_kind() == constr_kind_product ? static_cast<const constr_product*>(node()) : nullptr; }
+const constr_lambda* constr_t::as_lambda() const noexcept { return repr_ && node()->constr_kind() == constr_kind_lambda ? static_cast<const constr_lambda*>(node()) : nullptr; }
+const constr_let* constr_t::as_let() const noexcept { return repr_ && node()->constr_kind() == constr_kind_let ? static_cast<const constr_let*>(node()) : nullptr; }
+const constr_apply* constr_t::as_apply() const noexcept { return repr_ && node()->constr_kind() == constr_kind_apply ? static_cast<const constr_apply*>(node()) : nullptr; }
+const constr_cast* constr_t::as_cast() const noexcept { return repr_ && node()->constr_kind() == constr_kind_cast ? static_cast<const constr_cast*>(node()) : nullptr; }
+const constr_match* constr_t::as_match() const noexcept { return repr_ && node()->constr_kind() == constr_kind_match ? static_cast<const constr_match*>(node()) : nullptr; }
+const constr_fix* constr_t::as_fix() const noexcept { return repr_ && node()->constr_kind() == constr_kind_fix ? static_cast<const constr_fix*>(node()) : nullptr; }
+
+const constr_base* constr_t::node() const noexcept { return repr_->constr_kind() != constr_kind_shifted ? repr_.get() : resolve_shifted(*repr_); }
+
+std::size_t constr_t::hash() const { return repr_ ? node()->hash() : 0; }
+std::size_t constr_t::loose_bound() const noexcept { return repr_ ? repr_->loose_bound() : 0; }
+constr_kind_t constr_t::constr_kind() const noexcept { return node()->constr_kind(); }
 
 template<typename Visitor>
 inline auto
 constr_t::visit(Visitor&& vis) const {
-	if (auto local = as_local()) {
-		return vis(*local);
-	} else if (auto global = as_global()) {
-		return vis(*global);
-	} else if (auto builtin = as_builtin()) {
-		return vis(*builtin);
-	} else if (auto product = as_product()) {
-		return vis(*product);
-	} else if (auto lambda = as_lambda()) {
-		return vis(*lambda);
-	} else if (auto let = as_let()) {
-		return vis(*let);
-	} else if (auto apply = as_apply()) {
-		return vis(*apply);
-	} else if (auto cast = as_cast()) {
-		return vis(*cast);
-	} else if (auto match_case = as_match()) {
-		return vis(*match_case);
-	} else if (auto fix = as_fix()) {
-		return vis(*fix);
-	} else {
-		std::terminate();
+	const constr_base* repr = node();
+	switch (repr->constr_kind()) {
+		case constr_kind_local: {
+			return vis(static_cast<const constr_local&>(*repr));
+		}
+		case constr_kind_global: {
+			return vis(static_cast<const constr_global&>(*repr));
+		}
+		case constr_kind_builtin: {
+			return vis(static_cast<const constr_builtin&>(*repr));
+		}
+		case constr_kind_product: {
+			return vis(static_cast<const constr_product&>(*repr));
+		}
+		case constr_kind_lambda: {
+			return vis(static_cast<const constr_lambda&>(*repr));
+		}
+		case constr_kind_let: {
+			return vis(static_cast<const constr_let&>(*repr));
+		}
+		case constr_kind_apply: {
+			return vis(static_cast<const constr_apply&>(*repr));
+		}
+		case constr_kind_cast: {
+			return vis(static_cast<const constr_cast&>(*repr));
+		}
+		case constr_kind_match: {
+			return vis(static_cast<const constr_match&>(*repr));
+		}
+		case constr_kind_fix: {
+			return vis(static_cast<const constr_fix&>(*repr));
+		}
+		default: {
+			std::terminate();
+		}
 	}
 }
 
@@ -1029,9 +1505,17 @@ namespace builder {
 constr_t
 local(std::string name, std::size_t index);
 
+// As above, for a name already interned in constr_symbols, e.g. the
+// symbol() of an existing local. Does not look up the name by string.
+constr_t
+local(symbol_table::id_type symbol, std::size_t index);
+
 constr_t
 global(std::string name);
 
+constr_t
+global(symbol_table::id_type symbol);
+
 constr_t
 builtin_set();
 
@@ -1070,6 +1554,31 @@ fix(std::size_t index, std::shared_ptr<const fix_group_t> group);
 
 }  // builder
 
+/**
+	\brief Combines hash values
+
+	\param seed
+		Hash value to be updated.
+	\param value
+		Hash value to be mixed into seed.
+*/
+inline void
+hash_combine(std::size_t& seed, std::size_t value) noexcept {
+	seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
 }  // namespace coqcic
 
+namespace std {
+
+template<>
+struct hash<coqcic::constr_t> {
+	inline std::size_t
+	operator()(const coqcic::constr_t& constr) const {
+		return constr.hash();
+	}
+};
+
+}  // namespace std
+
 #endif  // COQCIC_CONSTR_H
@@ -0,0 +1,166 @@
+// Micro-benchmark for dispatching over constr kinds.
+//
+// Builds a deep term mixing all kinds of constructions and traverses it
+// repeatedly, once dispatching through constr_t::visit (kind tag) and once
+// through a chain of dynamic_casts as used previously.
+
+#include "coqcic/constr.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+using namespace coqcic;
+
+constr_t
+make_deep_term(std::size_t depth) {
+	auto nat = builder::global("nat");
+	auto group = std::make_shared<fix_group_t>();
+	group->functions.push_back({
+		"f", {{"x", nat}}, nat, builder::apply(builder::local("f", 1), {builder::local("x", 0)})});
+	constr_t fix = builder::fix(0, group);
+
+	constr_t term = builder::builtin_set();
+	for (std::size_t n = 0; n < depth; ++n) {
+		switch (n % 5) {
+			case 0: {
+				term = builder::lambda({{"x", nat}}, term);
+				break;
+			}
+			case 1: {
+				term = builder::apply(fix, {term, builder::local("x", 0)});
+				break;
+			}
+			case 2: {
+				term = builder::product({{"y", nat}}, term);
+				break;
+			}
+			case 3: {
+				term = builder::cast(term, constr_cast::vm_cast, nat);
+				break;
+			}
+			case 4: {
+				term = builder::let("z", nat, nat, term);
+				break;
+			}
+		}
+	}
+	return term;
+}
+
+std::size_t
+count_visit(const constr_t& root) {
+	std::size_t count = 0;
+	std::vector<const constr_t*> stack{&root};
+	while (!stack.empty()) {
+		const constr_t& c = *stack.back();
+		stack.pop_back();
+		++count;
+		c.visit([&](const auto& repr) {
+			using T = std::decay_t<decltype(repr)>;
+			if constexpr (std::is_same<T, constr_product>()) {
+				for (const auto& arg : repr.args()) {
+					stack.push_back(&arg.type);
+				}
+				stack.push_back(&repr.restype());
+			} else if constexpr (std::is_same<T, constr_lambda>()) {
+				for (const auto& arg : repr.args()) {
+					stack.push_back(&arg.type);
+				}
+				stack.push_back(&repr.body());
+			} else if constexpr (std::is_same<T, constr_let>()) {
+				stack.push_back(&repr.value());
+				stack.push_back(&repr.type());
+				stack.push_back(&repr.body());
+			} else if constexpr (std::is_same<T, constr_apply>()) {
+				stack.push_back(&repr.fn());
+				for (const auto& arg : repr.args()) {
+					stack.push_back(&arg);
+				}
+			} else if constexpr (std::is_same<T, constr_cast>()) {
+				stack.push_back(&repr.term());
+				stack.push_back(&repr.typeterm());
+			}
+		});
+	}
+	return count;
+}
+
+std::size_t
+count_dynamic_cast(const constr_t& root) {
+	std::size_t count = 0;
+	std::vector<const constr_t*> stack{&root};
+	while (!stack.empty()) {
+		const constr_base* c = stack.back()->repr().get();
+		stack.pop_back();
+		++count;
+		if (dynamic_cast<const constr_local*>(c)) {
+		} else if (dynamic_cast<const constr_global*>(c)) {
+		} else if (dynamic_cast<const constr_builtin*>(c)) {
+		} else if (auto repr = dynamic_cast<const constr_product*>(c)) {
+			for (const auto& arg : repr->args()) {
+				stack.push_back(&arg.type);
+			}
+			stack.push_back(&repr->restype());
+		} else if (auto repr = dynamic_cast<const constr_lambda*>(c)) {
+			for (const auto& arg : repr->args()) {
+				stack.push_back(&arg.type);
+			}
+			stack.push_back(&repr->body());
+		} else if (auto repr = dynamic_cast<const constr_let*>(c)) {
+			stack.push_back(&repr->value());
+			stack.push_back(&repr->type());
+			stack.push_back(&repr->body());
+		} else if (auto repr = dynamic_cast<const constr_apply*>(c)) {
+			stack.push_back(&repr->fn());
+			for (const auto& arg : repr->args()) {
+				stack.push_back(&arg);
+			}
+		} else if (auto repr = dynamic_cast<const constr_cast*>(c)) {
+			stack.push_back(&repr->term());
+			stack.push_back(&repr->typeterm());
+		} else if (dynamic_cast<const constr_match*>(c)) {
+		} else if (dynamic_cast<const constr_fix*>(c)) {
+		}
+	}
+	return count;
+}
+
+template<typename Fn>
+double
+time_ms(Fn&& fn, std::size_t rounds, std::size_t& result) {
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t n = 0; n < rounds; ++n) {
+		result += fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+	const std::size_t depth = 100000;
+	const std::size_t rounds = 50;
+
+	auto term = make_deep_term(depth);
+
+	std::size_t visit_nodes = 0;
+	std::size_t cast_nodes = 0;
+	double visit_ms = time_ms([&] { return count_visit(term); }, rounds, visit_nodes);
+	double cast_ms = time_ms([&] { return count_dynamic_cast(term); }, rounds, cast_nodes);
+
+	if (visit_nodes != cast_nodes) {
+		std::cerr << "node count mismatch: " << visit_nodes << " vs " << cast_nodes << "\n";
+		return 1;
+	}
+
+	std::cout << "traversed " << visit_nodes / rounds << " nodes x " << rounds << " rounds\n";
+	std::cout << "kind tag dispatch:     " << visit_ms << " ms\n";
+	std::cout << "dynamic_cast dispatch: " << cast_ms << " ms\n";
+	std::cout << "speedup:               " << cast_ms / visit_ms << "x\n";
+
+	return 0;
+}
@@ -106,3 +106,123 @@ TEST(constr_test, dup_pair) {
 	auto zero_zero = apply(dup_nat, {globals.O});
 	EXPECT_EQ(zero_zero.check(ctx), apply(globals.prod, {globals.nat, globals.nat}));
 }
+
+TEST(constr_test, interned_names) {
+	auto a = global("Coq.Init.Datatypes.nat");
+	auto b = global(std::string("Coq.Init.Datatypes.") + "nat");
+	EXPECT_EQ(a.as_global()->symbol(), b.as_global()->symbol());
+	EXPECT_EQ(&a.as_global()->name(), &b.as_global()->name());
+	EXPECT_EQ("Coq.Init.Datatypes.nat", coqcic::constr_symbols().name(a.as_global()->symbol()));
+	EXPECT_NE(a.as_global()->symbol(), global("nat").as_global()->symbol());
+
+	auto x = local("x", 0);
+	auto shifted = x.shift(0, 2);
+	ASSERT_TRUE(shifted.as_local());
+	EXPECT_EQ(x.as_local()->symbol(), shifted.as_local()->symbol());
+	EXPECT_EQ("x", shifted.as_local()->name());
+
+	// Building from symbols of existing names.
+	auto c = global(a.as_global()->symbol());
+	EXPECT_EQ(a, c);
+	EXPECT_EQ(&a.as_global()->name(), &c.as_global()->name());
+	auto y = local(x.as_local()->symbol(), 3);
+	EXPECT_EQ("x", y.as_local()->name());
+	EXPECT_EQ(3u, y.as_local()->index());
+}
+
+TEST(constr_test, structural_hash) {
+	auto a = lambda({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+	auto b = lambda({{"y", global("nat")}}, apply(global("S"), {local("y", 0)}));
+	auto c = lambda({{"x", global("nat")}}, apply(global("S"), {local("x", 1)}));
+
+	EXPECT_EQ(a, b);
+	EXPECT_EQ(a.hash(), b.hash());
+	EXPECT_NE(a, c);
+	EXPECT_NE(a.hash(), c.hash());
+
+	std::unordered_map<constr_t, int> memo;
+	memo[a] = 1;
+	memo[c] = 2;
+	EXPECT_EQ(1, memo[b]);
+	EXPECT_EQ(2u, memo.size());
+}
+
+TEST(constr_test, reference_count) {
+	auto a = apply(global("S"), {global("O")});
+	EXPECT_EQ(1u, a.repr().use_count());
+
+	auto b = a;
+	EXPECT_EQ(2u, a.repr().use_count());
+	EXPECT_EQ(a.repr(), b.repr());
+
+	// The count is held by the node, plain pointers can be turned
+	// into further references.
+	coqcic::constr_ptr<const coqcic::constr_base> c(a.repr().get());
+	EXPECT_EQ(3u, c.use_count());
+
+	auto d = std::move(b).extract_repr();
+	EXPECT_EQ(3u, d.use_count());
+	EXPECT_FALSE(b.repr());
+	d.reset();
+	c.reset();
+	EXPECT_EQ(1u, a.repr().use_count());
+}
+
+TEST(constr_test, lazy_shift) {
+	auto a = lambda({{"x", global("nat")}}, apply(local("f", 1), {local("x", 0), local("y", 2)}));
+	auto expected = lambda({{"x", global("nat")}}, apply(local("f", 3), {local("x", 0), local("y", 4)}));
+
+	auto b = a.shift(0, 1).shift(1, 1);
+	EXPECT_EQ(expected, b);
+	EXPECT_EQ(expected.hash(), b.hash());
+	EXPECT_EQ(expected.debug_string(), b.debug_string());
+
+	// Shifting back cancels the pending shift.
+	EXPECT_EQ(a.repr(), a.shift(0, 2).shift(0, -2).repr());
+
+	// Shift whose range does not line up with the pending one.
+	auto c = a.shift(1, 1).shift(0, 1);
+	auto expected_c = lambda({{"x", global("nat")}}, apply(local("f", 2), {local("x", 0), local("y", 4)}));
+	EXPECT_EQ(expected_c, c);
+
+	// Terms built over pending shifts.
+	auto d = apply(global("S"), {a.shift(0, 2)});
+	EXPECT_EQ(apply(global("S"), {expected}), d);
+	ASSERT_TRUE(d.as_apply()->args()[0].as_lambda());
+	EXPECT_EQ(3u, d.as_apply()->args()[0].as_lambda()->body().as_apply()->fn().as_local()->index());
+
+	// Comparison does not compute hashes of terms above pending shifts,
+	// which are computed without recursion on first use.
+	constr_t deep = a.shift(0, 2);
+	for (std::size_t n = 0; n < 1000000; ++n) {
+		deep = apply(global("S"), {deep});
+	}
+	EXPECT_NE(d, deep);
+	EXPECT_EQ(0u, deep.repr()->cached_hash());
+	EXPECT_NE(0u, deep.hash());
+	EXPECT_EQ(deep.hash(), deep.repr()->cached_hash());
+}
+
+TEST(constr_test, loose_bound) {
+	auto closed = lambda({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+	auto open = lambda(
+		{{"x", global("nat")}, {"y", local("A", 1)}},
+		apply(local("f", 3), {local("x", 1), local("y", 0)}));
+	auto fn_match = match(
+		lambda({{"n", global("nat")}}, global("nat")),
+		local("n", 2),
+		{{"O", 0, local("a", 0)}, {"S", 1, lambda({{"p", global("nat")}}, local("p", 0))}});
+
+	EXPECT_EQ(0u, closed.loose_bound());
+	EXPECT_EQ(2u, open.loose_bound());
+	EXPECT_EQ(3u, fn_match.loose_bound());
+
+	// Shifts above the bound leave the term untouched.
+	EXPECT_EQ(open.repr(), open.shift(2, 1).repr());
+	EXPECT_EQ(closed.repr(), closed.shift(0, 1).repr());
+	EXPECT_EQ(3u, open.shift(1, 1).loose_bound());
+
+	EXPECT_EQ(std::vector<std::size_t>({0, 1}), collect_external_references(open));
+	EXPECT_EQ(std::vector<std::size_t>({0, 2}), collect_external_references(fn_match));
+	EXPECT_TRUE(collect_external_references(closed).empty());
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 
 #include "coqcic/simpl.h"
+#include "coqcic/skew_list.h"
 #include "coqcic/visitor.h"
 
 namespace coqcic {
@@ -20,7 +21,7 @@ struct sym_spec_arg {
 struct sym_none {};
 
 using sym = std::variant<sym_fix_function, sym_spec_arg, sym_none>;
-using sym_stack = lazy_stack<sym>;
+using sym_stack = skew_list<sym>;
 
 inline std::ostream&
 operator<<(std::ostream& os, const sym& s) {
@@ -264,7 +265,7 @@ struct replace_subst {
 };
 
 using replace = std::variant<replace_shift, replace_subst>;
-using replace_stack = lazy_stack<replace>;
+using replace_stack = skew_list<replace>;
 
 class specialize_visitor final : public transform_visitor {
 public:
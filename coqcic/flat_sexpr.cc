@@ -0,0 +1,99 @@
+#include "coqcic/flat_sexpr.h"
+
+#include <sstream>
+
+namespace coqcic {
+
+namespace {
+
+void
+flatten(const sexpr& e, flat_sexpr_builder& builder) {
+	if (auto t = e.as_terminal()) {
+		builder.add_terminal(t->value(), t->location());
+	} else {
+		auto c = e.as_compound();
+		builder.begin_compound();
+		for (const auto& arg : c->args()) {
+			flatten(arg, builder);
+		}
+		builder.end_compound(c->kind_id(), c->location());
+	}
+}
+
+flat_sexpr
+flatten(const sexpr& e) {
+	flat_sexpr_builder builder;
+	flatten(e, builder);
+	return builder.finish();
+}
+
+}  // namespace
+
+void
+flat_sexpr_ref::format(std::ostream& os) const {
+	if (as_terminal()) {
+		os << value();
+	} else {
+		os << '(';
+		os << kind();
+		for (const auto& arg : args()) {
+			os << ' ';
+			arg.format(os);
+		}
+		os << ')';
+	}
+}
+
+std::string
+flat_sexpr_ref::debug_string() const {
+	std::stringstream ss;
+	format(ss);
+	return ss.str();
+}
+
+flat_sexpr::flat_sexpr(std::shared_ptr<const flat_sexpr_storage> storage, std::uint32_t root) noexcept
+	: storage_(std::move(storage)), root_(root)
+{
+}
+
+flat_sexpr::flat_sexpr(const sexpr& e) : flat_sexpr(flatten(e)) {
+}
+
+flat_sexpr_builder::flat_sexpr_builder() : storage_(std::make_shared<flat_sexpr_storage>()) {
+}
+
+void
+flat_sexpr_builder::add_terminal(std::string_view value, std::size_t location) {
+	pending_.push_back(storage_->nodes.size());
+	storage_->nodes.push_back(flat_sexpr_node{
+		flat_sexpr_node::terminal, std::uint32_t(value.size()), storage_->strings.size(), location});
+	storage_->strings.append(value);
+}
+
+void
+flat_sexpr_builder::begin_compound() {
+	marks_.push_back(pending_.size());
+}
+
+void
+flat_sexpr_builder::end_compound(sexpr_kind_t kind, std::size_t location) {
+	std::size_t mark = marks_.back();
+	marks_.pop_back();
+
+	std::size_t first = storage_->args.size();
+	std::uint32_t size = pending_.size() - mark;
+	storage_->args.insert(storage_->args.end(), pending_.begin() + mark, pending_.end());
+	pending_.resize(mark);
+
+	pending_.push_back(storage_->nodes.size());
+	storage_->nodes.push_back(flat_sexpr_node{kind, size, first, location});
+}
+
+flat_sexpr
+flat_sexpr_builder::finish() {
+	std::uint32_t root = pending_.back();
+	pending_.clear();
+	return flat_sexpr(std::move(storage_), root);
+}
+
+}  // namespace coqcic
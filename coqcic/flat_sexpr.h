@@ -0,0 +1,300 @@
+#ifndef COQCIC_FLAT_SEXPR_H
+#define COQCIC_FLAT_SEXPR_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "coqcic/sexpr.h"
+
+namespace coqcic {
+
+// Node of a flat s-expression.
+struct flat_sexpr_node {
+	// Value of "kind" marking a terminal.
+	static constexpr std::uint32_t terminal = ~std::uint32_t(0);
+
+	// sexpr_kind_t of a compound, or "terminal".
+	std::uint32_t kind;
+	// Compound: number of arguments; terminal: length of value.
+	std::uint32_t size;
+	// Compound: index of first argument in argument index array;
+	// terminal: offset of value in string pool.
+	std::size_t first;
+	// Character index into source.
+	std::size_t location;
+};
+
+// Contiguous storage of all nodes of an s-expression. Arguments of each
+// compound are a contiguous range of node indices in "args", terminal
+// values are ranges of a single string pool.
+struct flat_sexpr_storage {
+	std::vector<flat_sexpr_node> nodes;
+	std::vector<std::uint32_t> args;
+	std::string strings;
+};
+
+// Non-owning reference to one node of a flat s-expression. Trivially
+// copyable, valid as long as the flat_sexpr it refers to exists. Offers
+// the same accessors as sexpr / sexpr_terminal / sexpr_compound such that
+// code can be written generically over both representations.
+class flat_sexpr_ref {
+public:
+	class args_type;
+
+	inline
+	flat_sexpr_ref(const flat_sexpr_storage* storage, std::uint32_t index) noexcept
+		: storage_(storage), index_(index)
+	{
+	}
+
+	inline
+	const flat_sexpr_ref*
+	as_terminal() const noexcept {
+		return node().kind == flat_sexpr_node::terminal ? this : nullptr;
+	}
+
+	inline
+	const flat_sexpr_ref*
+	as_compound() const noexcept {
+		return node().kind != flat_sexpr_node::terminal ? this : nullptr;
+	}
+
+	// Value of a terminal.
+	inline
+	std::string_view
+	value() const noexcept {
+		return std::string_view(storage_->strings.data() + node().first, node().size);
+	}
+
+	// Kind of a compound.
+	inline
+	sexpr_kind_t
+	kind_id() const noexcept {
+		return sexpr_kind_t(node().kind);
+	}
+
+	inline
+	const std::string&
+	kind() const {
+		return sexpr_kind_to_string(kind_id());
+	}
+
+	// Arguments of a compound.
+	inline
+	args_type
+	args() const noexcept;
+
+	inline
+	std::size_t
+	location() const noexcept {
+		return node().location;
+	}
+
+	void
+	format(std::ostream& os) const;
+
+	std::string
+	debug_string() const;
+
+private:
+	inline
+	const flat_sexpr_node&
+	node() const noexcept {
+		return storage_->nodes[index_];
+	}
+
+	const flat_sexpr_storage* storage_;
+	std::uint32_t index_;
+};
+
+// Random access range of the arguments of a compound.
+class flat_sexpr_ref::args_type {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = flat_sexpr_ref;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = flat_sexpr_ref;
+
+		inline
+		iterator(const flat_sexpr_storage* storage, const std::uint32_t* pos) noexcept
+			: storage_(storage), pos_(pos)
+		{
+		}
+
+		inline
+		flat_sexpr_ref
+		operator*() const noexcept {
+			return flat_sexpr_ref(storage_, *pos_);
+		}
+
+		inline
+		iterator&
+		operator++() noexcept {
+			++pos_;
+			return *this;
+		}
+
+		inline
+		iterator
+		operator+(difference_type n) const noexcept {
+			return iterator(storage_, pos_ + n);
+		}
+
+		inline
+		difference_type
+		operator-(const iterator& other) const noexcept {
+			return pos_ - other.pos_;
+		}
+
+		inline
+		bool
+		operator==(const iterator& other) const noexcept {
+			return pos_ == other.pos_;
+		}
+
+		inline
+		bool
+		operator!=(const iterator& other) const noexcept {
+			return pos_ != other.pos_;
+		}
+
+	private:
+		const flat_sexpr_storage* storage_;
+		const std::uint32_t* pos_;
+	};
+
+	inline
+	args_type(const flat_sexpr_storage* storage, const std::uint32_t* begin, std::size_t size) noexcept
+		: storage_(storage), begin_(begin), size_(size)
+	{
+	}
+
+	inline
+	std::size_t
+	size() const noexcept {
+		return size_;
+	}
+
+	inline
+	bool
+	empty() const noexcept {
+		return size_ == 0;
+	}
+
+	inline
+	flat_sexpr_ref
+	operator[](std::size_t n) const noexcept {
+		return flat_sexpr_ref(storage_, begin_[n]);
+	}
+
+	inline
+	iterator
+	begin() const noexcept {
+		return iterator(storage_, begin_);
+	}
+
+	inline
+	iterator
+	end() const noexcept {
+		return iterator(storage_, begin_ + size_);
+	}
+
+private:
+	const flat_sexpr_storage* storage_;
+	const std::uint32_t* begin_;
+	std::size_t size_;
+};
+
+inline
+flat_sexpr_ref::args_type
+flat_sexpr_ref::args() const noexcept {
+	return args_type(storage_, storage_->args.data() + node().first, node().size);
+}
+
+// Flat encoding of an s-expression: all nodes are held in one contiguous
+// array, referring to their arguments by index. Immutable once built, and
+// copies share the storage, hence copying is cheap (unlike sexpr, which
+// copies the whole tree). Produced by parse_flat_sexpr or by flattening
+// an sexpr tree.
+class flat_sexpr {
+public:
+	flat_sexpr(std::shared_ptr<const flat_sexpr_storage> storage, std::uint32_t root) noexcept;
+
+	explicit
+	flat_sexpr(const sexpr& e);
+
+	inline
+	flat_sexpr_ref
+	root() const noexcept {
+		return flat_sexpr_ref(storage_.get(), root_);
+	}
+
+	inline
+	operator flat_sexpr_ref() const noexcept {
+		return root();
+	}
+
+	// Total number of nodes.
+	inline
+	std::size_t
+	size() const noexcept {
+		return storage_->nodes.size();
+	}
+
+	inline
+	void
+	format(std::ostream& os) const {
+		root().format(os);
+	}
+
+	inline
+	std::string
+	debug_string() const {
+		return root().debug_string();
+	}
+
+private:
+	std::shared_ptr<const flat_sexpr_storage> storage_;
+	std::uint32_t root_;
+};
+
+// Incrementally builds a flat_sexpr bottom-up: each compound is opened
+// with begin_compound, followed by adding its arguments, and closed with
+// end_compound.
+class flat_sexpr_builder {
+public:
+	flat_sexpr_builder();
+
+	void
+	add_terminal(std::string_view value, std::size_t location);
+
+	void
+	begin_compound();
+
+	void
+	end_compound(sexpr_kind_t kind, std::size_t location);
+
+	// Finishes building, a single complete expression must have been
+	// added at top level.
+	flat_sexpr
+	finish();
+
+private:
+	std::shared_ptr<flat_sexpr_storage> storage_;
+	// Nodes completed, but not yet attached to their enclosing compound.
+	std::vector<std::uint32_t> pending_;
+	// Size of "pending" at start of each open compound.
+	std::vector<std::size_t> marks_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_FLAT_SEXPR_H
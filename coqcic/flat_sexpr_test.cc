@@ -0,0 +1,56 @@
+#include "coqcic/flat_sexpr.h"
+
+#include "gtest/gtest.h"
+
+#include "coqcic/parse_sexpr.h"
+
+TEST(flat_sexpr_test, structure) {
+	auto e = coqcic::parse_flat_sexpr(" (App (Global plus)\n(Local x 0) y)");
+	ASSERT_TRUE(e) << e.error().description << ":" << e.error().location;
+
+	auto root = e.value().root();
+	ASSERT_TRUE(root.as_compound());
+	EXPECT_EQ(root.kind_id(), coqcic::sexpr_kind_app);
+	EXPECT_EQ(root.location(), 1);
+	ASSERT_EQ(root.args().size(), 3);
+
+	auto local = root.args()[1];
+	EXPECT_EQ(local.kind(), "Local");
+	EXPECT_EQ(local.location(), 20);
+	ASSERT_EQ(local.args().size(), 2);
+	ASSERT_TRUE(local.args()[0].as_terminal());
+	EXPECT_EQ(local.args()[0].value(), "x");
+	EXPECT_EQ(local.args()[1].location(), 29);
+
+	EXPECT_EQ(root.args()[2].value(), "y");
+	EXPECT_EQ(e.value().size(), 7);
+
+	// Copies share storage.
+	coqcic::flat_sexpr copy = e.value();
+	EXPECT_EQ(copy.root().args()[0].args()[0].value().data(), root.args()[0].args()[0].value().data());
+}
+
+TEST(flat_sexpr_test, matches_sexpr) {
+	static const char* inputs[] = {
+		"(foo bar(baz bla   ))",
+		"  \n(App (Global plus)\t(Local x 0) (Local y 1))\r\n",
+		"terminal",
+		"(foo (bar",
+		"(foo ())",
+		"( )",
+		"(foo \"bar\")",
+		"",
+	};
+	for (const char* input : inputs) {
+		auto tree = coqcic::parse_sexpr(std::string_view(input));
+		auto flat = coqcic::parse_flat_sexpr(input);
+		ASSERT_EQ(!!tree, !!flat) << input;
+		if (tree) {
+			EXPECT_EQ(flat.value().debug_string(), tree.value().debug_string());
+			EXPECT_EQ(coqcic::flat_sexpr(tree.value()).debug_string(), tree.value().debug_string());
+		} else {
+			EXPECT_EQ(flat.error().description, tree.error().description) << input;
+			EXPECT_EQ(flat.error().location, tree.error().location) << input;
+		}
+	}
+}
@@ -1,796 +1,2443 @@
 #include "coqcic/from_sexpr.h"
 
-#include "coqcic/parse_sexpr.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+#include "coqcic/sexpr_scanner.h"
+#include "coqcic/work_stealing_pool.h"
 
 namespace coqcic {
 
 namespace {
 
-from_sexpr_result<std::optional<std::string>>
-argname_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
-		if (kind == "Name") {
-			if (args.size() != 1 || !args[0].as_terminal()) {
-				return from_sexpr_error {"Named argname requires single literal argument", &e};
-			}
-			return std::optional<std::string>(args[0].as_terminal()->value());
-		} else if (kind == "Anonymous") {
-			if (args.size() != 0) {
-				return from_sexpr_error {"Anonymous argname does not allow an argument", &e};
-			}
-			return std::optional<std::string>(std::nullopt);
-		} else {
-			return from_sexpr_error {"Unknown kind of argname", &e};
+// Parses a decimal unsigned integer literal.
+std::optional<std::size_t>
+uint_from_string(std::string_view s) {
+	if (s.empty()) {
+		return std::nullopt;
+	}
+	std::size_t value = 0;
+	for (char c : s) {
+		if (c < '0' || c > '9') {
+			return std::nullopt;
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into argname", &e};
+		value = value * 10 + (c - '0');
 	}
+	return value;
 }
 
-from_sexpr_result<std::size_t>
-uint_from_sexpr(const sexpr& e) {
-	if (auto t = e.as_terminal()) {
-		return std::stoi(t->value());
-	} else {
-		return from_sexpr_error {"Cannot parse non-terminal into integer", &e};
-	}
-}
+// Builds a function of a fixpoint group from its signature and definition
+// as exported: The leading arguments common to signature (product) and
+// definition (lambda) become the formal arguments of the function.
+fix_function_t
+make_fix_function(
+	std::optional<std::string> name,
+	constr_t sigtype,
+	constr_t fndef,
+	std::size_t nfunctions
+) {
+	std::string realname = name ? std::move(*name) : "_";
+
+	std::vector<formal_arg_t> args;
+	for (;;) {
+		auto sigtype_prod = sigtype.as_product();
+		auto fndef_lambda = fndef.as_lambda();
+
+		if (!sigtype_prod || !fndef_lambda) {
+			break;
+		}
 
-from_sexpr_result<std::string>
-string_from_sexpr(const sexpr& e) {
-	if (auto t = e.as_terminal()) {
-		return t->value();
-	} else {
-		return from_sexpr_error {"Cannot parse non-terminal into string", &e};
-	}
-}
+		std::size_t count = std::min(sigtype_prod->args().size(), fndef_lambda->args().size());
+		args.insert(args.end(), fndef_lambda->args().begin(), fndef_lambda->args().begin() + count);
 
-from_sexpr_result<constr_t>
-match_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
-		if (kind == "Match") {
-			if (args.size() != 1) {
-				return from_sexpr_error {"Match requires single argument", &e};
-			}
-			return constr_from_sexpr(args[0]);
+		std::vector<formal_arg_t> new_prod_args(sigtype_prod->args().begin() + count, sigtype_prod->args().end());
+		std::vector<formal_arg_t> new_fndef_args(fndef_lambda->args().begin() + count, fndef_lambda->args().end());
+
+		if (!new_prod_args.empty()) {
+			sigtype = builder::product(std::move(new_prod_args), sigtype_prod->restype());
 		} else {
-			return from_sexpr_error {"Unable to parse case match", &e};
+			sigtype = sigtype_prod->restype();
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into match", &e};
-	}
-}
-
-from_sexpr_result<match_branch_t>
-branch_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
 
-		if (kind == "Branch") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"Branch must have name and 2 arguments", &e};
-			}
-			auto consname = string_from_sexpr(args[0]);
-			auto nargs = uint_from_sexpr(args[1]);
-			auto expr = constr_from_sexpr(args[2]);
-			if (!nargs) {
-				return nargs.error();
-			}
-			if (!expr) {
-				return expr.error();
-			}
-			return match_branch_t {consname.move_value(), nargs.move_value(), expr.move_value() };
+		if (!new_fndef_args.empty()) {
+			fndef = builder::lambda(std::move(new_fndef_args), fndef_lambda->body());
 		} else {
-			return from_sexpr_error {"Unable to parse branch", &e};
+			fndef = fndef_lambda->body();
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into branch", &e};
 	}
+
+	return fix_function_t{std::move(realname), std::move(args), sigtype.shift(0, nfunctions), std::move(fndef)};
 }
 
-from_sexpr_result<std::vector<match_branch_t>>
-branches_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		auto kind = c->kind();
-		auto args = c->args();
-		if (kind == "Branches") {
-			std::vector<match_branch_t> branches;
-			for (const auto& arg : args) {
-				auto branch = branch_from_sexpr(arg);
-				if (!branch) {
-					return branch.error();
-				}
-				branches.push_back(branch.move_value());
+// If the given definition value is a fixpoint, check if its group matches
+// that one of the last fixpoint defined. It if does, then reuse it.
+constr_t
+share_fix_group(constr_t value, std::shared_ptr<const fix_group_t>& last_fix) {
+	if (auto fix = value.as_fix()) {
+		if (last_fix) {
+			if (fix->group() == last_fix || *fix->group() == *last_fix) {
+				return builder::fix(fix->index(), last_fix);
+			} else {
+				last_fix = fix->group();
 			}
-			return std::move(branches);
 		} else {
-			return from_sexpr_error {"Unable to parse branches", &e};
+			last_fix = fix->group();
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into branches", &e};
 	}
+	return value;
 }
 
-from_sexpr_result<fix_function_t>
-fixfunction_from_sexpr(const sexpr& e, std::size_t nfunctions) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
-		if (kind == "Function") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"Fixfunction requires 3 arguments", &e};
-			}
-			auto name = argname_from_sexpr(args[0]);
-			auto sigtype_parsed = constr_from_sexpr(args[1]);
-			auto fndef_parsed = constr_from_sexpr(args[2]);
-			if (!name) {
-				return name.error();
-			}
-			if (!sigtype_parsed) {
-				return sigtype_parsed.error();
-			}
-			if (!fndef_parsed) {
-				return fndef_parsed.error();
-			}
-			std::string realname = name.value() ? std::move(*name.move_value()) : "_";
+// Reporting of conversion errors: on sexpr trees, errors refer to the
+// offending node itself, on flat s-expressions to its location.
+template<typename Node>
+struct node_traits;
 
-			auto sigtype = sigtype_parsed.move_value();
-			auto fndef = fndef_parsed.move_value();
+template<>
+struct node_traits<sexpr> {
+	using error = from_sexpr_error;
+	using handle = std::reference_wrapper<const sexpr>;
 
-			std::vector<formal_arg_t> args;
-			for (;;) {
-				auto sigtype_prod = sigtype.as_product();
-				auto fndef_lambda = fndef.as_lambda();
+	static inline error
+	make_error(std::string description, const sexpr& e) {
+		return error{std::move(description), &e};
+	}
+};
 
-				if (!sigtype_prod || !fndef_lambda) {
-					break;
-				}
+template<>
+struct node_traits<flat_sexpr_ref> {
+	using error = from_sexpr_str_error;
+	using handle = flat_sexpr_ref;
+
+	static inline error
+	make_error(std::string description, const flat_sexpr_ref& e) {
+		return error{std::move(description), e.location()};
+	}
+};
 
-				std::size_t count = std::min(sigtype_prod->args().size(), fndef_lambda->args().size());
-				args.insert(args.end(), fndef_lambda->args().begin(), fndef_lambda->args().begin() + count);
+// Converts parsed s-expressions into constrs / sfbs, generic over the
+// representation of the s-expression (sexpr or flat_sexpr_ref).
+template<typename Node>
+class tree_converter {
+public:
+	using error = typename node_traits<Node>::error;
 
-				std::vector<formal_arg_t> new_prod_args(sigtype_prod->args().begin() + count, sigtype_prod->args().end());
-				std::vector<formal_arg_t> new_fndef_args(fndef_lambda->args().begin() + count, fndef_lambda->args().end());
+	template<typename T>
+	using result = parse_result<T, error>;
 
-				if (!new_prod_args.empty()) {
-					sigtype = builder::product(std::move(new_prod_args), sigtype_prod->restype());
-				} else {
-					sigtype = sigtype_prod->restype();
-				}
+	using mod_functor_args_t = std::vector<std::pair<std::string, modexpr>>;
+	using functored_modexpr_t = std::pair<mod_functor_args_t, modexpr>;
+	using modsig_t = std::pair<mod_functor_args_t, std::vector<sfb_t>>;
 
-				if (!new_fndef_args.empty()) {
-					fndef = builder::lambda(std::move(new_fndef_args), fndef_lambda->body());
-				} else {
-					fndef = fndef_lambda->body();
+	static inline error
+	make_error(std::string description, const Node& e) {
+		return node_traits<Node>::make_error(std::move(description), e);
+	}
+
+	static result<std::optional<std::string>>
+	argname(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
+			switch (c->kind_id()) {
+				case sexpr_kind_name: {
+					if (args.size() != 1 || !args[0].as_terminal()) {
+						return make_error("Named argname requires single literal argument", e);
+					}
+					return std::optional<std::string>(std::string(args[0].as_terminal()->value()));
+				}
+				case sexpr_kind_anonymous: {
+					if (args.size() != 0) {
+						return make_error("Anonymous argname does not allow an argument", e);
+					}
+					return std::optional<std::string>(std::nullopt);
+				}
+				default: {
+					return make_error("Unknown kind of argname", e);
 				}
 			}
-
-			return fix_function_t{std::move(realname), std::move(args), sigtype.shift(0, nfunctions), std::move(fndef)};
 		} else {
-			return from_sexpr_error {"Unable to parse fixfunction", &e};
+			return make_error("Cannot parse terminal into argname", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into fixfunction", &e};
 	}
-}
 
-}  // namespace
+	static result<std::size_t>
+	uint(const Node& e) {
+		if (auto t = e.as_terminal()) {
+			auto value = uint_from_string(t->value());
+			if (!value) {
+				return make_error("Cannot parse terminal into integer", e);
+			}
+			return *value;
+		} else {
+			return make_error("Cannot parse non-terminal into integer", e);
+		}
+	}
 
-from_sexpr_result<sfb_t>
-sfb_from_sexpr(const sexpr& e, std::shared_ptr<const fix_group_t>& last_fix);
+	static result<std::string>
+	string(const Node& e) {
+		if (auto t = e.as_terminal()) {
+			return std::string(t->value());
+		} else {
+			return make_error("Cannot parse non-terminal into string", e);
+		}
+	}
 
-from_sexpr_result<constr_t>
-constr_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
-		if (kind == "Sort") {
-			if (args.size() != 1 || !args[0].as_terminal()) {
-				return from_sexpr_error {"Sort requires literal sort name as single argument", &e};
-			}
-			const auto& name = args[0].as_terminal()->value();
-			if (name == "Prop") {
-				return builder::builtin_prop();
-			} else if (name == "Set") {
-				return builder::builtin_set();
-			} else if (name == "SProp") {
-				return builder::builtin_sprop();
-			} else if (name == "Type") {
-				return builder::builtin_type();
-			} else {
-				return from_sexpr_error {"Unknown kind of sort", &args[0]};
-			}
-		} else if (kind == "Global") {
-			if (args.size() != 1 || !args[0].as_terminal()) {
-				return from_sexpr_error {"Global requires literal name as single argument", &e};
-			}
-			const auto& name = args[0].as_terminal()->value();
-			return builder::global(name);
-		} else if (kind == "Local") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"Local requires literal name and index as arguments", &e};
-			}
-			auto name = string_from_sexpr(args[0]);
-			if (!name) {
-				return name.error();
-			}
-			auto index = uint_from_sexpr(args[1]);
-			if (!index) {
-				return index.error();
-			}
-			return builder::local(name.move_value(), index.move_value());
-		} else if (kind == "Prod") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"Product requires 3 arguments", &e};
-			}
-			auto argname = argname_from_sexpr(args[0]);
-			auto argtype = constr_from_sexpr(args[1]);
-			auto restype = constr_from_sexpr(args[2]);
-			if (!argname) {
-				return argname.error();
-			}
-			if (!argtype) {
-				return argtype.error();
-			}
-			if (!restype) {
-				return restype.error();
-			}
-			return builder::product({{argname.move_value(), argtype.move_value()}}, restype.move_value());
-		} else if (kind == "Lambda") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"Lambda requires 3 arguments", &e};
-			}
-			auto argname = argname_from_sexpr(args[0]);
-			auto argtype = constr_from_sexpr(args[1]);
-			auto body = constr_from_sexpr(args[2]);
-			if (!argname) {
-				return argname.error();
-			}
-			if (!argtype) {
-				return argtype.error();
-			}
-			if (!body) {
-				return body.error();
-			}
-			return builder::lambda({{argname.move_value(), argtype.move_value()}}, body.move_value());
-		} else if (kind == "LetIn") {
-			if (args.size() != 4) {
-				return from_sexpr_error {"LetIn requires 4 arguments", &e};
-			}
-			auto name = argname_from_sexpr(args[0]);
-			auto term = constr_from_sexpr(args[1]);
-			auto termtype = constr_from_sexpr(args[2]);
-			auto body = constr_from_sexpr(args[3]);
-			if (!name) {
-				return name.error();
-			}
-			if (!term) {
-				return term.error();
-			}
-			if (!termtype) {
-				return termtype.error();
-			}
-			if (!body) {
-				return body.error();
-			}
-			return builder::let(name.move_value(), term.move_value(), termtype.move_value(), body.move_value());
-		} else if (kind == "App") {
-			if (args.size() < 2) {
-				return from_sexpr_error {"Apply requires at least 2 arguments", &e};
-			}
-			auto fn = constr_from_sexpr(args[0]);
-			if (!fn) {
-				return fn.error();
-			}
-			std::vector<constr_t> app_args;
-			for (std::size_t n = 1; n < args.size(); ++n) {
-				auto arg = constr_from_sexpr(args[n]);
-				if (!arg) {
-					return arg.error();
+	// Converts a term. Nodes on the path to the node converted are kept on
+	// an explicit stack (see constr_frame), such that deeply nested terms
+	// do not exhaust the native stack.
+	static result<constr_t>
+	constr(const Node& e) {
+		// The first "depth" frames of the stack are in use, frames beyond
+		// are kept for reuse.
+		std::vector<constr_frame> stack;
+		stack.emplace_back(handle(e));
+		std::size_t depth = 1;
+		for (;;) {
+			auto step = constr_step(stack[depth - 1]);
+			if (auto child = std::get_if<handle>(&step)) {
+				if (depth == stack.size()) {
+					stack.emplace_back(*child);
+				} else {
+					stack[depth].reset(*child);
 				}
-				app_args.push_back(arg.move_value());
-			}
-			return builder::apply(fn.move_value(), std::move(app_args));
-		} else if (kind == "Cast") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"Cast requires 3 arguments", &e};
-			}
-			auto term = constr_from_sexpr(args[0]);
-			auto kind = string_from_sexpr(args[1]);
-			auto typeterm = constr_from_sexpr(args[2]);
-			if (!term) {
-				return term.error();
-			}
-			if (!kind) {
-				return kind.error();
-			}
-			if (!typeterm) {
-				return typeterm.error();
-			}
-			constr_cast::kind_type kind_enum;
-			if (kind.value() == "VMcast") {
-				kind_enum = constr_cast::vm_cast;
-			} else if (kind.value() == "DEFAULTcast") {
-				kind_enum = constr_cast::default_cast;
-			} else if (kind.value() == "REVERTcast") {
-				kind_enum = constr_cast::revert_cast;
-			} else if (kind.value() == "NATIVEcast") {
-				kind_enum = constr_cast::native_cast;
-			} else {
-				return from_sexpr_error {"Unknown kind of cast", &e};
-			}
-			return builder::cast(term.move_value(), kind_enum, typeterm.move_value());
-		} else if (kind == "Case") {
-			if (args.size() != 4) {
-				return from_sexpr_error {"Case requires at exactly 4 arguments", &e};
-			}
-			auto nargs = uint_from_sexpr(args[0]);
-			if (!nargs) {
-				return nargs.error();
-			}
-			auto casetype = constr_from_sexpr(args[1]);
-			if (!casetype) {
-				return casetype.error();
-			}
-			auto match = match_from_sexpr(args[2]);
-			if (!match) {
-				return match.error();
-			}
-			auto branches = branches_from_sexpr(args[3]);
-			if (!branches) {
-				return branches.error();
-			}
-			return builder::match(casetype.move_value(), match.move_value(), branches.move_value());
-		} else if (kind == "Fix") {
-			if (args.size() < 2) {
-				return from_sexpr_error {"Fix requires at least 2 arguments", &e};
-			}
-			auto index = uint_from_sexpr(args[0]);
-			if (!index) {
-				return index.error();
-			}
-			std::vector<fix_function_t> fns;
-			for (std::size_t n = 1; n < args.size(); ++n) {
-				const auto& arg = args[n];
-				auto fixfn = fixfunction_from_sexpr(arg, args.size() - 1);
-				if (!fixfn) {
-					return fixfn.error();
+				++depth;
+			} else if (auto term = std::get_if<constr_t>(&step)) {
+				--depth;
+				if (depth == 0) {
+					return std::move(*term);
 				}
-				fns.push_back(fixfn.move_value());
+				stack[depth - 1].terms.push_back(std::move(*term));
+			} else {
+				return std::get<error>(std::move(step));
 			}
-
-			return builder::fix(index.move_value(), std::make_shared<fix_group_t>(fix_group_t{std::move(fns)}));
-		} else {
-			return from_sexpr_error {"Unhandled kind of constr:" + kind, &e};
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into constr", &e};
 	}
-}
 
-from_sexpr_result<constructor_t>
-constructor_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<constructor_t>
+	constructor(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-		if (kind == "Constructor") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"Constructor requires 2 arguments", &e};
-			}
+			if (c->kind_id() == sexpr_kind_constructor) {
+				if (args.size() != 2) {
+					return make_error("Constructor requires 2 arguments", e);
+				}
 
-			auto id = string_from_sexpr(args[0]);
-			if (!id) {
-				return id.error();
-			}
-			auto type = constr_from_sexpr(args[1]);
-			if (!type) {
-				return type.error();
-			}
+				auto id = string(args[0]);
+				if (!id) {
+					return id.error();
+				}
+				auto type = constr(args[1]);
+				if (!type) {
+					return type.error();
+				}
 
-			return constructor_t { id.move_value(), type.move_value() };
+				return constructor_t { id.move_value(), type.move_value() };
+			} else {
+				return make_error("Unhandled kind of constructor", e);
+			}
 		} else {
-			return from_sexpr_error {"Unhandled kind of constructor", &e};
+			return make_error("Cannot parse terminal into constructor", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into constructor", &e};
 	}
-}
 
-from_sexpr_result<one_inductive_t>
-one_inductive_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<one_inductive_t>
+	one_inductive(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-		if (kind == "OneInductive") {
-			if (args.size() < 2) {
-				return from_sexpr_error {"Requires at least id and type for inductive", &e};
-			}
+			if (c->kind_id() == sexpr_kind_one_inductive) {
+				if (args.size() < 2) {
+					return make_error("Requires at least id and type for inductive", e);
+				}
 
-			auto id = string_from_sexpr(args[0]);
-			if (!id) {
-				return id.error();
-			}
-			auto type = constr_from_sexpr(args[1]);
-			if (!type) {
-				return type.error();
-			}
-			std::vector<constructor_t> constructors;
-			for (std::size_t n = 2; n < args.size(); ++n) {
-				const auto& arg = args[n];
-				auto cons = constructor_from_sexpr(arg);
-				if (!cons) {
-					return cons.error();
+				auto id = string(args[0]);
+				if (!id) {
+					return id.error();
+				}
+				auto type = constr(args[1]);
+				if (!type) {
+					return type.error();
+				}
+				std::vector<constructor_t> constructors;
+				for (std::size_t n = 2; n < args.size(); ++n) {
+					const auto& arg = args[n];
+					auto cons = constructor(arg);
+					if (!cons) {
+						return cons.error();
+					}
+					constructors.push_back(cons.move_value());
 				}
-				constructors.push_back(cons.move_value());
-			}
 
-			return one_inductive_t(id.move_value(), type.move_value(), std::move(constructors));
+				return one_inductive_t(id.move_value(), type.move_value(), std::move(constructors));
+			} else {
+				return make_error("Unhandled kind of sfb", e);
+			}
 		} else {
-			return from_sexpr_error {"Unhandled kind of sfb", &e};
+			return make_error("Cannot parse terminal into one_inductive", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into one_inductive", &e};
 	}
-}
 
-from_sexpr_result<modexpr>
-modexpr_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<modexpr>
+	mod_expr(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-		if (kind == "Apply") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"Apply requires exactly 2 arguments", &e};
-			}
+			if (c->kind_id() == sexpr_kind_apply) {
+				if (args.size() != 2) {
+					return make_error("Apply requires exactly 2 arguments", e);
+				}
 
-			auto inner = modexpr_from_sexpr(args[0]);
-			auto arg = string_from_sexpr(args[1]);
+				auto inner = mod_expr(args[0]);
+				auto arg = string(args[1]);
 
-			if (!inner) {
-				return inner.error();
-			}
-			if (!arg) {
-				return arg.error();
-			}
+				if (!inner) {
+					return inner.error();
+				}
+				if (!arg) {
+					return arg.error();
+				}
 
-			modexpr e = inner.move_value();
-			e.args.push_back(arg.move_value());
-			return {std::move(e)};
+				modexpr e = inner.move_value();
+				e.args.push_back(arg.move_value());
+				return {std::move(e)};
+			} else {
+				return make_error("Unhandled kind of modexpr", e);
+			}
+		} else if (auto t = e.as_terminal()) {
+			return {modexpr { std::string(t->value()), {} }};
 		} else {
-			return from_sexpr_error {"Unhandled kind of modexpr", &e};
+			return make_error("Unhandled kind of sexpr", e);
 		}
-	} else if (auto t = e.as_terminal()) {
-		return {modexpr { t->value(), {} }};
-	} else {
-		return from_sexpr_error {"Unhandled kind of sexpr", &e};
 	}
-}
 
-from_sexpr_result<std::pair<std::vector<std::pair<std::string, modexpr>>, modexpr>>
-functored_modexpr_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<functored_modexpr_t>
+	functored_modexpr(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-		if (kind == "Functor") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"functor requires exactly 3 arguments", &e};
-			}
+			if (c->kind_id() == sexpr_kind_functor) {
+				if (args.size() != 3) {
+					return make_error("functor requires exactly 3 arguments", e);
+				}
 
-			auto id = string_from_sexpr(args[0]);
-			auto type = modexpr_from_sexpr(args[1]);
-			auto inner = functored_modexpr_from_sexpr(args[2]);
+				auto id = string(args[0]);
+				auto type = mod_expr(args[1]);
+				auto inner = functored_modexpr(args[2]);
 
-			if (!id) {
-				return id.error();
-			}
-			if (!type) {
-				return type.error();
-			}
-			if (!inner) {
-				return inner.error();
-			}
+				if (!id) {
+					return id.error();
+				}
+				if (!type) {
+					return type.error();
+				}
+				if (!inner) {
+					return inner.error();
+				}
 
-			std::vector<std::pair<std::string, modexpr>> parameters;
-			modexpr expr;
-			std::tie(parameters, expr) = inner.move_value();
-			parameters.emplace_back(id.move_value(), type.move_value());
+				std::vector<std::pair<std::string, modexpr>> parameters;
+				modexpr expr;
+				std::tie(parameters, expr) = inner.move_value();
+				parameters.emplace_back(id.move_value(), type.move_value());
 
-			return std::pair<std::vector<std::pair<std::string, modexpr>>, modexpr>(std::move(parameters), std::move(expr));
+				return functored_modexpr_t(std::move(parameters), std::move(expr));
+			}
+		}
+		auto inner = mod_expr(e);
+		if (!inner) {
+			return inner.error();
 		}
-	}
-	auto inner = modexpr_from_sexpr(e);
-	if (!inner) {
-		return inner.error();
-	}
-
-	return std::pair<std::vector<std::pair<std::string, modexpr>>, modexpr>({}, inner.move_value());
-}
 
-namespace {
-using mod_functor_args_t = std::vector<std::pair<std::string, modexpr>>;
-}  // namespace
+		return functored_modexpr_t({}, inner.move_value());
+	}
 
-from_sexpr_result<std::pair<mod_functor_args_t, std::vector<sfb_t>>>
-modsig_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<modsig_t>
+	modsig(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
+
+			switch (c->kind_id()) {
+				case sexpr_kind_body: {
+					std::shared_ptr<const fix_group_t> last_fix;
+					modsig_t result;
+					for (const auto& arg : args) {
+						auto converted = sfb(arg, last_fix);
+						if (!converted) {
+							return converted.error();
+						}
+						result.second.push_back(converted.move_value());
+					}
 
-		if (kind == "Body") {
-			std::shared_ptr<const fix_group_t> last_fix;
-			std::pair<mod_functor_args_t, std::vector<sfb_t>> result;
-			for (const auto& arg : args) {
-				auto sfb = sfb_from_sexpr(arg, last_fix);
-				if (!sfb) {
-					return sfb.error();
+					return {std::move(result)};
+				}
+				case sexpr_kind_functor: {
+					if (args.size() != 3) {
+						return make_error("Functor requires exactly 3 arguments", e);
+					}
+					modsig_t result;
+					auto name = string(args[0]);
+					auto type = functored_modexpr(args[1]);
+					auto inner = modsig(args[2]);
+					if (!name) {
+						return name.error();
+					}
+					if (!type) {
+						return type.error();
+					}
+					if (!inner) {
+						return inner.error();
+					}
+					result = inner.move_value();
+					result.first.emplace_back(name.move_value(), type.move_value().second);
+					return {std::move(result)};
+				}
+				default: {
+					return make_error("Unhandled kind of modsig", e);
 				}
-				result.second.push_back(sfb.move_value());
-			}
-
-			return {std::move(result)};
-		} else if (kind == "Functor") {
-			std::pair<mod_functor_args_t, std::vector<sfb_t>> result;
-			auto name = string_from_sexpr(args[0]);
-			auto type = functored_modexpr_from_sexpr(args[1]);
-			auto inner = modsig_from_sexpr(args[2]);
-			if (!name) {
-				return name.error();
-			}
-			if (!type) {
-				return type.error();
-			}
-			if (!inner) {
-				return inner.error();
 			}
-			result = inner.move_value();
-			result.first.emplace_back(name.move_value(), type.move_value().second);
-			return {std::move(result)};
 		} else {
-			return from_sexpr_error {"Unhandled kind of modsig", &e};
+			return make_error("Cannot parse terminal into modsig", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into modsig", &e};
 	}
-}
 
-from_sexpr_result<std::optional<modexpr>>
-optional_mod_type_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<std::optional<modexpr>>
+	optional_mod_type(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-		if (kind == "Untyped") {
-			return std::optional<modexpr>(std::nullopt);
-		} else if (kind == "Typed") {
-			if (args.size() != 1) {
-				return from_sexpr_error {"Optional modtype requires exactly one argument", &e};
-			}
-			auto expr = functored_modexpr_from_sexpr(args[0]);
-			if (!expr) {
-				return expr.error();
-			}
+			switch (c->kind_id()) {
+				case sexpr_kind_untyped: {
+					return std::optional<modexpr>(std::nullopt);
+				}
+				case sexpr_kind_typed: {
+					if (args.size() != 1) {
+						return make_error("Optional modtype requires exactly one argument", e);
+					}
+					auto expr = functored_modexpr(args[0]);
+					if (!expr) {
+						return expr.error();
+					}
 
-			return std::optional<modexpr>(expr.move_value().second);
+					return std::optional<modexpr>(expr.move_value().second);
+				}
+				default: {
+					return make_error("Unknown kind of module body", e);
+				}
+			}
 		} else {
-			return from_sexpr_error {"Unknown kind of module body", &e};
+			return make_error("Cannot parse terminal into optional modtype", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into optional modtype", &e};
 	}
-}
 
-from_sexpr_result<module_body>
-module_body_from_sexpr(const sexpr& e) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
+	static result<module_body>
+	mod_body(const Node& e) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-		if (kind == "Algebraic") {
-			if (args.size() != 1) {
-				return from_sexpr_error {"Algebraic module requires exactly 1 argument", &e};
-			}
-			auto aexpr = functored_modexpr_from_sexpr(args[0]);
-			if (!aexpr) {
-				return aexpr.error();
-			}
+			switch (c->kind_id()) {
+				case sexpr_kind_algebraic: {
+					if (args.size() != 1) {
+						return make_error("Algebraic module requires exactly 1 argument", e);
+					}
+					auto aexpr = functored_modexpr(args[0]);
+					if (!aexpr) {
+						return aexpr.error();
+					}
 
-			std::vector<std::pair<std::string, modexpr>> parameters;
-			modexpr expr;
-			std::tie(parameters, expr) = aexpr.move_value();
-			std::reverse(parameters.begin(), parameters.end());
+					std::vector<std::pair<std::string, modexpr>> parameters;
+					modexpr expr;
+					std::tie(parameters, expr) = aexpr.move_value();
+					std::reverse(parameters.begin(), parameters.end());
 
-			return module_body(std::move(parameters), std::make_shared<module_body_algebraic_repr>(std::move(expr)));
-		} else if (kind == "Struct") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"Struct module definition requires exactly 2 arguments", &e};
-			}
-			auto optional_type = optional_mod_type_from_sexpr(args[0]);
-			auto modsig = modsig_from_sexpr(args[1]);
-			if (!optional_type) {
-				return optional_type.error();
-			}
-			if (!modsig) {
-				return modsig.error();
-			}
+					return module_body(std::move(parameters), std::make_shared<module_body_algebraic_repr>(std::move(expr)));
+				}
+				case sexpr_kind_struct: {
+					if (args.size() != 2) {
+						return make_error("Struct module definition requires exactly 2 arguments", e);
+					}
+					auto optional_type = optional_mod_type(args[0]);
+					auto sig = modsig(args[1]);
+					if (!optional_type) {
+						return optional_type.error();
+					}
+					if (!sig) {
+						return sig.error();
+					}
 
-			std::vector<std::pair<std::string, modexpr>> parameters;
-			std::vector<sfb_t> sfbs;
-			std::tie(parameters, sfbs) = modsig.move_value();
-			std::reverse(parameters.begin(), parameters.end());
+					std::vector<std::pair<std::string, modexpr>> parameters;
+					std::vector<sfb_t> sfbs;
+					std::tie(parameters, sfbs) = sig.move_value();
+					std::reverse(parameters.begin(), parameters.end());
 
-			return module_body(std::move(parameters), std::make_shared<module_body_struct_repr>(optional_type.move_value(), std::move(sfbs)));
+					return module_body(std::move(parameters), std::make_shared<module_body_struct_repr>(optional_type.move_value(), std::move(sfbs)));
+				}
+				default: {
+					return make_error("Unknown kind of module body", e);
+				}
+			}
 		} else {
-			return from_sexpr_error {"Unknown kind of module body", &e};
+			return make_error("Cannot parse terminal into module body", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into module body", &e};
 	}
-}
-
-from_sexpr_result<sfb_t>
-sfb_from_sexpr(const sexpr& e, std::shared_ptr<const fix_group_t>& last_fix) {
-	if (auto c = e.as_compound()) {
-		const auto& kind = c->kind();
-		const auto& args = c->args();
 
-		if (kind == "Definition") {
-			if (args.size() != 3) {
-				return from_sexpr_error {"Definition requires 3 arguments", &e};
-			}
+	static result<sfb_t>
+	sfb(const Node& e, std::shared_ptr<const fix_group_t>& last_fix) {
+		if (auto c = e.as_compound()) {
+			const auto& args = c->args();
 
-			auto id = string_from_sexpr(args[0]);
-			auto type = constr_from_sexpr(args[1]);
-			auto value = constr_from_sexpr(args[2]);
-			if (!id) {
-				return id.error();
-			}
-			if (!type) {
-				return type.error();
-			}
-			if (!value) {
-				return value.error();
-			}
+			switch (c->kind_id()) {
+				case sexpr_kind_definition: {
+					if (args.size() != 3) {
+						return make_error("Definition requires 3 arguments", e);
+					}
 
-			auto realvalue = value.move_value();
-			// If this is a definition of a fixpoint, check if its group matches
-			// that one of the last fixpoint defined. It if does, then reuse it.
-			if (auto fix = realvalue.as_fix()) {
-				if (last_fix) {
-					if (*fix->group() == *last_fix) {
-						realvalue = builder::fix(fix->index(), last_fix);
-					} else {
-						last_fix = fix->group();
+					auto id = string(args[0]);
+					auto type = constr(args[1]);
+					auto value = constr(args[2]);
+					if (!id) {
+						return id.error();
 					}
-				} else {
-					last_fix = fix->group();
+					if (!type) {
+						return type.error();
+					}
+					if (!value) {
+						return value.error();
+					}
+
+					return builder::definition(
+						id.move_value(), type.move_value(), share_fix_group(value.move_value(), last_fix));
 				}
-			}
+				case sexpr_kind_axiom: {
+					if (args.size() != 2) {
+						return make_error("Axiom requires 2 arguments", e);
+					}
 
-			return builder::definition(id.move_value(), type.move_value(), std::move(realvalue));
-		} else if (kind == "Axiom") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"Axiom requires 2 arguments", &e};
-			}
+					auto id = string(args[0]);
+					auto type = constr(args[1]);
+					if (!id) {
+						return id.error();
+					}
+					if (!type) {
+						return type.error();
+					}
 
-			auto id = string_from_sexpr(args[0]);
-			auto type = constr_from_sexpr(args[1]);
-			if (!id) {
-				return id.error();
-			}
-			if (!type) {
-				return type.error();
-			}
+					return builder::axiom(id.move_value(), type.move_value());
+				}
+				case sexpr_kind_inductive: {
+					if (args.size() < 1) {
+						return make_error("Requires at least one inductive definition", e);
+					}
 
-			return builder::axiom(id.move_value(), type.move_value());
-		} else if (kind == "Inductive") {
-			if (args.size() < 1) {
-				return from_sexpr_error {"Requires at least one inductive definition", &e};
-			}
+					std::vector<one_inductive_t> inds;
+					for (const auto& arg : args) {
+						auto ind = one_inductive(arg);
+						if (!ind) {
+							return ind.error();
+						}
+						inds.push_back(ind.move_value());
+					}
 
-			std::vector<one_inductive_t> inds;
-			for (const auto& arg : args) {
-				auto ind = one_inductive_from_sexpr(arg);
-				if (!ind) {
-					return ind.error();
+					return builder::inductive(std::move(inds));
 				}
-				inds.push_back(ind.move_value());
-			}
-
-			return builder::inductive(std::move(inds));
-		} else if (kind == "Module") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"Module requires exactly two arguments", &e};
-			}
+				case sexpr_kind_module: {
+					if (args.size() != 2) {
+						return make_error("Module requires exactly two arguments", e);
+					}
 
-			auto id = string_from_sexpr(args[0]);
-			auto body = module_body_from_sexpr(args[1]);
-			if (!id) {
-				return id.error();
-			}
-			if (!body) {
-				return body.error();
-			}
+					auto id = string(args[0]);
+					auto body = mod_body(args[1]);
+					if (!id) {
+						return id.error();
+					}
+					if (!body) {
+						return body.error();
+					}
 
-			return builder::module_def(id.move_value(), body.move_value());
-		} else if (kind == "ModuleType") {
-			if (args.size() != 2) {
-				return from_sexpr_error {"ModuleType requires exactly two arguments", &e};
-			}
-			auto id = string_from_sexpr(args[0]);
-			auto modsig = modsig_from_sexpr(args[1]);
+					return builder::module_def(id.move_value(), body.move_value());
+				}
+				case sexpr_kind_module_type: {
+					if (args.size() != 2) {
+						return make_error("ModuleType requires exactly two arguments", e);
+					}
+					auto id = string(args[0]);
+					auto sig = modsig(args[1]);
 
-			if (!id) {
-				return id.error();
-			}
-			if (!modsig) {
-				return modsig.error();
-			}
+					if (!id) {
+						return id.error();
+					}
+					if (!sig) {
+						return sig.error();
+					}
 
-			std::vector<std::pair<std::string, modexpr>> parameters;
-			std::vector<sfb_t> sfbs;
-			std::tie(parameters, sfbs) = modsig.move_value();
-			std::reverse(parameters.begin(), parameters.end());
+					std::vector<std::pair<std::string, modexpr>> parameters;
+					std::vector<sfb_t> sfbs;
+					std::tie(parameters, sfbs) = sig.move_value();
+					std::reverse(parameters.begin(), parameters.end());
 
-			return builder::module_type_def(
-				id.move_value(),
-				module_body(std::move(parameters), std::make_shared<module_body_struct_repr>(std::nullopt, std::move(sfbs))));
+					return builder::module_type_def(
+						id.move_value(),
+						module_body(std::move(parameters), std::make_shared<module_body_struct_repr>(std::nullopt, std::move(sfbs))));
+				}
+				default: {
+					return make_error("Unhandled kind of sfb", e);
+				}
+			}
 		} else {
-			return from_sexpr_error {"Unhandled kind of sfb", &e};
+			return make_error("Cannot parse terminal into sfb", e);
 		}
-	} else {
-		return from_sexpr_error {"Cannot parse terminal into sfb", &e};
-	}
-}
-
-from_sexpr_result<sfb_t>
-sfb_from_sexpr(const sexpr& e) {
-	std::shared_ptr<const fix_group_t> tmp;
-	return sfb_from_sexpr(e, tmp);
-}
-
-from_sexpr_str_result<constr_t>
-constr_from_sexpr_str(const std::string& str) {
-	auto e = parse_sexpr(str);
-	if (!e) {
-		return from_sexpr_str_error {e.error().description, e.error().location};
 	}
 
-	auto c = constr_from_sexpr(e.value());
-	if (!c) {
-		return from_sexpr_str_error {
-			c.error().description,
-			c.error().context ? c.error().context->location() : 0
-		};
-	}
+private:
+	// Reference to a node, as held by constr_frame.
+	using handle = typename node_traits<Node>::handle;
+
+	// Term being converted. Terms converted from its children so far are
+	// collected in "terms", along with the names and numbers (argument
+	// names, constructor names and argument counts of branches, ...)
+	// validated before descending into children. Frames are reused for
+	// the nodes converted at the same depth, keeping the capacity of their
+	// vectors.
+	struct constr_frame {
+		explicit
+		constr_frame(handle n) : node(n) {}
+
+		void
+		reset(handle n) {
+			node = n;
+			terms.clear();
+			names.clear();
+			numbers.clear();
+			functions.clear();
+		}
 
-	return c.move_value();
-}
+		handle node;
+		std::vector<constr_t> terms;
+		std::vector<std::optional<std::string>> names;
+		std::vector<std::size_t> numbers;
+		std::vector<fix_function_t> functions;
+	};
+
+	// Outcome of advancing the conversion of a term: the converted term, a
+	// child to convert next, or an error.
+	using constr_step_result = std::variant<constr_t, handle, error>;
+
+	// Advances the conversion of the term of the frame, given the terms
+	// converted from its children so far. Checks the node and converts
+	// its parts in the same order as a recursive descent would, such that
+	// the same first error is reported.
+	static constr_step_result
+	constr_step(constr_frame& frame) {
+		const Node& e = frame.node;
+		auto c = e.as_compound();
+		if (!c) {
+			return make_error("Cannot parse terminal into constr", e);
+		}
+		const auto& args = c->args();
+		auto& terms = frame.terms;
+		std::size_t stage = terms.size();
+		switch (c->kind_id()) {
+			case sexpr_kind_sort: {
+				if (args.size() != 1 || !args[0].as_terminal()) {
+					return make_error("Sort requires literal sort name as single argument", e);
+				}
+				const auto& name = args[0].as_terminal()->value();
+				if (name == "Prop") {
+					return builder::builtin_prop();
+				} else if (name == "Set") {
+					return builder::builtin_set();
+				} else if (name == "SProp") {
+					return builder::builtin_sprop();
+				} else if (name == "Type") {
+					return builder::builtin_type();
+				} else {
+					return make_error("Unknown kind of sort", args[0]);
+				}
+			}
+			case sexpr_kind_global: {
+				if (args.size() != 1 || !args[0].as_terminal()) {
+					return make_error("Global requires literal name as single argument", e);
+				}
+				const auto& name = args[0].as_terminal()->value();
+				return builder::global(std::string(name));
+			}
+			case sexpr_kind_local: {
+				if (args.size() != 2) {
+					return make_error("Local requires literal name and index as arguments", e);
+				}
+				auto name = string(args[0]);
+				if (!name) {
+					return name.error();
+				}
+				auto index = uint(args[1]);
+				if (!index) {
+					return index.error();
+				}
+				return builder::local(name.move_value(), index.move_value());
+			}
+			case sexpr_kind_prod:
+			case sexpr_kind_lambda: {
+				if (stage == 0) {
+					if (args.size() != 3) {
+						return make_error(
+							c->kind_id() == sexpr_kind_prod ?
+								"Product requires 3 arguments" : "Lambda requires 3 arguments",
+							e);
+					}
+					auto name = argname(args[0]);
+					if (!name) {
+						return name.error();
+					}
+					frame.names.push_back(name.move_value());
+					return handle(args[1]);
+				} else if (stage == 1) {
+					return handle(args[2]);
+				}
+				std::vector<formal_arg_t> binder{{std::move(frame.names[0]), std::move(terms[0])}};
+				if (c->kind_id() == sexpr_kind_prod) {
+					return builder::product(std::move(binder), std::move(terms[1]));
+				} else {
+					return builder::lambda(std::move(binder), std::move(terms[1]));
+				}
+			}
+			case sexpr_kind_let_in: {
+				if (stage == 0) {
+					if (args.size() != 4) {
+						return make_error("LetIn requires 4 arguments", e);
+					}
+					auto name = argname(args[0]);
+					if (!name) {
+						return name.error();
+					}
+					frame.names.push_back(name.move_value());
+				}
+				if (stage < 3) {
+					return handle(args[stage + 1]);
+				}
+				return builder::let(std::move(frame.names[0]), std::move(terms[0]), std::move(terms[1]), std::move(terms[2]));
+			}
+			case sexpr_kind_app: {
+				if (stage == 0 && args.size() < 2) {
+					return make_error("Apply requires at least 2 arguments", e);
+				}
+				if (stage < args.size()) {
+					return handle(args[stage]);
+				}
+				std::vector<constr_t> app_args(
+					std::make_move_iterator(terms.begin() + 1), std::make_move_iterator(terms.end()));
+				return builder::apply(std::move(terms[0]), std::move(app_args));
+			}
+			case sexpr_kind_cast: {
+				if (stage == 0) {
+					if (args.size() != 3) {
+						return make_error("Cast requires 3 arguments", e);
+					}
+					return handle(args[0]);
+				}
+				auto kind = string(args[1]);
+				if (!kind) {
+					return kind.error();
+				}
+				if (stage == 1) {
+					return handle(args[2]);
+				}
+				constr_cast::kind_type kind_enum;
+				if (kind.value() == "VMcast") {
+					kind_enum = constr_cast::vm_cast;
+				} else if (kind.value() == "DEFAULTcast") {
+					kind_enum = constr_cast::default_cast;
+				} else if (kind.value() == "REVERTcast") {
+					kind_enum = constr_cast::revert_cast;
+				} else if (kind.value() == "NATIVEcast") {
+					kind_enum = constr_cast::native_cast;
+				} else {
+					return make_error("Unknown kind of cast", e);
+				}
+				return builder::cast(std::move(terms[0]), kind_enum, std::move(terms[1]));
+			}
+			case sexpr_kind_case: {
+				if (stage == 0) {
+					if (args.size() != 4) {
+						return make_error("Case requires at exactly 4 arguments", e);
+					}
+					auto nargs = uint(args[0]);
+					if (!nargs) {
+						return nargs.error();
+					}
+					return handle(args[1]);
+				} else if (stage == 1) {
+					const Node& m = args[2];
+					auto mc = m.as_compound();
+					if (!mc) {
+						return make_error("Cannot parse terminal into match", m);
+					}
+					if (mc->kind_id() != sexpr_kind_match) {
+						return make_error("Unable to parse case match", m);
+					}
+					if (mc->args().size() != 1) {
+						return make_error("Match requires single argument", m);
+					}
+					return handle(mc->args()[0]);
+				}
+
+				const Node& bs = args[3];
+				auto bsc = bs.as_compound();
+				if (!bsc) {
+					return make_error("Cannot parse terminal into branches", bs);
+				}
+				if (bsc->kind_id() != sexpr_kind_branches) {
+					return make_error("Unable to parse branches", bs);
+				}
+				const auto& branch_nodes = bsc->args();
+				std::size_t index = stage - 2;
+				if (index < branch_nodes.size()) {
+					const Node& b = branch_nodes[index];
+					auto bc = b.as_compound();
+					if (!bc) {
+						return make_error("Cannot parse terminal into branch", b);
+					}
+					if (bc->kind_id() != sexpr_kind_branch) {
+						return make_error("Unable to parse branch", b);
+					}
+					const auto& branch_args = bc->args();
+					if (branch_args.size() != 3) {
+						return make_error("Branch must have name and 2 arguments", b);
+					}
+					auto consname = string(branch_args[0]);
+					if (!consname) {
+						return consname.error();
+					}
+					auto nargs = uint(branch_args[1]);
+					if (!nargs) {
+						return nargs.error();
+					}
+					frame.names.push_back(consname.move_value());
+					frame.numbers.push_back(nargs.move_value());
+					return handle(branch_args[2]);
+				}
+
+				std::vector<match_branch_t> branches;
+				branches.reserve(branch_nodes.size());
+				for (std::size_t n = 0; n < branch_nodes.size(); ++n) {
+					branches.push_back(match_branch_t{std::move(*frame.names[n]), frame.numbers[n], std::move(terms[n + 2])});
+				}
+				return builder::match(std::move(terms[0]), std::move(terms[1]), std::move(branches));
+			}
+			case sexpr_kind_fix: {
+				if (stage == 0) {
+					if (args.size() < 2) {
+						return make_error("Fix requires at least 2 arguments", e);
+					}
+					auto index = uint(args[0]);
+					if (!index) {
+						return index.error();
+					}
+					frame.numbers.push_back(index.move_value());
+				}
+
+				// Terms are signature and definition of each
+				// function in turn.
+				std::size_t nfunctions = args.size() - 1;
+				std::size_t function = stage / 2;
+				if (stage % 2 == 1) {
+					return handle(args[function + 1].as_compound()->args()[2]);
+				}
+				if (stage > 0) {
+					frame.functions.push_back(make_fix_function(
+						std::move(frame.names[function - 1]),
+						std::move(terms[stage - 2]),
+						std::move(terms[stage - 1]),
+						nfunctions));
+				}
+				if (function < nfunctions) {
+					const Node& f = args[function + 1];
+					auto fc = f.as_compound();
+					if (!fc) {
+						return make_error("Cannot parse terminal into fixfunction", f);
+					}
+					if (fc->kind_id() != sexpr_kind_function) {
+						return make_error("Unable to parse fixfunction", f);
+					}
+					const auto& function_args = fc->args();
+					if (function_args.size() != 3) {
+						return make_error("Fixfunction requires 3 arguments", f);
+					}
+					auto name = argname(function_args[0]);
+					if (!name) {
+						return name.error();
+					}
+					frame.names.push_back(name.move_value());
+					return handle(function_args[1]);
+				}
+
+				return builder::fix(
+					frame.numbers[0],
+					std::make_shared<fix_group_t>(fix_group_t{std::move(frame.functions)}));
+			}
+			default: {
+				return make_error("Unhandled kind of constr:" + c->kind(), e);
+			}
+		}
+	}
+};
+
+}  // namespace
+
+from_sexpr_result<constr_t>
+constr_from_sexpr(const sexpr& e) {
+	return tree_converter<sexpr>::constr(e);
+}
+
+from_sexpr_result<sfb_t>
+sfb_from_sexpr(const sexpr& e, std::shared_ptr<const fix_group_t>& last_fix) {
+	return tree_converter<sexpr>::sfb(e, last_fix);
+}
+
+from_sexpr_result<sfb_t>
+sfb_from_sexpr(const sexpr& e) {
+	std::shared_ptr<const fix_group_t> tmp;
+	return sfb_from_sexpr(e, tmp);
+}
+
+from_sexpr_result<std::optional<modexpr>>
+optional_mod_type_from_sexpr(const sexpr& e) {
+	return tree_converter<sexpr>::optional_mod_type(e);
+}
+
+from_sexpr_result<std::pair<std::vector<std::pair<std::string, modexpr>>, modexpr>>
+functored_modexpr_from_sexpr(const sexpr& e) {
+	return tree_converter<sexpr>::functored_modexpr(e);
+}
+
+from_sexpr_str_result<constr_t>
+constr_from_sexpr(flat_sexpr_ref e) {
+	return tree_converter<flat_sexpr_ref>::constr(e);
+}
 
 from_sexpr_str_result<sfb_t>
-sfb_from_sexpr_str(const std::string& str) {
-	auto e = parse_sexpr(str);
-	if (!e) {
-		return from_sexpr_str_error {e.error().description, e.error().location};
+sfb_from_sexpr(flat_sexpr_ref e, std::shared_ptr<const fix_group_t>& last_fix) {
+	return tree_converter<flat_sexpr_ref>::sfb(e, last_fix);
+}
+
+from_sexpr_str_result<sfb_t>
+sfb_from_sexpr(flat_sexpr_ref e) {
+	std::shared_ptr<const fix_group_t> tmp;
+	return sfb_from_sexpr(e, tmp);
+}
+
+namespace {
+
+// Converts each sfb independently on the pool, then links fixpoint groups
+// of consecutive definitions in sequence order, such that the result is
+// the same as converting sequentially with a common "last_fix".
+template<typename Node, typename Range>
+parse_result<std::vector<sfb_t>, typename node_traits<Node>::error>
+sfbs_from_sexpr_parallel(const Range& es, work_stealing_pool& pool) {
+	using result_type = typename tree_converter<Node>::template result<sfb_t>;
+
+	std::vector<std::optional<result_type>> results(es.size());
+	pool.parallel_for(es.size(), [&es, &results](std::size_t n) {
+		std::shared_ptr<const fix_group_t> last_fix;
+		results[n].emplace(tree_converter<Node>::sfb(es[n], last_fix));
+	});
+
+	std::vector<sfb_t> sfbs;
+	sfbs.reserve(results.size());
+	std::shared_ptr<const fix_group_t> last_fix;
+	for (auto& result : results) {
+		if (!*result) {
+			return result->error();
+		}
+		sfb_t sfb = result->move_value();
+		if (auto def = sfb.as_definition()) {
+			auto value = share_fix_group(def->value(), last_fix);
+			if (value.repr() != def->value().repr()) {
+				sfb = builder::definition(def->id(), def->type(), std::move(value));
+			}
+		}
+		sfbs.push_back(std::move(sfb));
+	}
+	return std::move(sfbs);
+}
+
+}  // namespace
+
+from_sexpr_result<std::vector<sfb_t>>
+sfbs_from_sexpr(const std::vector<sexpr>& es, work_stealing_pool& pool) {
+	return sfbs_from_sexpr_parallel<sexpr>(es, pool);
+}
+
+from_sexpr_str_result<std::vector<sfb_t>>
+sfbs_from_sexpr(flat_sexpr_ref::args_type es, work_stealing_pool& pool) {
+	return sfbs_from_sexpr_parallel<flat_sexpr_ref>(es, pool);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Direct conversion from text
+
+namespace {
+
+// Converts s-expression text directly into constrs / sfbs, dispatching on
+// the kind of each compound as it is scanned, without building an sexpr
+// tree first. Produces the same results and errors as parsing the text
+// with parse_sexpr and converting the tree with constr_from_sexpr /
+// sfb_from_sexpr:
+//
+// - syntax errors take precedence over conversion errors, the remainder
+//   of the input is therefore still scanned after a conversion error
+// - the number of arguments of a compound is only known after all of them
+//   have been scanned, errors on the arity override errors in arguments
+// - otherwise, the first error in order of arguments is reported
+//
+// Compounds nested within terms are kept on an explicit stack (see
+// constr_frame) and skipped compounds are counted, such that deeply
+// nested input does not exhaust the native stack.
+class text_converter {
+public:
+	template<typename T>
+	using result = from_sexpr_str_result<T>;
+	using error = from_sexpr_str_error;
+
+	inline explicit
+	text_converter(std::string_view data) noexcept : scan_(data) {
+		scan_.skip_whitespace();
+	}
+
+	result<constr_t>
+	constr();
+
+	result<sfb_t>
+	sfb(std::shared_ptr<const fix_group_t>& last_fix);
+
+	inline bool
+	failed() const noexcept {
+		return !!syntax_error_;
+	}
+
+	inline const error&
+	syntax_error() const noexcept {
+		return *syntax_error_;
+	}
+
+private:
+	struct fix_function_parts {
+		std::optional<std::string> name;
+		constr_t sigtype;
+		constr_t fndef;
+	};
+
+	// Compounds converted by constr() on its stack: terms holding terms,
+	// and the parts of terms holding terms.
+	enum class part_type {
+		constr,
+		match,
+		branches,
+		branch,
+		function,
+	};
+
+	// Arguments of compounds converted by constr(). Those holding terms
+	// are in the order of part_type.
+	enum class arg_type {
+		string,
+		uint,
+		argname,
+		skip,
+		constr,
+		match,
+		branches,
+		branch,
+		function,
+	};
+
+	// Compound being converted by constr(). Holds the number of arguments
+	// scanned so far, the values converted from them and the first error
+	// in any of them. Compounds take at most one name, string and number,
+	// and all but App at most 3 terms, which are held inline; only
+	// further terms, branches and functions are kept in vectors. Frames
+	// are reused for the compounds converted at the same depth, keeping
+	// the capacity of their vectors.
+	struct constr_frame {
+		static constexpr std::size_t inline_terms = 3;
+
+		void
+		reset(part_type p, sexpr_kind_t k, std::size_t l) {
+			part = p;
+			kind = k;
+			location = l;
+			n = 0;
+			first.reset();
+			for (std::size_t index = 0; index < std::min(nterms, inline_terms); ++index) {
+				terms[index].reset();
+			}
+			nterms = 0;
+			more_terms.clear();
+			name.reset();
+			string.reset();
+			number.reset();
+			branches.clear();
+			functions.clear();
+		}
+
+		void
+		push_term(constr_t term) {
+			if (nterms < inline_terms) {
+				terms[nterms].emplace(std::move(term));
+			} else {
+				more_terms.push_back(std::move(term));
+			}
+			++nterms;
+		}
+
+		inline constr_t&
+		term(std::size_t index) noexcept {
+			return *terms[index];
+		}
+
+		part_type part = part_type::constr;
+		sexpr_kind_t kind = sexpr_kind_unknown;
+		std::size_t location = 0;
+		std::size_t n = 0;
+		std::optional<error> first;
+		std::optional<constr_t> terms[inline_terms];
+		std::size_t nterms = 0;
+		std::vector<constr_t> more_terms;
+		std::optional<std::optional<std::string>> name;
+		std::optional<std::string> string;
+		std::optional<std::size_t> number;
+		std::vector<match_branch_t> branches;
+		std::vector<fix_function_parts> functions;
+	};
+
+	using functored_modexpr_t = std::pair<std::vector<std::pair<std::string, modexpr>>, modexpr>;
+	using modsig_t = std::pair<std::vector<std::pair<std::string, modexpr>>, std::vector<sfb_t>>;
+
+	// Records result of converting an argument, keeping the first error.
+	template<typename T>
+	static inline void
+	take(result<T> r, std::optional<T>& value, std::optional<error>& first) {
+		if (r) {
+			value.emplace(r.move_value());
+		} else if (!first) {
+			first = r.error();
+		}
+	}
+
+	template<typename T>
+	static inline void
+	take(result<T> r, std::vector<T>& values, std::optional<error>& first) {
+		if (r) {
+			values.push_back(r.move_value());
+		} else if (!first) {
+			first = r.error();
+		}
+	}
+
+	inline error
+	syntax(std::string description) {
+		syntax_error_ = error{std::move(description), scan_.index()};
+		return *syntax_error_;
+	}
+
+	// Whether another argument of the current compound follows.
+	inline bool
+	more() const noexcept {
+		char c = scan_.current();
+		return c != 0 && c != ')';
+	}
+
+	// The following return false on syntax error.
+	bool
+	terminal(std::string_view& value);
+
+	bool
+	enter(std::string_view& kind);
+
+	bool
+	leave();
+
+	bool
+	skip_expr();
+
+	bool
+	skip_rest();
+
+	bool
+	literal_arg(std::optional<std::string_view>& value);
+
+	result<std::string>
+	string_arg();
+
+	result<std::size_t>
+	uint_arg();
+
+	result<std::optional<std::string>>
+	argname();
+
+	// Begins converting the compound at the scan position as "part",
+	// resetting the frame for it. Returns false instead if the compound
+	// holds no terms or is not of a kind converted as "part", recording
+	// its value or error in the parent, or on syntax error.
+	bool
+	begin(part_type part, constr_frame& frame, constr_frame& parent);
+
+	// Converts the arguments of a compound of the kind of a term holding
+	// no terms (sort, global or local).
+	result<constr_t>
+	leaf(sexpr_kind_t kind, std::size_t location);
+
+	// Kind of the next argument of the compound of the frame.
+	static arg_type
+	next_arg(const constr_frame& frame) noexcept;
+
+	// Records the value of the compound of the frame in the parent, all
+	// arguments having been scanned.
+	static void
+	finish(constr_frame& frame, constr_frame& parent);
+
+	// Records the error converting an argument of the parent, keeping the
+	// first one.
+	static inline void
+	fail(constr_frame& parent, error e) {
+		if (!parent.first) {
+			parent.first = std::move(e);
+		}
+	}
+
+	result<constructor_t>
+	constructor();
+
+	result<one_inductive_t>
+	one_inductive();
+
+	result<modexpr>
+	modexpr_compound(std::string_view kind, std::size_t location);
+
+	result<modexpr>
+	mod_expr();
+
+	result<functored_modexpr_t>
+	functored_modexpr();
+
+	result<std::optional<modexpr>>
+	optional_mod_type();
+
+	result<modsig_t>
+	modsig();
+
+	result<module_body>
+	mod_body();
+
+	sexpr_buffer_scanner scan_;
+	std::optional<error> syntax_error_;
+	// Frames of constr(), see there.
+	std::vector<constr_frame> stack_;
+};
+
+bool
+text_converter::terminal(std::string_view& value) {
+	value = scan_.scan_normal();
+	if (value.empty()) {
+		syntax("Empty or invalid terminal");
+		return false;
+	}
+	scan_.skip_whitespace();
+	return true;
+}
+
+bool
+text_converter::enter(std::string_view& kind) {
+	scan_.advance();
+	scan_.skip_whitespace();
+	kind = scan_.scan_normal();
+	if (kind.empty()) {
+		syntax("Empty or invalid compound kind");
+		return false;
+	}
+	scan_.skip_whitespace();
+	return true;
+}
+
+bool
+text_converter::leave() {
+	if (scan_.current() == 0) {
+		syntax("Unexpected end of stream");
+		return false;
+	}
+	scan_.advance();
+	scan_.skip_whitespace();
+	return true;
+}
+
+bool
+text_converter::skip_expr() {
+	// Number of compounds entered and not yet left.
+	std::size_t open = 0;
+	do {
+		if (scan_.current() == '(') {
+			std::string_view kind;
+			if (!enter(kind)) {
+				return false;
+			}
+			++open;
+		} else if (open && !more()) {
+			if (!leave()) {
+				return false;
+			}
+			--open;
+		} else {
+			std::string_view value;
+			if (!terminal(value)) {
+				return false;
+			}
+		}
+	} while (open);
+	return true;
+}
+
+bool
+text_converter::skip_rest() {
+	while (more()) {
+		if (!skip_expr()) {
+			return false;
+		}
+	}
+	return leave();
+}
+
+bool
+text_converter::literal_arg(std::optional<std::string_view>& value) {
+	if (scan_.current() == '(') {
+		return skip_expr();
+	}
+	std::string_view v;
+	if (!terminal(v)) {
+		return false;
+	}
+	value = v;
+	return true;
+}
+
+text_converter::result<std::string>
+text_converter::string_arg() {
+	std::size_t location = scan_.index();
+	std::optional<std::string_view> value;
+	if (!literal_arg(value)) {
+		return syntax_error();
+	}
+	if (!value) {
+		return error{"Cannot parse non-terminal into string", location};
+	}
+	return std::string(*value);
+}
+
+text_converter::result<std::size_t>
+text_converter::uint_arg() {
+	std::size_t location = scan_.index();
+	std::optional<std::string_view> value;
+	if (!literal_arg(value)) {
+		return syntax_error();
+	}
+	if (!value) {
+		return error{"Cannot parse non-terminal into integer", location};
+	}
+	auto n = uint_from_string(*value);
+	if (!n) {
+		return error{"Cannot parse terminal into integer", location};
+	}
+	return *n;
+}
+
+text_converter::result<std::optional<std::string>>
+text_converter::argname() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into argname", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	sexpr_kind_t kind_id = find_sexpr_kind(kind);
+
+	if (kind_id == sexpr_kind_name) {
+		std::size_t n = 0;
+		std::optional<std::string_view> name;
+		while (more()) {
+			if (!(n++ == 0 ? literal_arg(name) : skip_expr())) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 1 || !name) {
+			return error{"Named argname requires single literal argument", location};
+		}
+		return std::optional<std::string>(std::string(*name));
+	} else if (kind_id == sexpr_kind_anonymous) {
+		std::size_t n = 0;
+		while (more()) {
+			++n;
+			if (!skip_expr()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 0) {
+			return error{"Anonymous argname does not allow an argument", location};
+		}
+		return std::optional<std::string>(std::nullopt);
+	} else {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unknown kind of argname", location};
+	}
+}
+
+text_converter::arg_type
+text_converter::next_arg(const constr_frame& frame) noexcept {
+	std::size_t n = frame.n;
+	switch (frame.part) {
+		case part_type::match: {
+			return n == 0 ? arg_type::constr : arg_type::skip;
+		}
+		case part_type::branches: {
+			return arg_type::branch;
+		}
+		case part_type::branch: {
+			static const arg_type args[] = {arg_type::string, arg_type::uint, arg_type::constr};
+			return n < 3 ? args[n] : arg_type::skip;
+		}
+		case part_type::function: {
+			static const arg_type args[] = {arg_type::argname, arg_type::constr, arg_type::constr};
+			return n < 3 ? args[n] : arg_type::skip;
+		}
+		case part_type::constr: {
+			break;
+		}
+	}
+	switch (frame.kind) {
+		case sexpr_kind_prod:
+		case sexpr_kind_lambda: {
+			static const arg_type args[] = {arg_type::argname, arg_type::constr, arg_type::constr};
+			return n < 3 ? args[n] : arg_type::skip;
+		}
+		case sexpr_kind_let_in: {
+			static const arg_type args[] = {arg_type::argname, arg_type::constr, arg_type::constr, arg_type::constr};
+			return n < 4 ? args[n] : arg_type::skip;
+		}
+		case sexpr_kind_app: {
+			return arg_type::constr;
+		}
+		case sexpr_kind_cast: {
+			static const arg_type args[] = {arg_type::constr, arg_type::string, arg_type::constr};
+			return n < 3 ? args[n] : arg_type::skip;
+		}
+		case sexpr_kind_case: {
+			static const arg_type args[] = {arg_type::uint, arg_type::constr, arg_type::match, arg_type::branches};
+			return n < 4 ? args[n] : arg_type::skip;
+		}
+		default: {
+			// Fix
+			return n == 0 ? arg_type::uint : arg_type::function;
+		}
+	}
+}
+
+text_converter::result<constr_t>
+text_converter::leaf(sexpr_kind_t kind, std::size_t location) {
+	std::size_t n = 0;
+	if (kind == sexpr_kind_local) {
+		std::optional<std::string> name;
+		std::optional<std::size_t> index;
+		std::optional<error> first;
+		while (more()) {
+			switch (n++) {
+				case 0: {
+					take(string_arg(), name, first);
+					break;
+				}
+				case 1: {
+					take(uint_arg(), index, first);
+					break;
+				}
+				default: {
+					skip_expr();
+					break;
+				}
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 2) {
+			return error{"Local requires literal name and index as arguments", location};
+		}
+		if (first) {
+			return *first;
+		}
+		return builder::local(std::move(*name), *index);
 	}
 
-	auto s = sfb_from_sexpr(e.value());
-	if (!s) {
-		return from_sexpr_str_error {
-			s.error().description,
-			s.error().context ? s.error().context->location() : 0
-		};
+	std::size_t name_location = scan_.index();
+	std::optional<std::string_view> name;
+	while (more()) {
+		if (!(n++ == 0 ? literal_arg(name) : skip_expr())) {
+			return syntax_error();
+		}
+	}
+	if (!leave()) {
+		return syntax_error();
+	}
+	if (kind == sexpr_kind_global) {
+		if (n != 1 || !name) {
+			return error{"Global requires literal name as single argument", location};
+		}
+		return builder::global(std::string(*name));
+	}
+	if (n != 1 || !name) {
+		return error{"Sort requires literal sort name as single argument", location};
+	}
+	if (*name == "Prop") {
+		return builder::builtin_prop();
+	} else if (*name == "Set") {
+		return builder::builtin_set();
+	} else if (*name == "SProp") {
+		return builder::builtin_sprop();
+	} else if (*name == "Type") {
+		return builder::builtin_type();
+	} else {
+		return error{"Unknown kind of sort", name_location};
 	}
+}
 
-	return s.move_value();
+bool
+text_converter::begin(part_type part, constr_frame& frame, constr_frame& parent) {
+	static const char* const terminal_errors[] = {
+		"Cannot parse terminal into constr",
+		"Cannot parse terminal into match",
+		"Cannot parse terminal into branches",
+		"Cannot parse terminal into branch",
+		"Cannot parse terminal into fixfunction",
+	};
+	static const char* const kind_errors[] = {
+		nullptr,
+		"Unable to parse case match",
+		"Unable to parse branches",
+		"Unable to parse branch",
+		"Unable to parse fixfunction",
+	};
+	static const sexpr_kind_t kinds[] = {
+		sexpr_kind_unknown,
+		sexpr_kind_match,
+		sexpr_kind_branches,
+		sexpr_kind_branch,
+		sexpr_kind_function,
+	};
+
+	std::size_t location = scan_.index();
+	std::size_t index = static_cast<std::size_t>(part);
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return false;
+		}
+		fail(parent, error{terminal_errors[index], location});
+		return false;
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return false;
+	}
+	sexpr_kind_t kind_id = find_sexpr_kind(kind);
+
+	bool known;
+	if (part == part_type::constr) {
+		switch (kind_id) {
+			case sexpr_kind_sort:
+			case sexpr_kind_global:
+			case sexpr_kind_local: {
+				auto term = leaf(kind_id, location);
+				if (term) {
+					parent.push_term(term.move_value());
+				} else {
+					fail(parent, term.error());
+				}
+				return false;
+			}
+			case sexpr_kind_prod:
+			case sexpr_kind_lambda:
+			case sexpr_kind_let_in:
+			case sexpr_kind_app:
+			case sexpr_kind_cast:
+			case sexpr_kind_case:
+			case sexpr_kind_fix: {
+				known = true;
+				break;
+			}
+			default: {
+				known = false;
+				break;
+			}
+		}
+	} else {
+		known = kind_id == kinds[index];
+	}
+	if (!known) {
+		if (!skip_rest()) {
+			return false;
+		}
+		if (part == part_type::constr) {
+			fail(parent, error{"Unhandled kind of constr:" + std::string(kind), location});
+			return false;
+		}
+		fail(parent, error{kind_errors[index], location});
+		return false;
+	}
+
+	frame.reset(part, kind_id, location);
+	return true;
+}
+
+void
+text_converter::finish(constr_frame& frame, constr_frame& parent) {
+	std::size_t location = frame.location;
+	std::size_t n = frame.n;
+
+	switch (frame.part) {
+		case part_type::match: {
+			if (n != 1) {
+				return fail(parent, error{"Match requires single argument", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			return parent.push_term(std::move(frame.term(0)));
+		}
+		case part_type::branches: {
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			parent.branches = std::move(frame.branches);
+			return;
+		}
+		case part_type::branch: {
+			if (n != 3) {
+				return fail(parent, error{"Branch must have name and 2 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			return parent.branches.push_back(match_branch_t{std::move(*frame.string), *frame.number, std::move(frame.term(0))});
+		}
+		case part_type::function: {
+			if (n != 3) {
+				return fail(parent, error{"Fixfunction requires 3 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			return parent.functions.push_back(fix_function_parts{std::move(*frame.name), std::move(frame.term(0)), std::move(frame.term(1))});
+		}
+		case part_type::constr: {
+			break;
+		}
+	}
+
+	switch (frame.kind) {
+		case sexpr_kind_prod:
+		case sexpr_kind_lambda: {
+			if (n != 3) {
+				return fail(parent, error{frame.kind == sexpr_kind_prod ? "Product requires 3 arguments" : "Lambda requires 3 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			std::vector<formal_arg_t> binder{{std::move(*frame.name), std::move(frame.term(0))}};
+			if (frame.kind == sexpr_kind_prod) {
+				return parent.push_term(builder::product(std::move(binder), std::move(frame.term(1))));
+			} else {
+				return parent.push_term(builder::lambda(std::move(binder), std::move(frame.term(1))));
+			}
+		}
+		case sexpr_kind_let_in: {
+			if (n != 4) {
+				return fail(parent, error{"LetIn requires 4 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			return parent.push_term(builder::let(std::move(*frame.name), std::move(frame.term(0)), std::move(frame.term(1)), std::move(frame.term(2))));
+		}
+		case sexpr_kind_app: {
+			if (n < 2) {
+				return fail(parent, error{"Apply requires at least 2 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			std::vector<constr_t> app_args;
+			app_args.reserve(frame.nterms - 1);
+			for (std::size_t index = 1; index < std::min(frame.nterms, constr_frame::inline_terms); ++index) {
+				app_args.push_back(std::move(frame.term(index)));
+			}
+			std::move(frame.more_terms.begin(), frame.more_terms.end(), std::back_inserter(app_args));
+			return parent.push_term(builder::apply(std::move(frame.term(0)), std::move(app_args)));
+		}
+		case sexpr_kind_cast: {
+			if (n != 3) {
+				return fail(parent, error{"Cast requires 3 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			const auto& cast_kind = *frame.string;
+			constr_cast::kind_type kind_enum;
+			if (cast_kind == "VMcast") {
+				kind_enum = constr_cast::vm_cast;
+			} else if (cast_kind == "DEFAULTcast") {
+				kind_enum = constr_cast::default_cast;
+			} else if (cast_kind == "REVERTcast") {
+				kind_enum = constr_cast::revert_cast;
+			} else if (cast_kind == "NATIVEcast") {
+				kind_enum = constr_cast::native_cast;
+			} else {
+				return fail(parent, error{"Unknown kind of cast", location});
+			}
+			return parent.push_term(builder::cast(std::move(frame.term(0)), kind_enum, std::move(frame.term(1))));
+		}
+		case sexpr_kind_case: {
+			if (n != 4) {
+				return fail(parent, error{"Case requires at exactly 4 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			return parent.push_term(builder::match(std::move(frame.term(0)), std::move(frame.term(1)), std::move(frame.branches)));
+		}
+		default: {
+			// Fix
+			if (n < 2) {
+				return fail(parent, error{"Fix requires at least 2 arguments", location});
+			}
+			if (frame.first) {
+				return fail(parent, std::move(*frame.first));
+			}
+			auto& parts = frame.functions;
+			std::vector<fix_function_t> fns;
+			for (auto& part : parts) {
+				fns.push_back(make_fix_function(
+					std::move(part.name), std::move(part.sigtype), std::move(part.fndef), parts.size()));
+			}
+			return parent.push_term(builder::fix(*frame.number, std::make_shared<fix_group_t>(fix_group_t{std::move(fns)})));
+		}
+	}
+}
+
+text_converter::result<constr_t>
+text_converter::constr() {
+	// The first "depth" frames of the stack are in use, frames beyond are
+	// kept for reuse. The first frame receives the converted term.
+	auto& stack = stack_;
+	if (stack.size() < 2) {
+		stack.resize(2);
+	}
+	stack[0].reset(part_type::constr, sexpr_kind_unknown, scan_.index());
+	std::size_t depth = begin(part_type::constr, stack[1], stack[0]) ? 2 : 1;
+
+	while (depth > 1 && !failed()) {
+		auto& frame = stack[depth - 1];
+		if (!more()) {
+			if (!leave()) {
+				break;
+			}
+			--depth;
+			finish(frame, stack[depth - 1]);
+			continue;
+		}
+
+		arg_type arg = next_arg(frame);
+		++frame.n;
+		switch (arg) {
+			case arg_type::string: {
+				take(string_arg(), frame.string, frame.first);
+				break;
+			}
+			case arg_type::uint: {
+				take(uint_arg(), frame.number, frame.first);
+				break;
+			}
+			case arg_type::argname: {
+				take(argname(), frame.name, frame.first);
+				break;
+			}
+			case arg_type::skip: {
+				skip_expr();
+				break;
+			}
+			default: {
+				// Parts are in the same order in both enums.
+				auto part = static_cast<part_type>(static_cast<int>(arg) - static_cast<int>(arg_type::constr));
+				if (depth == stack.size()) {
+					stack.emplace_back();
+				}
+				if (begin(part, stack[depth], stack[depth - 1])) {
+					++depth;
+				}
+				break;
+			}
+		}
+	}
+
+	if (failed()) {
+		return syntax_error();
+	}
+	auto& root = stack[0];
+	if (root.first) {
+		return *root.first;
+	}
+	return std::move(root.term(0));
+}
+
+text_converter::result<constructor_t>
+text_converter::constructor() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into constructor", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	if (kind != "Constructor") {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unhandled kind of constructor", location};
+	}
+
+	std::size_t n = 0;
+	std::optional<std::string> id;
+	std::optional<constr_t> type;
+	std::optional<error> first;
+	while (more()) {
+		switch (n++) {
+			case 0: {
+				take(string_arg(), id, first);
+				break;
+			}
+			case 1: {
+				take(constr(), type, first);
+				break;
+			}
+			default: {
+				skip_expr();
+				break;
+			}
+		}
+		if (failed()) {
+			return syntax_error();
+		}
+	}
+	if (!leave()) {
+		return syntax_error();
+	}
+	if (n != 2) {
+		return error{"Constructor requires 2 arguments", location};
+	}
+	if (first) {
+		return *first;
+	}
+	return constructor_t{std::move(*id), std::move(*type)};
+}
+
+text_converter::result<one_inductive_t>
+text_converter::one_inductive() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into one_inductive", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	if (kind != "OneInductive") {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unhandled kind of sfb", location};
+	}
+
+	std::size_t n = 0;
+	std::optional<std::string> id;
+	std::optional<constr_t> type;
+	std::vector<constructor_t> constructors;
+	std::optional<error> first;
+	while (more()) {
+		switch (n++) {
+			case 0: {
+				take(string_arg(), id, first);
+				break;
+			}
+			case 1: {
+				take(constr(), type, first);
+				break;
+			}
+			default: {
+				take(constructor(), constructors, first);
+				break;
+			}
+		}
+		if (failed()) {
+			return syntax_error();
+		}
+	}
+	if (!leave()) {
+		return syntax_error();
+	}
+	if (n < 2) {
+		return error{"Requires at least id and type for inductive", location};
+	}
+	if (first) {
+		return *first;
+	}
+	return one_inductive_t(std::move(*id), std::move(*type), std::move(constructors));
+}
+
+text_converter::result<modexpr>
+text_converter::modexpr_compound(std::string_view kind, std::size_t location) {
+	if (kind != "Apply") {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unhandled kind of modexpr", location};
+	}
+
+	std::size_t n = 0;
+	std::optional<modexpr> inner;
+	std::optional<std::string> arg;
+	std::optional<error> first;
+	while (more()) {
+		switch (n++) {
+			case 0: {
+				take(mod_expr(), inner, first);
+				break;
+			}
+			case 1: {
+				take(string_arg(), arg, first);
+				break;
+			}
+			default: {
+				skip_expr();
+				break;
+			}
+		}
+		if (failed()) {
+			return syntax_error();
+		}
+	}
+	if (!leave()) {
+		return syntax_error();
+	}
+	if (n != 2) {
+		return error{"Apply requires exactly 2 arguments", location};
+	}
+	if (first) {
+		return *first;
+	}
+	inner->args.push_back(std::move(*arg));
+	return std::move(*inner);
+}
+
+text_converter::result<modexpr>
+text_converter::mod_expr() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		std::string_view value;
+		if (!terminal(value)) {
+			return syntax_error();
+		}
+		return modexpr{std::string(value), {}};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	return modexpr_compound(kind, location);
+}
+
+text_converter::result<text_converter::functored_modexpr_t>
+text_converter::functored_modexpr() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		auto inner = mod_expr();
+		if (!inner) {
+			return inner.error();
+		}
+		return functored_modexpr_t({}, inner.move_value());
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	if (kind != "Functor") {
+		auto inner = modexpr_compound(kind, location);
+		if (!inner) {
+			return inner.error();
+		}
+		return functored_modexpr_t({}, inner.move_value());
+	}
+
+	std::size_t n = 0;
+	std::optional<std::string> id;
+	std::optional<modexpr> type;
+	std::optional<functored_modexpr_t> inner;
+	std::optional<error> first;
+	while (more()) {
+		switch (n++) {
+			case 0: {
+				take(string_arg(), id, first);
+				break;
+			}
+			case 1: {
+				take(mod_expr(), type, first);
+				break;
+			}
+			case 2: {
+				take(functored_modexpr(), inner, first);
+				break;
+			}
+			default: {
+				skip_expr();
+				break;
+			}
+		}
+		if (failed()) {
+			return syntax_error();
+		}
+	}
+	if (!leave()) {
+		return syntax_error();
+	}
+	if (n != 3) {
+		return error{"functor requires exactly 3 arguments", location};
+	}
+	if (first) {
+		return *first;
+	}
+	inner->first.emplace_back(std::move(*id), std::move(*type));
+	return std::move(*inner);
+}
+
+text_converter::result<std::optional<modexpr>>
+text_converter::optional_mod_type() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into optional modtype", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	sexpr_kind_t kind_id = find_sexpr_kind(kind);
+
+	if (kind_id == sexpr_kind_untyped) {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return std::optional<modexpr>(std::nullopt);
+	} else if (kind_id == sexpr_kind_typed) {
+		std::size_t n = 0;
+		std::optional<functored_modexpr_t> expr;
+		std::optional<error> first;
+		while (more()) {
+			if (n++ == 0) {
+				take(functored_modexpr(), expr, first);
+			} else {
+				skip_expr();
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 1) {
+			return error{"Optional modtype requires exactly one argument", location};
+		}
+		if (first) {
+			return *first;
+		}
+		return std::optional<modexpr>(std::move(expr->second));
+	} else {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unknown kind of module body", location};
+	}
+}
+
+text_converter::result<text_converter::modsig_t>
+text_converter::modsig() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into modsig", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	sexpr_kind_t kind_id = find_sexpr_kind(kind);
+
+	std::optional<error> first;
+	if (kind_id == sexpr_kind_body) {
+		std::shared_ptr<const fix_group_t> last_fix;
+		modsig_t result;
+		while (more()) {
+			take(sfb(last_fix), result.second, first);
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (first) {
+			return *first;
+		}
+		return std::move(result);
+	} else if (kind_id == sexpr_kind_functor) {
+		std::size_t n = 0;
+		std::optional<std::string> name;
+		std::optional<functored_modexpr_t> type;
+		std::optional<modsig_t> inner;
+		while (more()) {
+			switch (n++) {
+				case 0: {
+					take(string_arg(), name, first);
+					break;
+				}
+				case 1: {
+					take(functored_modexpr(), type, first);
+					break;
+				}
+				case 2: {
+					take(modsig(), inner, first);
+					break;
+				}
+				default: {
+					skip_expr();
+					break;
+				}
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 3) {
+			return error{"Functor requires exactly 3 arguments", location};
+		}
+		if (first) {
+			return *first;
+		}
+		inner->first.emplace_back(std::move(*name), std::move(type->second));
+		return std::move(*inner);
+	} else {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unhandled kind of modsig", location};
+	}
+}
+
+text_converter::result<module_body>
+text_converter::mod_body() {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into module body", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	sexpr_kind_t kind_id = find_sexpr_kind(kind);
+
+	std::size_t n = 0;
+	std::optional<error> first;
+	if (kind_id == sexpr_kind_algebraic) {
+		std::optional<functored_modexpr_t> expr;
+		while (more()) {
+			if (n++ == 0) {
+				take(functored_modexpr(), expr, first);
+			} else {
+				skip_expr();
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 1) {
+			return error{"Algebraic module requires exactly 1 argument", location};
+		}
+		if (first) {
+			return *first;
+		}
+		std::reverse(expr->first.begin(), expr->first.end());
+		return module_body(
+			std::move(expr->first), std::make_shared<module_body_algebraic_repr>(std::move(expr->second)));
+	} else if (kind_id == sexpr_kind_struct) {
+		std::optional<std::optional<modexpr>> type;
+		std::optional<modsig_t> sig;
+		while (more()) {
+			switch (n++) {
+				case 0: {
+					take(optional_mod_type(), type, first);
+					break;
+				}
+				case 1: {
+					take(modsig(), sig, first);
+					break;
+				}
+				default: {
+					skip_expr();
+					break;
+				}
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 2) {
+			return error{"Struct module definition requires exactly 2 arguments", location};
+		}
+		if (first) {
+			return *first;
+		}
+		std::reverse(sig->first.begin(), sig->first.end());
+		return module_body(
+			std::move(sig->first),
+			std::make_shared<module_body_struct_repr>(std::move(*type), std::move(sig->second)));
+	} else {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unknown kind of module body", location};
+	}
+}
+
+text_converter::result<sfb_t>
+text_converter::sfb(std::shared_ptr<const fix_group_t>& last_fix) {
+	std::size_t location = scan_.index();
+	if (scan_.current() != '(') {
+		if (!skip_expr()) {
+			return syntax_error();
+		}
+		return error{"Cannot parse terminal into sfb", location};
+	}
+	std::string_view kind;
+	if (!enter(kind)) {
+		return syntax_error();
+	}
+	sexpr_kind_t kind_id = find_sexpr_kind(kind);
+
+	std::size_t n = 0;
+	std::optional<error> first;
+	if (kind_id == sexpr_kind_definition) {
+		std::optional<std::string> id;
+		std::optional<constr_t> type;
+		std::optional<constr_t> value;
+		while (more()) {
+			switch (n++) {
+				case 0: {
+					take(string_arg(), id, first);
+					break;
+				}
+				case 1: {
+					take(constr(), type, first);
+					break;
+				}
+				case 2: {
+					take(constr(), value, first);
+					break;
+				}
+				default: {
+					skip_expr();
+					break;
+				}
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 3) {
+			return error{"Definition requires 3 arguments", location};
+		}
+		if (first) {
+			return *first;
+		}
+		return builder::definition(
+			std::move(*id), std::move(*type), share_fix_group(std::move(*value), last_fix));
+	} else if (kind_id == sexpr_kind_axiom) {
+		std::optional<std::string> id;
+		std::optional<constr_t> type;
+		while (more()) {
+			switch (n++) {
+				case 0: {
+					take(string_arg(), id, first);
+					break;
+				}
+				case 1: {
+					take(constr(), type, first);
+					break;
+				}
+				default: {
+					skip_expr();
+					break;
+				}
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 2) {
+			return error{"Axiom requires 2 arguments", location};
+		}
+		if (first) {
+			return *first;
+		}
+		return builder::axiom(std::move(*id), std::move(*type));
+	} else if (kind_id == sexpr_kind_inductive) {
+		std::vector<one_inductive_t> inds;
+		while (more()) {
+			++n;
+			take(one_inductive(), inds, first);
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n < 1) {
+			return error{"Requires at least one inductive definition", location};
+		}
+		if (first) {
+			return *first;
+		}
+		return builder::inductive(std::move(inds));
+	} else if (kind_id == sexpr_kind_module || kind_id == sexpr_kind_module_type) {
+		std::optional<std::string> id;
+		std::optional<module_body> body;
+		std::optional<modsig_t> sig;
+		while (more()) {
+			switch (n++) {
+				case 0: {
+					take(string_arg(), id, first);
+					break;
+				}
+				case 1: {
+					if (kind_id == sexpr_kind_module) {
+						take(mod_body(), body, first);
+					} else {
+						take(modsig(), sig, first);
+					}
+					break;
+				}
+				default: {
+					skip_expr();
+					break;
+				}
+			}
+			if (failed()) {
+				return syntax_error();
+			}
+		}
+		if (!leave()) {
+			return syntax_error();
+		}
+		if (n != 2) {
+			return error{
+				kind_id == sexpr_kind_module ? "Module requires exactly two arguments" : "ModuleType requires exactly two arguments",
+				location};
+		}
+		if (first) {
+			return *first;
+		}
+		if (kind_id == sexpr_kind_module) {
+			return builder::module_def(std::move(*id), std::move(*body));
+		}
+		std::reverse(sig->first.begin(), sig->first.end());
+		return builder::module_type_def(
+			std::move(*id),
+			module_body(std::move(sig->first), std::make_shared<module_body_struct_repr>(std::nullopt, std::move(sig->second))));
+	} else {
+		if (!skip_rest()) {
+			return syntax_error();
+		}
+		return error{"Unhandled kind of sfb", location};
+	}
+}
+
+}  // namespace
+
+from_sexpr_str_result<constr_t>
+constr_from_sexpr_str(std::string_view str) {
+	text_converter conv(str);
+	auto c = conv.constr();
+	if (conv.failed()) {
+		return conv.syntax_error();
+	}
+	return c;
+}
+
+from_sexpr_str_result<sfb_t>
+sfb_from_sexpr_str(std::string_view str) {
+	text_converter conv(str);
+	std::shared_ptr<const fix_group_t> last_fix;
+	auto s = conv.sfb(last_fix);
+	if (conv.failed()) {
+		return conv.syntax_error();
+	}
+	return s;
 }
 
 }  // namespace coqcic
@@ -1,15 +1,21 @@
 #ifndef COQCIC_FROM_SEXPR_H
 #define COQCIC_FROM_SEXPR_H
 
+#include <optional>
+#include <string_view>
+#include <utility>
 #include <variant>
 
 #include "coqcic/constr.h"
+#include "coqcic/flat_sexpr.h"
 #include "coqcic/parse_result.h"
 #include "coqcic/sexpr.h"
 #include "coqcic/sfb.h"
 
 namespace coqcic {
 
+class work_stealing_pool;
+
 struct from_sexpr_error {
 	std::string description;
 	const sexpr* context;
@@ -29,11 +35,60 @@ constr_from_sexpr(const sexpr& e);
 from_sexpr_result<sfb_t>
 sfb_from_sexpr(const sexpr& e);
 
+// Converts an sfb, sharing the fixpoint group of a definition with the
+// preceding one if both are defined by the same group. "last_fix" tracks
+// the group most recently seen, start with an empty pointer for a
+// sequence of sfbs.
+from_sexpr_result<sfb_t>
+sfb_from_sexpr(const sexpr& e, std::shared_ptr<const fix_group_t>& last_fix);
+
+// Converts the "Untyped" / "Typed" module type annotation of a module.
+from_sexpr_result<std::optional<modexpr>>
+optional_mod_type_from_sexpr(const sexpr& e);
+
+// Converts a module expression, possibly abstracted over functor
+// parameters (returned innermost first).
+from_sexpr_result<std::pair<std::vector<std::pair<std::string, modexpr>>, modexpr>>
+functored_modexpr_from_sexpr(const sexpr& e);
+
+// Conversion from flat s-expressions, equivalent to converting the
+// corresponding sexpr tree. Errors report the location of the offending
+// node.
+from_sexpr_str_result<constr_t>
+constr_from_sexpr(flat_sexpr_ref e);
+
+from_sexpr_str_result<sfb_t>
+sfb_from_sexpr(flat_sexpr_ref e);
+
+from_sexpr_str_result<sfb_t>
+sfb_from_sexpr(flat_sexpr_ref e, std::shared_ptr<const fix_group_t>& last_fix);
+
+// Converts a sequence of sfbs, e.g. the arguments of a module "Body",
+// using the threads of the given pool. The result is the same as
+// converting the sfbs in order with sfb_from_sexpr and a common
+// "last_fix": output order, sharing of fixpoint groups and the error
+// reported (the first one in sequence order) do not depend on scheduling.
+//
+// Note that arena and hash-consing scopes installed by the calling thread
+// do not apply to terms built on worker threads. When built with
+// non-atomic reference counts, the resulting terms must not be used
+// while another conversion runs on the same pool.
+from_sexpr_result<std::vector<sfb_t>>
+sfbs_from_sexpr(const std::vector<sexpr>& es, work_stealing_pool& pool);
+
+from_sexpr_str_result<std::vector<sfb_t>>
+sfbs_from_sexpr(flat_sexpr_ref::args_type es, work_stealing_pool& pool);
+
+// Converts text holding an s-expression directly into a constr. This is
+// equivalent to (but faster than) converting the result of parse_sexpr
+// with constr_from_sexpr, including all error descriptions and locations.
 from_sexpr_str_result<constr_t>
-constr_from_sexpr_str(const std::string& s);
+constr_from_sexpr_str(std::string_view s);
 
+// Converts text holding an s-expression directly into an sfb, see
+// constr_from_sexpr_str.
 from_sexpr_str_result<sfb_t>
-sfb_from_sexpr_str(const std::string& s);
+sfb_from_sexpr_str(std::string_view s);
 
 }  // namespace coqcic
 
@@ -3,6 +3,7 @@
 #include "gtest/gtest.h"
 
 #include "coqcic/parse_sexpr.h"
+#include "coqcic/work_stealing_pool.h"
 
 namespace {
 
@@ -342,3 +343,256 @@ TEST(from_sexpr_test, parse_fix_expression) {
 		)
 	);
 }
+
+namespace {
+
+// Converts via the intermediate sexpr tree, reporting errors in the same
+// shape as the direct text conversion.
+template<typename Convert>
+auto
+convert_via_tree(const std::string& text, Convert convert)
+	-> coqcic::from_sexpr_str_result<decltype(convert(std::declval<coqcic::sexpr>()).move_value())> {
+	auto e = coqcic::parse_sexpr(text);
+	if (!e) {
+		return coqcic::from_sexpr_str_error{e.error().description, e.error().location};
+	}
+	auto result = convert(e.value());
+	if (!result) {
+		return coqcic::from_sexpr_str_error{
+			result.error().description, result.error().context ? result.error().context->location() : 0};
+	}
+	return result.move_value();
+}
+
+template<typename Result>
+std::string
+describe(const Result& result) {
+	if (result) {
+		return result.value().debug_string();
+	} else {
+		return result.error().description + " @" + std::to_string(result.error().location);
+	}
+}
+
+}  // namespace
+
+TEST(from_sexpr_test, direct_matches_tree) {
+	auto to_constr = [](const coqcic::sexpr& e) { return coqcic::constr_from_sexpr(e); };
+	auto to_sfb = [](const coqcic::sexpr& e) { return coqcic::sfb_from_sexpr(e); };
+
+	for (std::string text : {
+		std::string(CONSTR_EXAMPLE),
+		std::string("(Cast (Sort Prop) VMcast (Sort SProp))"),
+		std::string("(LetIn (Anonymous) (Global a) (Global b) (Local x 0))"),
+		std::string("(Fix 0 (Function (Name f) (Global T) (App (Local f 0) (Local x 1))))"),
+	}) {
+		auto direct = coqcic::constr_from_sexpr_str(text);
+		ASSERT_TRUE(direct) << direct.error().description << ":" << direct.error().location;
+		EXPECT_EQ(describe(direct), describe(convert_via_tree(text, to_constr)));
+	}
+
+	for (std::string text : {std::string(SFB_INDUCTIVE_EXAMPLE), std::string(SFB_MODULE_EXAMPLE)}) {
+		auto direct = coqcic::sfb_from_sexpr_str(text);
+		ASSERT_TRUE(direct) << direct.error().description << ":" << direct.error().location;
+		EXPECT_EQ(describe(direct), describe(convert_via_tree(text, to_sfb)));
+	}
+}
+
+namespace {
+
+static const char* CONSTR_ERROR_EXAMPLES[] = {
+	"",
+	"nat",
+	"(Sort)",
+	"(Sort Foo)",
+	"(Sort (Prop))",
+	"(Local x y)",
+	"(Local x 1 2)",
+	"(Local (x) y)",
+	"(Lambda (Name) (Sort Set))",
+	"(Lambda (Foo x) (Sort Bar) (Local x 0))",
+	"(App (Sort Bar) (Local x -1))",
+	"(Cast (Sort Set) FOOcast (Sort Bar))",
+	"(Case 0 (Sort Set) (Local x 0) (Branches))",
+	"(Case 0 (Sort Set) (Match (Local x 0)) (Branches (Branch c x (Sort Set))))",
+	"(Fix 0 (Function (Name f) (Sort Set)))",
+	"(Unknown (Sort Bar) x)",
+	"(Sort Foo) (",
+	"(Sort Foo",
+	"(App (Sort Foo) ()",
+	"(App (Sort Foo) (Local x 0)",
+};
+
+static const char* SFB_ERROR_EXAMPLES[] = {
+	"(Definition x (Sort Set))",
+	"(Definition (x) (Sort Set) (Sort Foo))",
+	"(Axiom x (Sort Foo))",
+	"(Inductive)",
+	"(Inductive (OneInductive t (Sort Set) (Constructor c)))",
+	"(Module M (Algebraic (Apply X)))",
+	"(Module M (Struct (Typed (Functor y X)) (Body)))",
+	"(Module M (Struct (Untyped) (Functor y X (Body (Axiom a (Sort Foo))))))",
+	"(ModuleType M (Other))",
+	"(Module M (Struct (Untyped) (Body (Axiom a (Sort Set))))",
+};
+
+}  // namespace
+
+TEST(from_sexpr_test, direct_errors_match_tree) {
+	auto to_constr = [](const coqcic::sexpr& e) { return coqcic::constr_from_sexpr(e); };
+	auto to_sfb = [](const coqcic::sexpr& e) { return coqcic::sfb_from_sexpr(e); };
+
+	for (std::string text : CONSTR_ERROR_EXAMPLES) {
+		EXPECT_EQ(describe(coqcic::constr_from_sexpr_str(text)), describe(convert_via_tree(text, to_constr)))
+			<< text;
+	}
+
+	for (std::string text : SFB_ERROR_EXAMPLES) {
+		EXPECT_EQ(describe(coqcic::sfb_from_sexpr_str(text)), describe(convert_via_tree(text, to_sfb))) << text;
+	}
+}
+
+TEST(from_sexpr_test, flat_matches_tree) {
+	auto to_constr = [](const coqcic::sexpr& e) { return coqcic::constr_from_sexpr(e); };
+	auto to_sfb = [](const coqcic::sexpr& e) { return coqcic::sfb_from_sexpr(e); };
+
+	std::vector<std::string> constr_inputs(std::begin(CONSTR_ERROR_EXAMPLES), std::end(CONSTR_ERROR_EXAMPLES));
+	constr_inputs.push_back(CONSTR_EXAMPLE);
+	for (const auto& text : constr_inputs) {
+		auto e = coqcic::parse_flat_sexpr(text);
+		if (!e) {
+			continue;
+		}
+		EXPECT_EQ(describe(coqcic::constr_from_sexpr(e.value())), describe(convert_via_tree(text, to_constr)))
+			<< text;
+	}
+
+	std::vector<std::string> sfb_inputs(std::begin(SFB_ERROR_EXAMPLES), std::end(SFB_ERROR_EXAMPLES));
+	sfb_inputs.push_back(SFB_INDUCTIVE_EXAMPLE);
+	sfb_inputs.push_back(SFB_MODULE_EXAMPLE);
+	for (const auto& text : sfb_inputs) {
+		auto e = coqcic::parse_flat_sexpr(text);
+		if (!e) {
+			continue;
+		}
+		EXPECT_EQ(describe(coqcic::sfb_from_sexpr(e.value())), describe(convert_via_tree(text, to_sfb))) << text;
+	}
+}
+
+TEST(from_sexpr_test, parallel_matches_sequential) {
+	// Fixpoint groups are shared between consecutive definitions by equal
+	// groups, so interleave definitions by the same and by different
+	// groups. (Fixpoints compare equal only if they share their group,
+	// hence compare results by their printed form.)
+	std::string fix_f = "(Fix 0 (Function (Name f) (Global T) (App (Local f 0) (Local x 1))))";
+	std::string fix_g = "(Fix 0 (Function (Name g) (Global T) (App (Local g 0) (Local x 1))))";
+	std::string text = "(Body ";
+	for (std::size_t n = 0; n < 200; ++n) {
+		text += "(Definition d" + std::to_string(n) + " (Global T) " + (n % 7 < 3 ? fix_f : fix_g) + ")";
+		if (n % 5 == 0) {
+			text += "(Axiom a" + std::to_string(n) + " (Sort Prop))";
+		}
+	}
+	text += std::string(SFB_MODULE_EXAMPLE) + ")";
+
+	auto e = coqcic::parse_sexpr(text);
+	ASSERT_TRUE(e);
+	const auto& args = e.value().as_compound()->args();
+
+	std::vector<coqcic::sfb_t> sequential;
+	std::shared_ptr<const coqcic::fix_group_t> last_fix;
+	for (const auto& arg : args) {
+		auto sfb = coqcic::sfb_from_sexpr(arg, last_fix);
+		ASSERT_TRUE(sfb);
+		sequential.push_back(sfb.move_value());
+	}
+
+	coqcic::work_stealing_pool pool(4);
+	auto parallel = coqcic::sfbs_from_sexpr(args, pool);
+	ASSERT_TRUE(parallel) << parallel.error().description;
+	ASSERT_EQ(parallel.value().size(), sequential.size());
+	const coqcic::fix_group_t* parallel_group = nullptr;
+	const coqcic::fix_group_t* sequential_group = nullptr;
+	for (std::size_t n = 0; n < sequential.size(); ++n) {
+		EXPECT_EQ(parallel.value()[n].debug_string(), sequential[n].debug_string());
+		if (auto s = sequential[n].as_definition()) {
+			auto p = parallel.value()[n].as_definition();
+			EXPECT_EQ(
+				p->value().as_fix()->group().get() == parallel_group,
+				s->value().as_fix()->group().get() == sequential_group) << n;
+			parallel_group = p->value().as_fix()->group().get();
+			sequential_group = s->value().as_fix()->group().get();
+		}
+	}
+
+	auto flat = coqcic::parse_flat_sexpr(text);
+	ASSERT_TRUE(flat);
+	auto flat_parallel = coqcic::sfbs_from_sexpr(flat.value().root().args(), pool);
+	ASSERT_TRUE(flat_parallel);
+	ASSERT_EQ(flat_parallel.value().size(), parallel.value().size());
+	for (std::size_t n = 0; n < parallel.value().size(); ++n) {
+		EXPECT_EQ(flat_parallel.value()[n].debug_string(), parallel.value()[n].debug_string());
+	}
+
+	// First error in sequence order is reported.
+	std::string bad_text = "(Body (Axiom a (Sort Set)) (Axiom b (Sort Foo)) (Axiom c (Sort Bar)))";
+	auto bad = coqcic::parse_sexpr(bad_text);
+	auto bad_result = coqcic::sfbs_from_sexpr(bad.value().as_compound()->args(), pool);
+	ASSERT_FALSE(bad_result);
+	EXPECT_EQ(bad_result.error().context->location(), bad_text.find("Foo"));
+}
+
+TEST(from_sexpr_test, deep_nesting) {
+	// fun (x : Set) => ... fun (x : Set) => x, nested far beyond what
+	// recursive descent could handle on the native stack.
+	const std::size_t depth = 1000000;
+	std::string text;
+	coqcic::constr_t expected = coqcic::builder::local("x", 0);
+	for (std::size_t n = 0; n < depth; ++n) {
+		text += "(Lambda (Name x) (Sort Set) ";
+		expected = coqcic::builder::lambda({{"x", coqcic::builder::builtin_set()}}, expected);
+	}
+	std::size_t innermost = text.size();
+	text += "(Local x 0)";
+	text += std::string(depth, ')');
+
+	auto e = coqcic::parse_sexpr(text);
+	ASSERT_TRUE(e);
+	auto tree = coqcic::constr_from_sexpr(e.value());
+	ASSERT_TRUE(tree);
+	EXPECT_EQ(tree.value().hash(), expected.hash());
+
+	auto flat = coqcic::parse_flat_sexpr(text);
+	ASSERT_TRUE(flat);
+	auto from_flat = coqcic::constr_from_sexpr(flat.value().root());
+	ASSERT_TRUE(from_flat);
+	EXPECT_EQ(from_flat.value().hash(), expected.hash());
+
+	auto direct = coqcic::constr_from_sexpr_str(text);
+	ASSERT_TRUE(direct);
+	EXPECT_EQ(direct.value().hash(), expected.hash());
+
+	auto sfb = coqcic::sfb_from_sexpr_str("(Definition f " + text + " (Sort Set))");
+	ASSERT_TRUE(sfb);
+	auto definition = sfb.value().as_definition();
+	ASSERT_TRUE(definition);
+	EXPECT_EQ(definition->type().hash(), expected.hash());
+
+	// Errors at depth are reported for the innermost node.
+	text.replace(innermost, 11, "(Local x y)");
+	auto bad = coqcic::parse_sexpr(text);
+	ASSERT_TRUE(bad);
+	auto bad_tree = coqcic::constr_from_sexpr(bad.value());
+	ASSERT_FALSE(bad_tree);
+	EXPECT_EQ(bad_tree.error().description, "Cannot parse terminal into integer");
+	EXPECT_EQ(bad_tree.error().context->location(), innermost + 9);
+	auto bad_direct = coqcic::constr_from_sexpr_str(text);
+	ASSERT_FALSE(bad_direct);
+	EXPECT_EQ(bad_direct.error().description, "Cannot parse terminal into integer");
+	EXPECT_EQ(bad_direct.error().location, innermost + 9);
+
+	// Skipped arguments are nested as deeply.
+	auto extra = coqcic::constr_from_sexpr_str("(Sort Set " + text + ")");
+	ASSERT_FALSE(extra);
+	EXPECT_EQ(extra.error().description, "Sort requires literal sort name as single argument");
+}
@@ -0,0 +1,124 @@
+#include "coqcic/global_env.h"
+
+#include <stdexcept>
+
+namespace coqcic {
+
+namespace {
+
+std::string
+qualify(const std::string& prefix, const std::string& id) {
+	return prefix.empty() ? id : prefix + "." + id;
+}
+
+}  // namespace
+
+global_env::global_env(const std::vector<sfb_t>& sfbs, const std::string& prefix) {
+	for (const auto& sfb : sfbs) {
+		add(sfb, prefix);
+	}
+}
+
+void
+global_env::add(const sfb_t& sfb, const std::string& prefix) {
+	if (auto definition = sfb.as_definition()) {
+		declare({qualify(prefix, definition->id()), kind_definition, definition->type(), definition->value()});
+	} else if (auto axiom = sfb.as_axiom()) {
+		declare({qualify(prefix, axiom->id()), kind_axiom, axiom->type(), constr_t()});
+	} else if (auto fixpoint = sfb.as_fixpoint()) {
+		auto group = std::make_shared<fix_group_t>(fixpoint->fix_group());
+		for (std::size_t n = 0; n < group->functions.size(); ++n) {
+			const auto& fn = group->functions[n];
+			declare({
+				qualify(prefix, fn.name), kind_fixpoint,
+				builder::product(fn.args, fn.restype), builder::fix(n, group)});
+		}
+	} else if (auto inductive = sfb.as_inductive()) {
+		for (const auto& one : inductive->one_inductives()) {
+			inductives_.push_back(std::make_shared<one_inductive_t>(one));
+			const auto* ind = inductives_.back().get();
+			declare({qualify(prefix, ind->id), kind_inductive, ind->type, constr_t(), ind});
+			for (std::size_t n = 0; n < ind->constructors.size(); ++n) {
+				const auto& ctor = ind->constructors[n];
+				declare({qualify(prefix, ctor.id), kind_constructor, ctor.type, constr_t(), ind, n});
+			}
+		}
+	} else if (auto module = sfb.as_module()) {
+		if (!module->body().parameters().empty()) {
+			return;
+		}
+		auto body = dynamic_cast<const module_body_struct_repr*>(module->body().repr().get());
+		if (body) {
+			auto inner = qualify(prefix, module->id());
+			for (const auto& element : body->body()) {
+				add(element, inner);
+			}
+		}
+	}
+}
+
+void
+global_env::declare(entry e) {
+	id_type id = entries_.size();
+	auto symbol = constr_symbols().intern(e.name);
+	if (symbol >= ids_.size()) {
+		ids_.resize(symbol + 1, no_id);
+	}
+	ids_[symbol] = id;
+	entries_.push_back(std::move(e));
+}
+
+std::optional<global_env::id_type>
+global_env::find(const std::string& name) const {
+	auto symbol = constr_symbols().find(name);
+	if (symbol) {
+		return find(*symbol);
+	} else {
+		return std::nullopt;
+	}
+}
+
+type_context_t
+global_env::type_context() const {
+	type_context_t ctx;
+	ctx.globals = this;
+	ctx.global_types = [this](const std::string& name) {
+		auto id = find(name);
+		if (!id) {
+			throw std::runtime_error("unresolved global: " + name);
+		}
+		return type(*id);
+	};
+	return ctx;
+}
+
+std::function<std::optional<constr_t>(const std::string&)>
+global_env::globals_resolver() const {
+	return [this](const std::string& name) -> std::optional<constr_t> {
+		auto id = find(name);
+		if (id) {
+			return type(*id);
+		} else {
+			return std::nullopt;
+		}
+	};
+}
+
+std::function<std::optional<one_inductive_t>(const constr_t&)>
+global_env::inductive_resolver() const {
+	return [this](const constr_t& term) -> std::optional<one_inductive_t> {
+		constr_t head = term;
+		while (auto app = head.as_apply()) {
+			head = app->fn();
+		}
+		if (auto global = head.as_global()) {
+			auto id = find(global->symbol());
+			if (id && kind(*id) == kind_inductive) {
+				return *inductive(*id);
+			}
+		}
+		return std::nullopt;
+	};
+}
+
+}  // namespace coqcic
@@ -0,0 +1,227 @@
+#ifndef COQCIC_GLOBAL_ENV_H
+#define COQCIC_GLOBAL_ENV_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "coqcic/constr.h"
+#include "coqcic/sfb.h"
+
+namespace coqcic {
+
+/**
+	\brief Table of global objects declared by structure body elements
+
+	Collects the globals declared by a sequence of \ref sfb_t: axioms,
+	definitions, the functions of fixpoints, inductive types and their
+	constructors. Bodies of (non-functor) modules with structure bodies
+	are flattened, their elements are qualified by the module id, i.e.
+	global "foo" in module "M" is entered as "M.foo" (module ids at top
+	level are usually qualified already). Module types, functors and
+	algebraic modules do not declare globals.
+
+	Each global is assigned a dense integer id, in order of declaration.
+	Its type, body and inductive type are stored in a flat array indexed
+	by id. Ids are also indexed by the symbol of the name in
+	\ref constr_symbols, such that globals referenced by terms resolve
+	by array lookup; only resolving a name given as string requires a
+	(hash) lookup of its symbol.
+
+	Types of constructors are stored as given in their inductive
+	definition. Later declarations of a name shadow earlier ones.
+*/
+class global_env {
+public:
+	/**
+		\brief Dense id of a global, index into the table
+	*/
+	using id_type = std::size_t;
+
+	/**
+		\brief Kind of declaration of a global
+	*/
+	enum kind_type {
+		kind_axiom,
+		kind_definition,
+		kind_fixpoint,
+		kind_inductive,
+		kind_constructor
+	};
+
+	global_env() noexcept = default;
+
+	/**
+		\brief Collect globals declared by structure body elements
+
+		\param sfbs
+			Structure body elements, in order.
+
+		\param prefix
+			Qualifier prepended (followed by ".") to the ids of all
+			elements, if non-empty.
+	*/
+	explicit
+	global_env(const std::vector<sfb_t>& sfbs, const std::string& prefix = "");
+
+	/**
+		\brief Collect globals declared by an additional element
+
+		Pointers returned by \ref inductive remain valid.
+	*/
+	void
+	add(const sfb_t& sfb, const std::string& prefix = "");
+
+	/**
+		\brief Number of globals (ids are 0 up to size - 1)
+	*/
+	inline std::size_t
+	size() const noexcept {
+		return entries_.size();
+	}
+
+	/**
+		\brief Look up id of global by its qualified name
+
+		\returns
+			Id of the global, or nullopt if there is no global of
+			the given name.
+	*/
+	std::optional<id_type>
+	find(const std::string& name) const;
+
+	/**
+		\brief Look up id of global by the symbol of its name
+
+		\param symbol
+			Id of the qualified name in \ref constr_symbols, e.g.
+			\ref constr_global::symbol.
+
+		\returns
+			Id of the global, or nullopt if there is no global of
+			the given name.
+	*/
+	inline std::optional<id_type>
+	find(symbol_table::id_type symbol) const noexcept {
+		if (symbol < ids_.size() && ids_[symbol] != no_id) {
+			return ids_[symbol];
+		} else {
+			return std::nullopt;
+		}
+	}
+
+	/**
+		\brief Qualified name of global
+	*/
+	inline const std::string&
+	name(id_type id) const noexcept {
+		return entries_[id].name;
+	}
+
+	/**
+		\brief Kind of declaration of global
+	*/
+	inline kind_type
+	kind(id_type id) const noexcept {
+		return entries_[id].kind;
+	}
+
+	/**
+		\brief Type of global
+	*/
+	inline const constr_t&
+	type(id_type id) const noexcept {
+		return entries_[id].type;
+	}
+
+	/**
+		\brief Body of global
+
+		\returns
+			The value of definitions, the fixpoint (see
+			\ref constr_fix) for functions of fixpoints, nullptr for
+			all other globals.
+	*/
+	inline const constr_t*
+	body(id_type id) const noexcept {
+		const auto& entry = entries_[id];
+		return entry.kind == kind_definition || entry.kind == kind_fixpoint ? &entry.body : nullptr;
+	}
+
+	/**
+		\brief Inductive type of global
+
+		\returns
+			The inductive type declared by global, or the one its
+			constructor belongs to, nullptr for all other globals.
+	*/
+	inline const one_inductive_t*
+	inductive(id_type id) const noexcept {
+		return entries_[id].inductive;
+	}
+
+	/**
+		\brief Index of constructor in its inductive type
+
+		Only meaningful for globals of kind \ref kind_constructor.
+	*/
+	inline std::size_t
+	constructor_index(id_type id) const noexcept {
+		return entries_[id].constructor;
+	}
+
+	/**
+		\brief Typing context resolving globals in this table
+
+		The context refers to this table, which must outlive it.
+		Checking a term referring to an unknown global throws.
+	*/
+	type_context_t
+	type_context() const;
+
+	/**
+		\brief Resolver of global types for minigallina parsing
+
+		Refers to this table, which must outlive it.
+	*/
+	std::function<std::optional<constr_t>(const std::string&)>
+	globals_resolver() const;
+
+	/**
+		\brief Resolver of inductive types for minigallina parsing
+
+		Maps a term of the form (I params...) for an inductive type
+		I in this table to I. Refers to this table, which must
+		outlive it.
+	*/
+	std::function<std::optional<one_inductive_t>(const constr_t&)>
+	inductive_resolver() const;
+
+private:
+	static constexpr id_type no_id = ~id_type(0);
+
+	struct entry {
+		std::string name;
+		kind_type kind;
+		constr_t type;
+		constr_t body;
+		const one_inductive_t* inductive = nullptr;
+		std::size_t constructor = 0;
+	};
+
+	void
+	declare(entry e);
+
+	std::vector<entry> entries_;
+	std::vector<std::shared_ptr<const one_inductive_t>> inductives_;
+	// Id of global by symbol of its name, no_id for symbols not
+	// naming a global.
+	std::vector<id_type> ids_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_GLOBAL_ENV_H
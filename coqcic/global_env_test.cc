@@ -0,0 +1,115 @@
+#include "coqcic/global_env.h"
+
+#include "coqcic/minigallina.h"
+#include "coqcic/nbe.h"
+
+#include "gtest/gtest.h"
+
+namespace coqcic {
+
+namespace {
+
+// Inductive nat := O : nat | S : nat -> nat.
+// Module M.
+//   Definition one : nat := S O.
+//   Fixpoint double (n : nat) : nat := match n with O => O | S p => S (S (double p)) end.
+// End M.
+// Axiom n : nat.
+std::vector<sfb_t>
+make_sfbs() {
+	using namespace builder;
+	auto nat = global("nat");
+	fix_group_t group;
+	group.functions.push_back(fix_function_t{
+		"double",
+		{{"n", nat}},
+		nat,
+		match(
+			lambda({{"n", nat}}, nat),
+			local("n", 0),
+			{
+				{"O", 0, global("O")},
+				{"S", 1, lambda(
+					{{"p", nat}},
+					apply(global("S"), {apply(global("S"), {apply(local("double", 2), {local("p", 0)})})}))}
+			})
+	});
+
+	return {
+		sfb_t(std::make_shared<sfb_inductive>(std::vector<one_inductive_t>{
+			one_inductive_t("nat", builtin_set(), {
+				{"O", nat},
+				{"S", product({{std::nullopt, nat}}, nat)}})})),
+		sfb_t(std::make_shared<sfb_module>("M", module_body({}, std::make_shared<module_body_struct_repr>(
+			std::nullopt,
+			std::vector<sfb_t>{
+				sfb_t(std::make_shared<sfb_definition>("one", nat, apply(global("S"), {global("O")}))),
+				sfb_t(std::make_shared<sfb_fixpoint>(std::move(group)))
+			})))),
+		sfb_t(std::make_shared<sfb_axiom>("n", nat))
+	};
+}
+
+}  // namespace
+
+TEST(global_env_test, lookup) {
+	using namespace builder;
+	global_env env(make_sfbs());
+	EXPECT_EQ(6u, env.size());
+
+	auto nat = env.find("nat");
+	ASSERT_TRUE(nat);
+	EXPECT_EQ(global_env::kind_inductive, env.kind(*nat));
+	EXPECT_EQ(builtin_set(), env.type(*nat));
+	EXPECT_EQ(nullptr, env.body(*nat));
+
+	auto s = env.find("S");
+	ASSERT_TRUE(s);
+	EXPECT_EQ(global_env::kind_constructor, env.kind(*s));
+	EXPECT_EQ(env.inductive(*nat), env.inductive(*s));
+	EXPECT_EQ(1u, env.constructor_index(*s));
+
+	// Module contents are qualified.
+	EXPECT_FALSE(env.find("one"));
+	auto one = env.find("M.one");
+	ASSERT_TRUE(one);
+	EXPECT_EQ("M.one", env.name(*one));
+	ASSERT_TRUE(env.body(*one));
+	EXPECT_EQ(apply(global("S"), {global("O")}), *env.body(*one));
+
+	// Globals referenced by terms resolve by the symbols of their names.
+	EXPECT_EQ(one, env.find(global("M.one").as_global()->symbol()));
+	EXPECT_FALSE(env.find(global("unknown").as_global()->symbol()));
+
+	auto twice = env.find("M.double");
+	ASSERT_TRUE(twice);
+	EXPECT_EQ(global_env::kind_fixpoint, env.kind(*twice));
+	EXPECT_EQ(product({{"n", global("nat")}}, global("nat")), env.type(*twice));
+
+	auto n = env.find("n");
+	ASSERT_TRUE(n);
+	EXPECT_EQ(global_env::kind_axiom, env.kind(*n));
+	EXPECT_EQ(nullptr, env.body(*n));
+}
+
+TEST(global_env_test, clients) {
+	using namespace builder;
+	global_env env(make_sfbs());
+
+	auto ctx = env.type_context();
+	EXPECT_EQ(global("nat"), apply(global("S"), {global("M.one")}).check(ctx));
+	EXPECT_THROW(global("unknown").check(ctx), std::runtime_error);
+
+	EXPECT_EQ(
+		apply(global("S"), {global("n")}),
+		mgl::parse_constr("S n", env).value());
+	auto pred = mgl::parse_constr("match n as _ return nat with | O => O | S p => p end", env);
+	ASSERT_TRUE(pred) << pred.error().description;
+
+	nbe_engine engine(env);
+	EXPECT_EQ(
+		apply(global("S"), {apply(global("S"), {global("O")})}),
+		engine.normalize(apply(global("M.double"), {global("M.one")})));
+}
+
+}  // namespace coqcic
@@ -0,0 +1,208 @@
+#include "coqcic/hashcons.h"
+
+#include <functional>
+
+namespace coqcic {
+
+namespace {
+
+thread_local constr_hashcons* current_table = nullptr;
+
+inline bool
+child_equal(const constr_t& left, const constr_t& right) noexcept {
+	return left.repr() == right.repr();
+}
+
+bool
+args_equal(const std::vector<formal_arg_t>& left, const std::vector<formal_arg_t>& right) noexcept {
+	if (left.size() != right.size()) {
+		return false;
+	}
+	for (std::size_t n = 0; n < left.size(); ++n) {
+		if (left[n].name != right[n].name || !child_equal(left[n].type, right[n].type)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+shallow_equal(const constr_t& left, const constr_t& right) noexcept {
+	if (auto l = left.as_local()) {
+		auto r = right.as_local();
+		return r && l->index() == r->index() && l->symbol() == r->symbol();
+	} else if (auto l = left.as_global()) {
+		auto r = right.as_global();
+		return r && l->symbol() == r->symbol();
+	} else if (auto l = left.as_builtin()) {
+		auto r = right.as_builtin();
+		return r && l->name() == r->name();
+	} else if (auto l = left.as_product()) {
+		auto r = right.as_product();
+		return r && args_equal(l->args(), r->args()) && child_equal(l->restype(), r->restype());
+	} else if (auto l = left.as_lambda()) {
+		auto r = right.as_lambda();
+		return r && args_equal(l->args(), r->args()) && child_equal(l->body(), r->body());
+	} else if (auto l = left.as_let()) {
+		auto r = right.as_let();
+		return
+			r && l->varname() == r->varname() &&
+			child_equal(l->value(), r->value()) &&
+			child_equal(l->type(), r->type()) &&
+			child_equal(l->body(), r->body());
+	} else if (auto l = left.as_apply()) {
+		auto r = right.as_apply();
+		if (!r || !child_equal(l->fn(), r->fn()) || l->args().size() != r->args().size()) {
+			return false;
+		}
+		for (std::size_t n = 0; n < l->args().size(); ++n) {
+			if (!child_equal(l->args()[n], r->args()[n])) {
+				return false;
+			}
+		}
+		return true;
+	} else if (auto l = left.as_cast()) {
+		auto r = right.as_cast();
+		return
+			r && l->kind() == r->kind() &&
+			child_equal(l->term(), r->term()) &&
+			child_equal(l->typeterm(), r->typeterm());
+	} else if (auto l = left.as_match()) {
+		auto r = right.as_match();
+		if (
+			!r || !child_equal(l->casetype(), r->casetype()) || !child_equal(l->arg(), r->arg()) ||
+			l->branches().size() != r->branches().size()) {
+			return false;
+		}
+		for (std::size_t n = 0; n < l->branches().size(); ++n) {
+			const auto& lb = l->branches()[n];
+			const auto& rb = r->branches()[n];
+			if (lb.constructor != rb.constructor || lb.nargs != rb.nargs || !child_equal(lb.expr, rb.expr)) {
+				return false;
+			}
+		}
+		return true;
+	} else if (auto l = left.as_fix()) {
+		auto r = right.as_fix();
+		return r && l->index() == r->index() && l->group() == r->group();
+	} else {
+		return false;
+	}
+}
+
+}  // namespace
+
+/**
+	\class constr_hashcons
+	\brief Hash-consing table for term constructions.
+	\headerfile coqcic/hashcons.h <coqcic/hashcons.h>
+
+	Interns term nodes such that structurally identical terms built
+	while the table is installed share their representation. This
+	reduces memory for heavily shared subterms (e.g. types repeated
+	across an imported library) and turns most equality comparisons
+	into pointer comparisons.
+
+	Usage:
+
+	\code
+		constr_hashcons table;
+		{
+			constr_hashcons::scope s(table);
+			auto a = builder::global("nat");
+			auto b = builder::global("nat");
+			// a.repr() == b.repr()
+		}
+	\endcode
+*/
+
+constr_hashcons::~constr_hashcons() {
+}
+
+constr_hashcons::constr_hashcons() {
+}
+
+constr_ptr<const constr_base>
+constr_hashcons::intern(constr_ptr<const constr_base> node) {
+	return *nodes_.insert(std::move(node)).first;
+}
+
+std::shared_ptr<const fix_group_t>
+constr_hashcons::intern_group(std::shared_ptr<const fix_group_t> group) {
+	return *groups_.insert(std::move(group)).first;
+}
+
+std::size_t
+constr_hashcons::size() const noexcept {
+	return nodes_.size();
+}
+
+void
+constr_hashcons::clear() noexcept {
+	nodes_.clear();
+	groups_.clear();
+}
+
+constr_hashcons*
+constr_hashcons::current() noexcept {
+	return current_table;
+}
+
+std::size_t
+constr_hashcons::node_hash::operator()(const constr_ptr<const constr_base>& node) const noexcept {
+	// Shallowly equal nodes are also structurally equal, so the structural
+	// hash is a valid (and already computed) hash for interning.
+	return node->hash();
+}
+
+bool
+constr_hashcons::node_equal::operator()(
+	const constr_ptr<const constr_base>& left,
+	const constr_ptr<const constr_base>& right) const noexcept {
+	return left == right || shallow_equal(constr_t(left), constr_t(right));
+}
+
+std::size_t
+constr_hashcons::group_hash::operator()(const std::shared_ptr<const fix_group_t>& group) const {
+	std::size_t seed = group->functions.size();
+	for (const auto& fn : group->functions) {
+		for (const auto& arg : fn.args) {
+			hash_combine(seed, arg.type.hash());
+		}
+		hash_combine(seed, fn.restype.hash());
+		hash_combine(seed, fn.body.hash());
+	}
+	return seed;
+}
+
+bool
+constr_hashcons::group_equal::operator()(
+	const std::shared_ptr<const fix_group_t>& left,
+	const std::shared_ptr<const fix_group_t>& right) const noexcept {
+	if (left == right) {
+		return true;
+	}
+	if (left->functions.size() != right->functions.size()) {
+		return false;
+	}
+	for (std::size_t n = 0; n < left->functions.size(); ++n) {
+		const auto& l = left->functions[n];
+		const auto& r = right->functions[n];
+		if (
+			l.name != r.name || !args_equal(l.args, r.args) ||
+			!child_equal(l.restype, r.restype) || !child_equal(l.body, r.body)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+constr_hashcons::scope::~scope() {
+	current_table = previous_;
+}
+
+constr_hashcons::scope::scope(constr_hashcons& table) noexcept : previous_(current_table) {
+	current_table = &table;
+}
+
+}  // namespace coqcic
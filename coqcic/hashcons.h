@@ -0,0 +1,145 @@
+#ifndef COQCIC_HASHCONS_H
+#define COQCIC_HASHCONS_H
+
+#include <memory>
+#include <unordered_set>
+
+#include "coqcic/constr.h"
+
+namespace coqcic {
+
+/**
+	\brief Hash-consing table for term constructions
+
+	Maintains a set of unique \ref constr_base nodes. While a table is
+	installed for the current thread (see \ref constr_hashcons::scope),
+	all \ref builder functions look up newly constructed terms in the
+	table and return the existing node if a structurally identical one
+	has been built before. Structurally equal terms built under the same
+	table therefore share a single representation node, and comparing
+	them for equality reduces to a pointer comparison.
+
+	Nodes are compared shallowly: their children must be identical
+	(pointer-equal) representation nodes, and all names (local variable
+	names, formal argument names etc.) must be identical as well. Terms
+	that differ only in naming are hence not merged, but still compare
+	equal through \ref constr_t::operator==.
+
+	The table holds strong references to all nodes interned, they are
+	released when the table is cleared or destroyed. Tables are not
+	synchronized, each thread needs to install its own table.
+*/
+class constr_hashcons {
+public:
+	class scope;
+
+	~constr_hashcons();
+
+	constr_hashcons();
+
+	constr_hashcons(const constr_hashcons& other) = delete;
+	constr_hashcons& operator=(const constr_hashcons& other) = delete;
+
+	/**
+		\brief Look up node in table
+
+		\param node
+			Newly constructed node.
+
+		\returns
+			Either a structurally identical node that was interned
+			previously, or the given node (which is then interned).
+	*/
+	constr_ptr<const constr_base>
+	intern(constr_ptr<const constr_base> node);
+
+	/**
+		\brief Look up fixpoint group in table
+
+		\param group
+			Newly constructed fixpoint function group.
+
+		\returns
+			Either a structurally identical group that was interned
+			previously, or the given group (which is then interned).
+	*/
+	std::shared_ptr<const fix_group_t>
+	intern_group(std::shared_ptr<const fix_group_t> group);
+
+	/**
+		\brief Number of nodes interned in this table
+	*/
+	std::size_t
+	size() const noexcept;
+
+	/**
+		\brief Release all nodes interned in this table
+	*/
+	void
+	clear() noexcept;
+
+	/**
+		\brief Table installed for the current thread
+
+		\returns
+			Table installed by innermost active \ref scope of the
+			current thread, or nullptr if none.
+	*/
+	static
+	constr_hashcons*
+	current() noexcept;
+
+private:
+	struct node_hash {
+		std::size_t
+		operator()(const constr_ptr<const constr_base>& node) const noexcept;
+	};
+
+	struct node_equal {
+		bool
+		operator()(
+			const constr_ptr<const constr_base>& left,
+			const constr_ptr<const constr_base>& right) const noexcept;
+	};
+
+	struct group_hash {
+		std::size_t
+		operator()(const std::shared_ptr<const fix_group_t>& group) const;
+	};
+
+	struct group_equal {
+		bool
+		operator()(
+			const std::shared_ptr<const fix_group_t>& left,
+			const std::shared_ptr<const fix_group_t>& right) const noexcept;
+	};
+
+	std::unordered_set<constr_ptr<const constr_base>, node_hash, node_equal> nodes_;
+	std::unordered_set<std::shared_ptr<const fix_group_t>, group_hash, group_equal> groups_;
+};
+
+/**
+	\brief Installs a hash-consing table for the current thread
+
+	While an object of this class is alive, \ref builder functions
+	called on the current thread intern all terms in the given table.
+	Scopes may be nested, the previously installed table is restored
+	when the scope ends.
+*/
+class constr_hashcons::scope {
+public:
+	~scope();
+
+	explicit
+	scope(constr_hashcons& table) noexcept;
+
+	scope(const scope& other) = delete;
+	scope& operator=(const scope& other) = delete;
+
+private:
+	constr_hashcons* previous_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_HASHCONS_H
@@ -0,0 +1,54 @@
+#include "coqcic/hashcons.h"
+
+#include "gtest/gtest.h"
+
+#include "coqcic/from_sexpr.h"
+
+namespace coqcic {
+
+TEST(hashcons_test, shared_nodes) {
+	using namespace builder;
+
+	constr_hashcons table;
+	constr_t a, b, c;
+	{
+		constr_hashcons::scope s(table);
+		a = product({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+		b = product({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+		c = product({{"y", global("nat")}}, apply(global("S"), {local("y", 0)}));
+	}
+
+	EXPECT_EQ(a.repr(), b.repr());
+	// Names are significant for sharing, but not for equality.
+	EXPECT_NE(a.repr(), c.repr());
+	EXPECT_EQ(a, c);
+	EXPECT_EQ(a.as_product()->args()[0].type.repr(), c.as_product()->args()[0].type.repr());
+
+	// Outside of the scope, terms are not interned.
+	auto d = product({{"x", global("nat")}}, apply(global("S"), {local("x", 0)}));
+	EXPECT_NE(a.repr(), d.repr());
+	EXPECT_EQ(a, d);
+
+	table.clear();
+	EXPECT_EQ(0u, table.size());
+}
+
+TEST(hashcons_test, shared_fix_groups) {
+	static const char fix_expr[] = R"(
+		(Fix 0
+			(Function (Name f)
+				(Prod (Name n) (Global nat) (Global nat))
+				(Lambda (Name n) (Global nat) (App (Local f 1) (Local n 0))))))";
+
+	constr_hashcons table;
+	constr_hashcons::scope s(table);
+
+	auto a = constr_from_sexpr_str(fix_expr);
+	auto b = constr_from_sexpr_str(fix_expr);
+	ASSERT_TRUE(a);
+	ASSERT_TRUE(b);
+	EXPECT_EQ(a.value().repr(), b.value().repr());
+	EXPECT_EQ(a.value().as_fix()->group(), b.value().as_fix()->group());
+}
+
+}  // namespace coqcic
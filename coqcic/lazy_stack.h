@@ -7,6 +7,10 @@
 // state consists of objects at different logical depths. "Push"
 // and "pop" operations on the stack leave the old state unmodified
 // and create new states instead.
+//
+// Objects are stored in blocks of power-of-two size, pushing merges
+// blocks of equal size like a binary counter. For a stack with fixed-size
+// nodes, O(1) push and no copying of objects see skew_list.
 
 #include <memory>
 #include <stdexcept>
@@ -55,22 +59,20 @@ public:
 
 private:
 	inline
-	lazy_stack(std::shared_ptr<lazy_stack_repr<T>> repr) noexcept : repr_(std::move(repr)) {}
+	lazy_stack(std::shared_ptr<lazy_stack_repr<T>> repr, std::size_t size) noexcept
+		: repr_(std::move(repr)), size_(size)
+	{
+	}
 
 	std::shared_ptr<lazy_stack_repr<T>> repr_;
+	std::size_t size_ = 0;
 };
 
 template<typename T>
 inline
 std::size_t
 lazy_stack<T>::size() const noexcept {
-	std::size_t count = 0;
-	auto ptr = repr_.get();
-	while (ptr) {
-		count += ptr->items.size();
-		ptr = ptr->next.get();
-	}
-	return count;
+	return size_;
 }
 
 template<typename T>
@@ -84,22 +86,35 @@ template<typename T>
 inline
 lazy_stack<T>
 lazy_stack<T>::push(T t) const {
+	// Determine the blocks to be merged first, so the new block is
+	// allocated once at its final size.
+	std::size_t count = 1;
+	auto last = repr_.get();
+	while (last && last->items.size() == count) {
+		count += last->items.size();
+		last = last->next.get();
+	}
+
 	auto next = repr_;
 	auto repr = std::make_shared<lazy_stack_repr<T>>();
-	repr->items.push_back(t);
-	while (next && next->items.size() == repr->items.size()) {
+	repr->items.reserve(count);
+	repr->items.push_back(std::move(t));
+	while (next.get() != last) {
 		repr->items.insert(repr->items.end(), next->items.begin(), next->items.end());
 		next = next->next;
 	}
 	repr->next = std::move(next);
 
-	return lazy_stack(std::move(repr));
+	return lazy_stack(std::move(repr), size_ + 1);
 }
 
 template<typename T>
 inline
 lazy_stack<T>
 lazy_stack<T>::pop() const {
+	if (!repr_) {
+		throw std::runtime_error("Pop from empty stack");
+	}
 	auto next = repr_->next;
 	std::shared_ptr<lazy_stack_repr<T>> repr;
 	std::shared_ptr<lazy_stack_repr<T>>* current = &repr;
@@ -121,7 +136,7 @@ lazy_stack<T>::pop() const {
 
 	*current = next;
 
-	return lazy_stack(std::move(repr));
+	return lazy_stack(std::move(repr), size_ - 1);
 }
 
 template<typename T>
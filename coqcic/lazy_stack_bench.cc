@@ -0,0 +1,113 @@
+// Benchmark for the persistent stacks.
+//
+// Compares lazy_stack and skew_list on the operations performed by the
+// term transformations and the type checker: pushing elements, indexed
+// access, popping elements and querying the size. The element type is
+// the local entry of type contexts, which is not trivially copyable, so
+// the cost of copying elements when merging lazy_stack blocks shows.
+
+#include "coqcic/constr.h"
+#include "coqcic/lazy_stack.h"
+#include "coqcic/skew_list.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+using namespace coqcic;
+
+using entry = type_context_t::local_entry;
+
+template<typename Fn>
+double
+time_ms(Fn&& fn, std::size_t rounds) {
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t n = 0; n < rounds; ++n) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+template<typename Stack>
+Stack
+push_all(std::size_t depth) {
+	Stack stack;
+	auto type = builder::builtin_set();
+	for (std::size_t n = 0; n < depth; ++n) {
+		stack = stack.push({"x", type});
+	}
+	return stack;
+}
+
+// Looks up every element, innermost first.
+template<typename Stack>
+std::size_t
+at_all(const Stack& stack) {
+	std::size_t sum = 0;
+	for (std::size_t n = 0; n < stack.size(); ++n) {
+		sum += stack.at(n).name.size();
+	}
+	return sum;
+}
+
+// Pops one element from every state reached while pushing, the pattern of
+// leaving binders again.
+template<typename Stack>
+std::size_t
+push_pop(std::size_t depth) {
+	Stack stack;
+	std::size_t sum = 0;
+	auto type = builder::builtin_set();
+	for (std::size_t n = 0; n < depth; ++n) {
+		stack = stack.push({"x", type});
+		sum += stack.pop().size();
+	}
+	return sum;
+}
+
+// Queries the size of states of all depths.
+template<typename Stack>
+std::size_t
+size_all(const std::vector<Stack>& states) {
+	std::size_t sum = 0;
+	for (const auto& stack : states) {
+		sum += stack.size();
+	}
+	return sum;
+}
+
+template<typename Stack>
+void
+run(const char* name, std::size_t depth, std::size_t rounds, std::size_t& sink) {
+	auto stack = push_all<Stack>(depth);
+	std::vector<Stack> states;
+	for (auto s = stack; !s.empty(); s = s.pop()) {
+		states.push_back(s);
+	}
+
+	double push_ms = time_ms([&] { sink += push_all<Stack>(depth).size(); }, rounds);
+	double at_ms = time_ms([&] { sink += at_all(stack); }, rounds);
+	double pop_ms = time_ms([&] { sink += push_pop<Stack>(depth); }, rounds);
+	double size_ms = time_ms([&] { sink += size_all(states); }, rounds);
+
+	std::cout << name << " push: " << push_ms << " ms\n";
+	std::cout << name << " at:   " << at_ms << " ms\n";
+	std::cout << name << " pop:  " << pop_ms << " ms\n";
+	std::cout << name << " size: " << size_ms << " ms\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+	const std::size_t depth = 100000;
+	const std::size_t rounds = 20;
+
+	std::size_t sink = 0;
+	run<lazy_stack<entry>>("lazy_stack", depth, rounds, sink);
+	run<skew_list<entry>>("skew_list ", depth, rounds, sink);
+
+	return sink == 0 ? 1 : 0;
+}
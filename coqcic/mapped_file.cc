@@ -0,0 +1,73 @@
+#include "coqcic/mapped_file.h"
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace coqcic {
+
+mapped_file::~mapped_file() {
+	release();
+}
+
+mapped_file::mapped_file(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) < 0) {
+		int error = errno;
+		::close(fd);
+		throw std::system_error(error, std::generic_category(), "Cannot stat " + path);
+	}
+
+	// Empty files cannot be mapped, represent them by an empty buffer.
+	if (st.st_size > 0) {
+		void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			int error = errno;
+			::close(fd);
+			throw std::system_error(error, std::generic_category(), "Cannot map " + path);
+		}
+		// Input is scanned front to back exactly once.
+		::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+		data_ = static_cast<const char*>(addr);
+		size_ = st.st_size;
+	}
+
+	::close(fd);
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept : data_(other.data_), size_(other.size_) {
+	other.data_ = nullptr;
+	other.size_ = 0;
+}
+
+mapped_file&
+mapped_file::operator=(mapped_file&& other) noexcept {
+	if (this != &other) {
+		release();
+		data_ = other.data_;
+		size_ = other.size_;
+		other.data_ = nullptr;
+		other.size_ = 0;
+	}
+	return *this;
+}
+
+void
+mapped_file::release() noexcept {
+	if (data_) {
+		::munmap(const_cast<char*>(data_), size_);
+		data_ = nullptr;
+		size_ = 0;
+	}
+}
+
+}  // namespace coqcic
@@ -0,0 +1,49 @@
+#ifndef COQCIC_MAPPED_FILE_H
+#define COQCIC_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace coqcic {
+
+// Read-only memory mapping of an entire file. The contents are available
+// as a contiguous buffer for the lifetime of the object, suitable for
+// passing to parse_sexpr without copying. Throws std::system_error if the
+// file cannot be opened or mapped.
+class mapped_file {
+public:
+	~mapped_file();
+
+	explicit
+	mapped_file(const std::string& path);
+
+	mapped_file(const mapped_file& other) = delete;
+	mapped_file& operator=(const mapped_file& other) = delete;
+
+	mapped_file(mapped_file&& other) noexcept;
+	mapped_file& operator=(mapped_file&& other) noexcept;
+
+	inline
+	std::string_view
+	data() const noexcept {
+		return std::string_view(data_, size_);
+	}
+
+	inline
+	std::size_t
+	size() const noexcept {
+		return size_;
+	}
+
+private:
+	void
+	release() noexcept;
+
+	const char* data_ = nullptr;
+	std::size_t size_ = 0;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_MAPPED_FILE_H
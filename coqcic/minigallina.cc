@@ -100,7 +100,7 @@ symbol_name(symbol_t symbol) {
 }
 
 type_context_t make_type_context(
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve
 ) {
 	type_context_t ctx = {
@@ -174,7 +174,7 @@ constr_ast_node::~constr_ast_node() {
 parse_result<formal_arg_t, parse_error>
 constr_ast_formarg::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -191,7 +191,7 @@ constr_ast_node_id::~constr_ast_node_id() {
 parse_result<constr_t, parse_error>
 constr_ast_node_id::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -223,7 +223,7 @@ constr_ast_node_apply::~constr_ast_node_apply() {
 parse_result<constr_t, parse_error>
 constr_ast_node_apply::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -251,7 +251,7 @@ constr_ast_node_let::~constr_ast_node_let() {
 parse_result<constr_t, parse_error>
 constr_ast_node_let::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -283,7 +283,7 @@ constr_ast_node_product::~constr_ast_node_product() {
 parse_result<constr_t, parse_error>
 constr_ast_node_product::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -316,7 +316,7 @@ constr_ast_node_lambda::~constr_ast_node_lambda() {
 parse_result<constr_t, parse_error>
 constr_ast_node_lambda::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -349,7 +349,7 @@ constr_ast_node_fix::~constr_ast_node_fix() {
 parse_result<constr_t, parse_error>
 constr_ast_node_fix::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -417,7 +417,7 @@ constr_ast_node_match::~constr_ast_node_match() {
 parse_result<constr_t, parse_error>
 constr_ast_node_match::resolve(
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) const {
@@ -1221,7 +1221,7 @@ parse_result<constr_t, parse_error>
 parse_constr(
 	token_parser& tokenizer,
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 ) {
@@ -1241,7 +1241,15 @@ parse_constr(
 ) {
 	std::stringstream ss(s);
 	token_parser tokenizer(ss);
-	return parse_constr(tokenizer, {}, lazy_stack<type_context_t::local_entry>{}, globals_resolve, inductive_resolve);
+	return parse_constr(tokenizer, {}, type_context_t::local_stack{}, globals_resolve, inductive_resolve);
+}
+
+parse_result<constr_t, parse_error>
+parse_constr(
+	const std::string& s,
+	const global_env& env
+) {
+	return parse_constr(s, env.globals_resolver(), env.inductive_resolver());
 }
 
 struct sfb_ast_consdef {
@@ -1353,7 +1361,7 @@ parse_sfb_definition(
 		}
 
 		if (auto g = inner.as_global()) {
-			auto i = symtab.id_to_inductive.find(g->name());
+			auto i = symtab.id_to_inductive.find(g->symbol());
 			if (i != symtab.id_to_inductive.end()) {
 				return i->second;
 			}
@@ -1410,7 +1418,7 @@ parse_sfb_inductive(
 		}
 
 		if (auto g = inner.as_global()) {
-			auto i = symtab.id_to_inductive.find(g->name());
+			auto i = symtab.id_to_inductive.find(g->symbol());
 			if (i != symtab.id_to_inductive.end()) {
 				return i->second;
 			}
@@ -1434,7 +1442,7 @@ parse_sfb_inductive(
 	}
 
 	lazy_stackmap<std::string> locals_map;
-	lazy_stack<type_context_t::local_entry> locals_types;
+	type_context_t::local_stack locals_types;
 
 	std::vector<one_inductive_t> oinds;
 
@@ -1500,7 +1508,7 @@ parse_sfb_inductive(
 
 	for (const auto& oind : oinds) {
 		symtab.id_to_type[make_mod_id(mod_context, oind.id)] = oind.type;
-		symtab.id_to_inductive.emplace(make_mod_id(mod_context, oind.id), oind);
+		symtab.id_to_inductive.emplace(constr_symbols().intern(make_mod_id(mod_context, oind.id)), oind);
 
 		for (const auto& cons : oind.constructors) {
 			symtab.id_to_type[make_mod_id(mod_context, cons.id)] = cons.type;
@@ -1529,7 +1537,7 @@ parse_sfb_fixpoint(
 		}
 
 		if (auto g = inner.as_global()) {
-			auto i = symtab.id_to_inductive.find(g->name());
+			auto i = symtab.id_to_inductive.find(g->symbol());
 			if (i != symtab.id_to_inductive.end()) {
 				return i->second;
 			}
@@ -1599,7 +1607,7 @@ parse_sfb_fixpoint(
 	for (const auto& fn : ast_group) {
 		std::vector<formal_arg_t> args;
 		lazy_stackmap<std::string> locals_map;
-		lazy_stack<type_context_t::local_entry> locals_types;
+		type_context_t::local_stack locals_types;
 
 		for (const auto& arg : fn.args) {
 			auto type = arg.type->resolve(locals_map, locals_types, combined_globals_resolve, combined_inductive_resolve);
@@ -1626,7 +1634,7 @@ parse_sfb_fixpoint(
 	}
 
 	lazy_stackmap<std::string> locals_map;
-	lazy_stack<type_context_t::local_entry> locals_types;
+	type_context_t::local_stack locals_types;
 	// Push function names and signatures as local context variables.
 	for (const auto& sig : sigs) {
 		auto type = builder::product(sig.args, sig.restype);
@@ -1792,5 +1800,13 @@ parse_sfb(
 	return parse_sfb(s, globals_resolve, inductive_resolve, symtab, "");
 }
 
+parse_result<sfb_t, parse_error>
+parse_sfb(
+	const std::string& s,
+	const global_env& env
+) {
+	return parse_sfb(s, env.globals_resolver(), env.inductive_resolver());
+}
+
 }  // namespace mgl
 }  // namespace coqcic
@@ -2,6 +2,7 @@
 #define COQCIC_MINIGALLINA_H
 
 #include "coqcic/constr.h"
+#include "coqcic/global_env.h"
 #include "coqcic/lazy_stack.h"
 #include "coqcic/lazy_stackmap.h"
 #include "coqcic/parse_result.h"
@@ -110,7 +111,9 @@ struct parse_error {
 
 struct parse_symtab_t {
 	std::unordered_map<std::string, constr_t> id_to_type;
-	std::unordered_map<std::string, one_inductive_t> id_to_inductive;
+	// Keyed by the symbol of the qualified id in constr_symbols, such
+	// that globals resolve by their symbol().
+	std::unordered_map<symbol_table::id_type, one_inductive_t> id_to_inductive;
 };
 
 class constr_ast_node {
@@ -121,7 +124,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const = 0;
@@ -142,7 +145,7 @@ struct constr_ast_formarg {
 	parse_result<formal_arg_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const;
@@ -158,7 +161,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -196,7 +199,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -239,7 +242,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -300,7 +303,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -342,7 +345,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -390,7 +393,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -436,7 +439,7 @@ public:
 	parse_result<constr_t, parse_error>
 	resolve(
 		const lazy_stackmap<std::string>& locals_map,
-		const lazy_stack<type_context_t::local_entry>& locals_types,
+		const type_context_t::local_stack& locals_types,
 		const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 		const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 	) const override;
@@ -488,7 +491,7 @@ parse_result<constr_t, parse_error>
 parse_constr(
 	token_parser& tokenizer,
 	const lazy_stackmap<std::string>& locals_map,
-	const lazy_stack<type_context_t::local_entry>& locals_types,
+	const type_context_t::local_stack& locals_types,
 	const std::function<std::optional<constr_t>(const std::string&)>& globals_resolve,
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 );
@@ -500,6 +503,13 @@ parse_constr(
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 );
 
+// Resolves globals and inductive types against the given table.
+parse_result<constr_t, parse_error>
+parse_constr(
+	const std::string& s,
+	const global_env& env
+);
+
 parse_result<std::vector<token_t>, parse_error>
 parse_constr_tokenstream(
 	token_parser& tokenizer
@@ -530,6 +540,13 @@ parse_sfb(
 	const std::function<std::optional<one_inductive_t>(const constr_t&)>& inductive_resolve
 );
 
+// Resolves globals and inductive types against the given table.
+parse_result<sfb_t, parse_error>
+parse_sfb(
+	const std::string& s,
+	const global_env& env
+);
+
 
 }  // namespace mgl
 }  // namespace coqcic
@@ -0,0 +1,402 @@
+#include "coqcic/nbe.h"
+
+#include <stdexcept>
+
+#include "coqcic/lazy_stack.h"
+
+namespace coqcic {
+
+// Element of the semantic domain. Values are immutable and shared.
+class nbe_engine::value {
+public:
+	using ptr = std::shared_ptr<const value>;
+	using env_t = lazy_stack<ptr>;
+
+	enum kind_type {
+		// Lambda abstraction "term" awaiting its formal arguments from
+		// "first" on, with values for the preceding ones and the loose
+		// indices of the abstraction in "env".
+		kind_lambda,
+		// Product "term", formal arguments from "first" on, as above.
+		kind_product,
+		// Constructor with global id "ctor" (named by global "term")
+		// applied to "args".
+		kind_constructor,
+		// Fixpoint "term" closed by "env", applied to "args" that do not
+		// (yet) allow unfolding it.
+		kind_fix,
+		// Neutral: variable at binder "level" applied to "args".
+		// Negative levels designate loose indices of the normalized
+		// term, -1 for index 0.
+		kind_variable,
+		// Neutral: global or builtin "term" that cannot be unfolded,
+		// applied to "args".
+		kind_opaque,
+		// Neutral: match "term" closed by "env", stuck on the neutral
+		// value "scrutinee", applied to "args".
+		kind_match
+	};
+
+	kind_type kind;
+	constr_t term;
+	env_t env;
+	std::size_t first = 0;
+	global_env::id_type ctor = 0;
+	std::ptrdiff_t level = 0;
+	symbol_table::id_type symbol = 0;
+	ptr scrutinee;
+	std::vector<ptr> args;
+};
+
+class nbe_engine::evaluator {
+public:
+	using ptr = value::ptr;
+	using env_t = value::env_t;
+
+	explicit
+	evaluator(nbe_engine& engine) noexcept : engine_(engine) {}
+
+	ptr
+	eval(const constr_t& term, const env_t& env);
+
+	ptr
+	apply(const ptr& fn, ptr arg);
+
+	constr_t
+	quote(const value& v, std::size_t depth);
+
+private:
+	static ptr
+	variable(symbol_table::id_type symbol, std::ptrdiff_t level);
+
+	ptr
+	eval_global(const constr_t& term, const constr_global& global);
+
+	ptr
+	eval_match(const constr_t& term, const env_t& env);
+
+	// Evaluates the body of the fixpoint function applied to the
+	// arguments of the given fixpoint value.
+	ptr
+	unfold(const value& fix);
+
+	// Quotes the formal arguments of a binder from "first" on, extending
+	// env and depth by them.
+	std::vector<formal_arg_t>
+	quote_args(const std::vector<formal_arg_t>& args, std::size_t first, env_t& env, std::size_t& depth);
+
+	constr_t
+	quote_fix(const value& v, std::size_t depth);
+
+	constr_t
+	quote_spine(constr_t head, const std::vector<ptr>& args, std::size_t depth);
+
+	nbe_engine& engine_;
+};
+
+nbe_engine::value::ptr
+nbe_engine::evaluator::variable(symbol_table::id_type symbol, std::ptrdiff_t level) {
+	auto v = std::make_shared<value>();
+	v->kind = value::kind_variable;
+	v->symbol = symbol;
+	v->level = level;
+	return v;
+}
+
+nbe_engine::value::ptr
+nbe_engine::evaluator::eval(const constr_t& term, const env_t& env) {
+	switch (term.constr_kind()) {
+		case constr_kind_local: {
+			auto local = term.as_local();
+			static const ptr none;
+			const auto& bound = env.get(local->index(), none);
+			if (bound) {
+				return bound;
+			}
+			std::ptrdiff_t loose = static_cast<std::ptrdiff_t>(local->index() - env.size());
+			return variable(local->symbol(), -loose - 1);
+		}
+		case constr_kind_global: {
+			return eval_global(term, *term.as_global());
+		}
+		case constr_kind_builtin: {
+			auto v = std::make_shared<value>();
+			v->kind = value::kind_opaque;
+			v->term = term;
+			return v;
+		}
+		case constr_kind_product:
+		case constr_kind_lambda: {
+			auto v = std::make_shared<value>();
+			v->kind = term.as_lambda() ? value::kind_lambda : value::kind_product;
+			v->term = term;
+			v->env = env;
+			return v;
+		}
+		case constr_kind_let: {
+			auto let = term.as_let();
+			return eval(let->body(), env.push(eval(let->value(), env)));
+		}
+		case constr_kind_apply: {
+			auto app = term.as_apply();
+			auto result = eval(app->fn(), env);
+			for (const auto& arg : app->args()) {
+				result = apply(result, eval(arg, env));
+			}
+			return result;
+		}
+		case constr_kind_cast: {
+			return eval(term.as_cast()->term(), env);
+		}
+		case constr_kind_match: {
+			return eval_match(term, env);
+		}
+		case constr_kind_fix: {
+			auto v = std::make_shared<value>();
+			v->kind = value::kind_fix;
+			v->term = term;
+			v->env = env;
+			return v;
+		}
+		default: {
+			throw std::logic_error("nbe: unhandled term kind");
+		}
+	}
+}
+
+nbe_engine::value::ptr
+nbe_engine::evaluator::eval_global(const constr_t& term, const constr_global& global) {
+	const auto& globals = engine_.env_;
+	auto id = globals.find(global.symbol());
+	if (!id) {
+		throw std::runtime_error("unresolved global: " + global.name());
+	}
+	if (globals.kind(*id) == global_env::kind_constructor) {
+		auto v = std::make_shared<value>();
+		v->kind = value::kind_constructor;
+		v->term = term;
+		v->ctor = *id;
+		return v;
+	}
+	if (globals.body(*id)) {
+		auto& cached = engine_.definition_values_[*id];
+		if (!cached) {
+			cached = eval(*globals.body(*id), env_t());
+		}
+		return cached;
+	}
+
+	auto v = std::make_shared<value>();
+	v->kind = value::kind_opaque;
+	v->term = term;
+	return v;
+}
+
+nbe_engine::value::ptr
+nbe_engine::evaluator::eval_match(const constr_t& term, const env_t& env) {
+	auto match = term.as_match();
+	auto scrutinee = eval(match->arg(), env);
+	if (scrutinee->kind != value::kind_constructor) {
+		auto v = std::make_shared<value>();
+		v->kind = value::kind_match;
+		v->term = term;
+		v->env = env;
+		v->scrutinee = std::move(scrutinee);
+		return v;
+	}
+
+	// Branches normally follow the order of the constructors of the
+	// inductive type, otherwise search by (qualified) name.
+	const auto& branches = match->branches();
+	const auto& globals = engine_.env_;
+	std::size_t index = globals.constructor_index(scrutinee->ctor);
+	const auto& id = globals.name(scrutinee->ctor);
+	const match_branch_t* branch = nullptr;
+	if (index < branches.size() && branches[index].constructor == id) {
+		branch = &branches[index];
+	} else {
+		for (const auto& candidate : branches) {
+			if (candidate.constructor == id) {
+				branch = &candidate;
+				break;
+			}
+		}
+	}
+	if (!branch || branch->nargs > scrutinee->args.size()) {
+		throw std::invalid_argument("nbe: no match branch for constructor " + id);
+	}
+
+	// Constructor arguments follow the inductive parameters.
+	auto result = eval(branch->expr, env);
+	for (std::size_t n = scrutinee->args.size() - branch->nargs; n < scrutinee->args.size(); ++n) {
+		result = apply(result, scrutinee->args[n]);
+	}
+	return result;
+}
+
+nbe_engine::value::ptr
+nbe_engine::evaluator::apply(const ptr& fn, ptr arg) {
+	switch (fn->kind) {
+		case value::kind_lambda: {
+			auto lambda = fn->term.as_lambda();
+			auto env = fn->env.push(std::move(arg));
+			if (fn->first + 1 < lambda->args().size()) {
+				auto v = std::make_shared<value>(*fn);
+				v->env = std::move(env);
+				v->first = fn->first + 1;
+				return v;
+			}
+			return eval(lambda->body(), env);
+		}
+		case value::kind_product: {
+			throw std::invalid_argument("nbe: application of a product");
+		}
+		case value::kind_fix: {
+			auto v = std::make_shared<value>(*fn);
+			v->args.push_back(std::move(arg));
+			// Once all formal arguments are present, the fixpoint either
+			// unfolds or remains stuck for good.
+			auto fix = fn->term.as_fix();
+			const auto& function = fix->group()->functions[fix->index()];
+			if (v->args.size() == function.args.size()) {
+				auto k = function.structural_arg();
+				if (k && v->args[*k]->kind == value::kind_constructor) {
+					return unfold(*v);
+				}
+			}
+			return v;
+		}
+		default: {
+			auto v = std::make_shared<value>(*fn);
+			v->args.push_back(std::move(arg));
+			return v;
+		}
+	}
+}
+
+nbe_engine::value::ptr
+nbe_engine::evaluator::unfold(const value& fix) {
+	auto node = fix.term.as_fix();
+	const auto& functions = node->group()->functions;
+	// Function n is bound at index nfun - 1 - n within the bodies.
+	env_t env = fix.env;
+	for (std::size_t n = 0; n < functions.size(); ++n) {
+		auto v = std::make_shared<value>();
+		v->kind = value::kind_fix;
+		v->term = builder::fix(n, node->group());
+		v->env = fix.env;
+		env = env.push(std::move(v));
+	}
+	const auto& function = functions[node->index()];
+	for (std::size_t n = 0; n < function.args.size(); ++n) {
+		env = env.push(fix.args[n]);
+	}
+	return eval(function.body, env);
+}
+
+std::vector<formal_arg_t>
+nbe_engine::evaluator::quote_args(
+	const std::vector<formal_arg_t>& args, std::size_t first, env_t& env, std::size_t& depth)
+{
+	std::vector<formal_arg_t> result;
+	for (std::size_t n = first; n < args.size(); ++n) {
+		const auto& arg = args[n];
+		result.push_back({arg.name, quote(*eval(arg.type, env), depth)});
+		env = env.push(variable(constr_symbols().intern(arg.name ? *arg.name : "_"), depth));
+		++depth;
+	}
+	return result;
+}
+
+constr_t
+nbe_engine::evaluator::quote_fix(const value& v, std::size_t depth) {
+	auto fix = v.term.as_fix();
+	const auto& functions = fix->group()->functions;
+	env_t fix_env = v.env;
+	for (std::size_t n = 0; n < functions.size(); ++n) {
+		fix_env = fix_env.push(variable(constr_symbols().intern(functions[n].name), depth + n));
+	}
+	auto group = std::make_shared<fix_group_t>();
+	for (const auto& fn : functions) {
+		env_t env = fix_env;
+		std::size_t inner = depth + functions.size();
+		fix_function_t new_fn;
+		new_fn.name = fn.name;
+		new_fn.args = quote_args(fn.args, 0, env, inner);
+		new_fn.restype = quote(*eval(fn.restype, env), inner);
+		new_fn.body = quote(*eval(fn.body, env), inner);
+		group->functions.push_back(std::move(new_fn));
+	}
+	return builder::fix(fix->index(), std::move(group));
+}
+
+constr_t
+nbe_engine::evaluator::quote_spine(constr_t head, const std::vector<ptr>& args, std::size_t depth) {
+	if (args.empty()) {
+		return head;
+	}
+	std::vector<constr_t> quoted;
+	for (const auto& arg : args) {
+		quoted.push_back(quote(*arg, depth));
+	}
+	return builder::apply(std::move(head), std::move(quoted));
+}
+
+constr_t
+nbe_engine::evaluator::quote(const value& v, std::size_t depth) {
+	switch (v.kind) {
+		case value::kind_lambda: {
+			auto lambda = v.term.as_lambda();
+			env_t env = v.env;
+			std::size_t inner = depth;
+			auto args = quote_args(lambda->args(), v.first, env, inner);
+			return builder::lambda(std::move(args), quote(*eval(lambda->body(), env), inner));
+		}
+		case value::kind_product: {
+			auto product = v.term.as_product();
+			env_t env = v.env;
+			std::size_t inner = depth;
+			auto args = quote_args(product->args(), v.first, env, inner);
+			return builder::product(std::move(args), quote(*eval(product->restype(), env), inner));
+		}
+		case value::kind_fix: {
+			return quote_spine(quote_fix(v, depth), v.args, depth);
+		}
+		case value::kind_variable: {
+			std::ptrdiff_t index = static_cast<std::ptrdiff_t>(depth) - v.level - 1;
+			return quote_spine(builder::local(v.symbol, index), v.args, depth);
+		}
+		case value::kind_match: {
+			auto match = v.term.as_match();
+			std::vector<match_branch_t> branches;
+			for (const auto& branch : match->branches()) {
+				branches.push_back({branch.constructor, branch.nargs, quote(*eval(branch.expr, v.env), depth)});
+			}
+			auto head = builder::match(
+				quote(*eval(match->casetype(), v.env), depth),
+				quote(*v.scrutinee, depth),
+				std::move(branches));
+			return quote_spine(std::move(head), v.args, depth);
+		}
+		default: {
+			return quote_spine(v.term, v.args, depth);
+		}
+	}
+}
+
+nbe_engine::~nbe_engine() {
+}
+
+nbe_engine::nbe_engine(const std::vector<sfb_t>& sfbs) : nbe_engine(global_env(sfbs)) {
+}
+
+nbe_engine::nbe_engine(global_env env) : env_(std::move(env)), definition_values_(env_.size()) {
+}
+
+constr_t
+nbe_engine::normalize(const constr_t& term) {
+	evaluator e(*this);
+	return e.quote(*e.eval(term, value::env_t()), 0);
+}
+
+}  // namespace coqcic
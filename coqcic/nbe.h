@@ -0,0 +1,67 @@
+#ifndef COQCIC_NBE_H
+#define COQCIC_NBE_H
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "coqcic/constr.h"
+#include "coqcic/global_env.h"
+#include "coqcic/sfb.h"
+
+namespace coqcic {
+
+// Strong normalization by evaluation.
+//
+// Terms are evaluated into a semantic domain: abstractions become closures
+// (the term together with values for its loose de Bruijn indices),
+// constructor applications become constructor values, and computations
+// blocked on a variable become neutral terms. Matches on constructor values
+// and fixpoints applied to constructor values in their structural argument
+// are evaluated directly in this domain. The value is then quoted back to
+// a term in normal form, evaluating closures on fresh variables to
+// normalize below binders.
+//
+// Globals are resolved against the global environment given at
+// construction (or built from structure body elements): definitions and
+// fixpoints are unfolded, constructors of inductive types are recognized
+// as such. Globals are looked up by the symbols of their names, the
+// constructors of match branches by their fully qualified name;
+// normalizing a term referring to a global not in the environment
+// throws. Evaluation of terms without normal form does not terminate.
+//
+// Values of definitions are computed once and shared by all terms
+// normalized by the same engine, which is therefore not safe to use from
+// multiple threads concurrently.
+class nbe_engine {
+public:
+	~nbe_engine();
+
+	explicit
+	nbe_engine(const std::vector<sfb_t>& sfbs);
+
+	explicit
+	nbe_engine(global_env env);
+
+	nbe_engine(const nbe_engine& other) = delete;
+	nbe_engine& operator=(const nbe_engine& other) = delete;
+
+	// Computes the normal form of the given term. Loose de Bruijn indices
+	// of the term are treated as free variables.
+	constr_t
+	normalize(const constr_t& term);
+
+private:
+	class value;
+	class evaluator;
+
+	global_env env_;
+
+	// Values of definitions and fixpoints, indexed by global id.
+	std::vector<std::shared_ptr<const value>> definition_values_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_NBE_H
@@ -0,0 +1,188 @@
+// Benchmark for strong normalization by evaluation.
+//
+// Compares nbe_engine against normalizing by repeated simpl() calls (a
+// bottom-up pass applying simpl to every application, repeated until
+// nothing changes) on arithmetic with Church numerals, which only requires
+// beta reduction. Additionally compares against nf on arithmetic with
+// inductive naturals, which requires match and fixpoint reduction that
+// simpl does not perform.
+
+#include "coqcic/constr.h"
+#include "coqcic/nbe.h"
+#include "coqcic/reduce.h"
+#include "coqcic/visitor.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+using namespace coqcic;
+
+class simpl_visitor final : public transform_visitor {
+public:
+	std::optional<constr_t>
+	handle_apply(const constr_t& fn, const std::vector<constr_t>& args) override {
+		auto term = builder::apply(fn, args);
+		auto result = term.simpl();
+		if (result.repr() == term.repr()) {
+			return term;
+		}
+		changed = true;
+		return result;
+	}
+
+	bool changed = false;
+};
+
+constr_t
+simpl_normalize(constr_t term) {
+	for (;;) {
+		simpl_visitor visitor;
+		auto result = visit_transform(term, visitor);
+		if (result) {
+			term = std::move(*result);
+		}
+		if (!visitor.changed) {
+			return term;
+		}
+	}
+}
+
+// fun f x => f (... (f x))
+constr_t
+church(std::size_t n) {
+	using namespace builder;
+	constr_t body = local("x", 0);
+	for (std::size_t k = 0; k < n; ++k) {
+		body = apply(local("f", 1), {body});
+	}
+	return lambda({{"f", global("T")}}, lambda({{"x", global("T")}}, body));
+}
+
+// fun m n f => m (n f)
+constr_t
+church_mult() {
+	using namespace builder;
+	return lambda(
+		{{"m", global("T")}, {"n", global("T")}, {"f", global("T")}},
+		apply(local("m", 2), {apply(local("n", 1), {local("f", 0)})}));
+}
+
+constr_t
+nat_of(std::size_t n) {
+	constr_t result = builder::global("O");
+	for (std::size_t k = 0; k < n; ++k) {
+		result = builder::apply(builder::global("S"), {result});
+	}
+	return result;
+}
+
+// fix mult (n : nat) (m : nat) : nat :=
+//   match n with O => O | S p => plus m (mult p m) end
+// with plus inlined as a fixpoint of its own.
+constr_t
+nat_mult() {
+	using namespace builder;
+	auto nat = global("nat");
+	auto plus_group = std::make_shared<fix_group_t>();
+	plus_group->functions.push_back(fix_function_t{
+		"plus",
+		{{"n", nat}, {"m", nat}},
+		nat,
+		match(
+			lambda({{"n", nat}}, nat),
+			local("n", 1),
+			{
+				{"O", 0, local("m", 0)},
+				{"S", 1, lambda(
+					{{"p", nat}},
+					apply(global("S"), {apply(local("plus", 3), {local("p", 0), local("m", 1)})}))}
+			})
+	});
+	auto plus = fix(0, plus_group);
+	auto group = std::make_shared<fix_group_t>();
+	group->functions.push_back(fix_function_t{
+		"mult",
+		{{"n", nat}, {"m", nat}},
+		nat,
+		match(
+			lambda({{"n", nat}}, nat),
+			local("n", 1),
+			{
+				{"O", 0, global("O")},
+				{"S", 1, lambda(
+					{{"p", nat}},
+					apply(plus, {local("m", 1), apply(local("mult", 3), {local("p", 0), local("m", 1)})}))}
+			})
+	});
+	return fix(0, std::move(group));
+}
+
+std::vector<sfb_t>
+nat_env() {
+	using namespace builder;
+	std::vector<sfb_t> sfbs;
+	sfbs.emplace_back(std::make_shared<sfb_inductive>(std::vector<one_inductive_t>{
+		one_inductive_t("nat", builtin_set(), {
+			{"O", local("nat", 0)},
+			{"S", product({{std::nullopt, local("nat", 0)}}, local("nat", 1))}})}));
+	// Type of the arguments of church numerals.
+	sfbs.emplace_back(std::make_shared<sfb_axiom>("T", builtin_set()));
+	return sfbs;
+}
+
+template<typename Fn>
+double
+time_ms(Fn&& fn, std::size_t rounds) {
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t n = 0; n < rounds; ++n) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+	const std::size_t rounds = 20;
+	nbe_engine engine(nat_env());
+	std::size_t sink = 0;
+
+	{
+		auto mult = church_mult();
+		auto term = builder::apply(mult, {church(12), builder::apply(mult, {church(10), church(10)})});
+		auto expected = church(1200);
+		if (simpl_normalize(term) != expected || engine.normalize(term) != expected || nf(term) != expected) {
+			throw std::logic_error("church numerals: unexpected normal form");
+		}
+
+		double simpl_ms = time_ms([&] { sink += simpl_normalize(term).hash(); }, rounds);
+		double nf_ms = time_ms([&] { sink += nf(term).hash(); }, rounds);
+		double nbe_ms = time_ms([&] { sink += engine.normalize(term).hash(); }, rounds);
+
+		std::cout << "church 12 * 10 * 10:\n";
+		std::cout << "  repeated simpl: " << simpl_ms << " ms\n";
+		std::cout << "  nf:             " << nf_ms << " ms\n";
+		std::cout << "  nbe:            " << nbe_ms << " ms\n";
+	}
+
+	{
+		auto term = builder::apply(nat_mult(), {nat_of(40), nat_of(30)});
+		auto expected = nat_of(1200);
+		if (engine.normalize(term) != expected || nf(term) != expected) {
+			throw std::logic_error("nat: unexpected normal form");
+		}
+
+		double nf_ms = time_ms([&] { sink += nf(term).hash(); }, rounds);
+		double nbe_ms = time_ms([&] { sink += engine.normalize(term).hash(); }, rounds);
+
+		std::cout << "nat 40 * 30:\n";
+		std::cout << "  nf:             " << nf_ms << " ms\n";
+		std::cout << "  nbe:            " << nbe_ms << " ms\n";
+	}
+
+	return sink == 0 ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include "coqcic/nbe.h"
+
+#include "gtest/gtest.h"
+
+namespace coqcic {
+
+namespace {
+
+constr_t
+nat_of(std::size_t n, const std::string& prefix = "") {
+	constr_t result = builder::global(prefix + "O");
+	for (std::size_t k = 0; k < n; ++k) {
+		result = builder::apply(builder::global(prefix + "S"), {result});
+	}
+	return result;
+}
+
+// Inductive nat := O : nat | S : nat -> nat.
+// Fixpoint plus (n : nat) (m : nat) : nat :=
+//   match n with O => m | S p => S (plus p m) end.
+// Definition two := S (S O).
+// All in module Top.
+global_env
+nat_env() {
+	using namespace builder;
+	auto nat = global("Top.nat");
+	std::vector<sfb_t> sfbs;
+	sfbs.emplace_back(std::make_shared<sfb_inductive>(std::vector<one_inductive_t>{
+		one_inductive_t("nat", builtin_set(), {
+			{"O", local("nat", 0)},
+			{"S", product({{std::nullopt, local("nat", 0)}}, local("nat", 1))}})}));
+
+	fix_group_t group;
+	group.functions.push_back(fix_function_t{
+		"plus",
+		{{"n", nat}, {"m", nat}},
+		nat,
+		match(
+			lambda({{"n", nat}}, nat),
+			local("n", 1),
+			{
+				{"Top.O", 0, local("m", 0)},
+				{"Top.S", 1, lambda(
+					{{"p", nat}},
+					apply(global("Top.S"), {apply(local("plus", 3), {local("p", 0), local("m", 1)})}))}
+			})
+	});
+	sfbs.emplace_back(std::make_shared<sfb_fixpoint>(std::move(group)));
+	sfbs.emplace_back(std::make_shared<sfb_definition>("two", nat, nat_of(2, "Top.")));
+	return global_env(sfbs, "Top");
+}
+
+}  // namespace
+
+TEST(nbe_test, closed) {
+	using namespace builder;
+	nbe_engine engine(nat_env());
+	EXPECT_EQ(nat_of(5, "Top."), engine.normalize(apply(global("Top.plus"), {nat_of(3, "Top."), nat_of(2, "Top.")})));
+	EXPECT_EQ(
+		nat_of(4, "Top."),
+		engine.normalize(apply(global("Top.plus"), {global("Top.two"), global("Top.two")})));
+
+	// Branches out of constructor order are selected by name.
+	auto nat = global("Top.nat");
+	auto swapped = match(
+		lambda({{"n", nat}}, nat),
+		global("Top.two"),
+		{
+			{"Top.S", 1, lambda({{"p", nat}}, local("p", 0))},
+			{"Top.O", 0, global("Top.two")}
+		});
+	EXPECT_EQ(nat_of(1, "Top."), engine.normalize(swapped));
+
+	// Names are not resolved without their module prefix.
+	EXPECT_THROW(engine.normalize(apply(global("plus"), {nat_of(1, "Top."), nat_of(1, "Top.")})), std::runtime_error);
+	auto unqualified = match(
+		lambda({{"n", nat}}, nat),
+		global("Top.two"),
+		{
+			{"O", 0, global("Top.two")},
+			{"S", 1, lambda({{"p", nat}}, local("p", 0))}
+		});
+	EXPECT_THROW(engine.normalize(unqualified), std::invalid_argument);
+}
+
+TEST(nbe_test, open) {
+	using namespace builder;
+	nbe_engine engine(nat_env());
+	auto nat = global("Top.nat");
+
+	// Reduces below binders, the recursion proceeds on the constructor.
+	auto succ = lambda({{"k", nat}}, apply(global("Top.plus"), {nat_of(1, "Top."), local("k", 0)}));
+	EXPECT_EQ(lambda({{"k", nat}}, apply(global("Top.S"), {local("k", 0)})), engine.normalize(succ));
+
+	// Stuck on the variable: the fixpoint stays applied.
+	auto stuck = lambda({{"k", nat}}, apply(global("Top.plus"), {local("k", 0), global("Top.two")}));
+	auto result = engine.normalize(stuck);
+	ASSERT_TRUE(result.as_lambda());
+	auto body = result.as_lambda()->body().as_apply();
+	ASSERT_TRUE(body && body->fn().as_fix());
+	EXPECT_EQ(local("k", 0), body->args()[0]);
+	EXPECT_EQ(nat_of(2, "Top."), body->args()[1]);
+
+	// Loose indices and let bindings.
+	auto let_term = let("x", local("y", 0), nat, lambda({{"z", nat}}, apply(local("f", 3), {local("x", 1), local("z", 0)})));
+	EXPECT_EQ(
+		lambda({{"z", nat}}, apply(local("f", 2), {local("y", 1), local("z", 0)})),
+		engine.normalize(let_term));
+}
+
+}  // namespace coqcic
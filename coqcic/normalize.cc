@@ -1,188 +1,210 @@
 #include "coqcic/normalize.h"
 
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
 namespace coqcic {
 
 namespace {
 
-// Normalizes the given expression, that means:
-// - "apply-of-apply" will be flattened into a single apply
-// - "product-of-product" will be flattened into a single product
-// - "lambda-of-lambda" will be flattened into a single lambda
-std::optional<constr_t>
-normalize_rec(const constr_t& input) {
-	if (input.as_local()) {
-		return {};
-	} else if (input.as_global()) {
-		return {};
-	} else if (input.as_builtin()) {
-		return {};
-	} else if (auto product = input.as_product()) {
-		constr_t restype;
-		bool changed = false;
-		std::vector<formal_arg_t> args;
-
-		while (product) {
-			for (const auto& arg : product->args()) {
-				auto maybe_argtype = normalize_rec(arg.type);
-				changed = changed || maybe_argtype;
-				args.push_back(maybe_argtype ? formal_arg_t{arg.name, *maybe_argtype} : arg);
+// Node being normalized. For products, lambdas and applications, the
+// frame covers the entire chain of directly nested nodes of the same
+// kind, which are flattened into one. Children (the argument types of
+// all products in the chain and the final result type, etc.) are
+// normalized in order, results hold each normalized child (or the
+// original child if already normal). Frames are reused for the nodes
+// visited at the same depth, keeping the capacity of their vectors.
+struct normalize_frame {
+	void
+	reset(const constr_t& term) {
+		input = term;
+		args.clear();
+		children.clear();
+		results.clear();
+		changed = false;
+		if (auto product = input.as_product()) {
+			for (;;) {
+				for (const auto& arg : product->args()) {
+					args.push_back(&arg);
+					children.push_back(&arg.type);
+				}
+				auto next = product->restype().as_product();
+				if (!next) {
+					children.push_back(&product->restype());
+					break;
+				}
+				product = next;
+				changed = true;
 			}
-			restype = product->restype();
-			product = restype.as_product();
-			if (product) {
+		} else if (auto lambda = input.as_lambda()) {
+			for (;;) {
+				for (const auto& arg : lambda->args()) {
+					args.push_back(&arg);
+					children.push_back(&arg.type);
+				}
+				auto next = lambda->body().as_lambda();
+				if (!next) {
+					children.push_back(&lambda->body());
+					break;
+				}
+				lambda = next;
 				changed = true;
 			}
-		}
-
-		auto maybe_restype = normalize_rec(restype);
-		const auto& new_restype = maybe_restype ? *maybe_restype : restype;
-		changed = changed || maybe_restype;
-
-		if (changed) {
-			return builder::product(std::move(args), new_restype);
-		} else {
-			return {};
-		}
-	} else if (auto lambda = input.as_lambda()) {
-		constr_t body;
-		bool changed = false;
-		std::vector<formal_arg_t> args;
-
-		while (lambda) {
-			for (const auto& arg : lambda->args()) {
-				auto maybe_argtype = normalize_rec(arg.type);
-				changed = changed || maybe_argtype;
-				args.push_back(maybe_argtype ? formal_arg_t{arg.name, *maybe_argtype} : arg);
+		} else if (auto let = input.as_let()) {
+			children = {&let->value(), &let->type(), &let->body()};
+		} else if (auto apply = input.as_apply()) {
+			// Collect the chain outermost first, then order children
+			// as function followed by arguments of the innermost
+			// application first.
+			chain.clear();
+			for (; apply; apply = apply->fn().as_apply()) {
+				chain.push_back(apply);
 			}
-			body = lambda->body();
-			lambda = body.as_lambda();
-			if (lambda) {
-				changed = true;
+			changed = chain.size() > 1;
+			children.push_back(&chain.back()->fn());
+			for (auto i = chain.rbegin(); i != chain.rend(); ++i) {
+				for (const auto& arg : (*i)->args()) {
+					children.push_back(&arg);
+				}
 			}
-		}
-
-		auto maybe_body = normalize_rec(body);
-		const auto& new_body = maybe_body ? *maybe_body : body;
-		changed = changed || maybe_body;
-
-		if (changed) {
-			return builder::lambda(std::move(args), new_body);
-		} else {
-			return {};
-		}
-	} else if (auto let = input.as_let()) {
-		auto maybe_value = normalize_rec(let->value());
-		const auto& value = maybe_value ? *maybe_value : let->value();
-
-		auto maybe_type = normalize_rec(let->type());
-		const auto& type = maybe_type ? *maybe_type : let->type();
-
-		auto maybe_body = normalize_rec(let->body());
-		const auto& body = maybe_body ? *maybe_body : let->body();
-
-		if (maybe_value || maybe_type || maybe_body) {
-			return builder::let(let->varname(), value, type, body);
-		} else {
-			return {};
-		}
-	} else if (auto apply = input.as_apply()) {
-		constr_t fn;
-		bool changed = false;
-		/* note that we will initially push args in reverse */
-		std::vector<constr_t> args;
-
-		while (apply) {
-			for (auto i = apply->args().rbegin(); i != apply->args().rend(); ++i) {
-				const auto& arg = *i;
-				auto maybe_arg = normalize_rec(arg);
-				changed = changed || maybe_arg;
-				args.push_back(maybe_arg ? *maybe_arg : arg);
+		} else if (auto cast = input.as_cast()) {
+			children = {&cast->term(), &cast->typeterm()};
+		} else if (auto match_case = input.as_match()) {
+			children = {&match_case->arg(), &match_case->casetype()};
+			for (const auto& branch : match_case->branches()) {
+				children.push_back(&branch.expr);
 			}
-			fn = apply->fn();
-			apply = fn.as_apply();
-			if (apply) {
-				changed = true;
+		} else if (auto fix = input.as_fix()) {
+			for (const auto& function : fix->group()->functions) {
+				for (const auto& arg : function.args) {
+					children.push_back(&arg.type);
+				}
+				children.push_back(&function.restype);
+				children.push_back(&function.body);
 			}
-		}
-
-		auto maybe_fn = normalize_rec(fn);
-		changed = changed || maybe_fn;
-		const auto& new_fn = maybe_fn ? *maybe_fn : fn;
-		if (changed) {
-			std::reverse(args.begin(), args.end());
-			return builder::apply(new_fn, std::move(args));
 		} else {
-			return {};
+			throw std::logic_error("Unhandled constr kind");
 		}
-	} else if (auto cast = input.as_cast()) {
-		auto maybe_term = normalize_rec(cast->term());
-		const auto& term = maybe_term ? *maybe_term : cast->term();
+		results.reserve(children.size());
+	}
 
-		auto maybe_typeterm = normalize_rec(cast->typeterm());
-		const auto& typeterm = maybe_typeterm ? *maybe_typeterm : cast->typeterm();
+	constr_t input;
+	// Formal arguments of the flattened products or lambdas.
+	std::vector<const formal_arg_t*> args;
+	std::vector<const constr_t*> children;
+	std::vector<constr_t> results;
+	bool changed = false;
+	// Chain of flattened applications, outermost first.
+	std::vector<const constr_apply*> chain;
+};
+
+inline bool
+is_leaf(const constr_t& term) {
+	return term.as_local() || term.as_global() || term.as_builtin();
+}
 
-		if (maybe_term || maybe_typeterm) {
-			return builder::cast(term, cast->kind(), typeterm);
-		} else {
-			return {};
-		}
-	} else if (auto match_case = input.as_match()) {
-		auto maybe_arg = normalize_rec(match_case->arg());
-		const auto& arg = maybe_arg ? *maybe_arg : match_case->arg();
+// Rebuilds the node of the frame from its normalized children, if
+// anything changed.
+std::optional<constr_t>
+finish_frame(normalize_frame& frame) {
+	if (!frame.changed) {
+		return {};
+	}
 
-		auto maybe_casetype = normalize_rec(match_case->casetype());
-		const auto& casetype = maybe_casetype ? *maybe_casetype : match_case->casetype();
+	const auto& input = frame.input;
+	auto& results = frame.results;
 
-		bool changed = false;
-		std::vector<match_branch_t> branches;
-		for (const auto& branch : match_case->branches()) {
-			auto maybe_expr = normalize_rec(branch.expr);
-			changed = changed || maybe_expr;
-			const auto& expr = maybe_expr ? *maybe_expr : branch.expr;
-			branches.push_back(match_branch_t{branch.constructor, branch.nargs, expr});
+	auto make_args = [&results] (const std::vector<const formal_arg_t*>& args) {
+		std::vector<formal_arg_t> new_args;
+		new_args.reserve(args.size());
+		for (std::size_t n = 0; n < args.size(); ++n) {
+			new_args.push_back(formal_arg_t{args[n]->name, std::move(results[n])});
 		}
+		return new_args;
+	};
 
-		changed = changed || maybe_arg || maybe_casetype;
-
-		if (changed) {
-			return builder::match(casetype, arg, branches);
-		} else {
-			return {};
+	if (input.as_product()) {
+		return builder::product(make_args(frame.args), std::move(results.back()));
+	} else if (input.as_lambda()) {
+		return builder::lambda(make_args(frame.args), std::move(results.back()));
+	} else if (auto let = input.as_let()) {
+		return builder::let(let->varname(), std::move(results[0]), std::move(results[1]), std::move(results[2]));
+	} else if (input.as_apply()) {
+		std::vector<constr_t> args(std::make_move_iterator(results.begin() + 1), std::make_move_iterator(results.end()));
+		return builder::apply(std::move(results[0]), std::move(args));
+	} else if (auto cast = input.as_cast()) {
+		return builder::cast(std::move(results[0]), cast->kind(), std::move(results[1]));
+	} else if (auto match_case = input.as_match()) {
+		std::vector<match_branch_t> branches;
+		branches.reserve(match_case->branches().size());
+		for (std::size_t n = 0; n < match_case->branches().size(); ++n) {
+			const auto& branch = match_case->branches()[n];
+			branches.push_back(match_branch_t{branch.constructor, branch.nargs, std::move(results[n + 2])});
 		}
-	} else if (auto fix = input.as_fix()) {
-		std::vector<fix_function_t> functions;
-
-		bool changed = false;
+		return builder::match(std::move(results[1]), std::move(results[0]), std::move(branches));
+	} else {
+		auto fix = input.as_fix();
+		auto new_group = std::make_shared<fix_group_t>();
+		std::size_t first = 0;
 		for (const auto& function : fix->group()->functions) {
 			std::vector<formal_arg_t> args;
+			args.reserve(function.args.size());
 			for (const auto& arg : function.args) {
-				auto maybe_argtype = normalize_rec(arg.type);
-				changed = changed || maybe_argtype;
-				const auto& argtype = maybe_argtype ? *maybe_argtype : arg.type;
-				args.push_back({arg.name, argtype});
+				args.push_back(formal_arg_t{arg.name, std::move(results[first++])});
 			}
-			auto maybe_restype = normalize_rec(function.restype);
-			const auto& restype = maybe_restype ? *maybe_restype : function.restype;
-
-			auto maybe_body = normalize_rec(function.body);
-			const auto& body = maybe_body ? *maybe_body : function.body;
-			changed = changed || maybe_restype || maybe_body;
-
-			functions.push_back(fix_function_t{function.name, std::move(args), restype, body});
-		}
-		std::shared_ptr<fix_group_t> new_group;
-		if (changed) {
-			new_group = std::make_shared<fix_group_t>();
-			new_group->functions = std::move(functions);
+			auto restype = std::move(results[first++]);
+			auto body = std::move(results[first++]);
+			new_group->functions.push_back(fix_function_t{function.name, std::move(args), std::move(restype), std::move(body)});
 		}
+		return builder::fix(fix->index(), std::move(new_group));
+	}
+}
+
+// Normalizes the given expression, that means:
+// - "apply-of-apply" will be flattened into a single apply
+// - "product-of-product" will be flattened into a single product
+// - "lambda-of-lambda" will be flattened into a single lambda
+//
+// Nodes on the path to the node normalized are kept on an explicit stack,
+// such that deeply nested terms do not exhaust the native stack.
+std::optional<constr_t>
+normalize_iter(const constr_t& input) {
+	if (is_leaf(input)) {
+		return {};
+	}
 
-		if (changed) {
-			return builder::fix(fix->index(), std::move(new_group));
+	// Nodes on the path are the first "depth" frames of the stack.
+	std::vector<normalize_frame> stack(1);
+	std::size_t depth = 1;
+	stack[0].reset(input);
+
+	for (;;) {
+		auto& frame = stack[depth - 1];
+		std::size_t index = frame.results.size();
+		std::optional<constr_t> result;
+		if (index < frame.children.size()) {
+			const auto& child = *frame.children[index];
+			if (!is_leaf(child)) {
+				if (depth == stack.size()) {
+					stack.emplace_back();
+				}
+				stack[depth].reset(child);
+				++depth;
+				continue;
+			}
 		} else {
-			return {};
+			result = finish_frame(frame);
+			--depth;
+			if (depth == 0) {
+				return result;
+			}
 		}
-	} else {
-		throw std::logic_error("Unhandled constr kind");
+
+		auto& parent = stack[depth - 1];
+		index = parent.results.size();
+		parent.changed = parent.changed || result;
+		parent.results.push_back(result ? std::move(*result) : *parent.children[index]);
 	}
 }
 
@@ -190,7 +212,7 @@ normalize_rec(const constr_t& input) {
 
 constr_t
 normalize(const constr_t& expr) {
-	auto res = normalize_rec(expr);
+	auto res = normalize_iter(expr);
 	return res ? *res : expr;
 }
 
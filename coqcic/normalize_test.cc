@@ -30,3 +30,36 @@ TEST(normalize_test, lambda_apply) {
 	auto ec = e.check(ctx);
 	std::cout << ec.debug_string() << "\n";
 }
+
+TEST(normalize_test, deep_nesting) {
+	using namespace coqcic::builder;
+
+	// fun (x : nat) => ... fun (x : nat) => ((f x) ...) x, nested far
+	// beyond what recursion could handle on the native stack.
+	const std::size_t depth = 1000000;
+	coqcic::constr_t body = global("f");
+	for (std::size_t n = 0; n < depth; ++n) {
+		body = apply(body, {local("x", n)});
+	}
+	coqcic::constr_t term = body;
+	for (std::size_t n = 0; n < depth; ++n) {
+		term = lambda({{"x", global("nat")}}, term);
+	}
+
+	auto n = normalize(term);
+	auto l = n.as_lambda();
+	ASSERT_TRUE(l);
+	EXPECT_EQ(l->args().size(), depth);
+	auto a = l->body().as_apply();
+	ASSERT_TRUE(a);
+	EXPECT_EQ(a->args().size(), depth);
+	EXPECT_EQ(a->args()[0], local("x", 0));
+	EXPECT_EQ(a->args()[depth - 1], local("x", depth - 1));
+
+	// Already normal, deep in argument position.
+	coqcic::constr_t nested = global("O");
+	for (std::size_t n = 0; n < depth; ++n) {
+		nested = apply(global("S"), {nested});
+	}
+	EXPECT_EQ(normalize(nested).repr(), nested.repr());
+}
@@ -1,91 +1,232 @@
 #include "coqcic/parse_sexpr.h"
 
-#include <sstream>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "coqcic/sexpr_scanner.h"
 
 namespace coqcic {
 
 namespace {
 
-bool
+constexpr bool
 is_whitespace(char c) {
 	return (c == ' ' || c == '\n' || c == '\r' || c == '\t');
 }
 
-bool
+constexpr bool
 is_normal_char(char c) {
 	return !is_whitespace(c) && c != '(' && c != ')' && c != '"' && c != 0;
 }
 
-class parser {
+// Parser operating on a contiguous buffer. Accepts exactly the same
+// language (and reports the same error locations) as the stream parser,
+// but scans runs of whitespace and terminal characters in tight loops
+// over the buffer and constructs each terminal with a single allocation.
+class buffer_parser {
 public:
 	inline explicit
-	parser(std::istream& stream) : stream_(stream), index_(0) {
-		stream_.get(current_);
-		if (stream_.eof()) {
-			current_ = 0;
-		}
+	buffer_parser(std::string_view data) noexcept : scan_(data) {
 	}
 
 	sexpr_parse_result<sexpr>
 	parse_terminal();
 
-	sexpr_parse_result<sexpr>
-	parse_compound();
-
 	sexpr_parse_result<sexpr>
 	parse_expr();
 
 	inline void
-	skip_whitespace() {
-		while (is_whitespace(current_)) {
-			next();
-		}
+	skip_whitespace() noexcept {
+		scan_.skip_whitespace();
 	}
 
 private:
-	inline void
-	next() {
-		++index_;
-		stream_.get(current_);
-		if (stream_.eof()) {
-			current_ = 0;
-		}
+	sexpr_buffer_scanner scan_;
+};
+
+sexpr_parse_result<sexpr>
+buffer_parser::parse_terminal() {
+	std::size_t location = scan_.index();
+
+	std::string_view value = scan_.scan_normal();
+
+	if (value.empty()) {
+		return sexpr_parse_error{"Empty or invalid terminal", scan_.index()};
 	}
 
-	std::istream& stream_;
-	char current_;
-	std::size_t index_;
-};
+	scan_.skip_whitespace();
+
+	return sexpr::make_terminal(std::string(value), location);
+}
 
 sexpr_parse_result<sexpr>
-parser::parse_terminal() {
-	std::size_t location = index_;
+buffer_parser::parse_expr() {
+	// Compounds opened but not closed yet, innermost last. Kept on an
+	// explicit stack such that deeply nested input does not exhaust the
+	// native stack.
+	struct open_compound {
+		std::string_view kind;
+		std::size_t location;
+		std::vector<sexpr> args;
+	};
+	std::vector<open_compound> open;
 
-	std::string value;
+	for (;;) {
+		sexpr e;
+		// Whether "e" holds a complete expression.
+		bool complete = false;
+		if (scan_.current() == '(') {
+			std::size_t location = scan_.index();
+			scan_.advance();
+			scan_.skip_whitespace();
+			std::string_view kind = scan_.scan_normal();
 
-	while (is_normal_char(current_)) {
-		value += current_;
-		next();
+			if (kind.empty()) {
+				return sexpr_parse_error{"Empty or invalid compound kind", scan_.index()};
+			}
+
+			scan_.skip_whitespace();
+			open.push_back(open_compound{kind, location, {}});
+		} else {
+			auto terminal = parse_terminal();
+			if (!terminal) {
+				return terminal.error();
+			}
+			e = terminal.move_value();
+			complete = true;
+		}
+
+		// Add the expression to its enclosing compound, and close all
+		// compounds ending here.
+		for (;;) {
+			if (complete) {
+				if (open.empty()) {
+					return e;
+				}
+				open.back().args.push_back(std::move(e));
+			}
+			if (scan_.current() != 0 && scan_.current() != ')') {
+				break;
+			}
+			if (scan_.current() == 0) {
+				return sexpr_parse_error{"Unexpected end of stream", scan_.index()};
+			}
+
+			scan_.advance();
+			scan_.skip_whitespace();
+
+			auto& compound = open.back();
+			e = sexpr::make_compound(compound.kind, std::move(compound.args), compound.location);
+			open.pop_back();
+			complete = true;
+		}
 	}
+}
 
-	if (value.empty()) {
-		return sexpr_parse_error{"Empty or invalid terminal", index_};
+// Same as buffer_parser, but builds a flat_sexpr.
+class flat_buffer_parser {
+public:
+	inline explicit
+	flat_buffer_parser(std::string_view data) noexcept : scan_(data) {
 	}
 
-	skip_whitespace();
+	std::optional<sexpr_parse_error>
+	parse_expr();
 
-	return sexpr::make_terminal(std::move(value), location);
+	inline void
+	skip_whitespace() noexcept {
+		scan_.skip_whitespace();
+	}
+
+	inline flat_sexpr
+	finish() {
+		return builder_.finish();
+	}
+
+private:
+	sexpr_buffer_scanner scan_;
+	flat_sexpr_builder builder_;
+};
+
+std::optional<sexpr_parse_error>
+flat_buffer_parser::parse_expr() {
+	// Kinds and locations of the compounds opened but not closed yet,
+	// innermost last (their arguments are tracked by the builder).
+	std::vector<std::pair<std::string_view, std::size_t>> open;
+
+	for (;;) {
+		std::size_t location = scan_.index();
+
+		if (scan_.current() != '(') {
+			std::string_view value = scan_.scan_normal();
+			if (value.empty()) {
+				return sexpr_parse_error{"Empty or invalid terminal", scan_.index()};
+			}
+			scan_.skip_whitespace();
+			builder_.add_terminal(value, location);
+		} else {
+			scan_.advance();
+			scan_.skip_whitespace();
+			std::string_view kind = scan_.scan_normal();
+
+			if (kind.empty()) {
+				return sexpr_parse_error{"Empty or invalid compound kind", scan_.index()};
+			}
+
+			scan_.skip_whitespace();
+
+			builder_.begin_compound();
+			open.emplace_back(kind, location);
+		}
+
+		// Close all compounds ending here.
+		while (!open.empty() && (scan_.current() == 0 || scan_.current() == ')')) {
+			if (scan_.current() == 0) {
+				return sexpr_parse_error{"Unexpected end of stream", scan_.index()};
+			}
+
+			scan_.advance();
+			scan_.skip_whitespace();
+
+			builder_.end_compound(intern_sexpr_kind(open.back().first), open.back().second);
+			open.pop_back();
+		}
+		if (open.empty()) {
+			return std::nullopt;
+		}
+	}
+}
+
+}  // namespace
+
+sexpr_stream_parser::sexpr_stream_parser(std::istream& stream) : stream_(stream), index_(0) {
+	stream_.get(current_);
+	if (stream_.eof()) {
+		current_ = 0;
+	}
+	skip_whitespace();
 }
 
 sexpr_parse_result<sexpr>
-parser::parse_compound() {
-	std::size_t location = index_;
+sexpr_stream_parser::parse_expr() {
+	if (current_ == '(') {
+		return parse_compound();
+	} else {
+		return parse_terminal();
+	}
+}
 
-	std::string kind;
-	std::vector<sexpr> args;
+sexpr_parse_result<std::string>
+sexpr_stream_parser::enter_compound() {
+	if (current_ != '(') {
+		return sexpr_parse_error{"Expected compound expression", index_};
+	}
 
 	next();
 	skip_whitespace();
+
+	std::string kind;
 	while (is_normal_char(current_)) {
 		kind += current_;
 		next();
@@ -97,45 +238,139 @@ parser::parse_compound() {
 
 	skip_whitespace();
 
-	while (current_ != 0 && current_ != ')') {
-		auto sub = parse_expr();
-		if (!sub) {
-			return sub.error();
-		}
-		args.push_back(sub.move_value());
-	}
+	return kind;
+}
+
+sexpr_parse_result<std::size_t>
+sexpr_stream_parser::leave_compound() {
+	std::size_t location = index_;
 	if (current_ == 0) {
 		return sexpr_parse_error{"Unexpected end of stream", index_};
+	} else if (current_ != ')') {
+		return sexpr_parse_error{"Expected end of compound expression", index_};
 	}
 
 	next();
 	skip_whitespace();
 
-	return sexpr::make_compound(std::move(kind), std::move(args), location);
+	return location;
 }
 
 sexpr_parse_result<sexpr>
-parser::parse_expr() {
-	if (current_ == '(') {
-		return parse_compound();
-	} else {
-		return parse_terminal();
+sexpr_stream_parser::parse_terminal() {
+	std::size_t location = index_;
+
+	std::string value;
+
+	while (is_normal_char(current_)) {
+		value += current_;
+		next();
+	}
+
+	if (value.empty()) {
+		return sexpr_parse_error{"Empty or invalid terminal", index_};
 	}
+
+	skip_whitespace();
+
+	return sexpr::make_terminal(std::move(value), location);
 }
 
-}  // namespace
+sexpr_parse_result<sexpr>
+sexpr_stream_parser::parse_compound() {
+	// Compounds opened but not closed yet, innermost last. Kept on an
+	// explicit stack such that deeply nested input does not exhaust the
+	// native stack.
+	struct open_compound {
+		std::string kind;
+		std::size_t location;
+		std::vector<sexpr> args;
+	};
+	std::vector<open_compound> open;
+
+	for (;;) {
+		sexpr e;
+		// Whether "e" holds a complete expression.
+		bool complete = false;
+		if (current_ == '(') {
+			std::size_t location = index_;
+			auto kind = enter_compound();
+			if (!kind) {
+				return kind.error();
+			}
+			open.push_back(open_compound{kind.move_value(), location, {}});
+		} else {
+			auto terminal = parse_terminal();
+			if (!terminal) {
+				return terminal.error();
+			}
+			e = terminal.move_value();
+			complete = true;
+		}
+
+		// Add the expression to its enclosing compound, and close all
+		// compounds ending here.
+		for (;;) {
+			if (complete) {
+				if (open.empty()) {
+					return e;
+				}
+				open.back().args.push_back(std::move(e));
+			}
+			if (current_ != 0 && current_ != ')') {
+				break;
+			}
+
+			auto end = leave_compound();
+			if (!end) {
+				return end.error();
+			}
+
+			auto& compound = open.back();
+			e = sexpr::make_compound(compound.kind, std::move(compound.args), compound.location);
+			open.pop_back();
+			complete = true;
+		}
+	}
+}
+
+void
+sexpr_stream_parser::skip_whitespace() {
+	while (is_whitespace(current_)) {
+		next();
+	}
+}
+
+void
+sexpr_stream_parser::next() {
+	++index_;
+	stream_.get(current_);
+	if (stream_.eof()) {
+		current_ = 0;
+	}
+}
 
 sexpr_parse_result<sexpr>
 parse_sexpr(std::istream& s) {
-	parser p(s);
-	p.skip_whitespace();
+	sexpr_stream_parser p(s);
 	return p.parse_expr();
 }
 
 sexpr_parse_result<sexpr>
-parse_sexpr(const std::string& s) {
-	std::stringstream ss(s, std::ios_base::in);
-	return parse_sexpr(ss);
+parse_sexpr(std::string_view s) {
+	buffer_parser p(s);
+	p.skip_whitespace();
+	return p.parse_expr();
+}
+
+sexpr_parse_result<flat_sexpr>
+parse_flat_sexpr(std::string_view s) {
+	flat_buffer_parser p(s);
+	p.skip_whitespace();
+	if (auto error = p.parse_expr()) {
+		return *error;
+	}
+	return p.finish();
 }
 
 }  // namespace coqcic
@@ -3,7 +3,9 @@
 
 #include <istream>
 #include <string>
+#include <string_view>
 
+#include "coqcic/flat_sexpr.h"
 #include "coqcic/parse_result.h"
 #include "coqcic/sexpr.h"
 
@@ -18,11 +20,94 @@ struct sexpr_parse_error {
 template<typename ResultType>
 using sexpr_parse_result = parse_result<ResultType, sexpr_parse_error>;
 
+// Incremental parser reading a sequence of s-expressions from a stream.
+// Besides parsing complete expressions, it allows stepping into compound
+// expressions one level at a time, such that large enclosing forms can be
+// processed piece by piece without materializing them in memory. All
+// operations skip whitespace following the consumed input.
+class sexpr_stream_parser {
+public:
+	explicit
+	sexpr_stream_parser(std::istream& stream);
+
+	sexpr_stream_parser(const sexpr_stream_parser& other) = delete;
+	sexpr_stream_parser& operator=(const sexpr_stream_parser& other) = delete;
+
+	// Character index of next input into source.
+	inline
+	std::size_t
+	location() const noexcept {
+		return index_;
+	}
+
+	// Whether all input has been consumed.
+	inline
+	bool
+	at_end() const noexcept {
+		return current_ == 0;
+	}
+
+	// Whether the next input opens a compound expression.
+	inline
+	bool
+	at_compound() const noexcept {
+		return current_ == '(';
+	}
+
+	// Whether the next input closes the innermost compound expression
+	// entered.
+	inline
+	bool
+	at_close() const noexcept {
+		return current_ == ')';
+	}
+
+	// Parses next complete expression.
+	sexpr_parse_result<sexpr>
+	parse_expr();
+
+	// Consumes the opening of a compound expression, returns its kind.
+	// Arguments are then consumed by subsequent calls, up to the matching
+	// leave_compound.
+	sexpr_parse_result<std::string>
+	enter_compound();
+
+	// Consumes the end of a compound expression, returns its location.
+	sexpr_parse_result<std::size_t>
+	leave_compound();
+
+private:
+	sexpr_parse_result<sexpr>
+	parse_terminal();
+
+	sexpr_parse_result<sexpr>
+	parse_compound();
+
+	void
+	skip_whitespace();
+
+	void
+	next();
+
+	std::istream& stream_;
+	char current_;
+	std::size_t index_;
+};
+
+// Parses an s-expression from a stream, reading it character by character.
 sexpr_parse_result<sexpr>
 parse_sexpr(std::istream& s);
 
+// Parses an s-expression from a contiguous buffer, e.g. a string or the
+// contents of a mapped_file. Accepts the same language as the stream
+// variant, but is considerably faster on large inputs.
 sexpr_parse_result<sexpr>
-parse_sexpr(const std::string& s);
+parse_sexpr(std::string_view s);
+
+// Parses an s-expression from a contiguous buffer into its flat encoding.
+// Accepts the same language and reports the same errors as parse_sexpr.
+sexpr_parse_result<flat_sexpr>
+parse_flat_sexpr(std::string_view s);
 
 
 }  // namespace coqcic
@@ -2,6 +2,12 @@
 
 #include "gtest/gtest.h"
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "coqcic/mapped_file.h"
+
 TEST(parse_sexpr_test, parse_success) {
 	auto e = coqcic::parse_sexpr("(foo bar(baz bla   ))");
 	EXPECT_TRUE(e);
@@ -10,3 +16,111 @@ TEST(parse_sexpr_test, parse_success) {
 	e.value().format(os);
 	EXPECT_EQ(os.str(), "(foo bar (baz bla))");
 }
+
+TEST(parse_sexpr_test, interned_kinds) {
+	auto e = coqcic::parse_sexpr("(App (Global f) (SomeKind x))");
+	ASSERT_TRUE(e);
+
+	auto c = e.value().as_compound();
+	ASSERT_TRUE(c);
+	EXPECT_EQ(c->kind_id(), coqcic::sexpr_kind_app);
+	EXPECT_EQ(c->args()[0].as_compound()->kind_id(), coqcic::sexpr_kind_global);
+
+	auto other = c->args()[1].as_compound();
+	EXPECT_GE(other->kind_id(), coqcic::sexpr_kind_num_known);
+	EXPECT_EQ(other->kind(), "SomeKind");
+	EXPECT_EQ(coqcic::intern_sexpr_kind("SomeKind"), other->kind_id());
+	EXPECT_EQ(coqcic::sexpr_kind_to_string(coqcic::sexpr_kind_module_type), "ModuleType");
+
+	// Lookup without interning.
+	EXPECT_EQ(coqcic::find_sexpr_kind("Match"), coqcic::sexpr_kind_match);
+	EXPECT_EQ(coqcic::find_sexpr_kind("SomeKind"), coqcic::sexpr_kind_unknown);
+}
+
+TEST(parse_sexpr_test, buffer_matches_stream) {
+	static const char* inputs[] = {
+		"(foo bar(baz bla   ))",
+		"  \n(App (Global plus)\t(Local x 0) (Local y 1))\r\n",
+		"terminal",
+		"(foo (bar",
+		"(foo ())",
+		"( )",
+		"(foo \"bar\")",
+		"",
+	};
+
+	for (const char* input : inputs) {
+		std::stringstream ss(input);
+		auto s = coqcic::parse_sexpr(ss);
+		auto b = coqcic::parse_sexpr(std::string_view(input));
+		ASSERT_EQ(!!s, !!b) << input;
+		if (s) {
+			EXPECT_EQ(s.value().debug_string(), b.value().debug_string()) << input;
+			EXPECT_EQ(s.value().location(), b.value().location()) << input;
+		} else {
+			EXPECT_EQ(s.error().description, b.error().description) << input;
+			EXPECT_EQ(s.error().location, b.error().location) << input;
+		}
+	}
+}
+
+TEST(parse_sexpr_test, mapped_file) {
+	std::string path = testing::TempDir() + "parse_sexpr_test_mapped_file";
+	{
+		std::ofstream out(path);
+		out << "(foo bar (baz bla))\n";
+	}
+
+	{
+		coqcic::mapped_file file(path);
+		auto e = coqcic::parse_sexpr(file.data());
+		ASSERT_TRUE(e);
+		EXPECT_EQ(e.value().debug_string(), "(foo bar (baz bla))");
+	}
+
+	std::remove(path.c_str());
+	EXPECT_THROW(coqcic::mapped_file file(path), std::system_error);
+}
+
+TEST(parse_sexpr_test, deep_nesting) {
+	// Nesting far beyond what recursive descent could handle on the
+	// native stack.
+	const std::size_t depth = 1000000;
+	std::string text;
+	for (std::size_t n = 0; n < depth; ++n) {
+		text += "(App (Global f) ";
+	}
+	text += "(Global a)";
+	text += std::string(depth, ')');
+
+	std::stringstream ss(text);
+	auto s = coqcic::parse_sexpr(ss);
+	auto b = coqcic::parse_sexpr(std::string_view(text));
+	auto f = coqcic::parse_flat_sexpr(text);
+	ASSERT_TRUE(s);
+	ASSERT_TRUE(b);
+	ASSERT_TRUE(f);
+
+	const coqcic::sexpr* se = &s.value();
+	const coqcic::sexpr* be = &b.value();
+	coqcic::flat_sexpr_ref fe = f.value().root();
+	for (std::size_t n = 0; n < depth; ++n) {
+		ASSERT_EQ(se->as_compound()->kind_id(), coqcic::sexpr_kind_app);
+		ASSERT_EQ(be->as_compound()->kind_id(), coqcic::sexpr_kind_app);
+		ASSERT_EQ(fe.kind_id(), coqcic::sexpr_kind_app);
+		ASSERT_EQ(be->location(), 16 * n);
+		se = &se->as_compound()->args()[1];
+		be = &be->as_compound()->args()[1];
+		fe = fe.args()[1];
+	}
+	EXPECT_EQ(se->as_compound()->kind_id(), coqcic::sexpr_kind_global);
+	EXPECT_EQ(be->as_compound()->kind_id(), coqcic::sexpr_kind_global);
+	EXPECT_EQ(fe.kind_id(), coqcic::sexpr_kind_global);
+
+	// Unterminated at depth.
+	text.pop_back();
+	auto error = coqcic::parse_sexpr(std::string_view(text));
+	ASSERT_FALSE(error);
+	EXPECT_EQ(error.error().description, "Unexpected end of stream");
+	EXPECT_EQ(error.error().location, text.size());
+}
@@ -0,0 +1,256 @@
+#include "coqcic/pass_manager.h"
+
+namespace coqcic {
+
+namespace {
+
+// Calls the handler of the visitor for the kind of the node, passing its
+// children.
+std::optional<constr_t>
+handle_node(transform_visitor& visitor, const constr_t& node) {
+	switch (node.constr_kind()) {
+		case constr_kind_local: {
+			auto local = node.as_local();
+			return visitor.handle_local(local->name(), local->index());
+		}
+		case constr_kind_global: {
+			return visitor.handle_global(node.as_global()->name());
+		}
+		case constr_kind_builtin: {
+			return visitor.handle_builtin(node.as_builtin()->name());
+		}
+		case constr_kind_product: {
+			auto product = node.as_product();
+			return visitor.handle_product(product->args(), product->restype());
+		}
+		case constr_kind_lambda: {
+			auto lambda = node.as_lambda();
+			return visitor.handle_lambda(lambda->args(), lambda->body());
+		}
+		case constr_kind_let: {
+			auto let = node.as_let();
+			return visitor.handle_let(let->varname(), let->value(), let->type(), let->body());
+		}
+		case constr_kind_apply: {
+			auto apply = node.as_apply();
+			return visitor.handle_apply(apply->fn(), apply->args());
+		}
+		case constr_kind_cast: {
+			auto cast = node.as_cast();
+			return visitor.handle_cast(cast->term(), cast->kind(), cast->typeterm());
+		}
+		case constr_kind_match: {
+			auto match_case = node.as_match();
+			return visitor.handle_match(match_case->casetype(), match_case->arg(), match_case->branches());
+		}
+		case constr_kind_fix: {
+			auto fix = node.as_fix();
+			return visitor.handle_fix(fix->index(), fix->group());
+		}
+		case constr_kind_shifted: {
+			// Never reported by constr_kind.
+			break;
+		}
+	}
+	throw std::logic_error("Unhandled constr kind");
+}
+
+// Calls "fn", updating the statistics of the pass.
+template<typename Fn>
+std::optional<constr_t>
+count_call(pass_manager::statistics& stats, bool timing, Fn&& fn) {
+	++stats.calls;
+	std::optional<constr_t> result;
+	if (timing) {
+		auto start = std::chrono::steady_clock::now();
+		result = fn();
+		stats.time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	} else {
+		result = fn();
+	}
+	if (result) {
+		++stats.changes;
+	}
+	return result;
+}
+
+}  // namespace
+
+pass_manager::~pass_manager() {
+}
+
+pass_manager::pass_manager(bool timing) : timing_(timing) {
+}
+
+void
+pass_manager::add(std::string name, transform_visitor& pass) {
+	passes_.push_back({std::move(name), &pass, {}, active});
+}
+
+std::optional<constr_t>
+pass_manager::run(const constr_t& input) {
+	return visit_transform(input, *this);
+}
+
+void
+pass_manager::push_local(
+	const std::string* name,
+	const constr_t* type,
+	const constr_t* value
+) {
+	for (auto& p : passes_) {
+		p.visitor->push_local(name, type, value);
+	}
+}
+
+void
+pass_manager::pop_local() {
+	for (auto& p : passes_) {
+		p.visitor->pop_local();
+	}
+}
+
+template<typename Handle>
+std::optional<constr_t>
+pass_manager::run_passes(Handle&& handle, std::size_t first, std::optional<constr_t> result) {
+	for (std::size_t n = first; n < passes_.size(); ++n) {
+		auto& p = passes_[n];
+		if (p.skipped_at != active) {
+			continue;
+		}
+		auto substitute = count_call(p.stats, timing_, [&] {
+			return result ? handle_node(*p.visitor, *result) : handle(*p.visitor);
+		});
+		if (substitute) {
+			result = std::move(substitute);
+		}
+	}
+	return result;
+}
+
+template<typename Handle>
+std::optional<constr_t>
+pass_manager::close_node(Handle&& handle) {
+	--open_;
+	auto result = run_passes(handle);
+	for (auto& p : passes_) {
+		if (p.skipped_at == open_) {
+			p.skipped_at = active;
+		}
+	}
+	return result;
+}
+
+std::optional<constr_t>
+pass_manager::pre_visit(const constr_t& term) {
+	std::optional<constr_t> result;
+	bool descend = false;
+	for (std::size_t n = 0; n < passes_.size(); ++n) {
+		auto& p = passes_[n];
+		if (p.skipped_at != active) {
+			continue;
+		}
+		auto replacement = count_call(p.stats, timing_, [&] { return p.visitor->pre_visit(term); });
+		if (!replacement) {
+			descend = true;
+		} else if (replacement->repr() == term.repr()) {
+			p.skipped_at = open_;
+		} else {
+			result = run_passes(
+				[] (transform_visitor&) -> std::optional<constr_t> { return {}; },
+				n + 1,
+				std::move(replacement));
+			break;
+		}
+	}
+
+	if (descend && !result) {
+		++open_;
+		return {};
+	}
+
+	// The subtree is not traversed, hence passes skipping it are active
+	// again right away.
+	for (auto& p : passes_) {
+		if (p.skipped_at == open_) {
+			p.skipped_at = active;
+		}
+	}
+	if (result) {
+		return result;
+	} else {
+		return term;
+	}
+}
+
+std::optional<constr_t>
+pass_manager::handle_local(const std::string& name, std::size_t index) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_local(name, index);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_global(const std::string& name) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_global(name);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_builtin(const std::string& name) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_builtin(name);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_product(const std::vector<formal_arg_t>& args, const constr_t& restype) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_product(args, restype);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_lambda(const std::vector<formal_arg_t>& args, const constr_t& body) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_lambda(args, body);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_let(const std::optional<std::string>& varname, const constr_t& value, const constr_t& type, const constr_t& body) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_let(varname, value, type, body);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_apply(const constr_t& fn, const std::vector<constr_t>& args) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_apply(fn, args);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_cast(const constr_t& term, const constr_cast::kind_type kind, const constr_t& typeterm) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_cast(term, kind, typeterm);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_match(const constr_t& casetype, const constr_t& arg, const std::vector<match_branch_t>& branches) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_match(casetype, arg, branches);
+	});
+}
+
+std::optional<constr_t>
+pass_manager::handle_fix(std::size_t index, const std::shared_ptr<const fix_group_t>& group) {
+	return close_node([&] (transform_visitor& visitor) {
+		return visitor.handle_fix(index, group);
+	});
+}
+
+}  // namespace coqcic
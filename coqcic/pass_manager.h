@@ -0,0 +1,145 @@
+#ifndef COQCIC_PASS_MANAGER_H
+#define COQCIC_PASS_MANAGER_H
+
+#include "coqcic/visitor.h"
+
+#include <chrono>
+
+namespace coqcic {
+
+// Runs several transform visitors ("passes") in a single traversal.
+//
+// At every node the passes are applied in the order they were added: the
+// first pass sees the node with its children transformed by all passes,
+// every later pass sees the result of the preceding ones. If a pass
+// substitutes a node, later passes see the substitute (dispatched by its
+// kind, with its children as given), but do not descend into it. The
+// result equals running the passes one after another whenever the
+// substitutes introduced by a pass are left alone by the later passes
+// below their root, e.g. for passes rewriting distinct constructions.
+//
+// All passes see all locals pushed and popped. A pass skipping a subtree
+// from pre_visit is not called for nodes in that subtree, while the other
+// passes still are; the subtree is only left untraversed if all passes
+// skip it. If a pass replaces a node from pre_visit, the subtree is not
+// traversed either and later passes see the replacement as above.
+class pass_manager final : public transform_visitor {
+public:
+	struct statistics {
+		// Number of handler and pre_visit calls.
+		std::size_t calls = 0;
+		// Number of calls that returned a substitute.
+		std::size_t changes = 0;
+		// Time spent in the calls, only measured if timing is enabled.
+		std::chrono::nanoseconds time{0};
+	};
+
+	~pass_manager() override;
+
+	explicit pass_manager(bool timing = false);
+
+	// Adds a pass to run after all passes added before. The pass must
+	// outlive this object.
+	void
+	add(std::string name, transform_visitor& pass);
+
+	// Transforms the input by all passes. Returns none if no pass
+	// substituted anything.
+	std::optional<constr_t>
+	run(const constr_t& input);
+
+	// Name of pass "index".
+	inline const std::string&
+	name(std::size_t index) const noexcept {
+		return passes_[index].name;
+	}
+
+	// Counters of pass "index" accumulated over all runs.
+	inline const statistics&
+	stats(std::size_t index) const noexcept {
+		return passes_[index].stats;
+	}
+
+	inline std::size_t
+	size() const noexcept {
+		return passes_.size();
+	}
+
+	void
+	push_local(
+		const std::string* name,
+		const constr_t* type,
+		const constr_t* value
+	) override;
+
+	void
+	pop_local() override;
+
+	std::optional<constr_t>
+	pre_visit(const constr_t& term) override;
+
+	std::optional<constr_t>
+	handle_local(const std::string& name, std::size_t index) override;
+
+	std::optional<constr_t>
+	handle_global(const std::string& name) override;
+
+	std::optional<constr_t>
+	handle_builtin(const std::string& name) override;
+
+	std::optional<constr_t>
+	handle_product(const std::vector<formal_arg_t>& args, const constr_t& restype) override;
+
+	std::optional<constr_t>
+	handle_lambda(const std::vector<formal_arg_t>& args, const constr_t& body) override;
+
+	std::optional<constr_t>
+	handle_let(const std::optional<std::string>& varname, const constr_t& value, const constr_t& type, const constr_t& body) override;
+
+	std::optional<constr_t>
+	handle_apply(const constr_t& fn, const std::vector<constr_t>& args) override;
+
+	std::optional<constr_t>
+	handle_cast(const constr_t& term, const constr_cast::kind_type kind, const constr_t& typeterm) override;
+
+	std::optional<constr_t>
+	handle_match(const constr_t& casetype, const constr_t& arg, const std::vector<match_branch_t>& branches) override;
+
+	std::optional<constr_t>
+	handle_fix(std::size_t index, const std::shared_ptr<const fix_group_t>& group) override;
+
+private:
+	static constexpr std::size_t active = ~std::size_t(0);
+
+	struct pass {
+		std::string name;
+		transform_visitor* visitor;
+		statistics stats;
+		// Number of open nodes when the pass skipped the subtree of the
+		// innermost of them, or "active".
+		std::size_t skipped_at;
+	};
+
+	// Calls "handle" for each active pass on the current node, or the
+	// handler for the substitute returned by a preceding pass, starting
+	// with pass "first" and the given substitute.
+	template<typename Handle>
+	std::optional<constr_t>
+	run_passes(Handle&& handle, std::size_t first = 0, std::optional<constr_t> result = {});
+
+	// Runs the handlers of the passes for the node closed, reactivating
+	// passes that skipped it.
+	template<typename Handle>
+	std::optional<constr_t>
+	close_node(Handle&& handle);
+
+	std::vector<pass> passes_;
+	bool timing_;
+	// Number of nodes on the path to the node visited that pre_visit
+	// descended into, and whose handlers are yet to be called.
+	std::size_t open_ = 0;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_PASS_MANAGER_H
@@ -0,0 +1,141 @@
+#include "coqcic/pass_manager.h"
+
+#include "gtest/gtest.h"
+
+namespace coqcic {
+
+namespace {
+
+// Replaces global "from" by "to", and records the names of locals in scope
+// whenever a local is visited. Skips applications of global "skip".
+class rename_pass final : public transform_visitor {
+public:
+	rename_pass(std::string from, std::string to) : from(std::move(from)), to(std::move(to)) {}
+
+	void
+	push_local(const std::string* name, const constr_t* type, const constr_t* value) override {
+		names.push_back(name ? *name : "_");
+	}
+
+	void
+	pop_local() override {
+		names.pop_back();
+	}
+
+	std::optional<constr_t>
+	pre_visit(const constr_t& term) override {
+		if (auto apply = term.as_apply()) {
+			auto fn = apply->fn().as_global();
+			if (fn && fn->name() == "skip") {
+				return term;
+			}
+		}
+		return {};
+	}
+
+	std::optional<constr_t>
+	handle_local(const std::string& name, std::size_t index) override {
+		seen.push_back(names[names.size() - 1 - index]);
+		return {};
+	}
+
+	std::optional<constr_t>
+	handle_global(const std::string& name) override {
+		if (name == from) {
+			return builder::global(to);
+		}
+		return {};
+	}
+
+	std::string from;
+	std::string to;
+	std::vector<std::string> names;
+	std::vector<std::string> seen;
+};
+
+// Replaces "id x" by "x".
+class drop_id_pass final : public transform_visitor {
+public:
+	std::optional<constr_t>
+	handle_apply(const constr_t& fn, const std::vector<constr_t>& args) override {
+		auto global = fn.as_global();
+		if (global && global->name() == "id" && args.size() == 1) {
+			return args[0];
+		}
+		return {};
+	}
+};
+
+}  // namespace
+
+TEST(pass_manager_test, compose) {
+	using namespace builder;
+	auto nat = global("nat");
+	auto closed = lambda({{"y", nat}}, apply(global("g"), {local("y", 0)}));
+	// fun (x : nat) => f (a x) (alias x) closed
+	auto term = lambda(
+		{{"x", nat}},
+		apply(global("f"), {
+			apply(global("a"), {local("x", 0)}),
+			apply(global("alias"), {local("x", 0)}),
+			closed}));
+
+	// a -> id, alias -> id, then id x -> x: later passes see the
+	// substitutes of earlier ones.
+	rename_pass first("a", "id");
+	rename_pass second("alias", "id");
+	drop_id_pass third;
+	pass_manager passes(true);
+	passes.add("first", first);
+	passes.add("second", second);
+	passes.add("third", third);
+
+	auto result = passes.run(term);
+	ASSERT_TRUE(result);
+	EXPECT_EQ(*result, lambda({{"x", nat}}, apply(global("f"), {local("x", 0), local("x", 0), closed})));
+	EXPECT_EQ(first.seen, (std::vector<std::string>{"x", "x", "y"}));
+	EXPECT_EQ(second.seen, first.seen);
+	EXPECT_TRUE(first.names.empty());
+	EXPECT_TRUE(second.names.empty());
+
+	// Unchanged subtrees are shared with the input.
+	EXPECT_EQ(result->as_lambda()->body().as_apply()->args()[2].repr(), closed.repr());
+
+	ASSERT_EQ(passes.size(), 3u);
+	EXPECT_EQ(passes.name(1), "second");
+	EXPECT_EQ(passes.stats(0).changes, 1u);
+	EXPECT_EQ(passes.stats(1).changes, 1u);
+	EXPECT_EQ(passes.stats(2).changes, 2u);
+	EXPECT_EQ(passes.stats(0).calls, passes.stats(2).calls);
+
+	EXPECT_FALSE(passes.run(closed));
+}
+
+TEST(pass_manager_test, skip) {
+	using namespace builder;
+	// f (skip a b) a
+	auto term = apply(global("f"), {apply(global("skip"), {global("a"), global("b")}), global("a")});
+
+	rename_pass a_to_b("a", "b");
+	drop_id_pass drop_id;
+	pass_manager passes;
+	passes.add("a_to_b", a_to_b);
+	passes.add("drop_id", drop_id);
+
+	// Subtrees skipped by one pass are still visited by the others.
+	auto result = passes.run(term);
+	ASSERT_TRUE(result);
+	EXPECT_EQ(*result, apply(global("f"), {apply(global("skip"), {global("a"), global("b")}), global("b")}));
+	EXPECT_EQ(passes.stats(0).calls, 7u);
+	EXPECT_EQ(passes.stats(1).calls, 14u);
+	EXPECT_EQ(passes.stats(0).time.count(), 0);
+
+	// Subtrees skipped by all passes are not traversed.
+	pass_manager skip_all;
+	skip_all.add("a_to_b", a_to_b);
+	EXPECT_FALSE(skip_all.run(apply(global("skip"), {global("a")})));
+	EXPECT_EQ(skip_all.stats(0).calls, 1u);
+	EXPECT_TRUE(skip_all.run(global("a")));
+}
+
+}  // namespace coqcic
@@ -0,0 +1,494 @@
+#include "coqcic/reduce.h"
+
+#include <memory>
+#include <string_view>
+
+#include "coqcic/global_env.h"
+#include "coqcic/lazy_stack.h"
+#include "coqcic/simpl.h"
+
+namespace coqcic {
+
+namespace {
+
+class closure;
+
+using closure_ptr = std::shared_ptr<const closure>;
+using env_t = lazy_stack<closure_ptr>;
+
+// A term together with values for its lowest loose de Bruijn indices
+// (index n refers to env.at(n)), or a variable bound while normalizing
+// below a binder. Loose indices beyond the environment refer to the context
+// of the term to be reduced.
+//
+// Each closure is created at a depth, the number of binders of the output
+// term that enclose the point of creation. Its readback is computed once
+// at this depth, and shifted to wherever it is used.
+class closure {
+public:
+	closure(constr_t term, env_t env, std::size_t depth)
+		: term_(std::move(term)), env_(std::move(env)), depth_(depth)
+	{
+	}
+
+	// Variable bound by the output binder at the given level (i.e.
+	// nested in "level" other binders). The name is interned once, such
+	// that readback of the variable does not look it up again.
+	static closure_ptr
+	variable(std::string_view name, std::size_t level) {
+		auto c = std::make_shared<closure>(constr_t(), env_t(), level);
+		c->symbol_ = constr_symbols().intern(name);
+		c->is_variable_ = true;
+		return c;
+	}
+
+	inline const constr_t& term() const noexcept { return term_; }
+	inline const env_t& env() const noexcept { return env_; }
+	inline std::size_t depth() const noexcept { return depth_; }
+	inline bool is_variable() const noexcept { return is_variable_; }
+
+	// Symbol of the name and binder level of a variable.
+	inline symbol_table::id_type symbol() const noexcept { return symbol_; }
+	inline std::size_t level() const noexcept { return depth_; }
+
+	// Readback at depth(), computed on first use.
+	mutable std::optional<constr_t> readback;
+
+private:
+	constr_t term_;
+	env_t env_;
+	std::size_t depth_;
+	symbol_table::id_type symbol_ = 0;
+	bool is_variable_ = false;
+};
+
+const closure_ptr no_closure;
+
+// State of the machine: "term" evaluated in "env", applied to the arguments
+// on "stack" (the first argument at the back).
+struct machine_state {
+	constr_t term;
+	env_t env;
+	std::size_t depth;
+	std::vector<closure_ptr> stack;
+	// If set, the head is this variable instead of "term".
+	closure_ptr variable;
+	// If set, "term" is a match stuck on this (evaluated) matched term.
+	std::unique_ptr<machine_state> scrutinee;
+};
+
+class reducer {
+public:
+	explicit
+	reducer(unsigned flags, const global_env* globals = nullptr) noexcept
+		: flags_(flags), globals_(globals)
+	{
+	}
+
+	// Runs the machine until the head of the state is not a redex.
+	void
+	run(machine_state& s);
+
+	// Rebuilds the term represented by a closure, at the given output
+	// depth.
+	constr_t
+	readback(const closure& c, std::size_t depth);
+
+	constr_t
+	readback(const constr_t& term, const env_t& env, std::size_t depth);
+
+	constr_t
+	readback(const machine_state& s, std::size_t depth);
+
+	// Normal form of a term in an environment, at the given output depth.
+	constr_t
+	normalize(const constr_t& term, const env_t& env, std::size_t depth);
+
+	constr_t
+	normalize(const closure& c, std::size_t depth);
+
+	// Normal form of a state the machine has been run on.
+	constr_t
+	normalize(const machine_state& s, std::size_t depth);
+
+	// Whether any reduction step has been performed.
+	inline
+	bool
+	reduced() const noexcept {
+		return reduced_;
+	}
+
+private:
+	// Normalizes argument types of a binder, extending the environment
+	// and depth by the arguments.
+	std::vector<formal_arg_t>
+	normalize_args(const std::vector<formal_arg_t>& args, env_t& env, std::size_t& depth);
+
+	// Unfolds the fixpoint at the head of the state if its structural
+	// argument is a constructor application. Returns false otherwise,
+	// leaving the state as is (up to evaluating arguments).
+	bool
+	unfold_fix(machine_state& s, const constr_fix& fix);
+
+	unsigned flags_;
+	const global_env* globals_;
+	bool reduced_ = false;
+};
+
+// Whether the state represents a constructor application (in the sense of
+// reduce_iota / reduce_fix).
+const constr_global*
+constructor_head(const machine_state& s, const global_env* globals) noexcept {
+	auto head = s.variable || s.scrutinee ? nullptr : s.term.as_global();
+	if (head && globals) {
+		auto id = globals->find(head->symbol());
+		if (id && globals->kind(*id) != global_env::kind_constructor) {
+			return nullptr;
+		}
+	}
+	return head;
+}
+
+const match_branch_t*
+select_branch(const constr_match& match, const machine_state& scrutinee, const global_env* globals) {
+	if (auto head = constructor_head(scrutinee, globals)) {
+		for (const auto& branch : match.branches()) {
+			if (branch.constructor == head->name() && branch.nargs <= scrutinee.stack.size()) {
+				return &branch;
+			}
+		}
+	}
+	return nullptr;
+}
+
+// Closure representing an evaluated constructor application, such that it
+// need not be evaluated again.
+closure_ptr
+reify(const machine_state& s) {
+	if (s.stack.empty()) {
+		return std::make_shared<closure>(s.term, env_t(), s.depth);
+	}
+	std::size_t count = s.stack.size();
+	static const auto anonymous = constr_symbols().intern("_");
+	std::vector<constr_t> args;
+	env_t env;
+	for (std::size_t n = 0; n < count; ++n) {
+		env = env.push(s.stack[count - 1 - n]);
+		args.push_back(builder::local(anonymous, count - 1 - n));
+	}
+	return std::make_shared<closure>(builder::apply(s.term, std::move(args)), std::move(env), s.depth);
+}
+
+template<typename Fn>
+constr_t
+apply_stack(constr_t head, const std::vector<closure_ptr>& stack, Fn fn) {
+	if (stack.empty()) {
+		return head;
+	}
+	std::vector<constr_t> args;
+	for (auto i = stack.rbegin(); i != stack.rend(); ++i) {
+		args.push_back(fn(**i));
+	}
+	return builder::apply(std::move(head), std::move(args));
+}
+
+void
+reducer::run(machine_state& s) {
+	for (;;) {
+		if (auto local = s.term.as_local()) {
+			closure_ptr c = s.env.get(local->index(), no_closure);
+			if (!c) {
+				return;
+			} else if (c->is_variable()) {
+				s.variable = std::move(c);
+				return;
+			}
+			s.term = c->term();
+			s.env = c->env();
+			s.depth = c->depth();
+		} else if (auto apply = s.term.as_apply()) {
+			for (auto i = apply->args().rbegin(); i != apply->args().rend(); ++i) {
+				s.stack.push_back(std::make_shared<closure>(*i, s.env, s.depth));
+			}
+			s.term = apply->fn();
+		} else if (auto lambda = s.term.as_lambda()) {
+			if (!(flags_ & reduce_beta) || s.stack.empty()) {
+				return;
+			}
+			const auto& args = lambda->args();
+			std::size_t n = 0;
+			while (n < args.size() && !s.stack.empty()) {
+				s.env = s.env.push(std::move(s.stack.back()));
+				s.stack.pop_back();
+				++n;
+			}
+			if (n == args.size()) {
+				s.term = lambda->body();
+			} else {
+				s.term = builder::lambda({args.begin() + n, args.end()}, lambda->body());
+			}
+			reduced_ = true;
+		} else if (auto let = s.term.as_let()) {
+			if (!(flags_ & reduce_zeta)) {
+				return;
+			}
+			s.env = s.env.push(std::make_shared<closure>(let->value(), s.env, s.depth));
+			s.term = let->body();
+			reduced_ = true;
+		} else if (auto cast = s.term.as_cast()) {
+			s.term = cast->term();
+			reduced_ = true;
+		} else if (auto match = s.term.as_match()) {
+			if (!(flags_ & reduce_iota)) {
+				return;
+			}
+			auto scrutinee = std::make_unique<machine_state>(machine_state{match->arg(), s.env, s.depth});
+			run(*scrutinee);
+			auto branch = select_branch(*match, *scrutinee, globals_);
+			if (!branch) {
+				s.scrutinee = std::move(scrutinee);
+				return;
+			}
+			// The branch is a function of the constructor arguments,
+			// these are the last ones of the application.
+			for (std::size_t n = 0; n < branch->nargs; ++n) {
+				s.stack.push_back(scrutinee->stack[n]);
+			}
+			s.term = branch->expr;
+			reduced_ = true;
+		} else if (auto fix = s.term.as_fix()) {
+			if (!(flags_ & reduce_fix) || !unfold_fix(s, *fix)) {
+				return;
+			}
+		} else if (auto global = s.term.as_global()) {
+			if (!(flags_ & reduce_delta) || !globals_) {
+				return;
+			}
+			auto id = globals_->find(global->symbol());
+			if (!id) {
+				return;
+			}
+			auto kind = globals_->kind(*id);
+			if (kind == global_env::kind_definition) {
+				s.term = *globals_->body(*id);
+				s.env = env_t();
+				reduced_ = true;
+			} else if (kind == global_env::kind_fixpoint && (flags_ & reduce_fix)) {
+				// Stuck applications keep referring to the global.
+				constr_t name = std::move(s.term);
+				s.term = *globals_->body(*id);
+				s.env = env_t();
+				if (!unfold_fix(s, *s.term.as_fix())) {
+					s.term = std::move(name);
+					return;
+				}
+			} else {
+				return;
+			}
+		} else {
+			return;
+		}
+	}
+}
+
+bool
+reducer::unfold_fix(machine_state& s, const constr_fix& fix) {
+	auto group = fix.group();
+	const auto& fn = group->functions[fix.index()];
+	auto k = fn.structural_arg();
+	if (!k || *k >= s.stack.size()) {
+		return false;
+	}
+	closure_ptr& arg = s.stack[s.stack.size() - 1 - *k];
+	if (arg->is_variable()) {
+		return false;
+	}
+	machine_state arg_state{arg->term(), arg->env(), arg->depth()};
+	run(arg_state);
+	if (!constructor_head(arg_state, globals_)) {
+		return false;
+	}
+	arg = reify(arg_state);
+
+	// The body refers to all functions of the group, the last one at the
+	// lowest index.
+	env_t env = s.env;
+	for (std::size_t n = 0; n < group->functions.size(); ++n) {
+		constr_t fn_term = n == fix.index() ? s.term : builder::fix(n, group);
+		env = env.push(std::make_shared<closure>(std::move(fn_term), s.env, s.depth));
+	}
+	s.term = builder::lambda(fn.args, fn.body);
+	s.env = std::move(env);
+	reduced_ = true;
+	return true;
+}
+
+constr_t
+reducer::readback(const closure& c, std::size_t depth) {
+	if (c.is_variable()) {
+		return builder::local(c.symbol(), depth - c.level() - 1);
+	}
+	if (!c.readback) {
+		c.readback = readback(c.term(), c.env(), c.depth());
+	}
+	return c.readback->shift(0, depth - c.depth());
+}
+
+constr_t
+reducer::readback(const constr_t& term, const env_t& env, std::size_t depth) {
+	std::size_t bound = term.loose_bound();
+	std::vector<constr_t> subst;
+	for (std::size_t n = 0; n < bound; ++n) {
+		const auto& c = env.get(n, no_closure);
+		if (!c) {
+			break;
+		}
+		subst.push_back(readback(*c, depth));
+	}
+	// Indices beyond the environment refer to the context of the input,
+	// which is "depth" binders further out.
+	std::size_t nsubst = subst.size();
+	return local_subst(term.shift(nsubst, depth), 0, std::move(subst));
+}
+
+constr_t
+reducer::readback(const machine_state& s, std::size_t depth) {
+	constr_t head;
+	if (s.variable) {
+		head = readback(*s.variable, depth);
+	} else if (s.scrutinee) {
+		auto match = s.term.as_match();
+		std::vector<match_branch_t> branches;
+		for (const auto& branch : match->branches()) {
+			branches.push_back({branch.constructor, branch.nargs, readback(branch.expr, s.env, depth)});
+		}
+		head = builder::match(
+			readback(match->casetype(), s.env, depth),
+			readback(*s.scrutinee, depth),
+			std::move(branches));
+	} else {
+		head = readback(s.term, s.env, depth);
+	}
+	return apply_stack(std::move(head), s.stack, [this, depth](const closure& c) {
+		return readback(c, depth);
+	});
+}
+
+constr_t
+reducer::normalize(const constr_t& term, const env_t& env, std::size_t depth) {
+	machine_state s{term, env, depth};
+	run(s);
+	return normalize(s, depth);
+}
+
+constr_t
+reducer::normalize(const closure& c, std::size_t depth) {
+	if (c.is_variable()) {
+		return readback(c, depth);
+	} else {
+		return normalize(c.term(), c.env(), depth);
+	}
+}
+
+std::vector<formal_arg_t>
+reducer::normalize_args(const std::vector<formal_arg_t>& args, env_t& env, std::size_t& depth) {
+	std::vector<formal_arg_t> result;
+	for (const auto& arg : args) {
+		result.push_back({arg.name, normalize(arg.type, env, depth)});
+		env = env.push(closure::variable(arg.name ? *arg.name : "_", depth));
+		++depth;
+	}
+	return result;
+}
+
+constr_t
+reducer::normalize(const machine_state& s, std::size_t depth) {
+	constr_t head;
+	if (s.variable) {
+		head = readback(*s.variable, depth);
+	} else if (s.scrutinee || s.term.as_match()) {
+		auto match = s.term.as_match();
+		std::vector<match_branch_t> branches;
+		for (const auto& branch : match->branches()) {
+			branches.push_back({branch.constructor, branch.nargs, normalize(branch.expr, s.env, depth)});
+		}
+		head = builder::match(
+			normalize(match->casetype(), s.env, depth),
+			s.scrutinee ? normalize(*s.scrutinee, depth) : normalize(match->arg(), s.env, depth),
+			std::move(branches));
+	} else if (auto product = s.term.as_product()) {
+		env_t env = s.env;
+		std::size_t inner = depth;
+		auto args = normalize_args(product->args(), env, inner);
+		head = builder::product(std::move(args), normalize(product->restype(), env, inner));
+	} else if (auto lambda = s.term.as_lambda()) {
+		env_t env = s.env;
+		std::size_t inner = depth;
+		auto args = normalize_args(lambda->args(), env, inner);
+		head = builder::lambda(std::move(args), normalize(lambda->body(), env, inner));
+	} else if (auto let = s.term.as_let()) {
+		auto env = s.env.push(closure::variable(let->varname() ? *let->varname() : "_", depth));
+		head = builder::let(
+			let->varname(),
+			normalize(let->value(), s.env, depth),
+			normalize(let->type(), s.env, depth),
+			normalize(let->body(), env, depth + 1));
+	} else if (auto fix = s.term.as_fix()) {
+		const auto& functions = fix->group()->functions;
+		env_t fix_env = s.env;
+		for (std::size_t n = 0; n < functions.size(); ++n) {
+			fix_env = fix_env.push(closure::variable(functions[n].name, depth + n));
+		}
+		auto group = std::make_shared<fix_group_t>();
+		for (const auto& fn : functions) {
+			env_t env = fix_env;
+			std::size_t inner = depth + functions.size();
+			fix_function_t new_fn;
+			new_fn.name = fn.name;
+			new_fn.args = normalize_args(fn.args, env, inner);
+			new_fn.restype = normalize(fn.restype, env, inner);
+			new_fn.body = normalize(fn.body, env, inner);
+			group->functions.push_back(std::move(new_fn));
+		}
+		head = builder::fix(fix->index(), std::move(group));
+	} else {
+		head = readback(s.term, s.env, depth);
+	}
+	return apply_stack(std::move(head), s.stack, [this, depth](const closure& c) {
+		return normalize(c, depth);
+	});
+}
+
+}  // namespace
+
+constr_t
+whnf(const constr_t& term, unsigned flags) {
+	reducer r(flags);
+	machine_state s{term, env_t(), 0};
+	r.run(s);
+	return r.reduced() ? r.readback(s, 0) : term;
+}
+
+constr_t
+nf(const constr_t& term, unsigned flags) {
+	reducer r(flags);
+	auto result = r.normalize(term, env_t(), 0);
+	return r.reduced() ? result : term;
+}
+
+constr_t
+whnf(const constr_t& term, const global_env& globals, unsigned flags) {
+	reducer r(flags, &globals);
+	machine_state s{term, env_t(), 0};
+	r.run(s);
+	return r.reduced() ? r.readback(s, 0) : term;
+}
+
+constr_t
+nf(const constr_t& term, const global_env& globals, unsigned flags) {
+	reducer r(flags, &globals);
+	auto result = r.normalize(term, env_t(), 0);
+	return r.reduced() ? result : term;
+}
+
+}  // namespace coqcic
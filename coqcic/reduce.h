@@ -0,0 +1,62 @@
+#ifndef COQCIC_REDUCE_H
+#define COQCIC_REDUCE_H
+
+#include "coqcic/constr.h"
+
+namespace coqcic {
+
+// Reduction rules applied by whnf and nf, may be combined.
+enum reduce_flags : unsigned {
+	// Application of a lambda abstraction to arguments.
+	reduce_beta = 1,
+	// Substitution of the value of a let expression into its body.
+	reduce_zeta = 2,
+	// Match on a constructor application: selects the branch whose
+	// constructor name equals the name of the (global) head of the
+	// matched term, and applies it to the constructor arguments (the
+	// last "nargs" arguments of the application, preceding ones are
+	// the inductive parameters).
+	reduce_iota = 4,
+	// Unfolding of a fixpoint function applied to a constructor
+	// application as its structural argument. The structural argument
+	// is the formal argument the function body directly matches on,
+	// functions with a different shape of body are never unfolded.
+	// Constructor applications are recognized as applications of
+	// globals, except for globals of the global environment given that
+	// are not constructors.
+	reduce_fix = 8,
+	// Unfolding of globals of the global environment given: definitions
+	// are replaced by their value, functions of fixpoints only if the
+	// unfolded fixpoint reduces (see reduce_fix). Globals are never
+	// unfolded without environment.
+	reduce_delta = 16,
+	reduce_all = reduce_beta | reduce_zeta | reduce_iota | reduce_fix | reduce_delta
+};
+
+// Reduces the head of the given term until it is not a redex anymore,
+// i.e. computes its weak head normal form. Casts at the head are removed.
+// Returns the input itself if it is already in weak head normal form.
+//
+// Reduction runs on an abstract machine that keeps substitutions in
+// environments of closures and arguments on a stack; terms are only
+// rebuilt (substituting the environments) once for the final result.
+constr_t
+whnf(const constr_t& term, unsigned flags = reduce_all);
+
+// Reduces the given term to normal form: computes the weak head normal
+// form, and then the normal forms of all remaining subterms, including
+// those below binders. Does not terminate for terms without normal form.
+// Returns the input itself if it is already in normal form.
+constr_t
+nf(const constr_t& term, unsigned flags = reduce_all);
+
+// As above, unfolding globals of the given environment (see reduce_delta).
+constr_t
+whnf(const constr_t& term, const global_env& globals, unsigned flags = reduce_all);
+
+constr_t
+nf(const constr_t& term, const global_env& globals, unsigned flags = reduce_all);
+
+}  // namespace coqcic
+
+#endif  // COQCIC_REDUCE_H
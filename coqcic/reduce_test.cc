@@ -0,0 +1,116 @@
+#include "coqcic/reduce.h"
+
+#include "coqcic/global_env.h"
+
+#include "gtest/gtest.h"
+
+namespace coqcic {
+
+namespace {
+
+constr_t
+nat_of(std::size_t n) {
+	constr_t result = builder::global("O");
+	for (std::size_t k = 0; k < n; ++k) {
+		result = builder::apply(builder::global("S"), {result});
+	}
+	return result;
+}
+
+// fix plus (n : nat) (m : nat) : nat :=
+//   match n with O => m | S p => S (plus p m) end
+constr_t
+plus() {
+	using namespace builder;
+	auto nat = global("nat");
+	auto group = std::make_shared<fix_group_t>();
+	group->functions.push_back(fix_function_t{
+		"plus",
+		{{"n", nat}, {"m", nat}},
+		nat,
+		match(
+			lambda({{"n", nat}}, nat),
+			local("n", 1),
+			{
+				{"O", 0, local("m", 0)},
+				{"S", 1, lambda(
+					{{"p", nat}},
+					apply(global("S"), {apply(local("plus", 3), {local("p", 0), local("m", 1)})}))}
+			})
+	});
+	return fix(0, std::move(group));
+}
+
+}  // namespace
+
+TEST(reduce_test, whnf) {
+	using namespace builder;
+	// (fun x y => let z := x in f z y) a b
+	auto redex = apply(
+		lambda(
+			{{"x", global("nat")}, {"y", global("nat")}},
+			let("z", local("x", 1), global("nat"), apply(local("f", 3), {local("z", 0), local("y", 1)}))),
+		{global("a"), local("b", 1)});
+
+	EXPECT_EQ(apply(local("f", 0), {global("a"), local("b", 1)}), whnf(redex));
+	EXPECT_EQ(
+		let("z", global("a"), global("nat"), apply(local("f", 1), {local("z", 0), local("b", 2)})),
+		whnf(redex, reduce_beta));
+
+	// Partial application leaves a lambda, which is in whnf.
+	auto partial = apply(lambda({{"x", global("nat")}, {"y", global("nat")}}, local("x", 1)), {global("a")});
+	EXPECT_EQ(lambda({{"y", global("nat")}}, global("a")), whnf(partial));
+
+	auto normal = apply(local("f", 0), {redex});
+	EXPECT_EQ(normal.repr(), whnf(normal).repr());
+}
+
+TEST(reduce_test, nf) {
+	using namespace builder;
+	EXPECT_EQ(nat_of(5), nf(apply(plus(), {nat_of(3), nat_of(2)})));
+
+	// Stuck on the variable, but reduces below the binder.
+	auto open = lambda({{"k", global("nat")}}, apply(plus(), {local("k", 0), nat_of(1)}));
+	auto open_nf = nf(open);
+	ASSERT_TRUE(open_nf.as_lambda());
+	auto body = open_nf.as_lambda()->body().as_apply();
+	ASSERT_TRUE(body && body->fn().as_fix());
+	EXPECT_EQ(local("k", 0), body->args()[0]);
+
+	auto shifted = lambda({{"k", global("nat")}}, apply(plus(), {nat_of(1), local("k", 0)}));
+	EXPECT_EQ(lambda({{"k", global("nat")}}, apply(global("S"), {local("k", 0)})), nf(shifted));
+
+	// Without fixpoint unfolding, the application stays.
+	auto stuck = apply(plus(), {nat_of(1), nat_of(1)});
+	EXPECT_EQ(stuck.repr(), nf(stuck, reduce_beta | reduce_iota).repr());
+}
+
+TEST(reduce_test, delta) {
+	using namespace builder;
+	auto nat = global("nat");
+	// Inductive nat, Definition two := S (S O), Fixpoint plus, Axiom a.
+	global_env globals(std::vector<sfb_t>{
+		sfb_t(std::make_shared<sfb_inductive>(std::vector<one_inductive_t>{
+			one_inductive_t("nat", builtin_set(), {
+				{"O", nat},
+				{"S", product({{std::nullopt, nat}}, nat)}})})),
+		sfb_t(std::make_shared<sfb_definition>("two", nat, nat_of(2))),
+		sfb_t(std::make_shared<sfb_fixpoint>(*plus().as_fix()->group())),
+		sfb_t(std::make_shared<sfb_axiom>("a", nat))
+	});
+
+	EXPECT_EQ(nat_of(2), whnf(global("two"), globals));
+	EXPECT_EQ(global("two"), whnf(global("two")));
+	EXPECT_EQ(global("two"), whnf(global("two"), globals, reduce_all & ~reduce_delta));
+	EXPECT_EQ(global("a"), whnf(global("a"), globals));
+
+	// Definitions unfold in matched terms and structural arguments.
+	EXPECT_EQ(nat_of(4), nf(apply(global("plus"), {global("two"), global("two")}), globals));
+
+	// Fixpoints stuck on their structural argument keep their name.
+	auto stuck = apply(global("plus"), {global("a"), global("two")});
+	EXPECT_EQ(apply(global("plus"), {global("a"), nat_of(2)}), nf(stuck, globals));
+	EXPECT_EQ(stuck.repr(), whnf(stuck, globals).repr());
+}
+
+}  // namespace coqcic
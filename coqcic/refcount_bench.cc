@@ -0,0 +1,96 @@
+// Benchmark for reference counting overhead in term transformations.
+//
+// Runs normalize and simpl (beta reduction via local_subst) over large
+// terms on a worker thread. Reference count updates dominate these
+// transformations, compare results of a default build against one
+// configured with --enable-nonatomic-refcount.
+
+#include "coqcic/constr.h"
+#include "coqcic/normalize.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+using namespace coqcic;
+
+// Builds a term of the given depth that uses locals bound by an
+// enclosing lambda of arity "nargs", with nested apply / lambda / product
+// constructions that normalize flattens.
+constr_t
+make_body(std::size_t depth, std::size_t nargs) {
+	auto nat = builder::global("nat");
+	constr_t term = builder::local("x", 0);
+	for (std::size_t n = 0; n < depth; ++n) {
+		// Each lambda binds one variable, references to the outer
+		// arguments are shifted accordingly.
+		std::size_t outer = n / 3 + 1;
+		switch (n % 3) {
+			case 0: {
+				term = builder::apply(
+					builder::apply(builder::global("plus"), {term}),
+					{builder::local("x", (n % nargs) + outer - 1)});
+				break;
+			}
+			case 1: {
+				term = builder::product({{"y", nat}}, builder::product({{"z", nat}}, term));
+				term = builder::apply(builder::global("f"), {term, builder::local("x", (n % nargs) + outer)});
+				break;
+			}
+			case 2: {
+				term = builder::lambda({{"y", nat}}, term);
+				break;
+			}
+		}
+	}
+	return term;
+}
+
+template<typename Fn>
+double
+time_ms(Fn&& fn, std::size_t rounds) {
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t n = 0; n < rounds; ++n) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+	const std::size_t depth = 3000;
+	const std::size_t nargs = 4;
+	const std::size_t rounds = 50;
+
+#ifdef COQCIC_NONATOMIC_REFCOUNT
+	std::cout << "reference counts: non-atomic\n";
+#else
+	std::cout << "reference counts: atomic\n";
+#endif
+
+	std::size_t sink = 0;
+	std::thread worker([&] {
+		auto nat = builder::global("nat");
+		auto body = make_body(depth, nargs);
+		std::vector<formal_arg_t> formals;
+		std::vector<constr_t> actuals;
+		for (std::size_t n = 0; n < nargs; ++n) {
+			formals.push_back({"x", nat});
+			actuals.push_back(builder::apply(builder::global("S"), {builder::global("O")}));
+		}
+		auto redex = builder::apply(builder::lambda(formals, body), actuals);
+
+		double normalize_ms = time_ms([&] { sink += normalize(body).hash(); }, rounds);
+		double simpl_ms = time_ms([&] { sink += redex.simpl().hash(); }, rounds);
+
+		std::cout << "normalize: " << normalize_ms << " ms\n";
+		std::cout << "simpl:     " << simpl_ms << " ms\n";
+	});
+	worker.join();
+
+	return sink == 0 ? 1 : 0;
+}
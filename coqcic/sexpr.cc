@@ -1,9 +1,94 @@
 #include "coqcic/sexpr.h"
 
 #include <sstream>
+#include <unordered_map>
+
+#include "coqcic/symbol_table.h"
 
 namespace coqcic {
 
+namespace {
+
+// Names of kinds with fixed ids, in order of sexpr_kind_t.
+const std::string known_kind_names[sexpr_kind_num_known] = {
+	"Algebraic",
+	"Anonymous",
+	"App",
+	"Apply",
+	"Axiom",
+	"Body",
+	"Branch",
+	"Branches",
+	"Case",
+	"Cast",
+	"Constructor",
+	"Definition",
+	"Fix",
+	"Function",
+	"Functor",
+	"Global",
+	"Inductive",
+	"Lambda",
+	"LetIn",
+	"Local",
+	"Match",
+	"Module",
+	"ModuleType",
+	"Name",
+	"OneInductive",
+	"Prod",
+	"Sort",
+	"Struct",
+	"Typed",
+	"Untyped",
+};
+
+const std::unordered_map<std::string_view, sexpr_kind_t>&
+known_kinds() {
+	static const std::unordered_map<std::string_view, sexpr_kind_t> kinds = [] {
+		std::unordered_map<std::string_view, sexpr_kind_t> kinds;
+		for (std::uint32_t n = 0; n < sexpr_kind_num_known; ++n) {
+			kinds.emplace(known_kind_names[n], sexpr_kind_t(n));
+		}
+		return kinds;
+	}();
+	return kinds;
+}
+
+// Kinds beyond the known ones, offset by sexpr_kind_num_known.
+symbol_table&
+other_kinds() {
+	static symbol_table table;
+	return table;
+}
+
+}  // namespace
+
+sexpr_kind_t
+intern_sexpr_kind(std::string_view name) {
+	const auto& known = known_kinds();
+	auto i = known.find(name);
+	if (i != known.end()) {
+		return i->second;
+	}
+	return sexpr_kind_t(sexpr_kind_num_known + other_kinds().intern(name));
+}
+
+sexpr_kind_t
+find_sexpr_kind(std::string_view name) {
+	const auto& known = known_kinds();
+	auto i = known.find(name);
+	return i != known.end() ? i->second : sexpr_kind_unknown;
+}
+
+const std::string&
+sexpr_kind_to_string(sexpr_kind_t kind) {
+	if (kind < sexpr_kind_num_known) {
+		return known_kind_names[kind];
+	}
+	return other_kinds().name(kind - sexpr_kind_num_known);
+}
+
 std::string
 sexpr::debug_string() const {
 	std::stringstream ss;
@@ -28,12 +113,41 @@ sexpr_terminal::copy() const {
 }
 
 sexpr_compound::~sexpr_compound() {
+	// Destroying nested compounds recursively would exhaust the stack for
+	// deeply nested expressions. Recurse up to a bounded depth only, below
+	// that detach nested compounds, and destroy them one at a time after
+	// detaching their own arguments.
+	static constexpr std::size_t max_depth = 256;
+	static thread_local std::size_t depth = 0;
+	if (depth < max_depth) {
+		++depth;
+		args_.clear();
+		--depth;
+		return;
+	}
+
+	std::vector<std::unique_ptr<sexpr_repr>> pending;
+	auto detach = [&pending] (std::vector<sexpr>& args) {
+		for (auto& arg : args) {
+			auto compound = dynamic_cast<sexpr_compound*>(arg.repr_.get());
+			if (compound && !compound->args_.empty()) {
+				pending.push_back(std::move(arg.repr_));
+			}
+		}
+	};
+
+	detach(args_);
+	while (!pending.empty()) {
+		auto repr = std::move(pending.back());
+		pending.pop_back();
+		detach(static_cast<sexpr_compound&>(*repr).args_);
+	}
 }
 
 void
 sexpr_compound::format(std::ostream& os) const {
 	os << '(';
-	os << kind_;
+	os << kind();
 	for (const auto& arg : args()) {
 		os << ' ';
 		arg.format(os);
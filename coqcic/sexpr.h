@@ -1,12 +1,68 @@
 #ifndef COQCIC_SEXPR_H
 #define COQCIC_SEXPR_H
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace coqcic {
 
+// Kind of a compound expression, interned to an integer id. The kinds
+// used by the exported term format have fixed ids listed here, other
+// kinds receive ids from sexpr_kind_num_known upwards when first seen.
+enum sexpr_kind_t : std::uint32_t {
+	sexpr_kind_algebraic,
+	sexpr_kind_anonymous,
+	sexpr_kind_app,
+	sexpr_kind_apply,
+	sexpr_kind_axiom,
+	sexpr_kind_body,
+	sexpr_kind_branch,
+	sexpr_kind_branches,
+	sexpr_kind_case,
+	sexpr_kind_cast,
+	sexpr_kind_constructor,
+	sexpr_kind_definition,
+	sexpr_kind_fix,
+	sexpr_kind_function,
+	sexpr_kind_functor,
+	sexpr_kind_global,
+	sexpr_kind_inductive,
+	sexpr_kind_lambda,
+	sexpr_kind_let_in,
+	sexpr_kind_local,
+	sexpr_kind_match,
+	sexpr_kind_module,
+	sexpr_kind_module_type,
+	sexpr_kind_name,
+	sexpr_kind_one_inductive,
+	sexpr_kind_prod,
+	sexpr_kind_sort,
+	sexpr_kind_struct,
+	sexpr_kind_typed,
+	sexpr_kind_untyped,
+	sexpr_kind_num_known,
+	// Returned by find_sexpr_kind for kinds without fixed id.
+	sexpr_kind_unknown = ~std::uint32_t(0)
+};
+
+// Returns id for given compound kind, interning it if necessary. Kinds
+// with fixed ids are resolved without locking.
+sexpr_kind_t
+intern_sexpr_kind(std::string_view name);
+
+// Returns id for given compound kind if it has a fixed id, or
+// sexpr_kind_unknown otherwise. Never interns nor locks, for use when only
+// the kinds with fixed ids are accepted.
+sexpr_kind_t
+find_sexpr_kind(std::string_view name);
+
+// Returns name of interned compound kind.
+const std::string&
+sexpr_kind_to_string(sexpr_kind_t kind);
+
 class sexpr_compound;
 class sexpr_terminal;
 class sexpr_repr;
@@ -54,9 +110,16 @@ public:
 	inline
 	static
 	sexpr
-	make_compound(std::string kind, std::vector<sexpr> args, std::size_t location);
+	make_compound(sexpr_kind_t kind, std::vector<sexpr> args, std::size_t location);
+
+	inline
+	static
+	sexpr
+	make_compound(std::string_view kind, std::vector<sexpr> args, std::size_t location);
 
 private:
+	friend class sexpr_compound;
+
 	inline
 	sexpr(std::unique_ptr<sexpr_repr> repr)
 		: repr_(std::move(repr))
@@ -124,7 +187,7 @@ public:
 
 	inline
 	sexpr_compound(
-		std::string kind,
+		sexpr_kind_t kind,
 		std::vector<sexpr> args,
 		std::size_t location
 	) : sexpr_repr(location), kind_(std::move(kind)), args_(std::move(args)) {
@@ -137,7 +200,12 @@ public:
 	copy() const override;
 
 	inline const std::string&
-	kind() const noexcept {
+	kind() const {
+		return sexpr_kind_to_string(kind_);
+	}
+
+	inline sexpr_kind_t
+	kind_id() const noexcept {
 		return kind_;
 	}
 
@@ -148,7 +216,7 @@ public:
 	}
 
 private:
-	std::string kind_;
+	sexpr_kind_t kind_;
 	std::vector<sexpr> args_;
 };
 
@@ -195,8 +263,14 @@ sexpr::make_terminal(std::string value, std::size_t location) {
 
 inline
 sexpr
-sexpr::make_compound(std::string kind, std::vector<sexpr> args, std::size_t location) {
-	return sexpr(std::make_unique<sexpr_compound>(std::move(kind), std::move(args), location));
+sexpr::make_compound(sexpr_kind_t kind, std::vector<sexpr> args, std::size_t location) {
+	return sexpr(std::make_unique<sexpr_compound>(kind, std::move(args), location));
+}
+
+inline
+sexpr
+sexpr::make_compound(std::string_view kind, std::vector<sexpr> args, std::size_t location) {
+	return make_compound(intern_sexpr_kind(kind), std::move(args), location);
 }
 
 }  // namespace coqcic
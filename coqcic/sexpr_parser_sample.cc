@@ -1,16 +1,19 @@
 #include "coqcic/from_sexpr.h"
+#include "coqcic/mapped_file.h"
 #include "coqcic/parse_sexpr.h"
 
 #include <iostream>
+#include <iterator>
+#include <optional>
 
 void show_error_context(
-	const std::string& data,
+	std::string_view data,
 	std::size_t location
 ) {
 	std::size_t current_line_start = 0;
-	for (;;) {
+	while (current_line_start < data.size()) {
 		std::size_t end = data.find('\n', current_line_start);
-		if (end == std::string::npos) {
+		if (end == std::string_view::npos) {
 			end = data.size();
 		} else {
 			end = end + 1;
@@ -20,17 +23,23 @@ void show_error_context(
 			std::cerr << std::string(location - current_line_start, ' ') << "^ here\n";
 			return;
 		}
+		current_line_start = end;
 	}
 	std::cerr << "(at end of stream)\n";
 }
 
 int main(int argc, char** argv) {
-	std::string data;
-	while (!std::cin.eof()) {
-		std::string tmp;
-		std::getline(std::cin, tmp);
-		data += std::move(tmp);
-		data += '\n';
+	// Parse the file given on the command line directly from a memory
+	// mapping, or read all of stdin otherwise.
+	std::optional<coqcic::mapped_file> file;
+	std::string input;
+	std::string_view data;
+	if (argc > 1) {
+		file.emplace(argv[1]);
+		data = file->data();
+	} else {
+		input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+		data = input;
 	}
 
 	auto sexpr = coqcic::parse_sexpr(data);
@@ -0,0 +1,96 @@
+#ifndef COQCIC_SEXPR_SCANNER_H
+#define COQCIC_SEXPR_SCANNER_H
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace coqcic {
+
+// Character classes of s-expression syntax.
+enum sexpr_char_class : unsigned char {
+	sexpr_char_normal,
+	sexpr_char_whitespace,
+	sexpr_char_delimiter
+};
+
+constexpr std::array<unsigned char, 256>
+make_sexpr_char_class_table() {
+	std::array<unsigned char, 256> table{};
+	for (std::size_t n = 0; n < table.size(); ++n) {
+		char c = static_cast<char>(n);
+		if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+			table[n] = sexpr_char_whitespace;
+		} else if (c == '(' || c == ')' || c == '"' || c == 0) {
+			table[n] = sexpr_char_delimiter;
+		} else {
+			table[n] = sexpr_char_normal;
+		}
+	}
+	return table;
+}
+
+inline constexpr std::array<unsigned char, 256> sexpr_char_class_table = make_sexpr_char_class_table();
+
+// Low-level scanner for s-expressions held in a contiguous buffer. Scans
+// runs of whitespace and terminal characters in tight table-driven loops.
+// Shared by the buffer variant of parse_sexpr and by the direct text
+// conversion of constr_from_sexpr_str / sfb_from_sexpr_str, such that
+// both accept the same syntax.
+class sexpr_buffer_scanner {
+public:
+	inline explicit
+	sexpr_buffer_scanner(std::string_view data) noexcept
+		: begin_(data.data()), pos_(data.data()), end_(data.data() + data.size())
+	{
+	}
+
+	// Current character, 0 at end of buffer (a NUL character in the
+	// buffer is treated as end as well, just like the stream parser).
+	inline
+	char
+	current() const noexcept {
+		return pos_ != end_ ? *pos_ : 0;
+	}
+
+	// Character index of current position into buffer.
+	inline
+	std::size_t
+	index() const noexcept {
+		return pos_ - begin_;
+	}
+
+	inline
+	void
+	advance() noexcept {
+		++pos_;
+	}
+
+	inline
+	void
+	skip_whitespace() noexcept {
+		while (pos_ != end_ && sexpr_char_class_table[static_cast<unsigned char>(*pos_)] == sexpr_char_whitespace) {
+			++pos_;
+		}
+	}
+
+	// Consumes the longest run of terminal characters.
+	inline
+	std::string_view
+	scan_normal() noexcept {
+		const char* start = pos_;
+		while (pos_ != end_ && sexpr_char_class_table[static_cast<unsigned char>(*pos_)] == sexpr_char_normal) {
+			++pos_;
+		}
+		return std::string_view(start, pos_ - start);
+	}
+
+private:
+	const char* begin_;
+	const char* pos_;
+	const char* end_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_SEXPR_SCANNER_H
@@ -0,0 +1,190 @@
+#include "coqcic/sfb_reader.h"
+
+namespace coqcic {
+
+namespace {
+
+inline from_sexpr_str_error
+str_error(const sexpr_parse_error& error) {
+	return {error.description, error.location};
+}
+
+inline from_sexpr_str_error
+str_error(const from_sexpr_error& error) {
+	return {error.description, error.context ? error.context->location() : 0};
+}
+
+}  // namespace
+
+sfb_reader::sfb_reader(std::istream& stream) : parser_(stream), frames_{frame{0, {}}} {
+}
+
+from_sexpr_str_result<sfb_reader_item>
+sfb_reader::next() {
+	std::size_t location = parser_.location();
+
+	if (parser_.at_close()) {
+		if (frames_.size() == 1) {
+			return from_sexpr_str_error{"Unbalanced end of compound expression", location};
+		}
+		for (std::size_t n = 0; n < frames_.back().closes; ++n) {
+			auto end = parser_.leave_compound();
+			if (!end) {
+				return str_error(end.error());
+			}
+		}
+		frames_.pop_back();
+		return sfb_reader_item{sfb_reader_item::module_end, location};
+	}
+
+	if (parser_.at_end()) {
+		if (frames_.size() != 1) {
+			return from_sexpr_str_error{"Unexpected end of stream", location};
+		}
+		return sfb_reader_item{sfb_reader_item::end_of_stream, location};
+	}
+
+	return read_sfb();
+}
+
+from_sexpr_str_result<sfb_reader_item>
+sfb_reader::read_sfb() {
+	std::size_t location = parser_.location();
+	if (!parser_.at_compound()) {
+		auto e = parser_.parse_expr();
+		if (!e) {
+			return str_error(e.error());
+		}
+		return from_sexpr_str_error{"Cannot parse terminal into sfb", location};
+	}
+
+	auto kind = parser_.enter_compound();
+	if (!kind) {
+		return str_error(kind.error());
+	}
+
+	if (kind.value() == "Module" || kind.value() == "ModuleType") {
+		auto id = parser_.parse_expr();
+		if (!id) {
+			return str_error(id.error());
+		}
+		if (!id.value().as_terminal() || !parser_.at_compound()) {
+			return finish_sfb(kind.move_value(), location, {id.move_value()});
+		}
+
+		sfb_reader_item item{sfb_reader_item::module_type_begin, location, id.value().as_terminal()->value()};
+		if (kind.value() == "ModuleType") {
+			return read_modsig(std::move(item), 1);
+		}
+
+		std::size_t body_location = parser_.location();
+		auto body_kind = parser_.enter_compound();
+		if (!body_kind) {
+			return str_error(body_kind.error());
+		}
+		if (body_kind.value() != "Struct") {
+			auto body = finish_compound(body_kind.move_value(), body_location, {});
+			if (!body) {
+				return str_error(body.error());
+			}
+			return finish_sfb(kind.move_value(), location, {id.move_value(), body.move_value()});
+		}
+
+		auto type_expr = parser_.parse_expr();
+		if (!type_expr) {
+			return str_error(type_expr.error());
+		}
+		auto type = optional_mod_type_from_sexpr(type_expr.value());
+		if (!type) {
+			return str_error(type.error());
+		}
+
+		item.kind = sfb_reader_item::module_begin;
+		item.type = type.move_value();
+		return read_modsig(std::move(item), 2);
+	} else {
+		return finish_sfb(kind.move_value(), location, {});
+	}
+}
+
+from_sexpr_str_result<sfb_reader_item>
+sfb_reader::read_modsig(sfb_reader_item item, std::size_t closes) {
+	for (;;) {
+		std::size_t location = parser_.location();
+		if (!parser_.at_compound()) {
+			auto e = parser_.parse_expr();
+			if (!e) {
+				return str_error(e.error());
+			}
+			return from_sexpr_str_error{"Cannot parse terminal into modsig", location};
+		}
+
+		auto kind = parser_.enter_compound();
+		if (!kind) {
+			return str_error(kind.error());
+		}
+		++closes;
+
+		if (kind.value() == "Functor") {
+			std::size_t name_location = parser_.location();
+			auto name = parser_.parse_expr();
+			if (!name) {
+				return str_error(name.error());
+			}
+			if (!name.value().as_terminal()) {
+				return from_sexpr_str_error{"Cannot parse non-terminal into string", name_location};
+			}
+			auto type_expr = parser_.parse_expr();
+			if (!type_expr) {
+				return str_error(type_expr.error());
+			}
+			auto type = functored_modexpr_from_sexpr(type_expr.value());
+			if (!type) {
+				return str_error(type.error());
+			}
+			item.parameters.emplace_back(name.value().as_terminal()->value(), type.move_value().second);
+		} else if (kind.value() == "Body") {
+			frames_.push_back(frame{closes, {}});
+			return {std::move(item)};
+		} else {
+			return from_sexpr_str_error{"Unhandled kind of modsig", location};
+		}
+	}
+}
+
+from_sexpr_str_result<sfb_reader_item>
+sfb_reader::finish_sfb(std::string kind, std::size_t location, std::vector<sexpr> args) {
+	auto e = finish_compound(std::move(kind), location, std::move(args));
+	if (!e) {
+		return str_error(e.error());
+	}
+
+	auto s = sfb_from_sexpr(e.value(), frames_.back().last_fix);
+	if (!s) {
+		return str_error(s.error());
+	}
+
+	sfb_reader_item item{sfb_reader_item::sfb, location};
+	item.value = s.move_value();
+	return {std::move(item)};
+}
+
+sexpr_parse_result<sexpr>
+sfb_reader::finish_compound(std::string kind, std::size_t location, std::vector<sexpr> args) {
+	while (!parser_.at_end() && !parser_.at_close()) {
+		auto sub = parser_.parse_expr();
+		if (!sub) {
+			return sub.error();
+		}
+		args.push_back(sub.move_value());
+	}
+
+	auto end = parser_.leave_compound();
+	if (!end) {
+		return end.error();
+	}
+
+	return sexpr::make_compound(std::move(kind), std::move(args), location);
+}
+
+}  // namespace coqcic
@@ -0,0 +1,121 @@
+#ifndef COQCIC_SFB_READER_H
+#define COQCIC_SFB_READER_H
+
+#include <istream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "coqcic/from_sexpr.h"
+#include "coqcic/parse_sexpr.h"
+#include "coqcic/sfb.h"
+
+namespace coqcic {
+
+// Item produced by sfb_reader.
+struct sfb_reader_item {
+	enum kind_type {
+		// All input has been consumed.
+		end_of_stream,
+		// Start of a structured module definition, its contents
+		// follow as separate items up to the matching module_end.
+		module_begin,
+		// Start of a module type definition, its contents follow as
+		// separate items up to the matching module_end.
+		module_type_begin,
+		// A complete sfb.
+		sfb,
+		// End of the innermost module (type) definition begun.
+		module_end
+	};
+
+	kind_type kind;
+
+	// Character index of the item into source.
+	std::size_t location;
+
+	// Name of module (type), for module_begin and module_type_begin.
+	std::string id;
+
+	// Functor parameters of module (type), outermost first, for
+	// module_begin and module_type_begin.
+	std::vector<std::pair<std::string, modexpr>> parameters;
+
+	// Declared type of module, for module_begin.
+	std::optional<modexpr> type;
+
+	// The sfb, for sfb.
+	sfb_t value;
+};
+
+// Incrementally reads a sequence of sfbs (as exported by the Coq plugin)
+// from a stream. Instead of materializing each top-level form completely,
+// the reader descends into the bodies of structured modules and module
+// types: it reports the beginning and end of each such module separately,
+// and yields every contained sfb as soon as it has been read. Memory usage
+// is hence bounded by the size of the largest sfb that is not a structured
+// module, rather than by the size of whole modules.
+//
+// Modules that are not structured (i.e. algebraic module definitions) are
+// yielded as a single sfb.
+//
+// Usage:
+//
+//   sfb_reader reader(stream);
+//   for (;;) {
+//     auto item = reader.next();
+//     if (!item) { /* handle error */ }
+//     if (item.value().kind == sfb_reader_item::end_of_stream) break;
+//     ...
+//   }
+//
+// After an error, the reader must not be used anymore.
+class sfb_reader {
+public:
+	explicit
+	sfb_reader(std::istream& stream);
+
+	sfb_reader(const sfb_reader& other) = delete;
+	sfb_reader& operator=(const sfb_reader& other) = delete;
+
+	from_sexpr_str_result<sfb_reader_item>
+	next();
+
+	// Number of module (type) definitions currently open.
+	inline
+	std::size_t
+	depth() const noexcept {
+		return frames_.size() - 1;
+	}
+
+private:
+	// A module (type) body currently being read.
+	struct frame {
+		// Number of enclosing compound expressions to close at end
+		// of body (Body, Functor, Struct, Module / ModuleType).
+		std::size_t closes;
+		// Last fixpoint group seen in body, see sfb_from_sexpr.
+		std::shared_ptr<const fix_group_t> last_fix;
+	};
+
+	from_sexpr_str_result<sfb_reader_item>
+	read_sfb();
+
+	from_sexpr_str_result<sfb_reader_item>
+	read_modsig(sfb_reader_item item, std::size_t closes);
+
+	from_sexpr_str_result<sfb_reader_item>
+	finish_sfb(std::string kind, std::size_t location, std::vector<sexpr> args);
+
+	sexpr_parse_result<sexpr>
+	finish_compound(std::string kind, std::size_t location, std::vector<sexpr> args);
+
+	sexpr_stream_parser parser_;
+	// Innermost frame last, first frame represents top level.
+	std::vector<frame> frames_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_SFB_READER_H
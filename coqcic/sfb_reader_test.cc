@@ -0,0 +1,180 @@
+#include "coqcic/sfb_reader.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace coqcic {
+
+namespace {
+
+static const char SFB_STREAM_EXAMPLE[] = R"(
+(Module
+ CPPSynth.export.X
+ (Struct
+  (Untyped)
+  (Body
+   (ModuleType
+    Y
+    (Body (Axiom foo (Sort Set))))
+   (Module
+    Z
+    (Struct
+     (Untyped)
+      (Functor
+       CPPSynth.export.y
+       CPPSynth.export.X.Y
+       (Body
+        (Definition
+         q
+         (Sort Type)
+         (App (Global CPPSynth.export.y) (Global CPPSynth.export.y.foo)))))))
+   (Module
+    YY
+    (Struct
+     (Typed CPPSynth.export.X.Y)
+     (Body
+      (Definition
+       foo
+       (Sort Set) (Global Coq.Init.Datatypes.nat)))))
+   (Module
+    ZZ
+    (Algebraic
+     (Apply
+      CPPSynth.export.X.Z
+      CPPSynth.export.X.YY))))))
+(Axiom bar (Sort Prop))
+(Module W (Struct (Untyped) (Body)))
+)";
+
+// Reassembles the sfbs from the items produced by the reader.
+std::vector<sfb_t>
+read_all(sfb_reader& reader) {
+	struct open_module {
+		sfb_reader_item item;
+		std::vector<sfb_t> sfbs;
+	};
+	std::vector<open_module> stack(1);
+	for (;;) {
+		auto item = reader.next();
+		EXPECT_TRUE(item) << item.error().description << ":" << item.error().location;
+		if (!item) {
+			return {};
+		}
+		switch (item.value().kind) {
+			case sfb_reader_item::end_of_stream: {
+				EXPECT_EQ(1u, stack.size());
+				return std::move(stack.back().sfbs);
+			}
+			case sfb_reader_item::module_begin:
+			case sfb_reader_item::module_type_begin: {
+				stack.push_back({item.move_value(), {}});
+				break;
+			}
+			case sfb_reader_item::sfb: {
+				stack.back().sfbs.push_back(item.value().value);
+				break;
+			}
+			case sfb_reader_item::module_end: {
+				auto mod = std::move(stack.back());
+				stack.pop_back();
+				if (mod.item.kind == sfb_reader_item::module_begin) {
+					stack.back().sfbs.push_back(builder::module_def(
+						mod.item.id,
+						module_body(
+							mod.item.parameters,
+							std::make_shared<module_body_struct_repr>(mod.item.type, std::move(mod.sfbs)))));
+				} else {
+					stack.back().sfbs.push_back(builder::module_type_def(
+						mod.item.id,
+						module_body(
+							mod.item.parameters,
+							std::make_shared<module_body_struct_repr>(std::nullopt, std::move(mod.sfbs)))));
+				}
+				break;
+			}
+		}
+	}
+}
+
+}  // namespace
+
+TEST(sfb_reader_test, matches_full_parse) {
+	std::stringstream ss(SFB_STREAM_EXAMPLE);
+	sfb_reader reader(ss);
+	auto sfbs = read_all(reader);
+
+	std::stringstream full(SFB_STREAM_EXAMPLE);
+	sexpr_stream_parser parser(full);
+	std::vector<sfb_t> expected;
+	while (!parser.at_end()) {
+		auto e = parser.parse_expr();
+		ASSERT_TRUE(e);
+		auto s = sfb_from_sexpr(e.value());
+		ASSERT_TRUE(s);
+		expected.push_back(s.move_value());
+	}
+
+	ASSERT_EQ(expected.size(), sfbs.size());
+	for (std::size_t n = 0; n < sfbs.size(); ++n) {
+		EXPECT_EQ(expected[n].debug_string(), sfbs[n].debug_string());
+	}
+}
+
+TEST(sfb_reader_test, item_sequence) {
+	std::stringstream ss(SFB_STREAM_EXAMPLE);
+	sfb_reader reader(ss);
+
+	std::vector<sfb_reader_item::kind_type> kinds;
+	std::size_t max_depth = 0;
+	for (;;) {
+		auto item = reader.next();
+		ASSERT_TRUE(item);
+		kinds.push_back(item.value().kind);
+		max_depth = std::max(max_depth, reader.depth());
+		if (item.value().kind == sfb_reader_item::end_of_stream) {
+			break;
+		}
+	}
+
+	using k = sfb_reader_item;
+	std::vector<sfb_reader_item::kind_type> expected = {
+		k::module_begin,
+			k::module_type_begin, k::sfb, k::module_end,
+			k::module_begin, k::sfb, k::module_end,
+			k::module_begin, k::sfb, k::module_end,
+			k::sfb,
+		k::module_end,
+		k::sfb,
+		k::module_begin, k::module_end,
+		k::end_of_stream
+	};
+	EXPECT_EQ(expected, kinds);
+	EXPECT_EQ(2u, max_depth);
+}
+
+TEST(sfb_reader_test, errors) {
+	std::stringstream ss("(Module X (Struct (Untyped) (Body (Axiom foo))))");
+	sfb_reader reader(ss);
+
+	auto item = reader.next();
+	ASSERT_TRUE(item);
+	EXPECT_EQ(sfb_reader_item::module_begin, item.value().kind);
+	EXPECT_EQ("X", item.value().id);
+
+	item = reader.next();
+	ASSERT_FALSE(item);
+	EXPECT_EQ("Axiom requires 2 arguments", item.error().description);
+	EXPECT_EQ(34u, item.error().location);
+
+	std::stringstream truncated("(Module X (Struct (Untyped) (Body (Axiom foo (Sort Set))");
+	sfb_reader reader2(truncated);
+	ASSERT_TRUE(reader2.next());
+	ASSERT_TRUE(reader2.next());
+	item = reader2.next();
+	ASSERT_FALSE(item);
+	EXPECT_EQ("Unexpected end of stream", item.error().description);
+}
+
+}  // namespace coqcic
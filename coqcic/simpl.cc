@@ -27,19 +27,29 @@ public:
 	}
 
 	void
-	pop_local() {
+	pop_local() override {
 		--depth_;
 	}
 
 	std::optional<constr_t>
-	handle_local(const std::string& name, std::size_t index) override {
-		if (index >= index_ + subst_.size() + depth_) {
-			return {builder::local(name, index - subst_.size())};
-		} else if (index >= index_ + depth_) {
-			return {subst_[index - index_ - depth_].shift(0, depth_)};
-		} else {
-			return {};
+	pre_visit(const constr_t& term) override {
+		if (term.loose_bound() <= index_ + depth_) {
+			// No local refers to any substituted or shifted index, leave
+			// the subterm as it is. (Binders counted by the visitor are a
+			// superset of those counted by loose_bound.)
+			return term;
 		}
+		if (auto local = term.as_local()) {
+			// Locals are handled here rather than by handle_local, such
+			// that shifted ones are rebuilt from their symbol.
+			std::size_t index = local->index();
+			if (index >= index_ + subst_.size() + depth_) {
+				return builder::local(local->symbol(), index - subst_.size());
+			} else {
+				return subst_[index - index_ - depth_].shift(0, depth_);
+			}
+		}
+		return {};
 	}
 
 private:
@@ -56,6 +66,11 @@ local_subst(
 	std::size_t index,
 	std::vector<constr_t> subst
 ) {
+	if (input.loose_bound() <= index) {
+		// No local refers to any substituted or shifted index.
+		return input;
+	}
+
 	local_subst_visitor visitor(0, index, std::move(subst));
 	auto result = visit_transform(input, visitor);
 
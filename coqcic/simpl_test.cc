@@ -1,5 +1,7 @@
 #include "coqcic/simpl.h"
 
+#include "coqcic/lazy_stack.h"
+
 #include "gtest/gtest.h"
 
 namespace coqcic {
@@ -48,4 +50,18 @@ TEST(simpl_test, subst_1) {
 	EXPECT_EQ(o, e);
 }
 
+TEST(simpl_test, subst_closed) {
+	using namespace builder;
+	auto closed = lambda({{"b", global("nat")}}, apply(global("f"), {local("b", 0)}));
+	auto i = apply(global("plus"), {closed, local("a", 0)});
+
+	auto o = local_subst(i, 0, {global("O")});
+	EXPECT_EQ(o, apply(global("plus"), {closed, global("O")}));
+
+	// Closed subterms are not rebuilt.
+	auto apply = o.as_apply();
+	ASSERT_TRUE(apply);
+	EXPECT_EQ(apply->args()[0].repr(), closed.repr());
+}
+
 }  // namespace coqcic
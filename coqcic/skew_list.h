@@ -0,0 +1,169 @@
+#ifndef COQCIC_SKEW_LIST_H
+#define COQCIC_SKEW_LIST_H
+
+// Persistent random-access stack
+//
+// Skew-binary random-access list: the stack is represented as a sequence
+// of complete binary trees whose sizes (of the form 2^k - 1) follow the
+// digits of the skew-binary representation of the number of elements.
+// "Push" is O(1) and allocates one fixed-size node, "pop" is O(1) and
+// does not allocate, indexed access is O(log n), and size is O(1). As for
+// lazy_stack, push and pop leave the old state unmodified, all states
+// share structure.
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+namespace coqcic {
+
+// Root of a complete binary tree that is part of the sequence of trees.
+// The right subtree of a node is the successor of its left subtree in
+// the sequence: two trees are only ever linked below a new root while
+// they are adjacent, and nodes are immutable.
+template<typename T>
+struct skew_list_node {
+	T value;
+	// Number of elements of the tree rooted at this node.
+	std::size_t size;
+	std::shared_ptr<const skew_list_node<T>> left;
+	// Next tree in the sequence.
+	std::shared_ptr<const skew_list_node<T>> next;
+};
+
+template<typename T>
+class skew_list {
+public:
+	inline
+	skew_list() noexcept = default;
+
+	inline
+	std::size_t
+	size() const noexcept {
+		return size_;
+	}
+
+	inline
+	bool
+	empty() const noexcept {
+		return !head_;
+	}
+
+	inline
+	skew_list<T>
+	push(T t) const;
+
+	inline
+	skew_list<T>
+	pop() const;
+
+	inline
+	const T&
+	at(std::size_t index) const;
+
+	inline
+	const T&
+	get(std::size_t index, const T& fallback) const noexcept;
+
+	// Identifies this stack state. Copies of a state share its identity,
+	// states holding different elements have different identities as long
+	// as both are alive. All empty stacks share the identity nullptr.
+	inline
+	const void*
+	identity() const noexcept {
+		return head_.get();
+	}
+
+private:
+	using node_type = skew_list_node<T>;
+
+	inline
+	skew_list(std::shared_ptr<const node_type> head, std::size_t size) noexcept
+		: head_(std::move(head)), size_(size)
+	{
+	}
+
+	inline
+	const T*
+	find(std::size_t index) const noexcept;
+
+	std::shared_ptr<const node_type> head_;
+	std::size_t size_ = 0;
+};
+
+template<typename T>
+inline
+skew_list<T>
+skew_list<T>::push(T t) const {
+	const node_type* first = head_.get();
+	const node_type* second = first ? first->next.get() : nullptr;
+	std::shared_ptr<const node_type> head;
+	if (second && first->size == second->size) {
+		// Link the two smallest trees below a new root.
+		head = std::make_shared<node_type>(node_type{std::move(t), 1 + 2 * first->size, head_, second->next});
+	} else {
+		head = std::make_shared<node_type>(node_type{std::move(t), 1, nullptr, head_});
+	}
+	return skew_list(std::move(head), size_ + 1);
+}
+
+template<typename T>
+inline
+skew_list<T>
+skew_list<T>::pop() const {
+	if (!head_) {
+		throw std::runtime_error("Pop from empty stack");
+	}
+	// Either drop a single element tree, or split the first tree into its
+	// subtrees, which are still linked in sequence.
+	return skew_list(head_->size == 1 ? head_->next : head_->left, size_ - 1);
+}
+
+template<typename T>
+inline
+const T*
+skew_list<T>::find(std::size_t index) const noexcept {
+	const node_type* node = head_.get();
+	while (node && index >= node->size) {
+		index -= node->size;
+		node = node->next.get();
+	}
+	if (!node) {
+		return nullptr;
+	}
+
+	while (index != 0) {
+		std::size_t half = node->size / 2;
+		node = node->left.get();
+		if (index <= half) {
+			index -= 1;
+		} else {
+			node = node->next.get();
+			index -= 1 + half;
+		}
+	}
+	return &node->value;
+}
+
+template<typename T>
+inline
+const T&
+skew_list<T>::at(std::size_t index) const {
+	if (auto value = find(index)) {
+		return *value;
+	}
+
+	throw std::runtime_error("Index out of range");
+}
+
+template<typename T>
+inline
+const T&
+skew_list<T>::get(std::size_t index, const T& fallback) const noexcept {
+	auto value = find(index);
+	return value ? *value : fallback;
+}
+
+}  // namespace coqcic
+
+#endif  // COQCIC_SKEW_LIST_H
@@ -0,0 +1,64 @@
+#include "coqcic/skew_list.h"
+
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace coqcic {
+
+namespace {
+
+template<typename T>
+std::vector<T>
+to_vec(const skew_list<T>& list) {
+	std::vector<T> result;
+	for (std::size_t n = 0; n < list.size(); ++n) {
+		result.push_back(list.at(n));
+	}
+	return result;
+}
+
+}  // namespace
+
+TEST(skew_list_test, push_pop) {
+	skew_list<int> s;
+	EXPECT_TRUE(s.empty());
+	EXPECT_EQ(0u, s.size());
+
+	// Model with the top of stack at the front.
+	std::vector<int> model;
+	std::vector<skew_list<int>> states;
+	for (int n = 0; n < 100; ++n) {
+		states.push_back(s);
+		s = s.push(n);
+		model.insert(model.begin(), n);
+		ASSERT_EQ(model, to_vec(s));
+	}
+	EXPECT_THROW(s.at(100), std::runtime_error);
+	EXPECT_EQ(-1, s.get(100, -1));
+
+	for (int n = 99; n >= 0; --n) {
+		s = s.pop();
+		model.erase(model.begin());
+		ASSERT_EQ(model, to_vec(s));
+		// Earlier states are unaffected.
+		ASSERT_EQ(to_vec(states[n]), to_vec(s));
+	}
+	EXPECT_TRUE(s.empty());
+	EXPECT_THROW(s.pop(), std::runtime_error);
+}
+
+TEST(skew_list_test, sharing) {
+	auto base = skew_list<int>().push(1).push(2).push(3);
+	auto a = base.push(4);
+	auto b = base.push(5).push(6);
+	EXPECT_EQ((std::vector<int>{4, 3, 2, 1}), to_vec(a));
+	EXPECT_EQ((std::vector<int>{6, 5, 3, 2, 1}), to_vec(b));
+	EXPECT_EQ((std::vector<int>{3, 2, 1}), to_vec(base));
+
+	EXPECT_EQ(base.identity(), a.pop().identity());
+	EXPECT_NE(base.identity(), b.pop().identity());
+	EXPECT_EQ(nullptr, skew_list<int>().identity());
+}
+
+}  // namespace coqcic
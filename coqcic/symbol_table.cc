@@ -0,0 +1,77 @@
+#include "coqcic/symbol_table.h"
+
+#include <mutex>
+
+namespace coqcic {
+
+/**
+	\class symbol_table
+	\brief Interning table mapping strings to dense integer ids.
+	\headerfile coqcic/symbol_table.h <coqcic/symbol_table.h>
+
+	Usage:
+
+	\code
+		symbol_table table;
+		auto a = table.intern("Coq.Init.Datatypes.nat");
+		auto b = table.intern("Coq.Init.Datatypes.nat");
+		// a == b, table.name(a) == "Coq.Init.Datatypes.nat"
+	\endcode
+*/
+
+symbol_table::~symbol_table() {
+}
+
+symbol_table::symbol_table() {
+}
+
+symbol_table::id_type
+symbol_table::intern(std::string_view name) {
+	return intern_with_name(name).first;
+}
+
+std::pair<symbol_table::id_type, const std::string*>
+symbol_table::intern_with_name(std::string_view name) {
+	{
+		std::shared_lock<std::shared_mutex> guard(mutex_);
+		auto i = ids_.find(name);
+		if (i != ids_.end()) {
+			return {i->second, &names_[i->second]};
+		}
+	}
+
+	std::unique_lock<std::shared_mutex> guard(mutex_);
+	// Another thread may have added the name in the meantime.
+	auto i = ids_.find(name);
+	if (i != ids_.end()) {
+		return {i->second, &names_[i->second]};
+	}
+	id_type id = names_.size();
+	names_.emplace_back(name);
+	ids_.emplace(names_.back(), id);
+	return {id, &names_.back()};
+}
+
+std::optional<symbol_table::id_type>
+symbol_table::find(std::string_view name) const {
+	std::shared_lock<std::shared_mutex> guard(mutex_);
+	auto i = ids_.find(name);
+	if (i != ids_.end()) {
+		return i->second;
+	}
+	return std::nullopt;
+}
+
+const std::string&
+symbol_table::name(id_type id) const {
+	std::shared_lock<std::shared_mutex> guard(mutex_);
+	return names_[id];
+}
+
+std::size_t
+symbol_table::size() const {
+	std::shared_lock<std::shared_mutex> guard(mutex_);
+	return names_.size();
+}
+
+}  // namespace coqcic
@@ -0,0 +1,83 @@
+#ifndef COQCIC_SYMBOL_TABLE_H
+#define COQCIC_SYMBOL_TABLE_H
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace coqcic {
+
+/**
+	\brief Interning table mapping strings to dense integer ids
+
+	Each distinct string interned receives the next free id, starting
+	at zero. Names are stored once and remain valid (at the same
+	address) for the lifetime of the table, so frequently repeated
+	strings can be represented by their id and compared as integers.
+
+	All operations are synchronized and may be called concurrently
+	from multiple threads.
+*/
+class symbol_table {
+public:
+	using id_type = std::uint32_t;
+
+	~symbol_table();
+
+	symbol_table();
+
+	symbol_table(const symbol_table& other) = delete;
+	symbol_table& operator=(const symbol_table& other) = delete;
+
+	/**
+		\brief Id for the given name, adding it if not present yet
+	*/
+	id_type
+	intern(std::string_view name);
+
+	/**
+		\brief Id for the given name along with the stored name
+
+		Same as \ref intern followed by \ref name, but looks up
+		the name only once.
+	*/
+	std::pair<id_type, const std::string*>
+	intern_with_name(std::string_view name);
+
+	/**
+		\brief Id for the given name if present
+	*/
+	std::optional<id_type>
+	find(std::string_view name) const;
+
+	/**
+		\brief Name for the given id
+
+		The id must have been returned by \ref intern on this table.
+		The returned reference stays valid as long as the table exists.
+	*/
+	const std::string&
+	name(id_type id) const;
+
+	/**
+		\brief Number of distinct names interned
+	*/
+	std::size_t
+	size() const;
+
+private:
+	mutable std::shared_mutex mutex_;
+	// Deque never moves its elements, so string_view keys referring to
+	// names stay valid while the table grows.
+	std::deque<std::string> names_;
+	std::unordered_map<std::string_view, id_type> ids_;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_SYMBOL_TABLE_H
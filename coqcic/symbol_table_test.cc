@@ -0,0 +1,47 @@
+#include "coqcic/symbol_table.h"
+
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+TEST(symbol_table_test, intern) {
+	coqcic::symbol_table table;
+	auto nat = table.intern("Coq.Init.Datatypes.nat");
+	auto bool_ = table.intern("Coq.Init.Datatypes.bool");
+
+	EXPECT_NE(nat, bool_);
+	EXPECT_EQ(table.intern("Coq.Init.Datatypes.nat"), nat);
+	EXPECT_EQ(table.name(nat), "Coq.Init.Datatypes.nat");
+	EXPECT_EQ(table.name(bool_), "Coq.Init.Datatypes.bool");
+	EXPECT_EQ(table.find("Coq.Init.Datatypes.bool"), bool_);
+	auto entry = table.intern_with_name("Coq.Init.Datatypes.nat");
+	EXPECT_EQ(entry.first, nat);
+	EXPECT_EQ(entry.second, &table.name(nat));
+	EXPECT_FALSE(table.find("Coq.Init.Datatypes.list"));
+	EXPECT_EQ(table.size(), 2);
+}
+
+TEST(symbol_table_test, concurrent_intern) {
+	coqcic::symbol_table table;
+	std::vector<std::vector<coqcic::symbol_table::id_type>> ids(4);
+	std::vector<std::thread> threads;
+	for (auto& thread_ids : ids) {
+		threads.emplace_back([&table, &thread_ids] {
+			for (std::size_t n = 0; n < 1000; ++n) {
+				thread_ids.push_back(table.intern("name" + std::to_string(n)));
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	EXPECT_EQ(table.size(), 1000);
+	for (const auto& thread_ids : ids) {
+		EXPECT_EQ(thread_ids, ids[0]);
+	}
+	for (std::size_t n = 0; n < 1000; ++n) {
+		EXPECT_EQ(table.name(ids[0][n]), "name" + std::to_string(n));
+	}
+}
@@ -1,11 +1,16 @@
 #include "coqcic/to_sexpr.h"
 
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace coqcic {
 
 sexpr name_to_sexpr(const std::optional<std::string>& name) {
 	if (name) {
 		return sexpr::make_compound(
-			"Name",
+			sexpr_kind_name,
 			{
 				sexpr::make_terminal(*name, 0)
 			},
@@ -13,7 +18,7 @@ sexpr name_to_sexpr(const std::optional<std::string>& name) {
 		);
 	} else {
 		return sexpr::make_compound(
-			"Anonymous",
+			sexpr_kind_anonymous,
 			{
 			},
 			0
@@ -41,158 +46,242 @@ sexpr cast_kind_to_sexpr(constr_cast::kind_type kind) {
 	}
 }
 
-sexpr fix_function_to_sexpr(const fix_function_t& fixfn) {
-	return sexpr::make_compound(
-		"Function",
-		{
-			name_to_sexpr(fixfn.name),
-			constr_to_sexpr(builder::product(fixfn.args, fixfn.restype)),
-			constr_to_sexpr(builder::lambda(fixfn.args, fixfn.body))
-		},
-		0
-	);
+namespace {
+
+// Builds a compound expression from its arguments. Arguments are moved
+// into place, unlike with braced lists whose elements are copied, which
+// for nested expressions copies the whole subtree.
+template<typename... Args>
+sexpr
+make_compound_of(sexpr_kind_t kind, Args&&... args) {
+	std::vector<sexpr> result;
+	result.reserve(sizeof...(args));
+	(result.push_back(std::forward<Args>(args)), ...);
+	return sexpr::make_compound(kind, std::move(result), 0);
 }
 
+// Node being converted. Children are converted in order, results hold
+// their conversions. The signatures and definitions of fixpoint functions
+// are converted as product and lambda terms built for the purpose, which
+// the frame owns. Frames are reused for the nodes visited at the same
+// depth, keeping the capacity of their vectors.
+struct to_sexpr_frame {
+	void
+	reset(const constr_t& term) {
+		input = term;
+		owned.clear();
+		children.clear();
+		results.clear();
+		if (auto product = input.as_product()) {
+			for (const auto& arg : product->args()) {
+				children.push_back(&arg.type);
+			}
+			children.push_back(&product->restype());
+		} else if (auto lambda = input.as_lambda()) {
+			for (const auto& arg : lambda->args()) {
+				children.push_back(&arg.type);
+			}
+			children.push_back(&lambda->body());
+		} else if (auto let = input.as_let()) {
+			children = {&let->value(), &let->type(), &let->body()};
+		} else if (auto apply = input.as_apply()) {
+			children.push_back(&apply->fn());
+			for (const auto& arg : apply->args()) {
+				children.push_back(&arg);
+			}
+		} else if (auto cast = input.as_cast()) {
+			children = {&cast->term(), &cast->typeterm()};
+		} else if (auto match_case = input.as_match()) {
+			children = {&match_case->casetype(), &match_case->arg()};
+			for (const auto& branch : match_case->branches()) {
+				children.push_back(&branch.expr);
+			}
+		} else if (auto fix = input.as_fix()) {
+			const auto& functions = fix->group()->functions;
+			owned.reserve(2 * functions.size());
+			for (const auto& fixfn : functions) {
+				owned.push_back(builder::product(fixfn.args, fixfn.restype));
+				owned.push_back(builder::lambda(fixfn.args, fixfn.body));
+			}
+			for (const auto& term : owned) {
+				children.push_back(&term);
+			}
+		} else {
+			throw std::logic_error("non-exhaustive pattern matching on constr_t");
+		}
+		results.reserve(children.size());
+	}
+
+	constr_t input;
+	std::vector<constr_t> owned;
+	std::vector<const constr_t*> children;
+	std::vector<sexpr> results;
+};
+
+// Converts nodes without children. Returns false if the node has
+// children.
+bool
+leaf_to_sexpr(const constr_t& constr, sexpr& result) {
+	if (auto local = constr.as_local()) {
+		result = sexpr::make_compound(
+			sexpr_kind_local,
+			{
+				sexpr::make_terminal(local->name(), 0),
+				sexpr::make_terminal(std::to_string(local->index()), 0)
+			},
+			0
+		);
+	} else if (auto global = constr.as_global()) {
+		result = sexpr::make_compound(
+			sexpr_kind_global,
+			{
+				sexpr::make_terminal(global->name(), 0)
+			},
+			0
+		);
+	} else if (auto builtin = constr.as_builtin()) {
+		result = sexpr::make_compound(
+			sexpr_kind_sort,
+			{
+				sexpr::make_terminal(builtin->name(), 0)
+			},
+			0
+		);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Wraps "body" into nested binders of the given kind, one per argument.
+sexpr
+binders_to_sexpr(sexpr_kind_t kind, const std::vector<formal_arg_t>& args, std::vector<sexpr>& types, sexpr body) {
+	for (std::size_t n = args.size(); n; --n) {
+		body = make_compound_of(
+			kind,
+			name_to_sexpr(args[n - 1].name),
+			std::move(types[n - 1]),
+			std::move(body)
+		);
+	}
+	return body;
+}
+
+sexpr
+finish_frame(to_sexpr_frame& frame) {
+	const auto& input = frame.input;
+	auto& results = frame.results;
+
+	if (auto product = input.as_product()) {
+		return binders_to_sexpr(sexpr_kind_prod, product->args(), results, std::move(results.back()));
+	} else if (auto lambda = input.as_lambda()) {
+		return binders_to_sexpr(sexpr_kind_lambda, lambda->args(), results, std::move(results.back()));
+	} else if (auto let = input.as_let()) {
+		return make_compound_of(
+			sexpr_kind_let_in,
+			name_to_sexpr(let->varname()),
+			std::move(results[0]),
+			std::move(results[1]),
+			std::move(results[2])
+		);
+	} else if (input.as_apply()) {
+		return sexpr::make_compound(sexpr_kind_app, std::move(results), 0);
+	} else if (auto cast = input.as_cast()) {
+		return make_compound_of(
+			sexpr_kind_cast,
+			std::move(results[0]),
+			cast_kind_to_sexpr(cast->kind()),
+			std::move(results[1])
+		);
+	} else if (auto match_case = input.as_match()) {
+		std::vector<sexpr> branches;
+		branches.reserve(match_case->branches().size());
+		for (std::size_t n = 0; n < match_case->branches().size(); ++n) {
+			const auto& branch = match_case->branches()[n];
+			branches.push_back(
+				make_compound_of(
+					sexpr_kind_branch,
+					sexpr::make_terminal(branch.constructor, 0),
+					sexpr::make_terminal(std::to_string(branch.nargs), 0),
+					std::move(results[n + 2])
+				)
+			);
+		}
+		return make_compound_of(
+			sexpr_kind_case,
+			sexpr::make_terminal("1", 0),
+			std::move(results[0]),
+			make_compound_of(
+				sexpr_kind_match,
+				std::move(results[1])
+			),
+			sexpr::make_compound(
+				sexpr_kind_branches,
+				std::move(branches),
+				0
+			)
+		);
+	} else {
+		auto fix = input.as_fix();
+		std::vector<sexpr> args;
+		args.push_back(
+			sexpr::make_terminal(std::to_string(fix->index()), 0)
+		);
+
+		const auto& functions = fix->group()->functions;
+		for (std::size_t n = 0; n < functions.size(); ++n) {
+			args.push_back(
+				make_compound_of(
+					sexpr_kind_function,
+					name_to_sexpr(functions[n].name),
+					std::move(results[2 * n]),
+					std::move(results[2 * n + 1])
+				)
+			);
+		}
+
+		return sexpr::make_compound(sexpr_kind_fix, std::move(args), 0);
+	}
+}
+
+}  // namespace
+
 sexpr constr_to_sexpr(const constr_t& constr) {
-	return constr.visit(
-		[](const auto& constr) -> sexpr {
-			using T = std::decay_t<decltype(constr)>;
-			if constexpr (std::is_same<T, constr_local>()) {
-				return sexpr::make_compound(
-					"Local",
-					{
-						sexpr::make_terminal(constr.name(), 0),
-						sexpr::make_terminal(std::to_string(constr.index()), 0)
-					},
-					0
-				);
-			} else if constexpr (std::is_same<T, constr_global>()) {
-				return sexpr::make_compound(
-					"Global",
-					{
-						sexpr::make_terminal(constr.name(), 0)
-					},
-					0
-				);
-			} else if constexpr (std::is_same<T, constr_builtin>()) {
-				return sexpr::make_compound(
-					"Sort",
-					{
-						sexpr::make_terminal(constr.name(), 0)
-					},
-					0
-				);
-			} else if constexpr (std::is_same<T, constr_product>()) {
-				auto e = constr_to_sexpr(constr.restype());
-				for (std::size_t n = constr.args().size(); n; --n) {
-					const auto& arg = constr.args()[n - 1];
-					e = sexpr::make_compound(
-						"Prod",
-						{
-							name_to_sexpr(arg.name),
-							constr_to_sexpr(arg.type),
-							std::move(e)
-						},
-						0
-					);
-				}
-				return e;
-			} else if constexpr (std::is_same<T, constr_lambda>()) {
-				auto e = constr_to_sexpr(constr.body());
-				for (std::size_t n = constr.args().size(); n; --n) {
-					const auto& arg = constr.args()[n - 1];
-					e = sexpr::make_compound(
-						"Lambda",
-						{
-							name_to_sexpr(arg.name),
-							constr_to_sexpr(arg.type),
-							std::move(e)
-						},
-						0
-					);
-				}
-				return e;
-			} else if constexpr (std::is_same<T, constr_let>()) {
-				return sexpr::make_compound(
-					"LetIn",
-					{
-						name_to_sexpr(constr.varname()),
-						constr_to_sexpr(constr.value()),
-						constr_to_sexpr(constr.type()),
-						constr_to_sexpr(constr.body())
-					},
-					0
-				);
-			} else if constexpr (std::is_same<T, constr_apply>()) {
-				std::vector<sexpr> args;
-				args.push_back(constr_to_sexpr(constr.fn()));
-				for (const auto& arg : constr.args()) {
-					args.push_back(constr_to_sexpr(arg));
-				}
-				return sexpr::make_compound("App", args, 0);
-			} else if constexpr (std::is_same<T, constr_cast>()) {
-				return sexpr::make_compound(
-					"Cast",
-					{
-						constr_to_sexpr(constr.term()),
-						cast_kind_to_sexpr(constr.kind()),
-						constr_to_sexpr(constr.typeterm())
-					},
-					0
-				);
-			} else if constexpr (std::is_same<T, constr_match>()) {
-				std::vector<sexpr> branches;
-				for (const auto& branch : constr.branches()) {
-					branches.push_back(
-						sexpr::make_compound(
-							"Branch",
-							{
-								sexpr::make_terminal(branch.constructor, 0),
-								sexpr::make_terminal(std::to_string(branch.nargs), 0),
-								constr_to_sexpr(branch.expr)
-							},
-							0
-						)
-					);
-				}
-				return sexpr::make_compound(
-					"Case",
-					{
-						sexpr::make_terminal("1", 0),
-						constr_to_sexpr(constr.casetype()),
-						sexpr::make_compound(
-							"Match",
-							{
-								constr_to_sexpr(constr.arg())
-							},
-							0
-						),
-						sexpr::make_compound(
-							"Branches",
-							branches,
-							0
-						)
-					},
-					0
-				);
-			} else if constexpr (std::is_same<T, constr_fix>()) {
-				std::vector<sexpr> args;
-				args.push_back(
-					sexpr::make_terminal(std::to_string(constr.index()), 0)
-				);
-
-				for (const auto& fixfn : constr.group()->functions) {
-					args.push_back(
-						fix_function_to_sexpr(fixfn)
-					);
-				}
+	sexpr result;
+	if (leaf_to_sexpr(constr, result)) {
+		return result;
+	}
 
-				return sexpr::make_compound("Fix", args, 0);
-			} else {
-				throw std::logic_error("non-exhaustice pattern matching on constr_t");
+	// Nodes on the path to the node converted, kept on an explicit stack
+	// such that deeply nested terms do not exhaust the native stack.
+	// The first "depth" frames of the stack are in use.
+	std::vector<to_sexpr_frame> stack(1);
+	std::size_t depth = 1;
+	stack[0].reset(constr);
+
+	for (;;) {
+		auto& frame = stack[depth - 1];
+		std::size_t index = frame.results.size();
+		if (index < frame.children.size()) {
+			const auto& child = *frame.children[index];
+			if (!leaf_to_sexpr(child, result)) {
+				if (depth == stack.size()) {
+					stack.emplace_back();
+				}
+				stack[depth].reset(child);
+				++depth;
+				continue;
+			}
+		} else {
+			result = finish_frame(frame);
+			--depth;
+			if (depth == 0) {
+				return result;
 			}
 		}
-	);
+
+		stack[depth - 1].results.push_back(std::move(result));
+	}
 }
 
 }  // namespace coqcic
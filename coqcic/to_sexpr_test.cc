@@ -39,3 +39,20 @@ TEST_F(to_sexpr_test, parse_success) {
 		let("foo", apply(global("S"), {global("O")}), global("nat"), apply(global("S"), {local("foo", 0)}))
 	);
 }
+
+TEST_F(to_sexpr_test, deep_nesting) {
+	using namespace coqcic::builder;
+
+	// S (S (... (S O))), nested far beyond what recursion could handle
+	// on the native stack.
+	const std::size_t depth = 1000000;
+	coqcic::constr_t term = global("O");
+	for (std::size_t n = 0; n < depth; ++n) {
+		term = apply(global("S"), {term});
+	}
+
+	auto e = coqcic::constr_to_sexpr(term);
+	auto c = constr_from_sexpr(e);
+	ASSERT_TRUE(c);
+	EXPECT_EQ(c.value().hash(), term.hash());
+}
@@ -0,0 +1,214 @@
+// Benchmark for the traversals over terms and s-expressions.
+//
+// Measures visit_transform, visit_query, pass_manager, normalize,
+// constr_to_sexpr, constr_from_sexpr and parse_sexpr on a deep term mixing
+// all kinds of constructions, and on a wide term of many small subterms.
+// The depth of the deep term is kept within what recursive implementations
+// of these traversals handle on the native stack, such that results can be
+// compared against them. Also
+// compares visit_transform and visit_transform_shared on fix nodes
+// sharing a group.
+
+#include "coqcic/constr.h"
+#include "coqcic/from_sexpr.h"
+#include "coqcic/normalize.h"
+#include "coqcic/parse_sexpr.h"
+#include "coqcic/pass_manager.h"
+#include "coqcic/to_sexpr.h"
+#include "coqcic/visitor.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+using namespace coqcic;
+
+constr_t
+make_deep_term(std::size_t depth) {
+	auto nat = builder::global("nat");
+	constr_t term = builder::local("x", 0);
+	for (std::size_t n = 0; n < depth; ++n) {
+		switch (n % 5) {
+			case 0: {
+				term = builder::lambda({{"x", nat}}, term);
+				break;
+			}
+			case 1: {
+				term = builder::apply(builder::apply(builder::global("f"), {term}), {builder::local("x", 0)});
+				break;
+			}
+			case 2: {
+				term = builder::product({{"y", builder::apply(builder::global("T"), {term})}}, nat);
+				break;
+			}
+			case 3: {
+				term = builder::cast(term, constr_cast::vm_cast, nat);
+				break;
+			}
+			case 4: {
+				term = builder::let("z", nat, nat, term);
+				break;
+			}
+		}
+	}
+	return term;
+}
+
+// f (fun x => g x x) ... (fun x => g x x)
+constr_t
+make_wide_term(std::size_t width) {
+	std::vector<constr_t> args;
+	for (std::size_t n = 0; n < width; ++n) {
+		args.push_back(builder::lambda(
+			{{"x", builder::global("nat")}},
+			builder::apply(builder::global("g"), {builder::local("x", 0), builder::local("x", 0)})));
+	}
+	return builder::apply(builder::global("f"), std::move(args));
+}
+
+// f (fix g ...) ... (fix g ...), the fix nodes sharing one group whose
+// body is a deep term, as for the definitions read by sfb_from_sexpr.
+constr_t
+make_shared_term(std::size_t depth, std::size_t count) {
+	auto group = std::make_shared<fix_group_t>(fix_group_t{{
+		fix_function_t{"g", {{"x", builder::global("nat")}}, builder::global("nat"), make_deep_term(depth)}}});
+	std::vector<constr_t> args;
+	for (std::size_t n = 0; n < count; ++n) {
+		args.push_back(builder::fix(0, group));
+	}
+	return builder::apply(builder::global("f"), std::move(args));
+}
+
+// Replaces all globals "from" by "to", rebuilding the term.
+class rename_visitor final : public transform_visitor {
+public:
+	rename_visitor(const char* from = "nat", const char* to = "N") : from_(from), to_(to) {}
+
+	std::optional<constr_t>
+	handle_global(const std::string& name) override {
+		if (name == from_) {
+			return builder::global(to_);
+		}
+		return {};
+	}
+
+private:
+	std::string from_;
+	std::string to_;
+};
+
+// Counts occurrences of global "nat".
+class count_query final : public query_visitor {
+public:
+	query_action
+	visit(const constr_t& term) override {
+		auto global = term.as_global();
+		if (global && global->name() == "nat") {
+			++count;
+		}
+		return query_action::descend;
+	}
+
+	std::size_t count = 0;
+};
+
+template<typename Fn>
+double
+time_ms(Fn&& fn, std::size_t rounds) {
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t n = 0; n < rounds; ++n) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void
+run(const char* name, const constr_t& term, std::size_t rounds) {
+	std::size_t sink = 0;
+	auto e = constr_to_sexpr(term);
+	std::stringstream ss;
+	e.format(ss);
+	std::string text = ss.str();
+
+	double transform_ms = time_ms([&] {
+		rename_visitor visitor;
+		sink += visit_transform(term, visitor)->hash();
+	}, rounds);
+	double query_ms = time_ms([&] {
+		count_query visitor;
+		visit_query(term, visitor);
+		sink += visitor.count;
+	}, rounds);
+	double sequential_ms = time_ms([&] {
+		rename_visitor first("nat", "N");
+		rename_visitor second("f", "F");
+		sink += visit_transform(*visit_transform(term, first), second)->hash();
+	}, rounds);
+	double fused_ms = time_ms([&] {
+		rename_visitor first("nat", "N");
+		rename_visitor second("f", "F");
+		pass_manager passes;
+		passes.add("first", first);
+		passes.add("second", second);
+		sink += passes.run(term)->hash();
+	}, rounds);
+	double normalize_ms = time_ms([&] { sink += normalize(term).hash(); }, rounds);
+	double to_sexpr_ms = time_ms([&] { sink += constr_to_sexpr(term).location(); }, rounds);
+	double from_sexpr_ms = time_ms([&] { sink += constr_from_sexpr(e).value().hash(); }, rounds);
+	double parse_ms = time_ms([&] { sink += parse_sexpr(text).value().location(); }, rounds);
+	double parse_flat_ms = time_ms([&] { sink += parse_flat_sexpr(text).value().size(); }, rounds);
+
+	if (sink == 0) {
+		throw std::logic_error("unexpected result");
+	}
+
+	std::cout << name << ":\n";
+	std::cout << "  visit_transform:   " << transform_ms << " ms\n";
+	std::cout << "  visit_query:       " << query_ms << " ms\n";
+	std::cout << "  2 passes, apart:   " << sequential_ms << " ms\n";
+	std::cout << "  2 passes, fused:   " << fused_ms << " ms\n";
+	std::cout << "  normalize:         " << normalize_ms << " ms\n";
+	std::cout << "  constr_to_sexpr:   " << to_sexpr_ms << " ms\n";
+	std::cout << "  constr_from_sexpr: " << from_sexpr_ms << " ms\n";
+	std::cout << "  parse_sexpr:       " << parse_ms << " ms\n";
+	std::cout << "  parse_flat_sexpr:  " << parse_flat_ms << " ms\n";
+}
+
+void
+run_shared(const char* name, const constr_t& term, std::size_t rounds) {
+	std::size_t sink = 0;
+	double transform_ms = time_ms([&] {
+		rename_visitor visitor;
+		sink += visit_transform(term, visitor)->hash();
+	}, rounds);
+	double shared_ms = time_ms([&] {
+		rename_visitor visitor;
+		sink += visit_transform_shared(term, visitor)->hash();
+	}, rounds);
+
+	if (sink == 0) {
+		throw std::logic_error("unexpected result");
+	}
+
+	std::cout << name << ":\n";
+	std::cout << "  visit_transform:        " << transform_ms << " ms\n";
+	std::cout << "  visit_transform_shared: " << shared_ms << " ms\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+	const std::size_t depth = 5000;
+	const std::size_t width = 20000;
+	const std::size_t rounds = 20;
+
+	run("deep term (depth 5000)", make_deep_term(depth), rounds);
+	run("wide term (20000 args)", make_wide_term(width), rounds);
+	run_shared("shared fix group (depth 1000, 100 fixes)", make_shared_term(1000, 100), rounds);
+
+	return 0;
+}
@@ -1,5 +1,10 @@
 #include "coqcic/visitor.h"
 
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
 namespace coqcic {
 
 transform_visitor::~transform_visitor() {
@@ -17,6 +22,11 @@ void
 transform_visitor::pop_local() {
 }
 
+std::optional<constr_t>
+transform_visitor::pre_visit(const constr_t& term) {
+	return {};
+}
+
 std::optional<constr_t>
 transform_visitor::handle_local(const std::string& name, std::size_t index) {
 	return {};
@@ -72,36 +82,222 @@ transform_visitor::handle_fix(std::size_t index, const std::shared_ptr<const fix
 	return {};
 }
 
-std::optional<constr_t>
-visit_transform(
-	const constr_t& input,
-	transform_visitor& visitor
-) {
-	if (auto local = input.as_local()) {
-		return visitor.handle_local(local->name(), local->index());
+namespace {
+
+// Node whose children are being transformed by visit_transform. Children
+// are visited in order, with locals pushed and popped between them as the
+// binders of the node require. Results hold each transformed child (or
+// the original child if not transformed); they are reserved up front,
+// such that pointers to them passed to push_local remain valid. Frames
+// are reused for the nodes visited at the same depth, keeping the
+// capacity of their vectors.
+struct transform_frame {
+	void
+	reset(const constr_t& term) {
+		input = term;
+		children.clear();
+		results.clear();
+		changed = false;
+		share = false;
+		group.reset();
+		if (auto product = input.as_product()) {
+			for (const auto& arg : product->args()) {
+				children.push_back(&arg.type);
+			}
+			children.push_back(&product->restype());
+		} else if (auto lambda = input.as_lambda()) {
+			for (const auto& arg : lambda->args()) {
+				children.push_back(&arg.type);
+			}
+			children.push_back(&lambda->body());
+		} else if (auto let = input.as_let()) {
+			children = {&let->value(), &let->type(), &let->body()};
+		} else if (auto apply = input.as_apply()) {
+			children.push_back(&apply->fn());
+			for (const auto& arg : apply->args()) {
+				children.push_back(&arg);
+			}
+		} else if (auto cast = input.as_cast()) {
+			children = {&cast->term(), &cast->typeterm()};
+		} else if (auto match_case = input.as_match()) {
+			children = {&match_case->arg(), &match_case->casetype()};
+			for (const auto& branch : match_case->branches()) {
+				children.push_back(&branch.expr);
+			}
+		} else if (auto fix = input.as_fix()) {
+			for (const auto& function : fix->group()->functions) {
+				for (const auto& arg : function.args) {
+					children.push_back(&arg.type);
+				}
+				children.push_back(&function.restype);
+				children.push_back(&function.body);
+			}
+		} else {
+			throw std::logic_error("Unhandled constr kind");
+		}
+		results.reserve(children.size());
+	}
+
+	constr_t input;
+	std::vector<const constr_t*> children;
+	std::vector<constr_t> results;
+	bool changed = false;
+	// Whether the result is to be memoized (see transform_memo).
+	bool share = false;
+	// Transformed group of a fix node, if changed.
+	std::shared_ptr<const fix_group_t> group;
+};
+
+// Transforms nodes replaced by pre_visit and nodes without children
+// directly. Returns false (leaving "result" untouched) if the children of
+// the node are to be visited.
+bool
+transform_leaf(const constr_t& input, transform_visitor& visitor, std::optional<constr_t>& result) {
+	if (auto replacement = visitor.pre_visit(input)) {
+		// Replacing a node by itself leaves it unchanged.
+		if (replacement->repr() == input.repr()) {
+			result.reset();
+		} else {
+			result = std::move(replacement);
+		}
+	} else if (auto local = input.as_local()) {
+		result = visitor.handle_local(local->name(), local->index());
 	} else if (auto global = input.as_global()) {
-		return visitor.handle_global(global->name());
+		result = visitor.handle_global(global->name());
 	} else if (auto builtin = input.as_builtin()) {
-		return visitor.handle_builtin(builtin->name());
-	} else if (auto product = input.as_product()) {
-		std::vector<formal_arg_t> args;
-		bool changed = false;
-		for (const auto& arg : product->args()) {
-			auto maybe_argtype = visit_transform(arg.type, visitor);
-			changed = changed || maybe_argtype;
-			args.push_back(maybe_argtype ? formal_arg_t{arg.name, *maybe_argtype} : arg);
-
-			visitor.push_local(arg.name ? &*arg.name : nullptr, &arg.type, nullptr);
-		}
-		auto maybe_restype = visit_transform(product->restype(), visitor);
-		const auto& restype = maybe_restype ? *maybe_restype : product->restype();
-		changed = changed || maybe_restype;
-
-		for (const auto& arg : product->args()) {
-			(void) arg;
+		result = visitor.handle_builtin(builtin->name());
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Forwards locals to the visitor, counting them.
+struct transform_scope {
+	void
+	push_local(const std::string* name, const constr_t* type, const constr_t* value) {
+		visitor.push_local(name, type, value);
+		++locals;
+	}
+
+	void
+	pop_local() {
+		visitor.pop_local();
+		--locals;
+	}
+
+	transform_visitor& visitor;
+	std::size_t locals = 0;
+};
+
+// Pushes the locals bound before visiting child "index" of the frame.
+void
+enter_child(transform_frame& frame, std::size_t index, transform_scope& visitor) {
+	const auto& input = frame.input;
+	if (auto let = input.as_let()) {
+		if (index == 2) {
+			visitor.push_local(
+				let->varname() ? &*let->varname() : nullptr,
+				&frame.results[1],
+				&frame.results[0]);
+		}
+	} else if (auto match_case = input.as_match()) {
+		if (index == 1) {
+			visitor.push_local(nullptr, &frame.results[0], nullptr);
+		} else if (index >= 2) {
+			const auto& branch = match_case->branches()[index - 2];
+			for (std::size_t n = 0; n < branch.nargs; ++n) {
+				visitor.push_local(nullptr, nullptr, nullptr);
+			}
+		}
+	} else if (auto fix = input.as_fix()) {
+		if (index == 0) {
+			for (const auto& function : fix->group()->functions) {
+				// XXX: product at least correct signature for this function
+				visitor.push_local(&function.name, nullptr, nullptr);
+			}
+		}
+	}
+}
+
+// Pushes or pops the locals bound after visiting child "index" of the
+// frame.
+void
+leave_child(transform_frame& frame, std::size_t index, transform_scope& visitor) {
+	const auto& input = frame.input;
+	auto push_arg = [&visitor] (const formal_arg_t& arg) {
+		visitor.push_local(arg.name ? &*arg.name : nullptr, &arg.type, nullptr);
+	};
+	auto pop = [&visitor] (std::size_t count) {
+		for (std::size_t n = 0; n < count; ++n) {
 			visitor.pop_local();
 		}
+	};
+
+	if (auto product = input.as_product()) {
+		const auto& args = product->args();
+		if (index < args.size()) {
+			push_arg(args[index]);
+		} else {
+			pop(args.size());
+		}
+	} else if (auto lambda = input.as_lambda()) {
+		const auto& args = lambda->args();
+		if (index < args.size()) {
+			push_arg(args[index]);
+		} else {
+			pop(args.size());
+		}
+	} else if (input.as_let()) {
+		if (index == 2) {
+			pop(1);
+		}
+	} else if (auto match_case = input.as_match()) {
+		if (index == 1) {
+			pop(1);
+		} else if (index >= 2) {
+			pop(match_case->branches()[index - 2].nargs);
+		}
+	} else if (auto fix = input.as_fix()) {
+		const auto& functions = fix->group()->functions;
+		// Locate function and position within it.
+		std::size_t pos = index;
+		std::size_t fn = 0;
+		while (pos >= functions[fn].args.size() + 2) {
+			pos -= functions[fn].args.size() + 2;
+			++fn;
+		}
+		const auto& function = functions[fn];
+		if (pos < function.args.size()) {
+			push_arg(function.args[pos]);
+		} else if (pos == function.args.size() + 1) {
+			pop(function.args.size());
+			if (fn + 1 == functions.size()) {
+				pop(functions.size());
+			}
+		}
+	}
+}
+
+// Rebuilds the node of the frame from its transformed children.
+std::optional<constr_t>
+finish_frame(transform_frame& frame, transform_visitor& visitor) {
+	const auto& input = frame.input;
+	auto& results = frame.results;
+	bool changed = frame.changed;
+
+	auto make_args = [&results] (const std::vector<formal_arg_t>& args, std::size_t first) {
+		std::vector<formal_arg_t> new_args;
+		new_args.reserve(args.size());
+		for (std::size_t n = 0; n < args.size(); ++n) {
+			new_args.push_back(formal_arg_t{args[n].name, std::move(results[first + n])});
+		}
+		return new_args;
+	};
 
+	if (auto product = input.as_product()) {
+		auto args = make_args(product->args(), 0);
+		const auto& restype = results.back();
 		auto result = visitor.handle_product(args, restype);
 		if (result) {
 			return result;
@@ -111,26 +307,8 @@ visit_transform(
 			return {};
 		}
 	} else if (auto lambda = input.as_lambda()) {
-		std::vector<formal_arg_t> args;
-		bool changed = false;
-		for (const auto& arg : lambda->args()) {
-			auto maybe_argtype = visit_transform(arg.type, visitor);
-			changed = changed || maybe_argtype;
-			args.push_back(maybe_argtype ? formal_arg_t{arg.name, *maybe_argtype} : arg);
-
-			visitor.push_local(arg.name ? &*arg.name : nullptr, &arg.type, nullptr);
-		}
-
-
-		auto maybe_body = visit_transform(lambda->body(), visitor);
-		const auto& body = maybe_body ? *maybe_body : lambda->body();
-		changed = changed || maybe_body;
-
-		for (const auto& arg : lambda->args()) {
-			(void) arg;
-			visitor.pop_local();
-		}
-
+		auto args = make_args(lambda->args(), 0);
+		const auto& body = results.back();
 		auto result = visitor.handle_lambda(args, body);
 		if (result) {
 			return result;
@@ -140,41 +318,17 @@ visit_transform(
 			return {};
 		}
 	} else if (auto let = input.as_let()) {
-		auto maybe_value = visit_transform(let->value(), visitor);
-		const auto& value = maybe_value ? *maybe_value : let->value();
-
-		auto maybe_type = visit_transform(let->type(), visitor);
-		const auto& type = maybe_type ? *maybe_type : let->type();
-
-		visitor.push_local(
-			let->varname() ? &*let->varname() : nullptr,
-			&type,
-			&value
-		);
-		auto maybe_body = visit_transform(let->body(), visitor);
-		const auto& body = maybe_body ? *maybe_body : let->body();
-		visitor.pop_local();
-
-		auto result = visitor.handle_let(let->varname(), value, type, body);
+		auto result = visitor.handle_let(let->varname(), results[0], results[1], results[2]);
 		if (result) {
 			return result;
-		} else if (maybe_value || maybe_body) {
-			return builder::let(let->varname(), value, type, body);
+		} else if (changed) {
+			return builder::let(let->varname(), results[0], results[1], results[2]);
 		} else {
 			return {};
 		}
-	} else if (auto apply = input.as_apply()) {
-		auto maybe_fn = visit_transform(apply->fn(), visitor);
-		bool changed = !!maybe_fn;
-		const auto& fn = maybe_fn ? *maybe_fn : apply->fn();
-
-		std::vector<constr_t> args;
-		for (const auto& arg : apply->args()) {
-			auto maybe_arg = visit_transform(arg, visitor);
-			changed = changed || maybe_arg;
-			args.push_back(maybe_arg ? *maybe_arg : arg);
-		}
-
+	} else if (input.as_apply()) {
+		const auto& fn = results[0];
+		std::vector<constr_t> args(std::make_move_iterator(results.begin() + 1), std::make_move_iterator(results.end()));
 		auto result = visitor.handle_apply(fn, args);
 		if (result) {
 			return result;
@@ -184,50 +338,24 @@ visit_transform(
 			return {};
 		}
 	} else if (auto cast = input.as_cast()) {
-		auto maybe_term = visit_transform(cast->term(), visitor);
-		const auto& term = maybe_term ? *maybe_term : cast->term();
-
-		auto maybe_typeterm = visit_transform(cast->typeterm(), visitor);
-		const auto& typeterm = maybe_typeterm ? *maybe_typeterm : cast->typeterm();
-
-		auto result = visitor.handle_cast(term, cast->kind(), typeterm);
+		auto result = visitor.handle_cast(results[0], cast->kind(), results[1]);
 		if (result) {
 			return result;
-		} else if (maybe_term || maybe_typeterm) {
-			return builder::cast(term, cast->kind(), typeterm);
+		} else if (changed) {
+			return builder::cast(results[0], cast->kind(), results[1]);
 		} else {
 			return {};
 		}
 	} else if (auto match_case = input.as_match()) {
-		auto maybe_arg = visit_transform(match_case->arg(), visitor);
-		const auto& arg = maybe_arg ? *maybe_arg : match_case->arg();
-
-		visitor.push_local(
-			nullptr,
-			&arg,
-			nullptr
-		);
-		auto maybe_casetype = visit_transform(match_case->casetype(), visitor);
-		const auto& casetype = maybe_casetype ? *maybe_casetype : match_case->casetype();
-		visitor.pop_local();
-
-		bool changed = false;
+		const auto& arg = results[0];
+		const auto& casetype = results[1];
 		std::vector<match_branch_t> branches;
-		for (const auto& branch : match_case->branches()) {
-			for (std::size_t n = 0; n < branch.nargs; ++n) {
-				visitor.push_local(nullptr, nullptr, nullptr);
-			}
-			auto maybe_expr = visit_transform(branch.expr, visitor);
-			for (std::size_t n = 0; n < branch.nargs; ++n) {
-				visitor.pop_local();
-			}
-			changed = changed || maybe_expr;
-			const auto& expr = maybe_expr ? *maybe_expr : branch.expr;
-			branches.push_back(match_branch_t{branch.constructor, branch.nargs, expr});
+		branches.reserve(match_case->branches().size());
+		for (std::size_t n = 0; n < match_case->branches().size(); ++n) {
+			const auto& branch = match_case->branches()[n];
+			branches.push_back(match_branch_t{branch.constructor, branch.nargs, std::move(results[n + 2])});
 		}
 
-		changed = changed || maybe_arg || maybe_casetype;
-
 		auto result = visitor.handle_match(casetype, arg, branches);
 		if (result) {
 			return result;
@@ -236,44 +364,21 @@ visit_transform(
 		} else {
 			return {};
 		}
-	} else if (auto fix = input.as_fix()) {
-		std::vector<fix_function_t> functions;
-		for (const auto& function : fix->group()->functions) {
-			// XXX: product at least correct signature for this function
-			visitor.push_local(&function.name, nullptr, nullptr);
-		}
-
-		bool changed = false;
-		for (const auto& function : fix->group()->functions) {
-			std::vector<formal_arg_t> args;
-			for (const auto& arg : function.args) {
-				auto maybe_argtype = visit_transform(arg.type, visitor);
-				changed = changed || maybe_argtype;
-				const auto& argtype = maybe_argtype ? *maybe_argtype : arg.type;
-				args.push_back({arg.name, argtype});
-				visitor.push_local(arg.name ? &*arg.name : nullptr, &arg.type, nullptr);
-			}
-			auto maybe_restype = visit_transform(function.restype, visitor);
-			const auto& restype = maybe_restype ? *maybe_restype : function.restype;
-
-			auto maybe_body = visit_transform(function.body, visitor);
-			const auto& body = maybe_body ? *maybe_body : function.body;
-			changed = changed || maybe_restype || maybe_body;
-
-			functions.push_back(fix_function_t{function.name, std::move(args), restype, body});
-			for (const auto& arg : function.args) {
-				(void) arg;
-				visitor.pop_local();
-			}
-		}
-		for (const auto& function : fix->group()->functions) {
-			(void) function;
-			visitor.pop_local();
-		}
+	} else {
+		auto fix = input.as_fix();
 		std::shared_ptr<fix_group_t> new_group;
 		if (changed) {
 			new_group = std::make_shared<fix_group_t>();
-			new_group->functions = std::move(functions);
+			std::size_t first = 0;
+			for (const auto& function : fix->group()->functions) {
+				auto args = make_args(function.args, first);
+				first += function.args.size();
+				auto restype = std::move(results[first]);
+				auto body = std::move(results[first + 1]);
+				first += 2;
+				new_group->functions.push_back(fix_function_t{function.name, std::move(args), std::move(restype), std::move(body)});
+			}
+			frame.group = new_group;
 		}
 
 		const auto& group = changed ? new_group : fix->group();
@@ -286,9 +391,332 @@ visit_transform(
 		} else {
 			return {};
 		}
-	} else {
-		throw std::logic_error("Unhandled constr kind");
 	}
 }
 
+// Results of visit_transform_shared for nodes and fix groups referenced
+// more than once, keyed by their address and the number of locals in
+// scope. The keys are subterms of the input, which keeps them alive.
+class transform_memo {
+public:
+	// Whether "term" may be reached more than once.
+	static bool
+	shared(const constr_t& term) noexcept {
+		switch (term.constr_kind()) {
+			case constr_kind_local:
+			case constr_kind_global:
+			case constr_kind_builtin: {
+				return false;
+			}
+			case constr_kind_fix: {
+				return term.repr().use_count() > 1 || term.as_fix()->group().use_count() > 1;
+			}
+			default: {
+				return term.repr().use_count() > 1;
+			}
+		}
+	}
+
+	// Looks up the transformed "term", setting "result" if found.
+	bool
+	find(const constr_t& term, std::size_t locals, transform_visitor& visitor, std::optional<constr_t>& result) const {
+		auto i = terms_.find(key{term.repr().get(), locals});
+		if (i != terms_.end()) {
+			result = i->second;
+			return true;
+		}
+		if (auto fix = term.as_fix()) {
+			auto j = groups_.find(key{fix->group().get(), locals});
+			if (j != groups_.end()) {
+				result = visitor.handle_fix(fix->index(), j->second);
+				if (!result && j->second != fix->group()) {
+					result = builder::fix(fix->index(), j->second);
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Records the result of the frame.
+	void
+	store(const transform_frame& frame, std::size_t locals, const std::optional<constr_t>& result) {
+		terms_.emplace(key{frame.input.repr().get(), locals}, result);
+		if (auto fix = frame.input.as_fix()) {
+			groups_.emplace(key{fix->group().get(), locals}, frame.group ? frame.group : fix->group());
+		}
+	}
+
+private:
+	struct key {
+		const void* node;
+		std::size_t locals;
+
+		inline bool
+		operator==(const key& other) const noexcept {
+			return node == other.node && locals == other.locals;
+		}
+	};
+
+	struct key_hash {
+		inline std::size_t
+		operator()(const key& k) const noexcept {
+			return std::hash<const void*>()(k.node) ^ (k.locals * 0x9e3779b97f4a7c15ull);
+		}
+	};
+
+	std::unordered_map<key, std::optional<constr_t>, key_hash> terms_;
+	std::unordered_map<key, std::shared_ptr<const fix_group_t>, key_hash> groups_;
+};
+
+std::optional<constr_t>
+transform(
+	const constr_t& input,
+	transform_visitor& visitor,
+	transform_memo* memo
+) {
+	std::optional<constr_t> result;
+	if (transform_leaf(input, visitor, result)) {
+		return result;
+	}
+
+	// Nodes on the path from the input to the node currently visited are
+	// the first "depth" frames of the stack.
+	transform_scope scope{visitor};
+	std::vector<transform_frame> stack(1);
+	std::size_t depth = 1;
+	stack[0].reset(input);
+	enter_child(stack[0], 0, scope);
+
+	for (;;) {
+		auto& frame = stack[depth - 1];
+		std::size_t index = frame.results.size();
+		if (index < frame.children.size()) {
+			const auto& child = *frame.children[index];
+			bool share = memo && transform_memo::shared(child);
+			if (share && memo->find(child, scope.locals, visitor, result)) {
+				// Transformed before, at the same depth.
+			} else if (!transform_leaf(child, visitor, result)) {
+				if (depth == stack.size()) {
+					stack.emplace_back();
+				}
+				stack[depth].reset(child);
+				stack[depth].share = share;
+				enter_child(stack[depth], 0, scope);
+				++depth;
+				continue;
+			}
+		} else {
+			result = finish_frame(frame, visitor);
+			if (frame.share) {
+				memo->store(frame, scope.locals, result);
+			}
+			--depth;
+			if (depth == 0) {
+				return result;
+			}
+		}
+
+		// Deliver result of the child to its parent, and proceed to the
+		// next child.
+		auto& parent = stack[depth - 1];
+		index = parent.results.size();
+		parent.changed = parent.changed || result;
+		parent.results.push_back(result ? std::move(*result) : *parent.children[index]);
+		leave_child(parent, index, scope);
+		if (index + 1 < parent.children.size()) {
+			enter_child(parent, index + 1, scope);
+		}
+	}
+}
+
+}  // namespace
+
+std::optional<constr_t>
+visit_transform(
+	const constr_t& input,
+	transform_visitor& visitor
+) {
+	return transform(input, visitor, nullptr);
+}
+
+std::optional<constr_t>
+visit_transform_shared(
+	const constr_t& input,
+	transform_visitor& visitor
+) {
+	transform_memo memo;
+	return transform(input, visitor, &memo);
+}
+
+query_visitor::~query_visitor() {
+}
+
+void
+query_visitor::push_local(
+	const std::string* name,
+	const constr_t* type,
+	const constr_t* value
+) {
+}
+
+void
+query_visitor::pop_local() {
+}
+
+query_action
+query_visitor::visit(const constr_t& term) {
+	return query_action::descend;
+}
+
+
+namespace detail {
+
+namespace {
+
+// Writes steps of query_expand into entries reserved on the stack.
+class query_writer {
+public:
+	query_writer(std::vector<query_item>& stack, std::size_t count) {
+		std::size_t size = stack.size();
+		stack.resize(size + count);
+		next_ = stack.data() + size;
+	}
+
+	void
+	visit(const constr_t& term) noexcept {
+		next_->op = query_item::visit;
+		next_->term = &term;
+		++next_;
+	}
+
+	void
+	push_arg(const formal_arg_t& arg) noexcept {
+		next_->op = query_item::push_arg;
+		next_->arg = &arg;
+		++next_;
+	}
+
+	void
+	push_let(const constr_let& let) noexcept {
+		next_->op = query_item::push_let;
+		next_->let = &let;
+		++next_;
+	}
+
+	void
+	push_functions(const fix_group_t& group) noexcept {
+		next_->op = query_item::push_functions;
+		next_->group = &group;
+		++next_;
+	}
+
+	void
+	pop(std::size_t count) noexcept {
+		next_->op = query_item::pop;
+		next_->count = count;
+		++next_;
+	}
+
+	// Argument types, each in scope of the preceding arguments, followed
+	// by "body" in scope of all arguments. Writes 2 * args.size() + 2
+	// steps.
+	void
+	binders(const std::vector<formal_arg_t>& args, const constr_t& body) noexcept {
+		pop(args.size());
+		visit(body);
+		for (std::size_t n = args.size(); n; --n) {
+			push_arg(args[n - 1]);
+			visit(args[n - 1].type);
+		}
+	}
+
+private:
+	query_item* next_;
+};
+
+}  // namespace
+
+void
+query_expand(const constr_t& term, std::vector<query_item>& stack) {
+	switch (term.constr_kind()) {
+		case constr_kind_product: {
+			auto product = term.as_product();
+			query_writer(stack, 2 * product->args().size() + 2).binders(product->args(), product->restype());
+			break;
+		}
+		case constr_kind_lambda: {
+			auto lambda = term.as_lambda();
+			query_writer(stack, 2 * lambda->args().size() + 2).binders(lambda->args(), lambda->body());
+			break;
+		}
+		case constr_kind_let: {
+			auto let = term.as_let();
+			query_writer out(stack, 5);
+			out.pop(1);
+			out.visit(let->body());
+			out.push_let(*let);
+			out.visit(let->type());
+			out.visit(let->value());
+			break;
+		}
+		case constr_kind_apply: {
+			auto apply = term.as_apply();
+			const auto& args = apply->args();
+			query_writer out(stack, args.size() + 1);
+			for (std::size_t n = args.size(); n; --n) {
+				out.visit(args[n - 1]);
+			}
+			out.visit(apply->fn());
+			break;
+		}
+		case constr_kind_cast: {
+			auto cast = term.as_cast();
+			query_writer out(stack, 2);
+			out.visit(cast->typeterm());
+			out.visit(cast->term());
+			break;
+		}
+		case constr_kind_match: {
+			auto match_case = term.as_match();
+			const auto& branches = match_case->branches();
+			query_writer out(stack, branches.size() + 2);
+			for (std::size_t n = branches.size(); n; --n) {
+				out.visit(branches[n - 1].expr);
+			}
+			out.visit(match_case->arg());
+			out.visit(match_case->casetype());
+			break;
+		}
+		case constr_kind_fix: {
+			// All functions are in scope of each function, followed by
+			// its arguments.
+			const auto& group = *term.as_fix()->group();
+			std::size_t count = 2;
+			for (const auto& function : group.functions) {
+				count += 2 * function.args.size() + 3;
+			}
+			query_writer out(stack, count);
+			out.pop(group.functions.size());
+			for (std::size_t n = group.functions.size(); n; --n) {
+				const auto& function = group.functions[n - 1];
+				out.pop(function.args.size());
+				out.visit(function.body);
+				out.visit(function.restype);
+				for (std::size_t k = function.args.size(); k; --k) {
+					out.push_arg(function.args[k - 1]);
+					out.visit(function.args[k - 1].type);
+				}
+			}
+			out.push_functions(group);
+			break;
+		}
+		default: {
+			break;
+		}
+	}
+}
+
+}  // namespace detail
+
 }  // namespace coqcic
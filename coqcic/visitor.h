@@ -23,6 +23,15 @@ public:
 	virtual void
 	pop_local();
 
+	// Called for every node in top-down order, before its children are
+	// visited. Returning a substitute replaces the node: its children are
+	// not visited and no handler is called for it. Returning the node
+	// itself thus leaves it untransformed, skipping its subtree. Returning
+	// none visits the node as usual.
+	virtual
+	std::optional<constr_t>
+	pre_visit(const constr_t& term);
+
 	// Handler functions for constr_t kinds, called in bottom-up order (children
 	// first). Each function can return a substitute for its input constr.
 	// (It can also return none in which case the input is left untransformed).
@@ -68,11 +77,29 @@ public:
 	handle_fix(std::size_t index, const std::shared_ptr<const fix_group_t>& group);
 };
 
+// Transforms the input bottom-up, calling the handlers of the visitor for
+// every node not replaced by pre_visit. Returns the transformed input, or
+// none if no node was replaced. Nodes on the path to the node visited are
+// kept on an explicit heap-allocated stack, hence the nesting depth of the
+// input is not limited by the native stack.
 std::optional<constr_t>
 visit_transform(
 	const constr_t& input,
 	transform_visitor& visitor);
 
+// Transforms the input as visit_transform, but transforms nodes reached
+// more than once (subterms shared within the input, and fix groups shared
+// by several fix nodes) only once per number of locals in scope, reusing
+// the result for further occurrences. The result shares the transformed
+// nodes and groups as the input shares the original ones. Handlers and
+// pre_visit are not called again for the reused nodes, hence the visitor
+// must transform a subterm depending only on the subterm and the number
+// of locals in scope.
+std::optional<constr_t>
+visit_transform_shared(
+	const constr_t& input,
+	transform_visitor& visitor);
+
 // Instantiates given Visitor with args... and applies it to transform the
 // input. Returns transformed input (possibly identical to original input).
 template<typename Visitor, typename... Args>
@@ -86,6 +113,157 @@ visit_transform_simple(
 	return result ? std::move(*result) : input;
 }
 
+// Action to take after a query_visitor inspected a node.
+enum class query_action {
+	// Visit the children of the node.
+	descend,
+	// Do not visit the children of the node, continue with its siblings.
+	skip,
+	// End the traversal.
+	stop
+};
+
+// Interface for read-only top-down visitor utility. Unlike
+// transform_visitor, nothing is rebuilt and no copies of children are
+// made, the visitor inspects the nodes of the input in place.
+class query_visitor {
+public:
+	virtual
+	~query_visitor();
+
+	// Push local variable to stack. Binders are those of the term
+	// representation (see constr_t::loose_bound): products, lambdas, let
+	// and fix bind locals; match does not, its branches are functions
+	// taking the constructor arguments.
+	virtual void
+	push_local(
+		const std::string* name,
+		const constr_t* type,
+		const constr_t* value
+	);
+
+	// Remove local variable from stack again.
+	virtual void
+	pop_local();
+
+	// Called for every node in top-down order (node first, then its
+	// children from left to right), with the locals bound by enclosing
+	// nodes pushed.
+	virtual
+	query_action
+	visit(const constr_t& term);
+};
+
+// Implementation details of visit_query, not part of the interface.
+namespace detail {
+
+// Pending step of visit_query, either visiting a term, or pushing or
+// popping locals of a binder around the terms in its scope.
+struct query_item {
+	enum op_type {
+		visit,
+		push_arg,
+		push_let,
+		push_functions,
+		pop
+	};
+
+	op_type op;
+	union {
+		// visit: term to visit.
+		const constr_t* term;
+		// push_arg: formal argument to push.
+		const formal_arg_t* arg;
+		// push_let: let whose variable to push.
+		const constr_let* let;
+		// push_functions: fixpoint group whose function names to push.
+		const fix_group_t* group;
+		// pop: number of locals to pop.
+		std::size_t count;
+	};
+};
+
+// Pushes the steps visiting the children of "term" (and binding locals
+// around them) onto "stack", last step first.
+void
+query_expand(const constr_t& term, std::vector<query_item>& stack);
+
+}  // namespace detail
+
+// Visits the input top-down, calling the visitor for every node not below
+// a skipped node. Returns false if the visitor stopped the traversal, true
+// otherwise. Pushes and pops of locals are balanced also when stopped.
+// Pending steps are kept on an explicit heap-allocated stack of
+// fixed-size entries, no other allocation is made.
+//
+// Visitor is query_visitor or a class derived from it; for final classes,
+// calls to the visitor are resolved statically.
+template<typename Visitor>
+inline
+bool
+visit_query(
+	const constr_t& input,
+	Visitor& visitor)
+{
+	std::vector<detail::query_item> stack;
+	detail::query_item first;
+	first.op = detail::query_item::visit;
+	first.term = &input;
+	stack.push_back(first);
+
+	// Locals currently pushed.
+	std::size_t pushed = 0;
+	while (!stack.empty()) {
+		detail::query_item item = stack.back();
+		stack.pop_back();
+		switch (item.op) {
+			case detail::query_item::visit: {
+				auto action = visitor.visit(*item.term);
+				if (action == query_action::stop) {
+					for (; pushed; --pushed) {
+						visitor.pop_local();
+					}
+					return false;
+				}
+				auto kind = item.term->constr_kind();
+				bool leaf = kind == constr_kind_local || kind == constr_kind_global || kind == constr_kind_builtin;
+				if (action == query_action::descend && !leaf) {
+					detail::query_expand(*item.term, stack);
+				}
+				break;
+			}
+			case detail::query_item::push_arg: {
+				const auto& arg = *item.arg;
+				visitor.push_local(arg.name ? &*arg.name : nullptr, &arg.type, nullptr);
+				++pushed;
+				break;
+			}
+			case detail::query_item::push_let: {
+				const auto& let = *item.let;
+				visitor.push_local(let.varname() ? &*let.varname() : nullptr, &let.type(), &let.value());
+				++pushed;
+				break;
+			}
+			case detail::query_item::push_functions: {
+				for (const auto& function : item.group->functions) {
+					visitor.push_local(&function.name, nullptr, nullptr);
+					++pushed;
+				}
+				break;
+			}
+			case detail::query_item::pop: {
+				for (std::size_t n = 0; n < item.count; ++n) {
+					visitor.pop_local();
+				}
+				pushed -= item.count;
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
 }  // namespace coqcic
 
 #endif  // COQCIC_VISITOR_H
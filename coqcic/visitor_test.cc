@@ -0,0 +1,304 @@
+#include "coqcic/visitor.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+namespace coqcic {
+
+namespace {
+
+// Replaces global "a" by "b", and records the names of locals in scope
+// whenever a local is visited.
+class rename_visitor final : public transform_visitor {
+public:
+	void
+	push_local(const std::string* name, const constr_t* type, const constr_t* value) override {
+		names.push_back(name ? *name : "_");
+		max_depth = std::max(max_depth, names.size());
+	}
+
+	void
+	pop_local() override {
+		names.pop_back();
+	}
+
+	std::optional<constr_t>
+	handle_local(const std::string& name, std::size_t index) override {
+		seen.push_back(names[names.size() - 1 - index]);
+		return {};
+	}
+
+	std::optional<constr_t>
+	handle_global(const std::string& name) override {
+		if (name == "a") {
+			return builder::global("b");
+		}
+		return {};
+	}
+
+	std::vector<std::string> names;
+	std::vector<std::string> seen;
+	std::size_t max_depth = 0;
+};
+
+// Replaces applications of global "replace" by global "c" and leaves
+// applications of global "skip" untransformed, before descending. Replaces
+// global "a" by "b" elsewhere, and records the globals visited by handlers.
+class prune_visitor final : public transform_visitor {
+public:
+	std::optional<constr_t>
+	pre_visit(const constr_t& term) override {
+		if (auto apply = term.as_apply()) {
+			auto fn = apply->fn().as_global();
+			if (fn && fn->name() == "replace") {
+				return builder::global("c");
+			} else if (fn && fn->name() == "skip") {
+				return term;
+			}
+		}
+		return {};
+	}
+
+	std::optional<constr_t>
+	handle_global(const std::string& name) override {
+		seen.push_back(name);
+		if (name == "a") {
+			return builder::global("b");
+		}
+		return {};
+	}
+
+	std::vector<std::string> seen;
+};
+
+// Replaces global "a" by "b" and locals not bound within the input by
+// global "free", counting applications visited.
+class free_visitor final : public transform_visitor {
+public:
+	void
+	push_local(const std::string* name, const constr_t* type, const constr_t* value) override {
+		++depth;
+	}
+
+	void
+	pop_local() override {
+		--depth;
+	}
+
+	std::optional<constr_t>
+	handle_local(const std::string& name, std::size_t index) override {
+		if (index >= depth) {
+			return builder::global("free");
+		}
+		return {};
+	}
+
+	std::optional<constr_t>
+	handle_global(const std::string& name) override {
+		if (name == "a") {
+			return builder::global("b");
+		}
+		return {};
+	}
+
+	std::optional<constr_t>
+	handle_apply(const constr_t& fn, const std::vector<constr_t>& args) override {
+		++applies;
+		return {};
+	}
+
+	std::size_t depth = 0;
+	std::size_t applies = 0;
+};
+
+// Records the names of locals in scope whenever a local is visited, and
+// the globals visited in order. Stops at global "stop", skips subterms
+// that are applications of global "skip".
+class names_query final : public query_visitor {
+public:
+	void
+	push_local(const std::string* name, const constr_t* type, const constr_t* value) override {
+		names.push_back(name ? *name : "_");
+		max_depth = std::max(max_depth, names.size());
+	}
+
+	void
+	pop_local() override {
+		names.pop_back();
+	}
+
+	query_action
+	visit(const constr_t& term) override {
+		if (auto local = term.as_local()) {
+			seen.push_back(names[names.size() - 1 - local->index()]);
+		} else if (auto global = term.as_global()) {
+			seen.push_back(global->name());
+			if (global->name() == "stop") {
+				return query_action::stop;
+			}
+		} else if (auto apply = term.as_apply()) {
+			auto fn = apply->fn().as_global();
+			if (fn && fn->name() == "skip") {
+				return query_action::skip;
+			}
+		}
+		return query_action::descend;
+	}
+
+	std::vector<std::string> names;
+	std::vector<std::string> seen;
+	std::size_t max_depth = 0;
+};
+
+}  // namespace
+
+TEST(visitor_test, binders) {
+	using namespace builder;
+	auto nat = global("nat");
+	// let y := a in fun (x : nat) (z : nat) => f y x z
+	auto term = let(
+		"y", global("a"), nat,
+		lambda(
+			{{"x", nat}, {"z", nat}},
+			apply(global("f"), {local("y", 2), local("x", 1), local("z", 0)})));
+
+	rename_visitor visitor;
+	auto result = visit_transform(term, visitor);
+	ASSERT_TRUE(result);
+	EXPECT_EQ(
+		*result,
+		let(
+			"y", global("b"), nat,
+			lambda(
+				{{"x", nat}, {"z", nat}},
+				apply(global("f"), {local("y", 2), local("x", 1), local("z", 0)}))));
+	EXPECT_EQ(visitor.seen, (std::vector<std::string>{"y", "x", "z"}));
+	EXPECT_TRUE(visitor.names.empty());
+
+	// Nothing to replace.
+	auto unchanged = lambda({{"x", nat}}, local("x", 0));
+	EXPECT_FALSE(visit_transform(unchanged, visitor));
+}
+
+TEST(visitor_test, deep_nesting) {
+	using namespace builder;
+
+	// fun (x : nat) => ... fun (x : nat) => a, nested far beyond what
+	// recursion could handle on the native stack.
+	const std::size_t depth = 1000000;
+	constr_t term = global("a");
+	for (std::size_t n = 0; n < depth; ++n) {
+		term = lambda({{"x", global("nat")}}, term);
+	}
+
+	rename_visitor visitor;
+	auto result = visit_transform(term, visitor);
+	ASSERT_TRUE(result);
+	EXPECT_EQ(visitor.max_depth, depth);
+	EXPECT_TRUE(visitor.names.empty());
+
+	const constr_t* inner = &*result;
+	for (std::size_t n = 0; n < depth; ++n) {
+		auto lambda = inner->as_lambda();
+		ASSERT_TRUE(lambda);
+		inner = &lambda->body();
+	}
+	EXPECT_EQ(*inner, global("b"));
+}
+
+TEST(visitor_test, pre_visit) {
+	using namespace builder;
+	auto skipped = apply(global("skip"), {global("a")});
+	auto term = apply(global("f"), {global("a"), apply(global("replace"), {global("a")}), skipped});
+
+	prune_visitor visitor;
+	auto result = visit_transform(term, visitor);
+	ASSERT_TRUE(result);
+	EXPECT_EQ(*result, apply(global("f"), {global("b"), global("c"), skipped}));
+	EXPECT_EQ(visitor.seen, (std::vector<std::string>{"f", "a"}));
+	EXPECT_EQ(result->as_apply()->args()[2].repr(), skipped.repr());
+
+	// Skipping the input leaves it unchanged, replacing it replaces it.
+	EXPECT_FALSE(visit_transform(skipped, visitor));
+	EXPECT_EQ(visit_transform(apply(global("replace"), {}), visitor), global("c"));
+}
+
+TEST(visitor_test, transform_shared) {
+	using namespace builder;
+	auto nat = global("nat");
+	// f s s (fun (x : nat) => s) with s := g x a
+	auto shared = apply(global("g"), {local("x", 0), global("a")});
+	auto term = apply(global("f"), {shared, shared, lambda({{"x", nat}}, shared)});
+
+	free_visitor visitor;
+	auto result = visit_transform_shared(term, visitor);
+	ASSERT_TRUE(result);
+	EXPECT_EQ(
+		*result,
+		apply(global("f"), {
+			apply(global("g"), {global("free"), global("b")}),
+			apply(global("g"), {global("free"), global("b")}),
+			lambda({{"x", nat}}, apply(global("g"), {local("x", 0), global("b")}))}));
+	// Transformed once per depth, and shared as in the input.
+	EXPECT_EQ(visitor.applies, 3u);
+	const auto& args = result->as_apply()->args();
+	EXPECT_EQ(args[0].repr(), args[1].repr());
+
+	// Fix nodes sharing a group share the transformed group.
+	auto group = std::make_shared<fix_group_t>(fix_group_t{{
+		fix_function_t{"f", {{"n", nat}}, nat, apply(global("a"), {local("n", 0)})}}});
+	auto fixes = apply(global("f"), {fix(0, group), fix(0, group)});
+	result = visit_transform_shared(fixes, visitor);
+	ASSERT_TRUE(result);
+	const auto& fix_args = result->as_apply()->args();
+	EXPECT_EQ(fix_args[0].as_fix()->group(), fix_args[1].as_fix()->group());
+	EXPECT_EQ(fix_args[0].as_fix()->group()->functions[0].body, apply(global("b"), {local("n", 0)}));
+}
+
+TEST(visitor_test, query_binders) {
+	using namespace builder;
+	auto nat = global("nat");
+	// let y := a in fun (x : nat) => match x return P with
+	// | O => fix f (n : nat) : nat := f n y | S => skip x end
+	auto fn = fix(0, std::make_shared<fix_group_t>(fix_group_t{{
+		fix_function_t{"f", {{"n", nat}}, nat, apply(local("f", 1), {local("n", 0), local("y", 3)})}}}));
+	auto term = let(
+		"y", global("a"), nat,
+		lambda(
+			{{"x", nat}},
+			match(global("P"), local("x", 0), {
+				{"O", 0, fn},
+				{"S", 1, apply(global("skip"), {local("x", 0)})}})));
+
+	names_query visitor;
+	EXPECT_TRUE(visit_query(term, visitor));
+	EXPECT_EQ(
+		visitor.seen,
+		(std::vector<std::string>{"a", "nat", "nat", "P", "x", "nat", "nat", "f", "n", "y"}));
+	EXPECT_EQ(visitor.max_depth, 4u);
+	EXPECT_TRUE(visitor.names.empty());
+
+	EXPECT_EQ(std::vector<std::size_t>({0}), collect_external_references(lambda({{"x", nat}}, fn)));
+}
+
+TEST(visitor_test, query_stop) {
+	using namespace builder;
+
+	// fun (x : nat) => ... fun (x : nat) => f stop a, nested far beyond
+	// what recursion could handle on the native stack.
+	const std::size_t depth = 1000000;
+	constr_t term = apply(global("f"), {global("stop"), global("a")});
+	for (std::size_t n = 0; n < depth; ++n) {
+		term = lambda({{"x", global("nat")}}, term);
+	}
+
+	names_query visitor;
+	EXPECT_FALSE(visit_query(term, visitor));
+	EXPECT_EQ(visitor.max_depth, depth);
+	EXPECT_EQ(visitor.seen.size(), depth + 2);
+	EXPECT_EQ(visitor.seen.back(), "stop");
+	EXPECT_TRUE(visitor.names.empty());
+}
+
+}  // namespace coqcic
@@ -0,0 +1,199 @@
+#include "coqcic/work_stealing_pool.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace coqcic {
+
+/**
+	\class work_stealing_pool
+	\brief Fixed set of worker threads executing index ranges.
+	\headerfile coqcic/work_stealing_pool.h <coqcic/work_stealing_pool.h>
+
+	Usage:
+
+	\code
+		work_stealing_pool pool;
+		std::vector<std::size_t> squares(1000);
+		pool.parallel_for(squares.size(), [&](std::size_t n) {
+			squares[n] = n * n;
+		});
+	\endcode
+*/
+
+// State of one parallel_for call. Each participating thread owns one
+// queue, holding a contiguous range of task indices.
+class work_stealing_pool::job {
+public:
+	job(std::size_t count, std::size_t nqueues, const std::function<void(std::size_t)>& fn)
+		: fn_(fn), queues_(nqueues)
+	{
+		for (std::size_t n = 0; n < nqueues; ++n) {
+			queues_[n].begin = count * n / nqueues;
+			queues_[n].end = count * (n + 1) / nqueues;
+		}
+	}
+
+	// Executes tasks until no queue holds any tasks anymore.
+	void
+	run(std::size_t own) {
+		std::size_t task;
+		while (pop(own, task) || steal(own, task)) {
+			try {
+				fn_(task);
+			} catch (...) {
+				std::lock_guard<std::mutex> guard(error_mutex_);
+				if (!error_ || task < error_task_) {
+					error_ = std::current_exception();
+					error_task_ = task;
+				}
+			}
+		}
+	}
+
+	void
+	rethrow() const {
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+	}
+
+private:
+	struct queue {
+		std::mutex mutex;
+		std::size_t begin = 0;
+		std::size_t end = 0;
+	};
+
+	bool
+	pop(std::size_t own, std::size_t& task) {
+		queue& q = queues_[own];
+		std::lock_guard<std::mutex> guard(q.mutex);
+		if (q.begin == q.end) {
+			return false;
+		}
+		task = q.begin++;
+		return true;
+	}
+
+	// Takes the upper half of the tasks of the first non-empty queue of
+	// another thread, runs the first of them and enqueues the remainder
+	// to the (empty) own queue.
+	bool
+	steal(std::size_t own, std::size_t& task) {
+		for (std::size_t n = 1; n < queues_.size(); ++n) {
+			queue& victim = queues_[(own + n) % queues_.size()];
+			std::size_t begin, end;
+			{
+				std::lock_guard<std::mutex> guard(victim.mutex);
+				if (victim.begin == victim.end) {
+					continue;
+				}
+				begin = victim.begin + (victim.end - victim.begin) / 2;
+				end = victim.end;
+				victim.end = begin;
+			}
+			task = begin;
+			queue& q = queues_[own];
+			std::lock_guard<std::mutex> guard(q.mutex);
+			q.begin = begin + 1;
+			q.end = end;
+			return true;
+		}
+		return false;
+	}
+
+	const std::function<void(std::size_t)>& fn_;
+	std::vector<queue> queues_;
+
+	std::mutex error_mutex_;
+	std::exception_ptr error_;
+	std::size_t error_task_ = 0;
+};
+
+work_stealing_pool::~work_stealing_pool() {
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		shutdown_ = true;
+	}
+	wake_.notify_all();
+	for (auto& worker : workers_) {
+		worker.join();
+	}
+}
+
+work_stealing_pool::work_stealing_pool(std::size_t nthreads) {
+	if (nthreads == 0) {
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (std::size_t n = 0; n + 1 < nthreads; ++n) {
+		workers_.emplace_back([this, n] { worker_main(n); });
+	}
+}
+
+std::size_t
+work_stealing_pool::size() const noexcept {
+	return workers_.size() + 1;
+}
+
+void
+work_stealing_pool::parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn) {
+	if (count == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> run_guard(run_mutex_);
+
+	job j(count, size(), fn);
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		job_ = &j;
+		++generation_;
+	}
+	wake_.notify_all();
+
+	// The calling thread uses the last queue.
+	j.run(workers_.size());
+
+	{
+		// Once no worker is active and the calling thread has found all
+		// queues empty, all tasks have completed. Workers waking up only
+		// after this point find no job.
+		std::unique_lock<std::mutex> guard(mutex_);
+		idle_.wait(guard, [this] { return active_ == 0; });
+		job_ = nullptr;
+	}
+
+	j.rethrow();
+}
+
+void
+work_stealing_pool::worker_main(std::size_t index) {
+	std::size_t seen = 0;
+	for (;;) {
+		job* j;
+		{
+			std::unique_lock<std::mutex> guard(mutex_);
+			wake_.wait(guard, [this, seen] { return shutdown_ || generation_ != seen; });
+			if (shutdown_) {
+				return;
+			}
+			seen = generation_;
+			j = job_;
+			if (!j) {
+				continue;
+			}
+			++active_;
+		}
+
+		j->run(index);
+
+		{
+			std::lock_guard<std::mutex> guard(mutex_);
+			--active_;
+		}
+		idle_.notify_all();
+	}
+}
+
+}  // namespace coqcic
@@ -0,0 +1,81 @@
+#ifndef COQCIC_WORK_STEALING_POOL_H
+#define COQCIC_WORK_STEALING_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace coqcic {
+
+/**
+	\brief Fixed set of worker threads executing index ranges
+
+	Work of a \ref parallel_for call is split into one task per index.
+	Tasks are initially distributed in contiguous blocks over one queue
+	per participating thread (the workers and the calling thread). Each
+	thread processes its own queue front to back and, once it runs dry,
+	steals tasks from the back of other queues. This balances load when
+	the cost of individual tasks varies widely.
+
+	The pool executes one \ref parallel_for at a time, calls from
+	multiple threads are serialized.
+*/
+class work_stealing_pool {
+public:
+	~work_stealing_pool();
+
+	/**
+		\brief Starts worker threads
+
+		\param nthreads
+			Total number of threads participating in each
+			\ref parallel_for, including the calling thread. Zero
+			selects the number of hardware threads.
+	*/
+	explicit
+	work_stealing_pool(std::size_t nthreads = 0);
+
+	work_stealing_pool(const work_stealing_pool& other) = delete;
+	work_stealing_pool& operator=(const work_stealing_pool& other) = delete;
+
+	/**
+		\brief Total number of threads participating in each job
+	*/
+	std::size_t
+	size() const noexcept;
+
+	/**
+		\brief Calls fn(n) for each n in [0, count)
+
+		Returns when all calls have completed. If any call throws,
+		the remaining tasks are still executed, and the exception of
+		the lowest index is rethrown afterwards.
+	*/
+	void
+	parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn);
+
+private:
+	class job;
+
+	void
+	worker_main(std::size_t index);
+
+	std::vector<std::thread> workers_;
+
+	std::mutex run_mutex_;
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable idle_;
+	job* job_ = nullptr;
+	std::size_t generation_ = 0;
+	std::size_t active_ = 0;
+	bool shutdown_ = false;
+};
+
+}  // namespace coqcic
+
+#endif  // COQCIC_WORK_STEALING_POOL_H
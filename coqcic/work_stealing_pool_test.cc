@@ -0,0 +1,50 @@
+#include "coqcic/work_stealing_pool.h"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+TEST(work_stealing_pool_test, parallel_for) {
+	coqcic::work_stealing_pool pool(4);
+	EXPECT_EQ(pool.size(), 4);
+
+	// Tasks of very uneven cost, all expensive ones initially assigned to
+	// the same queue.
+	std::vector<std::atomic<int>> counts(1000);
+	std::atomic<std::size_t> sum{0};
+	for (int round = 0; round < 3; ++round) {
+		pool.parallel_for(counts.size(), [&](std::size_t n) {
+			if (n < 50) {
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+			++counts[n];
+			sum += n;
+		});
+	}
+
+	for (const auto& count : counts) {
+		EXPECT_EQ(count, 3);
+	}
+	EXPECT_EQ(sum, 3 * 999 * 1000 / 2);
+
+	pool.parallel_for(0, [](std::size_t n) { FAIL(); });
+}
+
+TEST(work_stealing_pool_test, exception) {
+	coqcic::work_stealing_pool pool(3);
+	std::atomic<std::size_t> executed{0};
+	try {
+		pool.parallel_for(100, [&](std::size_t n) {
+			++executed;
+			if (n % 30 == 17) {
+				throw std::runtime_error(std::to_string(n));
+			}
+		});
+		FAIL();
+	} catch (const std::runtime_error& e) {
+		EXPECT_EQ(std::string(e.what()), "17");
+	}
+	EXPECT_EQ(executed, 100);
+}